@@ -6,7 +6,30 @@
 #include "bwfs_common.h"
 
 /**
- * Allocate a contiguous region of free blocks using worst-fit strategy.
+ * Block allocation policies (value stored in `bwfs_superblock_t.alloc_policy`
+ * and `bwfs_bitmap_t.policy`).  Worst-fit is 0 so that disks formatted before
+ * policies existed keep their original behaviour.
+ */
+typedef enum {
+    BWFS_ALLOC_WORST_FIT = 0,   /**< Largest free region                  */
+    BWFS_ALLOC_FIRST_FIT,       /**< Lowest-addressed region that fits    */
+    BWFS_ALLOC_NEXT_FIT,        /**< First-fit from a rotating cursor     */
+    BWFS_ALLOC_BEST_FIT,        /**< Smallest region that fits            */
+    BWFS_ALLOC_BUDDY,           /**< Binary buddy over aligned 2^k blocks */
+    BWFS_ALLOC_LOG,             /**< Append at the log head (segments)    */
+    BWFS_ALLOC_POLICY_COUNT
+} bwfs_alloc_policy_t;
+
+/**
+ * Segment size of the log policy, in blocks.  The log head only moves to
+ * a segment whose blocks are all free ("clean"); see segment.h.
+ */
+#define BWFS_SEG_BLOCKS 16U
+
+/**
+ * Allocate a contiguous region of free blocks using the bitmap's policy.
+ * Blocks set aside by bwfs_free_blocks whose tag bm->settled now accepts
+ * are handed back first.
  * @param bm     Pointer to the bitmap tracking blocks.
  * @param count  Number of contiguous blocks requested.
  * @return Index of the first block in the allocated region, or UINT32_MAX on failure.
@@ -14,11 +37,28 @@
 uint32_t bwfs_alloc_blocks(bwfs_bitmap_t *bm, uint32_t count);
 
 /**
- * Free a previously allocated region of blocks.
+ * Free a previously allocated region of blocks.  Blocks that bm->retain
+ * claims for a snapshot stay allocated.  With bm->free_tag set, the rest
+ * are counted free and written free but kept out of the allocator until
+ * bm->settled accepts their tag.
  * @param bm     Pointer to the bitmap tracking blocks.
  * @param start  Starting block index of the region to free.
  * @param count  Number of contiguous blocks to free.
  */
 void bwfs_free_blocks(bwfs_bitmap_t *bm, uint32_t start, uint32_t count);
 
-#endif // ALLOCATION_H
\ No newline at end of file
+/**
+ * Parse a policy name ("worst", "first", "next", "best", "buddy", "log").
+ * @param name  Policy name as given on the command line.
+ * @return The matching bwfs_alloc_policy_t, or -1 if unknown.
+ */
+int bwfs_alloc_policy_from_name(const char *name);
+
+/**
+ * Human-readable name of a policy.
+ * @param policy  A bwfs_alloc_policy_t value.
+ * @return Static string ("?" for out-of-range values).
+ */
+const char *bwfs_alloc_policy_name(uint32_t policy);
+
+#endif // ALLOCATION_H
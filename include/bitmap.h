@@ -13,17 +13,20 @@
 /* ------------------------------------------------------------------------- */
 
 /**
- * \brief Persiste el mapa de bits en el disco (bloque 1).
+ * \brief Persiste el mapa de bits en el disco (bloque `bitmap_blk`, o la
+ *        copia no vigente si hay `alt_blk`).
  *
  * @param bm     Bitmap completo en memoria.
  * @param fs_dir Ruta al directorio que contiene los bloques-PNG.
- * @retval BWFS_OK       Éxito
- * @retval BWFS_ERR_IO   Fallo de escritura
+ * @retval BWFS_OK        Éxito
+ * @retval BWFS_ERR_NOMEM Sin memoria para el bloque con cola
+ * @retval BWFS_ERR_IO    Fallo de escritura
  */
 int bwfs_write_bitmap(const bwfs_bitmap_t *bm, const char *fs_dir);
 
 /**
- * \brief Carga el mapa de bits desde disco (bloque 1).
+ * \brief Carga el mapa de bits desde disco (bloque `bitmap_blk`, o la copia
+ *        válida más reciente si hay `alt_blk`).
  *
  * @param bm     Estructura destino (debe tener `total_blocks` ya definido).
  * @param fs_dir Directorio del FS.
@@ -31,6 +34,12 @@ int bwfs_write_bitmap(const bwfs_bitmap_t *bm, const char *fs_dir);
  */
 int bwfs_read_bitmap(bwfs_bitmap_t *bm, const char *fs_dir);
 
+/**
+ * \brief Bloques libres según el mapa en memoria (recorrido completo).
+ * @return Bits a 0 en `[0, total_blocks)`
+ */
+uint32_t bwfs_bitmap_count_free(const bwfs_bitmap_t *bm);
+
 /* ------------------------------------------------------------------------- */
 /* Utilidades inline                                                         */
 /* ------------------------------------------------------------------------- */
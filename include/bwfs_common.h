@@ -5,12 +5,13 @@
  * \brief Tipos y constantes públicas del *Black & White Filesystem (BWFS)*.
  *
  * Este archivo **define el formato on-disk**.  Cualquier cambio aquí rompe la
- * compatibilidad con discos ya formateados; recuerda incrementar el campo
- * `magic` del superbloque si modificas algo.
+ * compatibilidad con discos ya formateados; recuerda incrementar
+ * #BWFS_VERSION si modificas algo.
  */
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>     /* offsetof */
 
 /* ------------------------------------------------------------------------- */
 /* Parámetros globales                                                       */
@@ -19,16 +20,55 @@
 /** Secuencia ASCII «B W F S» → 0x42 0x57 0x46 0x53. */
 #define BWFS_MAGIC              0x42465753U
 
-/** Dimensión (px) del bloque-imagen lógico: 1000 × 1000 PX en blanco/negro. */
-#define BWFS_BLOCK_PX           1000U
+/**
+ * Revisión del formato.  Los discos v1 (un inodo por bloque) tienen el campo
+ * `version` a 0; la v2 empaqueta los inodos en una tabla.
+ */
+#define BWFS_VERSION            2U
+
+/**
+ * Dimensiones (px) del bloque-imagen en blanco/negro.  Se eligen en mkfs y
+ * se guardan en el superbloque; los discos anteriores son de 1000 × 1000.
+ * Cada lado es múltiplo de 8 (bloques de bytes enteros, alineados a 8).
+ */
+#define BWFS_BLOCK_PX           1000U   /**< Lado por defecto            */
+#define BWFS_BLOCK_PX_ALIGN     8U
+#define BWFS_BLOCK_BITS_MIN     (4096U * 8U)         /**< 4 KiB             */
+#define BWFS_BLOCK_BITS_MAX     (2048U * 2048U)      /**< 512 KiB           */
+
+/**
+ * \struct bwfs_geometry_t
+ * \brief Geometría de bloque del disco en uso.
+ *
+ * La fija \ref bwfs_geometry_set (mkfs, o al leer el superbloque); hasta
+ * entonces vale 1000 × 1000.
+ */
+typedef struct {
+    uint32_t width;          /**< Px por fila                            */
+    uint32_t height;         /**< Filas                                  */
+    uint32_t bits;           /**< width × height                         */
+    uint32_t bytes;          /**< bits / 8                               */
+    uint32_t dir_buckets;    /**< Cubetas de una hoja de directorio      */
+} bwfs_geometry_t;
+
+extern bwfs_geometry_t bwfs_geom;
+
+/**
+ * \brief Valida y activa una geometría de `width` × `height` px.
+ * @return BWFS_OK o BWFS_ERR_FULL si no es válida (la activa no cambia)
+ */
+int bwfs_geometry_set(uint32_t width, uint32_t height);
 
 /** Tamaño lógico de un bloque en bits y bytes. */
-#define BWFS_BLOCK_SIZE_BITS    (BWFS_BLOCK_PX * BWFS_BLOCK_PX)
-#define BWFS_BLOCK_SIZE_BYTES   (BWFS_BLOCK_SIZE_BITS / 8)
+#define BWFS_BLOCK_SIZE_BITS    (bwfs_geom.bits)
+#define BWFS_BLOCK_SIZE_BYTES   (bwfs_geom.bytes)
 
 /** Bloques reservados para metadatos. */
 #define BWFS_SUPERBLOCK_BLK     0U  /**< Superbloque                        */
 #define BWFS_BITMAP_BLK         1U  /**< Mapa de bits de bloques            */
+#define BWFS_SUPERBLOCK_ALT_BLK 1U  /**< Copia B del superbloque (DUAL)     */
+#define BWFS_INODE_BITMAP_BLK   2U  /**< Mapa de bits de inodos             */
+#define BWFS_INODE_TABLE_BLK    3U  /**< Primer bloque de la tabla de inodos*/
 
 /* ------------------------------------------------------------------------- */
 /* Superbloque                                                               */
@@ -40,6 +80,59 @@ enum {
     BWFS_SB_RESIZABLE  = 0x02,  /**< El disco admite *resize* dinámico   */
 };
 
+/**
+ * Características del formato.  Un programa que encuentra un bit que no
+ * conoce en:
+ *  - `feature_compat`: puede leer y escribir igualmente;
+ *  - `feature_ro_compat`: solo puede leer (no debe montar ni reparar);
+ *  - `feature_incompat`: no debe tocar el disco.
+ * Los discos anteriores tienen los tres campos a 0; al montarlos se marcan
+ * las estructuras que este código puede escribir (\ref bwfs_features_upgrade).
+ */
+enum {
+    BWFS_FEAT_COMPAT_COUNTERS   = 0x01,  /**< free_* válidos si está limpio */
+    BWFS_FEAT_COMPAT_JOURNAL    = 0x02,  /**< Diario de metadatos (journal_*)*/
+};
+enum {
+    BWFS_FEAT_RO_COMPAT_SNAP    = 0x01,  /**< Hay instantáneas: escribir sin
+                                              conocerlas las corrompería    */
+    BWFS_FEAT_RO_COMPAT_ORPHAN  = 0x02,  /**< Hay inodos borrados por
+                                              liberar (`orphan_head`)       */
+};
+enum {
+    BWFS_FEAT_INCOMPAT_INLINE   = 0x01,  /**< Datos en el inodo             */
+    BWFS_FEAT_INCOMPAT_EXTENTS  = 0x02,  /**< Archivos mapeados por extents */
+    BWFS_FEAT_INCOMPAT_DIRVAR   = 0x04,  /**< Directorios B+ de registros
+                                              variables                     */
+    BWFS_FEAT_INCOMPAT_FRAG     = 0x08,  /**< Colas en bloques de fragmentos*/
+    BWFS_FEAT_INCOMPAT_GEOMETRY = 0x10,  /**< Bloques distintos de 1000×1000*/
+    BWFS_FEAT_INCOMPAT_DIRATTR  = 0x20,  /**< Entradas con tamaño y bloques */
+    BWFS_FEAT_INCOMPAT_RECOVER  = 0x40,  /**< El diario puede guardar
+                                              transacciones sin aplicar     */
+    BWFS_FEAT_INCOMPAT_DUAL     = 0x80,  /**< Superbloque y bitmap en dos
+                                              copias A/B con secuencia      */
+};
+
+/** Características que entiende este código. */
+#define BWFS_FEAT_COMPAT_SUPP     ((uint32_t)(BWFS_FEAT_COMPAT_COUNTERS | \
+                                              BWFS_FEAT_COMPAT_JOURNAL))
+#define BWFS_FEAT_RO_COMPAT_SUPP  ((uint32_t)(BWFS_FEAT_RO_COMPAT_SNAP | \
+                                              BWFS_FEAT_RO_COMPAT_ORPHAN))
+#define BWFS_FEAT_INCOMPAT_SUPP   ((uint32_t)(BWFS_FEAT_INCOMPAT_INLINE  | \
+                                              BWFS_FEAT_INCOMPAT_EXTENTS | \
+                                              BWFS_FEAT_INCOMPAT_DIRVAR  | \
+                                              BWFS_FEAT_INCOMPAT_FRAG    | \
+                                              BWFS_FEAT_INCOMPAT_GEOMETRY | \
+                                              BWFS_FEAT_INCOMPAT_DIRATTR | \
+                                              BWFS_FEAT_INCOMPAT_RECOVER | \
+                                              BWFS_FEAT_INCOMPAT_DUAL))
+
+/** Estado del disco (`state`). */
+enum {
+    BWFS_STATE_CLEAN   = 0x01,  /**< Desmontado limpiamente: los contadores
+                                     del superbloque son exactos         */
+};
+
 /**
  * \struct bwfs_superblock_t
  * \brief Metadatos globales (reside en el bloque 0).
@@ -51,23 +144,100 @@ typedef struct __attribute__((packed)) {
     uint32_t magic;          /**< Valor fijo #BWFS_MAGIC                 */
     uint32_t total_blocks;   /**< Cantidad total de bloques lógicos      */
     uint32_t root_inode;     /**< Número de inodo del directorio raíz    */
-    uint32_t block_size;     /**< Copia de #BWFS_BLOCK_SIZE_BITS         */
+    uint32_t block_size;     /**< Bits por bloque (width × height)       */
     uint32_t flags;          /**< Véase enum BWFS_SB_*                   */
-    uint32_t reserved[11];   /**< Futuras extensiones (deja a 0)         */
+    uint32_t alloc_policy;   /**< Política de asignación (allocation.h)  */
+    uint32_t version;        /**< #BWFS_VERSION (0 en discos v1)         */
+    uint32_t inode_count;    /**< Inodos en la tabla (incluye el 0)      */
+    uint32_t inode_bitmap_blk;   /**< Bloque del bitmap de inodos        */
+    uint32_t inode_table_blk;    /**< Primer bloque de la tabla          */
+    uint32_t inode_table_blocks; /**< Bloques que ocupa la tabla         */
+    uint32_t block_width;    /**< Px por fila (0 = 1000 × 1000)          */
+    uint32_t block_height;   /**< Filas       (0 = 1000 × 1000)          */
+    uint32_t frag_head;      /**< Primer bloque de fragmentos (0=ninguno)*/
+    uint32_t feature_compat;     /**< BWFS_FEAT_COMPAT_*                 */
+    uint32_t feature_incompat;   /**< BWFS_FEAT_INCOMPAT_*               */
+    uint32_t feature_ro_compat;  /**< BWFS_FEAT_RO_COMPAT_*              */
+    uint32_t state;          /**< BWFS_STATE_*                           */
+    uint32_t mount_count;    /**< Generación: se incrementa al montar    */
+    uint32_t free_blocks;    /**< Bloques libres (válido si limpio)      */
+    uint32_t free_inodes;    /**< Inodos libres  (válido si limpio)      */
+    uint32_t block_bitmap_blk;   /**< Bitmap de bloques (0 = bloque 1)   */
+    uint32_t snap_table;     /**< Tabla de instantáneas (0 = ninguna)    */
+    uint32_t journal_blk;    /**< Primer bloque del diario               */
+    uint32_t journal_blocks; /**< Bloques del diario (0 = sin diario)    */
+    uint32_t bitmap_alt_blk; /**< Copia B del bitmap (DUAL)              */
+    uint32_t seq;            /**< Escritura que la produjo (DUAL)        */
+    uint32_t checksum;       /**< De los 128 bytes con este campo a 0    */
+    uint32_t orphan_head;    /**< Primer inodo huérfano (0 = ninguno)    */
+    uint32_t reserved[3];    /**< Futuras extensiones (deja a 0)         */
 } bwfs_superblock_t;
 
+/* Los discos anteriores escribían 64 bytes: lo que sigue se lee como 0 */
+typedef char bwfs_superblock_size_check[sizeof(bwfs_superblock_t) == 128U ? 1 : -1];
+
 /**
  * \brief Inicializa un superbloque con valores por defecto.
+ *
+ * La tabla de inodos se dimensiona para `inode_count` inodos (redondeado a
+ * bloques completos) y se coloca justo tras el bitmap de inodos.  La
+ * geometría es la activa en \ref bwfs_geom.
+ */
+void bwfs_init_superblock(bwfs_superblock_t *sb, uint32_t total_blocks,
+                          uint32_t inode_count);
+
+/**
+ * \brief Comprueba que este código entiende las características del disco.
+ *
+ * @param writable  true → también las `ro_compat` (montar o reparar).
+ * @return BWFS_OK o BWFS_ERR_FULL (con el motivo en el log)
  */
-void bwfs_init_superblock(bwfs_superblock_t *sb, uint32_t total_blocks);
+int bwfs_features_check(const bwfs_superblock_t *sb, bool writable);
+
+/**
+ * \brief Marca en `sb` las características que este código escribe (para
+ *        discos de antes de existir los campos).  No persiste.
+ */
+void bwfs_features_upgrade(bwfs_superblock_t *sb);
+
+/** \brief Bloque del bitmap de bloques (los discos antiguos no lo guardan). */
+static inline uint32_t bwfs_sb_bitmap_blk(const bwfs_superblock_t *sb)
+{
+    return sb->block_bitmap_blk ? sb->block_bitmap_blk : BWFS_BITMAP_BLK;
+}
+
+/**
+ * \brief Bloque con la copia vigente del superbloque: la última leída o
+ *        escrita (con #BWFS_FEAT_INCOMPAT_DUAL, la copia B en los pares de
+ *        secuencia impar).
+ */
+uint32_t bwfs_sb_current_blk(const bwfs_superblock_t *sb);
+
+/** Semilla de \ref bwfs_checksum. */
+#define BWFS_CHECKSUM_SEED      2166136261U
+
+/** \brief FNV-1a de `len` bytes partiendo de `h` (encadenable). */
+uint32_t bwfs_checksum(uint32_t h, const void *data, size_t len);
+
+/**
+ * \brief Ajusta \ref bwfs_geom a la geometría de un superbloque.
+ * @return BWFS_OK o BWFS_ERR_FULL si no es válida
+ */
+int bwfs_geometry_load(const bwfs_superblock_t *sb);
 
 /**
  * \brief Escribe el superbloque al disco.
+ *
+ * Con #BWFS_FEAT_INCOMPAT_DUAL escribe la copia que no es la vigente, con
+ * la secuencia siguiente y su checksum: un corte a medias deja intacta la
+ * otra.  Si la vigente aún no ha salido de la transacción del hilo
+ * (\ref util_block_held), la reescribe con la misma secuencia.
  */
 int bwfs_write_superblock(const bwfs_superblock_t *sb, const char *fs_dir);
 
 /**
- * \brief Lee y valida el superbloque desde disco.
+ * \brief Lee y valida el superbloque desde disco (con
+ *        #BWFS_FEAT_INCOMPAT_DUAL, la copia válida más reciente).
  */
 int bwfs_read_superblock(bwfs_superblock_t *sb, const char *fs_dir);
 
@@ -81,13 +251,75 @@ int bwfs_read_superblock(bwfs_superblock_t *sb, const char *fs_dir);
 /** El bit 0 del campo `flags` indica que el inodo es un directorio. */
 #define BWFS_INODE_DIR          0x01U
 
+/** El bit 1 indica que los datos del archivo viven dentro del propio inodo. */
+#define BWFS_INODE_INLINE       0x02U
+
+/** El bit 2 indica que los bloques del archivo se describen con extents. */
+#define BWFS_INODE_EXTENTS      0x04U
+
+/** El bit 3 indica que la cola del archivo vive en un bloque de fragmentos. */
+#define BWFS_INODE_FRAG         0x08U
+
+/** El bit 4 indica que el inodo está borrado y espera en la lista de huérfanos. */
+#define BWFS_INODE_ORPHAN       0x10U
+
+/** Desplazamiento y capacidad del área de datos en línea (blocks..unwritten). */
+#define BWFS_INLINE_OFF         16U
+#define BWFS_INLINE_MAX         48U
+
+/** Tamaño de cada ranura de la tabla de inodos (= sizeof(bwfs_inode_t)). */
+#define BWFS_INODE_SIZE         128U
+
+/** Inodos por bloque de tabla: 125 000 / 128 = 976. */
+#define BWFS_INODES_PER_BLOCK   (BWFS_BLOCK_SIZE_BYTES / BWFS_INODE_SIZE)
+
+/** El inodo 0 no existe: en un directorio, `ino == 0` marca ranura libre. */
+#define BWFS_ROOT_INO           1U
+
 /**
  * \struct bwfs_inode_t  (128 bytes)
  * \brief Inodo de tamaño fijo — lectura/escritura directa de disco.
  *
- * Para la versión mínima se usan **solo los bloques directos**; `indirect`
- * está reservado para crecer en el futuro.  Si `size` > `BWFS_DIRECT_BLOCKS`
- * ⋅ `BWFS_BLOCK_SIZE_BYTES` deberás gestionar la indirección.
+ * Los inodos viven empaquetados en la tabla de inodos: el inodo `ino` ocupa
+ * la ranura `ino % BWFS_INODES_PER_BLOCK` del bloque
+ * `inode_table_blk + ino / BWFS_INODES_PER_BLOCK`.
+ *
+ * Los directorios usan `blocks[0]` (raíz de su árbol, ver
+ * \ref bwfs_dir_node_t).  Los archivos con #BWFS_INODE_EXTENTS describen
+ * sus datos con extents (\ref bwfs_extent_t): los bytes 16..55 guardan una
+ * cabecera \ref bwfs_extent_hdr_t y hasta #BWFS_EXT_INLINE extents, y
+ * `indirect` apunta al bloque hoja o índice cuando no caben.  El tamaño es
+ * de 64 bits: `size` lleva la parte baja y `size_hi` la alta.
+ *
+ * El mapa puede tener huecos: un bloque lógico sin extent no ocupa espacio
+ * y se lee como ceros.  `block_count` es el fin del último extent (huecos
+ * intermedios incluidos); un hueco final no cuenta.
+ *
+ * Los archivos antiguos sin ese bit usan los 10 bloques directos; el bit i
+ * de `unwritten` indica que `blocks[i]` fue reservado (p. ej. por
+ * `fallocate`) pero nunca escrito y se lee como ceros sin hacer E/S.  Se
+ * convierten a extents la primera vez que cambia su asignación.
+ *
+ * Con #BWFS_INODE_INLINE los bytes 16..63 (`blocks`, `indirect` y
+ * `unwritten`) no son punteros sino el contenido del archivo (hasta
+ * #BWFS_INLINE_MAX bytes; lo que sigue a `size` queda a cero) y
+ * `block_count` vale 0.
+ *
+ * Con #BWFS_INODE_FRAG los `block_count` bloques del mapa de extents están
+ * llenos y los bytes restantes hasta `size` (la cola, como mucho
+ * #BWFS_FRAG_MAX) se guardan en la unidad `frag_unit` del bloque de
+ * fragmentos `frag_block` (\ref bwfs_frag_block_t).
+ *
+ * `parent` y `name_hash` localizan la entrada del inodo en su directorio
+ * (0 si no se conoce): solo los escribe dir.c (\ref bwfs_inode_set_link).
+ *
+ * Con #BWFS_INODE_ORPHAN ya no tiene entrada y `next_orphan` es el
+ * siguiente de la lista que empieza en `orphan_head` (\ref orphan.h).
+ *
+ * Las marcas de tiempo van en nanosegundos desde la época (0 en inodos
+ * anteriores a ellas).  `generation` sube con cada cambio de contenido:
+ * si no cambió entre dos aperturas, la caché de páginas del kernel sigue
+ * siendo válida.
  */
 typedef struct __attribute__((packed)) {
     /* Campo  Offset  Tamaño */
@@ -98,9 +330,240 @@ typedef struct __attribute__((packed)) {
     uint8_t  _pad[3];                        /**< 13   3  — Alineación    */
     uint32_t blocks[BWFS_DIRECT_BLOCKS];     /**< 16  40  — Directos      */
     uint32_t indirect;                       /**< 56   4  — Indirecto 1°  */
-    uint32_t reserved[14];                   /**< 60  56  — Relleno       */
+    uint32_t unwritten;                      /**< 60   4  — Sin escribir  */
+    uint32_t size_hi;                        /**< 64   4  — Tamaño >> 32  */
+    uint32_t frag_block;                     /**< 68   4  — Bloque de cola*/
+    uint32_t frag_unit;                      /**< 72   4  — Unidad de cola*/
+    uint32_t parent;                         /**< 76   4  — Dir. padre    */
+    uint32_t name_hash;                      /**< 80   4  — Hash de entrada*/
+    uint64_t atime_ns;                       /**< 84   8  — Último acceso */
+    uint64_t mtime_ns;                       /**< 92   8  — Último cambio
+                                                               de contenido */
+    uint64_t ctime_ns;                       /**< 100  8  — Último cambio
+                                                               del inodo    */
+    uint64_t generation;                     /**< 108  8  — Nº de cambios */
+    uint32_t next_orphan;                    /**< 116  4  — Lista huérfanos*/
+    uint32_t reserved[2];                    /**< 120  8  — Relleno       */
 } bwfs_inode_t;
 
+/** Comprobación en compilación de que el inodo llena su ranura. */
+typedef char bwfs_inode_size_check[sizeof(bwfs_inode_t) == BWFS_INODE_SIZE ? 1 : -1];
+typedef char bwfs_inode_inline_check[offsetof(bwfs_inode_t, size_hi) -
+                                     offsetof(bwfs_inode_t, blocks) == BWFS_INLINE_MAX &&
+                                     offsetof(bwfs_inode_t, blocks) == BWFS_INLINE_OFF ? 1 : -1];
+
+/* ------------------------------------------------------------------------- */
+/* Extents                                                                   */
+/* ------------------------------------------------------------------------- */
+
+/** Bit de `len` que marca un extent reservado pero sin escribir (ceros). */
+#define BWFS_EXT_UNWRITTEN      0x80000000U
+#define BWFS_EXT_LEN_MASK       0x7FFFFFFFU
+/** Tamaño máximo de archivo: tantos bloques lógicos como admite `len` */
+#define BWFS_MAX_FILE_BYTES     ((uint64_t)BWFS_EXT_LEN_MASK * BWFS_BLOCK_SIZE_BYTES)
+
+/** Extents que caben en el propio inodo (bytes 20..55). */
+#define BWFS_EXT_INLINE         3U
+
+/**
+ * \struct bwfs_extent_t
+ * \brief Tramo de bloques lógicos contiguos guardado en bloques físicos
+ *        contiguos.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t logical;                /**< Primer bloque lógico            */
+    uint32_t physical;               /**< Primer bloque físico            */
+    uint32_t len;                    /**< Bloques | #BWFS_EXT_UNWRITTEN   */
+} bwfs_extent_t;
+
+/**
+ * \struct bwfs_extent_hdr_t
+ * \brief Cabecera del árbol de extents en el inodo (bytes 16..19).
+ *
+ * - `depth` 0: los `count` extents están en el inodo.
+ * - `depth` 1: `indirect` es una hoja (\ref bwfs_extent_leaf_t).
+ * - `depth` 2: `indirect` es un índice (\ref bwfs_extent_index_t) de hojas.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t count;                  /**< Extents en el inodo (depth 0)   */
+    uint16_t depth;
+} bwfs_extent_hdr_t;
+
+#define BWFS_EXT_LEAF_MAGIC     0x4C545845U   /**< «EXTL» */
+#define BWFS_EXT_INDEX_MAGIC    0x49545845U   /**< «EXTI» */
+
+#define BWFS_EXT_LEAF_CAP       ((BWFS_BLOCK_SIZE_BYTES - 16U) / sizeof(bwfs_extent_t))
+#define BWFS_EXT_INDEX_CAP      ((BWFS_BLOCK_SIZE_BYTES - 16U) / 8U)
+
+/** \brief Bloque hoja: extents ordenados por `logical`. */
+typedef struct __attribute__((packed)) {
+    uint32_t      magic;                       /**< #BWFS_EXT_LEAF_MAGIC  */
+    uint32_t      count;
+    uint32_t      reserved[2];
+    bwfs_extent_t ext[];                       /**< #BWFS_EXT_LEAF_CAP    */
+} bwfs_extent_leaf_t;
+
+/** \brief Bloque índice: primer bloque lógico y bloque de cada hoja. */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;                            /**< #BWFS_EXT_INDEX_MAGIC */
+    uint32_t count;
+    uint32_t reserved[2];
+    struct __attribute__((packed)) {
+        uint32_t logical;
+        uint32_t block;
+    } idx[];                                   /**< #BWFS_EXT_INDEX_CAP   */
+} bwfs_extent_index_t;
+
+typedef char bwfs_extent_check[sizeof(bwfs_extent_hdr_t) +
+                               BWFS_EXT_INLINE * sizeof(bwfs_extent_t) ==
+                               offsetof(bwfs_inode_t, indirect) - BWFS_INLINE_OFF &&
+                               sizeof(bwfs_extent_leaf_t)  == 16U &&
+                               sizeof(bwfs_extent_index_t) == 16U ? 1 : -1];
+
+/* ------------------------------------------------------------------------- */
+/* Fragmentos (colas empaquetadas)                                           */
+/* ------------------------------------------------------------------------- */
+
+#define BWFS_FRAG_MAGIC         0x47415246U   /**< «FRAG» */
+
+/** Granularidad de asignación dentro de un bloque de fragmentos. */
+#define BWFS_FRAG_UNIT          64U
+#define BWFS_FRAG_UNITS         (BWFS_BLOCK_SIZE_BYTES / BWFS_FRAG_UNIT)
+
+/** Cola más larga que se empaqueta (un cuarto de bloque). */
+#define BWFS_FRAG_MAX           (BWFS_BLOCK_SIZE_BYTES / 4U)
+
+/**
+ * \struct bwfs_frag_block_t
+ * \brief Bloque compartido por las colas de varios archivos.
+ *
+ * Tras la cabecera va el dueño (nº de inodo, 0 = libre) de cada una de las
+ * #BWFS_FRAG_UNITS unidades de #BWFS_FRAG_UNIT bytes; las primeras
+ * #BWFS_FRAG_FIRST unidades las ocupa esa misma tabla.  Cada cola es un
+ * tramo de unidades contiguas con el mismo dueño, que permite mover
+ * fragmentos al compactar sin buscar quién los referencia.  Los bloques de
+ * fragmentos forman una lista desde `frag_head` del superbloque.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;                            /**< #BWFS_FRAG_MAGIC      */
+    uint32_t next;                             /**< Siguiente (0 = fin)   */
+    uint32_t used;                             /**< Unidades con dueño    */
+    uint32_t reserved;
+    uint32_t owner[];                          /**< #BWFS_FRAG_UNITS      */
+} bwfs_frag_block_t;
+
+#define BWFS_FRAG_HDR_SIZE      (sizeof(bwfs_frag_block_t) + BWFS_FRAG_UNITS * 4U)
+#define BWFS_FRAG_FIRST         ((BWFS_FRAG_HDR_SIZE + BWFS_FRAG_UNIT - 1U) / BWFS_FRAG_UNIT)
+
+/* ------------------------------------------------------------------------- */
+/* Instantáneas                                                              */
+/* ------------------------------------------------------------------------- */
+
+#define BWFS_SNAP_MAGIC         0x50414E53U   /**< «SNAP» */
+
+#define BWFS_SNAP_MAX           16U   /**< Instantáneas por disco             */
+#define BWFS_SNAP_NAME_MAX      63U   /**< Longitud máxima del nombre sin NUL */
+
+/**
+ * Bloques de mapa por instantánea: uno por cada BWFS_BLOCK_SIZE_BYTES / 4
+ * bloques del disco; como el bitmap es un solo bloque, nunca más de 32.
+ */
+#define BWFS_SNAP_MAP_CHUNKS    32U
+
+/**
+ * \struct bwfs_snap_rec_t
+ * \brief Una instantánea (240 bytes).
+ *
+ * - `shared_blk`: bitmap, con el formato del de bloques, de los bloques que
+ *   compartía con el disco vivo al crearse.  No cambia nunca.
+ * - `map`: bloques de mapa (0 = aún sin crear, todo a 0).  La entrada `b`
+ *   del mapa es el bloque que guarda la versión de `b` de la instantánea, o
+ *   0 si el disco vivo aún no la ha modificado y sigue valiendo.
+ */
+typedef struct __attribute__((packed)) {
+    char     name[BWFS_SNAP_NAME_MAX + 1];     /**< UTF-8 + NUL           */
+    uint64_t ctime_ns;                         /**< Hora de creación      */
+    uint32_t id;                               /**< Nº de instantánea     */
+    uint32_t shared_blk;                       /**< Bloques compartidos   */
+    uint32_t map[BWFS_SNAP_MAP_CHUNKS];        /**< Bloques de mapa       */
+    uint32_t reserved[8];
+} bwfs_snap_rec_t;
+
+/**
+ * \struct bwfs_snap_table_t
+ * \brief Bloque `snap_table` del superbloque: las instantáneas vivas.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t        magic;                     /**< #BWFS_SNAP_MAGIC      */
+    uint32_t        count;                     /**< Registros en uso      */
+    uint32_t        next_id;                   /**< Id de la siguiente    */
+    uint32_t        reserved;
+    bwfs_snap_rec_t rec[BWFS_SNAP_MAX];
+} bwfs_snap_table_t;
+
+typedef char bwfs_snap_check[sizeof(bwfs_snap_rec_t) == 240U &&
+                             sizeof(bwfs_snap_table_t) <= BWFS_BLOCK_BITS_MIN / 8U &&
+                             BWFS_BLOCK_BITS_MAX / 8U * 8U * 4U /
+                             (BWFS_BLOCK_BITS_MAX / 8U) <= BWFS_SNAP_MAP_CHUNKS ? 1 : -1];
+
+/* ------------------------------------------------------------------------- */
+/* Diario de metadatos                                                       */
+/* ------------------------------------------------------------------------- */
+
+#define BWFS_JOURNAL_MAGIC      0x4C4E524AU   /**< «JRNL» */
+#define BWFS_JOURNAL_TXN_MAGIC  0x4E58544AU   /**< «JTXN» */
+
+/**
+ * \struct bwfs_journal_hdr_t
+ * \brief Cabecera del diario, al principio de su primer bloque.
+ *
+ * El resto de bloques del diario forman un registro circular de
+ * `(journal_blocks - 1) × BWFS_BLOCK_SIZE_BYTES` bytes.  Las posiciones son
+ * absolutas (no vuelven a 0 al dar la vuelta): la posición `p` está en el
+ * byte `p % capacidad` del registro.  `tail` es la primera transacción que
+ * quizá no esté aún en su sitio; todo lo anterior ya lo está.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;          /**< #BWFS_JOURNAL_MAGIC                    */
+    uint32_t blocks;         /**< = `journal_blocks` del superbloque     */
+    uint64_t tail;           /**< Posición de la primera transacción viva*/
+    uint64_t tail_seq;       /**< Su número de secuencia                 */
+    uint32_t checksum;       /**< De la cabecera con este campo a 0      */
+    uint32_t reserved[3];
+} bwfs_journal_hdr_t;
+
+/**
+ * \struct bwfs_journal_txn_t
+ * \brief Transacción del diario: esta cabecera y `nrec` registros
+ *        \ref bwfs_journal_rec_t seguidos, `bytes` en total.
+ *
+ * La secuencia sube de uno en uno: la reproducción para en la primera
+ * cabecera que no tiene la secuencia esperada o cuyo `checksum` (de la
+ * cabecera con ese campo a 0 y de los registros) no cuadra.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;          /**< #BWFS_JOURNAL_TXN_MAGIC                */
+    uint32_t nrec;           /**< Registros                              */
+    uint64_t seq;            /**< Nº de secuencia                        */
+    uint32_t bytes;          /**< Bytes de registros tras la cabecera    */
+    uint32_t checksum;
+} bwfs_journal_txn_t;
+
+/**
+ * \struct bwfs_journal_rec_t
+ * \brief Nuevo contenido de los bytes `[off, off+len)` del bloque `blk`;
+ *        los `len` bytes siguen al registro.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t blk;
+    uint32_t off;
+    uint32_t len;
+} bwfs_journal_rec_t;
+
+typedef char bwfs_journal_check[sizeof(bwfs_journal_hdr_t) == 40U &&
+                                sizeof(bwfs_journal_txn_t) == 24U &&
+                                sizeof(bwfs_journal_rec_t) == 12U ? 1 : -1];
+
 /* ------------------------------------------------------------------------- */
 /* Directorios                                                               */
 /* ------------------------------------------------------------------------- */
@@ -109,27 +572,239 @@ typedef struct __attribute__((packed)) {
 
 /**
  * \struct bwfs_dir_entry_t
- * \brief Asociación nombre → inodo (registro fijo).
+ * \brief Asociación nombre → inodo (registro fijo de los formatos
+ *        antiguos, solo lectura).
  */
 typedef struct __attribute__((packed)) {
     uint32_t ino;                    /**< Inodo destino               */
     char     name[BWFS_NAME_MAX + 1];/**< UTF-8 + NUL final           */
 } bwfs_dir_entry_t;
 
+/**
+ * Marca del formato de hoja con registros fijos de \ref bwfs_dir_entry_t
+ * tras 1024 cubetas («DHSH»).  Solo se lee: la primera escritura convierte
+ * la hoja al formato de registros variables.  Como todas las marcas, es
+ * mayor que cualquier número de inodo posible, así que no se confunde con
+ * el `ino` de la primera entrada de un bloque lineal antiguo.
+ */
+#define BWFS_DIR_FIXED_MAGIC    0x48534844U
+#define BWFS_DIR_FIXED_OFF      (16U + 1024U * 4U)  /**< Primer registro   */
+#define BWFS_DIR_FIXED_ENTRIES  464U                /**< Registros máximos */
+
+/**
+ * Marca de bloque-directorio con índice hash y registros variables con
+ * atributos del hijo («DHVA», \ref bwfs_dirent_t).
+ */
+#define BWFS_DIR_HASH_MAGIC     0x41564844U
+
+/**
+ * Marca de la hoja anterior, de registros variables sin atributos
+ * (\ref bwfs_dirent_short_t, «DHVR»).  Solo se lee: la primera escritura
+ * la convierte al formato actual.
+ */
+#define BWFS_DIR_SHORT_MAGIC    0x52564844U
+
+/**
+ * Cubetas por hoja: la mayor potencia de 2 ≤ bytes/24, suficientes para
+ * llenar el heap con nombres cortos (4096 en bloques de 1000 × 1000).
+ */
+#define BWFS_DIR_BUCKETS        (bwfs_geom.dir_buckets)
+#define BWFS_DIR_HASH_ENTRIES   (BWFS_DIR_BUCKETS / 4U * 3U)  /**< 75 %  */
+
+/** Tipos de entrada (como `d_type`, evitan leer el inodo en readdir). */
+#define BWFS_FT_UNKNOWN         0U
+#define BWFS_FT_REG             1U
+#define BWFS_FT_DIR             2U
+
+/** `blocks` de un registro sin atributos (traducido de un formato antiguo). */
+#define BWFS_DIRENT_NOATTR      UINT32_MAX
+
+/**
+ * \struct bwfs_dirent_t
+ * \brief Registro de longitud variable de una hoja de directorio.
+ *
+ * Ocupa `rec_len` bytes: la cabecera, el nombre con su NUL y relleno hasta
+ * múltiplo de 8.  El hash se guarda para dividir y reindexar hojas sin
+ * recalcularlo.
+ *
+ * `size`, `blocks` y las marcas de tiempo copian las del inodo hijo para
+ * que readdir rellene `struct stat` sin leerlo; \ref bwfs_write_inode las
+ * mantiene al día a través del enlace `parent`/`name_hash` del inodo.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t ino;                    /**< Inodo destino               */
+    uint32_t hash;                   /**< bwfs_dir_name_hash(name)    */
+    uint16_t rec_len;                /**< Bytes del registro completo */
+    uint8_t  name_len;               /**< Longitud sin NUL            */
+    uint8_t  type;                   /**< BWFS_FT_*                   */
+    uint64_t size;                   /**< Tamaño del hijo             */
+    uint32_t blocks;                 /**< `block_count` del hijo      */
+    uint64_t atime_ns;               /**< Marcas de tiempo del hijo   */
+    uint64_t mtime_ns;
+    uint64_t ctime_ns;
+    char     name[];                 /**< UTF-8 + NUL final           */
+} bwfs_dirent_t;
+
+/**
+ * \brief Registro de las hojas #BWFS_DIR_SHORT_MAGIC: la cabecera de
+ *        \ref bwfs_dirent_t sin `size` ni `blocks` (solo lectura).
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t ino;
+    uint32_t hash;
+    uint16_t rec_len;
+    uint8_t  name_len;
+    uint8_t  type;
+    char     name[];
+} bwfs_dirent_short_t;
+
+/** Longitud de un registro cuyo nombre mide `name_len` bytes. */
+#define BWFS_DIRENT_LEN(name_len) \
+    ((uint16_t)((sizeof(bwfs_dirent_t) + (name_len) + 1U + 7U) & ~7U))
+
+/**
+ * \struct bwfs_dir_index_t
+ * \brief Cabecera + tabla hash de direccionamiento abierto de un
+ *        bloque-directorio.
+ *
+ * Cada cubeta vale 0 (vacía) o `(hash & 0xFFFF) << 16 | (desplazamiento / 8)`
+ * del registro dentro del bloque; los 16 bits de hash evitan leer registros
+ * que no coinciden y contienen la posición de origen
+ * (`hash & (BWFS_DIR_BUCKETS-1)`) para el sondeo lineal.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;                            /**< #BWFS_DIR_HASH_MAGIC */
+    uint32_t count;                            /**< Entradas en uso      */
+    uint32_t next;                             /**< Hoja siguiente (0=fin)*/
+    uint32_t used;                             /**< Bytes de heap usados */
+    uint32_t buckets[];                        /**< #BWFS_DIR_BUCKETS    */
+} bwfs_dir_index_t;
+
+/** Bytes de cabecera + cubetas: el heap empieza justo detrás. */
+#define BWFS_DIR_INDEX_SIZE     (sizeof(bwfs_dir_index_t) + BWFS_DIR_BUCKETS * 4U)
+#define BWFS_DIR_HEAP_SIZE      (BWFS_BLOCK_SIZE_BYTES - BWFS_DIR_INDEX_SIZE)
+
+/**
+ * \brief Bloque-directorio con índice hash; los registros
+ *        (\ref bwfs_dirent_t) ocupan los `used` primeros bytes del heap
+ *        (\ref bwfs_dir_heap) sin huecos: borrar compacta los que siguen.
+ *        Es también la hoja del árbol B+ de los directorios grandes
+ *        (\ref bwfs_dir_node_t).
+ */
+typedef bwfs_dir_index_t bwfs_dir_block_t;
+
+static inline uint8_t *bwfs_dir_heap(bwfs_dir_block_t *blk)
+{
+    return (uint8_t *)blk + BWFS_DIR_INDEX_SIZE;
+}
+
+/* Con lados múltiplo de 8 el bloque es múltiplo de 8 bytes; el máximo
+ * mantiene los desplazamientos / 8 en los 16 bits de la cubeta. */
+typedef char bwfs_dir_block_check[sizeof(bwfs_dir_index_t) % 8U == 0 &&
+                                  BWFS_BLOCK_BITS_MAX / 64U <= 0xFFFFU + 1U ? 1 : -1];
+
+/** Marca de nodo interno del árbol B+ de un directorio («DBTI»). */
+#define BWFS_DIR_NODE_MAGIC     0x49544244U
+
+/** Hijos por nodo interno: (125 000 − 16) / 8 = 15 623 en 1000 × 1000. */
+#define BWFS_DIR_NODE_CAP       ((BWFS_BLOCK_SIZE_BYTES - 16U) / 8U)
+
+/**
+ * \struct bwfs_dir_node_t
+ * \brief Nodo interno del árbol B+ indexado por hash de nombre.
+ *
+ * `blocks[0]` del inodo-directorio apunta a la raíz, que es una hoja
+ * (\ref bwfs_dir_block_t) mientras el directorio cabe en un bloque.  Tras
+ * la cabecera van #BWFS_DIR_NODE_CAP claves y otros tantos hijos
+ * (\ref bwfs_dir_node_keys, \ref bwfs_dir_node_children): el hijo `i`
+ * cubre los hashes en `[keys[i], keys[i+1])`; todas las entradas con el
+ * mismo hash viven en la misma hoja.  Las hojas se encadenan por `next` en
+ * orden de hash.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;                            /**< #BWFS_DIR_NODE_MAGIC */
+    uint32_t level;                            /**< 1 = hijos son hojas  */
+    uint32_t count;                            /**< Hijos en uso         */
+    uint32_t reserved;
+    uint32_t slots[];                          /**< Claves, luego hijos  */
+} bwfs_dir_node_t;
+
+/** Desplazamientos en el bloque de las claves y de los hijos. */
+#define BWFS_DIR_NODE_KEYS_OFF      offsetof(bwfs_dir_node_t, slots)
+#define BWFS_DIR_NODE_CHILDREN_OFF  (BWFS_DIR_NODE_KEYS_OFF + BWFS_DIR_NODE_CAP * 4U)
+
+/** Cota inferior (hash) de cada hijo. */
+static inline uint32_t *bwfs_dir_node_keys(bwfs_dir_node_t *node)
+{
+    return (uint32_t *)((uint8_t *)node + BWFS_DIR_NODE_KEYS_OFF);
+}
+
+/** Bloque de cada hijo. */
+static inline uint32_t *bwfs_dir_node_children(bwfs_dir_node_t *node)
+{
+    return (uint32_t *)((uint8_t *)node + BWFS_DIR_NODE_CHILDREN_OFF);
+}
+
 /* ------------------------------------------------------------------------- */
 /* Bitmap (solo en RAM)                                                      */
 /* ------------------------------------------------------------------------- */
 
+/** Tramo liberado que aún no puede reutilizarse (\ref bwfs_bitmap_t). */
+typedef struct {
+    uint32_t start, count;
+    uint64_t tag;              /**< Marca de `free_tag` al liberarlo     */
+} bwfs_pending_free_t;
+
 /**
  * \struct bwfs_bitmap_t
  * \brief Representación temporal del mapa de bits de bloques libres/ocupados.
  */
 typedef struct {
-    uint32_t bits_per_block;   /**< Constante: #BWFS_BLOCK_SIZE_BITS     */
+    uint32_t bits_per_block;   /**< #BWFS_BLOCK_SIZE_BITS del disco      */
     uint32_t total_blocks;     /**< Igual al valor del superbloque       */
     uint8_t *map;              /**< Buffer ⌈total_blocks/8⌉ bytes        */
+    uint32_t policy;           /**< Política de asignación activa        */
+    uint32_t cursor;           /**< Posición rotativa (Next-Fit)         */
+    uint32_t bitmap_blk;       /**< Bloque en disco (0 = #BWFS_BITMAP_BLK) */
+    uint32_t alt_blk;          /**< Copia B (0 = una sola copia)         */
+    uint32_t free_blocks;      /**< Bits a 0; lo mantiene allocation.c   */
+    /**
+     * Si no es NULL y devuelve true para un bloque que se libera, el bloque
+     * sigue ocupado: ahora es de una instantánea (\ref snapshot.h).
+     */
+    bool   (*retain)(uint32_t blk);
+    /**
+     * Si no son NULL, un bloque liberado no vuelve al asignador hasta que
+     * `settled` acepte la marca que dio `free_tag` (con los bloques del
+     * tramo) al liberarlo: con diario, hasta confirmar la transacción que
+     * lo libera; 0 = ya.
+     * Mientras tanto sigue a 1 en `map`, está en `pending` y se escribe
+     * en disco como libre.
+     */
+    uint64_t (*free_tag)(uint32_t blocks);
+    bool     (*settled)(uint64_t tag);
+    uint8_t             *pending;  /**< Bits de los tramos de `pend`    */
+    bwfs_pending_free_t *pend;     /**< En orden de liberación          */
+    uint32_t             npend, pend_cap;
 } bwfs_bitmap_t;
 
+#define BWFS_BITMAP_TAIL_MAGIC  0x4C494154U   /**< «TAIL» */
+
+/**
+ * \struct bwfs_bitmap_tail_t
+ * \brief Cola de cada copia del bitmap con #BWFS_FEAT_INCOMPAT_DUAL, en los
+ *        últimos bytes del bloque: vale la copia válida de mayor `seq`.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;                  /**< #BWFS_BITMAP_TAIL_MAGIC          */
+    uint32_t seq;
+    uint32_t checksum;               /**< Del mapa y la cola (este campo 0)*/
+    uint32_t reserved;
+} bwfs_bitmap_tail_t;
+
+/** Bloques que admite un bitmap con cola (el resto del bloque es suyo). */
+#define BWFS_BITMAP_DUAL_MAX    (BWFS_BLOCK_SIZE_BITS - 8U * (uint32_t)sizeof(bwfs_bitmap_tail_t))
+
 /* ------------------------------------------------------------------------- */
 /* Códigos de retorno genéricos                                              */
 /* ------------------------------------------------------------------------- */
@@ -138,5 +813,6 @@ typedef struct {
 #define BWFS_ERR_IO    -5   /**< Error de entrada/salida               */
 #define BWFS_ERR_NOMEM -6   /**< Sin memoria disponible                */
 #define BWFS_ERR_FULL  -7   /**< No hay espacio libre                  */
+#define BWFS_ERR_LOCK  -8   /**< Cerrojo pedido fuera de orden         */
 
 #endif /* BWFS_COMMON_H */
@@ -17,29 +17,38 @@
  * \brief Inserta una nueva entrada en un directorio.
  *
  * Si el directorio aún no posee bloques de datos se reserva el primero.
+ * El registro copia el tamaño y los bloques del hijo, cuyo enlace
+ * (`parent`, `name_hash`) pasa a apuntar a la nueva entrada.
  *
  * @param bm         Bitmap (puede ser NULL si `block_count>0`).
  * @param dir_inode  Inodo del directorio (en memoria; será re-escrito).
  * @param fs_dir     Directorio del FS.
  * @param name       Nombre UTF-8 sin «/».
  * @param child_ino  Inodo que se enlazará.
+ * @param type       BWFS_FT_* del hijo (ver \ref bwfs_dir_ftype).
  * @return           BWFS_OK o código BWFS_ERR_*
  */
 int bwfs_dir_add(bwfs_bitmap_t *bm,
                  bwfs_inode_t  *dir_inode,
                  const char    *fs_dir,
                  const char    *name,
-                 uint32_t       child_ino);
+                 uint32_t       child_ino,
+                 uint8_t        type);
 
 /**
  * \brief Elimina una entrada por nombre.
  *
+ * Si la hoja queda casi vacía se fusiona con su hermana y se libera un
+ * bloque del árbol.
+ *
+ * @param bm  Bitmap (NULL: nunca se fusionan hojas).
  * @return BWFS_OK si la entrada existía, BWFS_ERR_IO/-1 en error,
  *         UINT32_MAX si no se halló.
  */
-int bwfs_dir_remove(bwfs_inode_t *dir_inode,
-                    const char   *fs_dir,
-                    const char   *name);
+int bwfs_dir_remove(bwfs_bitmap_t *bm,
+                    bwfs_inode_t  *dir_inode,
+                    const char    *fs_dir,
+                    const char    *name);
 
 /**
  * \brief Busca un nombre dentro de un directorio.
@@ -53,4 +62,95 @@ uint32_t bwfs_dir_lookup(const bwfs_inode_t *dir_inode,
                          const char         *fs_dir,
                          const char         *name);
 
+/**
+ * \brief Función llamada por \ref bwfs_dir_iterate para cada entrada.
+ *
+ * `entry` apunta al registro dentro del bloque leído (válido solo durante
+ * la llamada); `entry->name` termina en NUL.  Los registros de formatos
+ * antiguos llegan traducidos y sin atributos (\ref bwfs_dirent_has_attr).
+ *
+ * @return 0 para continuar, distinto de 0 para detener el recorrido.
+ */
+typedef int (*bwfs_dir_iter_fn)(const bwfs_dirent_t *entry, void *arg);
+
+/**
+ * \brief Recorre las entradas en uso de un directorio (formato hash o
+ *        lineal antiguo), hoja a hoja en orden de hash, con una lectura
+ *        por bloque.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_dir_iterate(const bwfs_inode_t *dir_inode,
+                     const char         *fs_dir,
+                     bwfs_dir_iter_fn    fn,
+                     void               *arg);
+
+/**
+ * \brief Llama a `fn` con cada bloque del árbol del directorio (hojas y
+ *        nodos internos, hijos antes que su padre).
+ *
+ * @return BWFS_OK, el primer valor distinto de BWFS_OK devuelto por `fn`,
+ *         BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_dir_for_each_block(const bwfs_inode_t *dir_inode,
+                            const char         *fs_dir,
+                            int               (*fn)(uint32_t blk, void *arg),
+                            void               *arg);
+
+/**
+ * \brief Libera todos los bloques del árbol de un directorio y deja el
+ *        inodo sin bloques (`block_count = 0`).  El inodo no se escribe.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_dir_release(bwfs_bitmap_t *bm,
+                     bwfs_inode_t  *dir_inode,
+                     const char    *fs_dir);
+
+/**
+ * \brief Copia el tipo, el tamaño y los bloques de `child` en su entrada del
+ *        directorio, localizada por el hash del nombre y el número de inodo.
+ *
+ * Solo escribe la cabecera del registro, y solo si algo cambió.  Llamada
+ * desde \ref bwfs_write_inode; fsck la usa para reparar copias desfasadas.
+ *
+ * @param hash  `name_hash` del enlace del hijo.
+ * @return BWFS_OK, UINT32_MAX si no hay tal entrada (o su hoja es de un
+ *         formato sin atributos), BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_dir_update_attr(const bwfs_inode_t *dir_inode,
+                         const char         *fs_dir,
+                         uint32_t            hash,
+                         const bwfs_inode_t *child);
+
+/**
+ * \brief Comprueba que el directorio tenga una entrada de `ino` cuyo
+ *        nombre tenga hash `hash` (es decir, que el enlace de `ino` es
+ *        válido).  No escribe nada.
+ *
+ * @return BWFS_OK, UINT32_MAX si no la hay, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_dir_has_link(const bwfs_inode_t *dir_inode,
+                      const char         *fs_dir,
+                      uint32_t            hash,
+                      uint32_t            ino);
+
+/** \brief true si la entrada trae `size` y `blocks` del hijo. */
+static inline bool bwfs_dirent_has_attr(const bwfs_dirent_t *entry)
+{
+    return entry->blocks != BWFS_DIRENT_NOATTR;
+}
+
+/** \brief Tipo de entrada (BWFS_FT_*) que corresponde a un inodo. */
+static inline uint8_t bwfs_dir_ftype(const bwfs_inode_t *inode)
+{
+    return (inode->flags & BWFS_INODE_DIR) ? BWFS_FT_DIR : BWFS_FT_REG;
+}
+
+/**
+ * \brief Hash de un nombre de entrada (xxHash32, estable entre máquinas:
+ *        se guarda en disco).
+ */
+uint32_t bwfs_dir_name_hash(const char *name);
+
 #endif /* BWFS_DIR_H */
@@ -0,0 +1,55 @@
+#ifndef BWFS_DIRTY_H
+#define BWFS_DIRTY_H
+/**
+ * \file dirty.h
+ * \brief Bloques de datos pendientes de sincronizar, por inodo (fsync).
+ *
+ * Los datos de archivo van directos a su bloque (\ref journal.h) sin
+ * sincronizar.  Cada escritura apunta aquí el bloque en el inodo dueño;
+ * `fdatasync` lleva a disco solo esos bloques y `fsync` además confirma el
+ * diario con el inodo.  Sin diario, los metadatos se sincronizan con un
+ * syncfs.
+ *
+ * Las sincronizaciones simultáneas se agrupan: la primera que llega hace
+ * de líder y sincroniza los bloques de todas las que esperan en una sola
+ * tanda; las demás solo esperan a que acabe.  Una tanda de más de
+ * #BWFS_DIRTY_SYNC_MAX bloques se resuelve con un único syncfs en vez de
+ * un fdatasync por bloque.
+ */
+
+#include "bwfs_common.h"
+
+/** Bloques por tanda a partir de los que compensa un syncfs. */
+#define BWFS_DIRTY_SYNC_MAX   32U
+
+/** Bloques apuntados por inodo; pasado este número se sincroniza todo. */
+#define BWFS_DIRTY_INODE_MAX  1024U
+
+/** \brief Apunta que se escribió el bloque de datos `blk` de `ino`. */
+void bwfs_dirty_add(uint32_t ino, uint32_t blk);
+
+/**
+ * \brief Apunta que cambiaron metadatos que hacen falta para leer los
+ *        datos de `ino` (tamaño, mapa de bloques): también fdatasync
+ *        tendrá que confirmarlos.
+ */
+void bwfs_dirty_meta(uint32_t ino);
+
+/** \brief Olvida lo pendiente de `ino` (el inodo se borró). */
+void bwfs_dirty_forget(uint32_t ino);
+
+/**
+ * \brief Lleva a disco los datos pendientes de `ino` y, sin `datasync` o
+ *        si cambiaron sus metadatos, también estos.
+ *
+ * No debe llamarse con un manejador del diario abierto.  Un error de una
+ * tanda anterior con bloques de `ino` se devuelve aquí una vez.
+ *
+ * @return BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_dirty_sync(uint32_t ino, bool datasync, const char *fs_dir);
+
+/** \brief Libera todo lo apuntado (desmontaje, tras el syncfs final). */
+void bwfs_dirty_close(void);
+
+#endif /* BWFS_DIRTY_H */
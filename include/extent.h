@@ -0,0 +1,151 @@
+#ifndef BWFS_EXTENT_H
+#define BWFS_EXTENT_H
+/**
+ * \file extent.h
+ * \brief Asignación de bloques de archivo por extents.
+ *
+ * Un archivo #BWFS_INODE_EXTENTS describe sus datos como tramos
+ * `(logical, physical, len)`.  Los tres primeros viven en el inodo; si hay
+ * más, `indirect` apunta a una hoja o a un índice de hojas (ver
+ * \ref bwfs_extent_hdr_t).
+ *
+ * Para modificar la asignación se carga el mapa completo en memoria
+ * (\ref bwfs_extent_load), se edita y se vuelve a guardar
+ * (\ref bwfs_extent_store).  El mapa puede tener huecos: los bloques
+ * lógicos sin extent no ocupan espacio y se leen como ceros.  Las lecturas y escrituras solo necesitan
+ * \ref bwfs_extent_lookup, que devuelve el tramo entero que contiene un
+ * bloque: un recorrido secuencial hace una consulta por tramo, no por
+ * bloque.
+ */
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+
+/**
+ * \brief Mapa de extents de un archivo cargado en memoria.
+ */
+typedef struct {
+    bwfs_extent_t *ext;         /**< Extents ordenados por `logical`        */
+    uint32_t       count;       /**< Extents en uso                         */
+    uint32_t       cap;         /**< Capacidad de `ext`                     */
+    uint32_t      *meta;        /**< Bloques hoja/índice (índice primero)   */
+    uint32_t       meta_count;  /**< Bloques en `meta`                      */
+} bwfs_extent_map_t;
+
+void bwfs_extent_map_init(bwfs_extent_map_t *map);
+void bwfs_extent_map_free(bwfs_extent_map_t *map);
+
+/**
+ * \brief Carga el mapa de un archivo.  Los archivos antiguos de bloques
+ *        directos se traducen a extents; uno en línea da un mapa vacío.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO (árbol dañado)
+ */
+int bwfs_extent_load(const bwfs_inode_t *inode, const char *fs_dir,
+                     bwfs_extent_map_t *map);
+
+/**
+ * \brief Guarda el mapa en el inodo y, si no cabe, en bloques hoja/índice
+ *        (reutilizando los que ya tenía).  Activa #BWFS_INODE_EXTENTS.
+ *
+ * Actualiza el bitmap en memoria pero no lo persiste, ni escribe el inodo.
+ *
+ * @return BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_extent_store(bwfs_bitmap_t *bm, bwfs_inode_t *inode,
+                      const char *fs_dir, bwfs_extent_map_t *map);
+
+/** \brief Bloques lógicos cubiertos: fin del último extent. */
+uint32_t bwfs_extent_mapped(const bwfs_extent_map_t *map);
+
+/**
+ * \brief Reserva `count` bloques tras el último extent.
+ *
+ * Pide primero una sola región contigua y, si el bitmap no la tiene, va
+ * partiendo la petición a la mitad; los trozos contiguos se fusionan en
+ * un mismo extent.  Si falta espacio deshace lo reservado.
+ *
+ * @param unwritten  true → los bloques nuevos se leen como ceros.
+ * @return BWFS_OK, BWFS_ERR_FULL o BWFS_ERR_NOMEM
+ */
+int bwfs_extent_alloc(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                      uint32_t count, bool unwritten);
+
+/**
+ * \brief Reserva bloques para los huecos de `[first, first+count)`; lo que
+ *        ya estaba asignado no se toca.
+ *
+ * Los huecos del mapa (bloques lógicos sin extent) se leen como ceros sin
+ * ocupar espacio; esto los rellena antes de escribir en ellos.  Los
+ * extents nuevos se devuelven también en `added` (inicializado por quien
+ * llama), para poder liberarlos si luego falla el guardado.  Si falta
+ * espacio no se reserva nada.
+ *
+ * @param unwritten  true → los bloques nuevos se leen como ceros.
+ * @return BWFS_OK, BWFS_ERR_FULL o BWFS_ERR_NOMEM
+ */
+int bwfs_extent_fill(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                     uint32_t first, uint32_t count, bool unwritten,
+                     bwfs_extent_map_t *added);
+
+/** \brief Libera los bloques lógicos desde `from` en adelante. */
+void bwfs_extent_truncate(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                          uint32_t from);
+
+/**
+ * \brief Marca como escritos los bloques lógicos `[first, first+count)`,
+ *        partiendo los extents «sin escribir» que los contienen.
+ * @return BWFS_OK o BWFS_ERR_NOMEM
+ */
+int bwfs_extent_mark_written(bwfs_extent_map_t *map,
+                             uint32_t first, uint32_t count);
+
+/**
+ * \brief Apunta los bloques lógicos `[first, first+count)` a los físicos
+ *        `[physical, physical+count)` y libera los que tenían.
+ *
+ * El rango debe estar asignado (sin huecos).  Los bloques nuevos
+ * quedan escritos, o «sin escribir» si `unwritten`.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO (rango fuera del mapa)
+ */
+int bwfs_extent_remap(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                      uint32_t first, uint32_t count, uint32_t physical,
+                      bool unwritten);
+
+/**
+ * \brief Tramo que contiene el bloque lógico `lblk`, recortado para empezar
+ *        en él.
+ *
+ * Con `out->physical == 0` el bloque no está asignado y `out->len` cuenta
+ * los bloques hasta el siguiente extent (#BWFS_EXT_LEN_MASK si no hay
+ * ninguno).
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_extent_lookup(const bwfs_inode_t *inode, const char *fs_dir,
+                       uint32_t lblk, bwfs_extent_t *out);
+
+/**
+ * \brief Primer bloque lógico desde `lblk` con datos (`data`) o dentro de
+ *        un hueco (`!data`), para SEEK_DATA / SEEK_HOLE.
+ *
+ * Los extents «sin escribir» cuentan como hueco.  Recorre el mapa una vez:
+ * coste proporcional al número de extents.  Sin datos desde `lblk`,
+ * `*out` vale UINT32_MAX; siempre hay un hueco (como tarde, tras el
+ * último extent).
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_extent_seek(const bwfs_inode_t *inode, const char *fs_dir,
+                     uint32_t lblk, bool data, uint32_t *out);
+
+/**
+ * \brief Libera todos los bloques del archivo (datos, hojas e índice).
+ *        No modifica el inodo ni persiste el bitmap.
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_extent_release(bwfs_bitmap_t *bm, const bwfs_inode_t *inode,
+                        const char *fs_dir);
+
+#endif /* BWFS_EXTENT_H */
@@ -0,0 +1,90 @@
+#ifndef BWFS_FRAG_H
+#define BWFS_FRAG_H
+/**
+ * \file frag.h
+ * \brief Bloques de fragmentos: colas de archivos empaquetadas.
+ *
+ * Un archivo pequeño, o el último bloque parcial de uno grande, no necesita
+ * un bloque de datos propio: su cola se guarda como un tramo de unidades de
+ * #BWFS_FRAG_UNIT bytes en un bloque compartido (\ref bwfs_frag_block_t).
+ *
+ * En RAM solo se guarda la lista de bloques de fragmentos y las unidades
+ * ocupadas de cada uno; la tabla de dueños se lee del disco al asignar.
+ * Liberar deja huecos, que \ref bwfs_frag_compact recupera poco a poco
+ * vaciando los bloques casi vacíos.
+ */
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+
+/** Fragmentos movidos como mucho por cada llamada de compactación. */
+#define BWFS_FRAG_COMPACT_BUDGET    16U
+
+/**
+ * \brief Carga la lista de bloques de fragmentos (solo sus cabeceras).
+ *
+ * El superbloque debe seguir vivo mientras el módulo esté abierto: al
+ * cambiar el primer bloque de la lista se actualiza `frag_head` y se
+ * reescribe.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO (lista dañada)
+ */
+int bwfs_frag_open(bwfs_superblock_t *sb, const char *fs_dir);
+
+/** \brief Libera el estado cargado por \ref bwfs_frag_open. */
+void bwfs_frag_close(void);
+
+/** \brief true si \ref bwfs_frag_open se ha llamado con éxito. */
+bool bwfs_frag_ready(void);
+
+/**
+ * \brief Reserva unidades para `len` bytes (≤ #BWFS_FRAG_MAX) a nombre de
+ *        `ino`.
+ *
+ * Prueba el último bloque usado y unos pocos más con hueco suficiente; si
+ * ninguno tiene un tramo contiguo libre, añade un bloque nuevo a la lista
+ * (y persiste bitmap y superbloque).
+ *
+ * @param blk   Salida: bloque de fragmentos.
+ * @param unit  Salida: primera unidad del tramo.
+ * @return BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_frag_alloc(bwfs_bitmap_t *bm, uint32_t ino, uint32_t len,
+                    const char *fs_dir, uint32_t *blk, uint32_t *unit);
+
+/**
+ * \brief Libera el tramo de `ino` que empieza en `unit` del bloque `blk`.
+ *
+ * Un bloque que queda vacío sale de la lista y vuelve al bitmap, salvo el
+ * que se está llenando.
+ *
+ * @return BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_frag_free(bwfs_bitmap_t *bm, uint32_t ino, uint32_t blk,
+                   uint32_t unit, const char *fs_dir);
+
+/**
+ * \brief Un paso de compactación: mueve hasta `budget` fragmentos del
+ *        bloque menos ocupado (si lo está menos de un cuarto) a otros
+ *        bloques con hueco, y actualiza sus inodos.
+ *
+ * No añade bloques nuevos para ello.  Pensado para llamarse tras liberar,
+ * fuera del camino de las escrituras.
+ *
+ * @return Fragmentos movidos (≥ 0) o código BWFS_ERR_*
+ */
+int bwfs_frag_compact(bwfs_bitmap_t *bm, const char *fs_dir, uint32_t budget);
+
+/** \brief Desplazamiento en bytes de la unidad `unit` dentro de su bloque. */
+static inline size_t bwfs_frag_offset(uint32_t unit)
+{
+    return (size_t)unit * BWFS_FRAG_UNIT;
+}
+
+/** \brief Unidades que ocupan `len` bytes. */
+static inline uint32_t bwfs_frag_units(uint32_t len)
+{
+    return (len + BWFS_FRAG_UNIT - 1U) / BWFS_FRAG_UNIT;
+}
+
+#endif /* BWFS_FRAG_H */
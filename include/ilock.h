@@ -0,0 +1,38 @@
+#ifndef BWFS_ILOCK_H
+#define BWFS_ILOCK_H
+/**
+ * \file ilock.h
+ * \brief Cerrojos de lectura/escritura por inodo.
+ *
+ * Una operación toma con \ref bwfs_ilock los inodos que recorre y toca, y
+ * los suelta todos juntos con \ref bwfs_ilock_release después de cerrar
+ * su transacción (\ref txn.h): nadie ve a medias lo que todavía no se
+ * escribió.  Las lecturas de archivos distintos no comparten ningún
+ * cerrojo de escritura y van en paralelo.
+ *
+ * Orden, para no interbloquearse:
+ *   - de la raíz hacia abajo: cada directorio antes que lo que contiene
+ *     (resolver una ruta ya los toma así, de lectura);
+ *   - entre hermanos, por número de inodo creciente;
+ *   - nunca se pide un cerrojo de escritura sobre uno que el hilo ya tiene
+ *     de lectura: quien va a escribir un directorio lo pide así desde el
+ *     principio.
+ *
+ * Los cerrojos viven en una tabla hash y solo existen mientras alguien los
+ * tiene o los espera.
+ */
+
+#include "bwfs_common.h"
+
+/**
+ * \brief Toma el cerrojo de `ino` (de escritura si `write`) hasta
+ *        \ref bwfs_ilock_release.  Si el hilo ya lo tiene, no hace nada,
+ *        salvo que lo tenga de lectura y pida escritura: eso es un error.
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_LOCK (se tenía de lectura)
+ */
+int bwfs_ilock(uint32_t ino, bool write);
+
+/** \brief Suelta todos los cerrojos de inodo del hilo. */
+void bwfs_ilock_release(void);
+
+#endif /* BWFS_ILOCK_H */
@@ -13,20 +13,138 @@
 /* API pública                                                               */
 /* ------------------------------------------------------------------------- */
 
+/**
+ * \brief Inicializa el bitmap de inodos de un disco recién formateado.
+ *
+ * Solo marca como ocupado el inodo 0 (reservado, nunca se asigna).
+ *
+ * @param sb      Superbloque con la geometría de la tabla.
+ * @param fs_dir  Directorio del FS.
+ * @return        BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_itable_format(const bwfs_superblock_t *sb, const char *fs_dir);
+
+/**
+ * \brief Carga el bitmap de inodos en RAM; necesario antes de cualquier
+ *        otra función de este módulo.
+ *
+ * @param sb      Superbloque ya validado.
+ * @param fs_dir  Directorio del FS.
+ * @return        BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_itable_open(const bwfs_superblock_t *sb, const char *fs_dir);
+
+/** \brief Libera el estado cargado por \ref bwfs_itable_open. */
+void bwfs_itable_close(void);
+
+/** \brief Número de inodos libres en la tabla abierta. */
+uint32_t bwfs_itable_free_count(void);
+
+/** \brief true si `ino` es válido y está marcado en el bitmap de inodos. */
+bool bwfs_inode_in_use(uint32_t ino);
+
+/**
+ * \brief Marca o desmarca `ino` en el bitmap de inodos (y lo persiste).
+ *
+ * Pensado para fsck; el resto del código usa create/delete.
+ *
+ * @return BWFS_OK o BWFS_ERR_IO (también si `ino` está fuera de rango)
+ */
+int bwfs_inode_set_used(uint32_t ino, bool used, const char *fs_dir);
+
 /**
  * \brief Crea un nuevo inodo (archivo o directorio).
  *
- * Asigna un bloque para el propio inodo y lo inicializa en disco.
+ * Toma una ranura libre de la tabla, a ser posible en el mismo bloque que
+ * el directorio padre, y la inicializa en disco con las tres marcas de
+ * tiempo a la hora actual y `generation = 1`.  Los archivos nacen en
+ * línea (#BWFS_INODE_INLINE): no consumen bloques de datos hasta superar
+ * #BWFS_INLINE_MAX bytes.
+ *
+ * @param is_dir      true → directorio, false → archivo.
+ * @param parent_ino  Directorio que contendrá la entrada (0 si no hay).
+ * @param fs_dir      Directorio del FS.
+ * @return            Número de inodo o UINT32_MAX si la tabla está llena
+ *                    o falla la E/S.
+ */
+uint32_t bwfs_create_inode(bool is_dir, uint32_t parent_ino, const char *fs_dir);
+
+/**
+ * \brief Libera un inodo y todos sus bloques de datos.
+ *
+ * Los directorios multibloque deben vaciarse antes con
+ * \ref bwfs_dir_release: aquí solo se liberan sus `blocks[]` directos.
+ * La cola empaquetada, si la hay, se devuelve a su bloque de fragmentos.
  *
- * @param bm      Bitmap cargado en RAM (será actualizado).
- * @param is_dir  true → directorio, false → archivo.
- * @return        Número de inodo o UINT32_MAX en error.
+ * @param bm      Bitmap (actualizado y persistido).
+ * @param inode   Inodo a borrar (queda a cero salvo `ino`).
+ * @param fs_dir  Directorio del FS.
+ * @return        BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_delete_inode(bwfs_bitmap_t *bm, bwfs_inode_t *inode, const char *fs_dir);
+
+/**
+ * \brief Área de datos en línea de un inodo #BWFS_INODE_INLINE
+ *        (#BWFS_INLINE_MAX bytes).
+ */
+static inline uint8_t *bwfs_inode_inline_data(bwfs_inode_t *inode)
+{
+    return (uint8_t *)inode + BWFS_INLINE_OFF;
+}
+
+/** \brief Tamaño en bytes (64 bits: `size_hi:size`). */
+static inline uint64_t bwfs_inode_size(const bwfs_inode_t *inode)
+{
+    return ((uint64_t)inode->size_hi << 32) | inode->size;
+}
+
+static inline void bwfs_inode_set_size(bwfs_inode_t *inode, uint64_t size)
+{
+    inode->size    = (uint32_t)size;
+    inode->size_hi = (uint32_t)(size >> 32);
+}
+
+/** Marcas de tiempo que actualiza \ref bwfs_inode_touch. */
+enum {
+    BWFS_TOUCH_ATIME = 0x1,     /**< Acceso                                */
+    BWFS_TOUCH_MTIME = 0x2,     /**< Contenido (sube también `generation`) */
+    BWFS_TOUCH_CTIME = 0x4,     /**< Metadatos                             */
+};
+
+/** Antigüedad máxima de `atime` antes de actualizarlo en una lectura. */
+#define BWFS_ATIME_MAX_AGE_NS   (24ULL * 3600U * 1000000000ULL)
+
+/** \brief Hora actual (CLOCK_REALTIME) en nanosegundos desde la época. */
+uint64_t bwfs_now_ns(void);
+
+/**
+ * \brief Pone a la hora actual las marcas `what` (BWFS_TOUCH_*) del inodo
+ *        en memoria; con #BWFS_TOUCH_MTIME incrementa `generation`.
+ */
+void bwfs_inode_touch(bwfs_inode_t *inode, unsigned what);
+
+/**
+ * \brief Política «relatime»: ¿debe una lectura actualizar `atime`?
+ *
+ * Solo si es anterior a la última modificación o tiene más de
+ * #BWFS_ATIME_MAX_AGE_NS, así que las lecturas repetidas no escriben el
+ * inodo.
  */
-uint32_t bwfs_create_inode(bwfs_bitmap_t *bm, bool is_dir, const char *fs_dir);
+static inline bool bwfs_inode_atime_due(const bwfs_inode_t *inode, uint64_t now)
+{
+    return inode->atime_ns <= inode->mtime_ns ||
+           inode->atime_ns <= inode->ctime_ns ||
+           now - inode->atime_ns >= BWFS_ATIME_MAX_AGE_NS;
+}
 
 /**
  * \brief Persiste un inodo ya inicializado.
  *
+ * El enlace `parent`/`name_hash` se conserva del disco (lo gestiona dir.c).
+ * Si cambian el tipo, el tamaño, los bloques o las marcas de tiempo, se
+ * actualiza también la copia de esos atributos en la entrada del
+ * directorio padre.
+ *
  * @param inode   Puntero a la copia in-memory.
  * @param fs_dir  Directorio del FS.
  * @retval BWFS_OK      OK
@@ -34,6 +152,15 @@ uint32_t bwfs_create_inode(bwfs_bitmap_t *bm, bool is_dir, const char *fs_dir);
  */
 int bwfs_write_inode(const bwfs_inode_t *inode, const char *fs_dir);
 
+/**
+ * \brief Fija el enlace de `ino` con su entrada de directorio: el
+ *        directorio `parent` y el hash del nombre (solo esos 8 bytes).
+ *
+ * @return BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_inode_set_link(uint32_t ino, uint32_t parent, uint32_t name_hash,
+                        const char *fs_dir);
+
 /**
  * \brief Carga un inodo desde disco.
  *
@@ -45,9 +172,19 @@ int bwfs_write_inode(const bwfs_inode_t *inode, const char *fs_dir);
 int bwfs_read_inode(uint32_t ino, bwfs_inode_t *inode, const char *fs_dir);
 
 /**
- * \brief Ajusta el tamaño de un archivo, asignando o liberando bloques.
+ * \brief Ajusta el tamaño de un archivo.
+ *
+ * Crecer no asigna bloques: lo añadido es un hueco que se lee como ceros
+ * (\ref extent.h) hasta que se escribe en él (\ref bwfs_inode_fill_holes).
+ * Encoger libera todo bloque posterior al nuevo tamaño, preasignados
+ * incluidos, y pone a cero el resto del último bloque.  Un archivo antiguo
+ * de bloques directos se convierte a extents.
  *
- * Solo usa bloques directos.  Para valores grandes devolverá BWFS_ERR_FULL.
+ * Un archivo en línea que supera #BWFS_INLINE_MAX se migra a un bloque de
+ * datos (ninguno si estaba vacío); uno que queda sin bloques y cabe en
+ * #BWFS_INLINE_MAX vuelve a quedar en línea.  Una cola
+ * empaquetada (#BWFS_INODE_FRAG) se recorta en su sitio, se descarta si el
+ * corte cae antes de ella o vuelve a un bloque si el archivo crece.
  *
  * @param bm        Bitmap (actualizado).
  * @param inode     Inodo (actualizado y re-escrito).
@@ -57,7 +194,169 @@ int bwfs_read_inode(uint32_t ino, bwfs_inode_t *inode, const char *fs_dir);
  */
 int bwfs_inode_resize(bwfs_bitmap_t *bm,
                       bwfs_inode_t   *inode,
-                      uint32_t        new_size,
+                      uint64_t        new_size,
                       const char     *fs_dir);
 
+/**
+ * \brief Preasigna bloques para `[offset, offset+len)` (semántica fallocate).
+ *
+ * Operación de solo metadatos: los bloques nuevos se reservan, a ser posible
+ * contiguos, y se marcan «sin escribir» (se leen como ceros hasta su primera
+ * escritura).  Solo se reservan los huecos del rango: los bloques ya
+ * asignados no se tocan y lo que haya antes de `offset` sigue siendo hueco.
+ *
+ * @param bm         Bitmap (actualizado).
+ * @param inode      Inodo (actualizado y re-escrito).
+ * @param offset     Inicio del rango en bytes.
+ * @param len        Longitud del rango en bytes.
+ * @param keep_size  true → no modificar `size` (FALLOC_FL_KEEP_SIZE).
+ * @param fs_dir     Directorio del FS.
+ * @return           BWFS_OK, BWFS_ERR_FULL o BWFS_ERR_IO
+ */
+int bwfs_inode_fallocate(bwfs_bitmap_t *bm,
+                         bwfs_inode_t   *inode,
+                         uint64_t        offset,
+                         uint64_t        len,
+                         bool            keep_size,
+                         const char     *fs_dir);
+
+/**
+ * \brief Asigna bloques a los huecos de los bloques lógicos
+ *        `[first, first+count)`, antes de escribir en ellos.
+ *
+ * Lo ya asignado no se toca.  Si había huecos persiste el bitmap (y las
+ * hojas de extents), pero no el inodo: quien llama lo escribe una sola vez
+ * al terminar, normalmente con \ref bwfs_inode_mark_written tras escribir
+ * los datos.  Hasta entonces un corte solo deja bloques perdidos que fsck
+ * detecta, nunca datos viejos visibles.
+ *
+ * @param unwritten  true → los bloques nuevos se leen como ceros hasta que
+ *                   se marquen escritos (\ref bwfs_inode_mark_written).
+ * @return BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_inode_fill_holes(bwfs_bitmap_t *bm,
+                          bwfs_inode_t   *inode,
+                          uint32_t        first,
+                          uint32_t        count,
+                          bool            unwritten,
+                          const char     *fs_dir);
+
+/**
+ * \brief Marca como escritos los bloques lógicos `[first, first+count)`
+ *        tras escribir sobre bloques preasignados, y re-escribe el inodo.
+ *
+ * @return BWFS_OK o código BWFS_ERR_*
+ */
+int bwfs_inode_mark_written(bwfs_bitmap_t *bm,
+                            bwfs_inode_t   *inode,
+                            uint32_t        first,
+                            uint32_t        count,
+                            const char     *fs_dir);
+
+/**
+ * \brief Libera los bloques del mapa desde el lógico `keep` sin tocar el
+ *        tamaño.  Persiste bitmap e inodo.
+ *
+ * Sirve para vaciar por tramos un inodo que se va a borrar
+ * (\ref orphan.h); los archivos en línea o de bloques directos no cambian.
+ * Una cola empaquetada se libera también: lo que queda tras `keep` se lee
+ * como un hueco.
+ *
+ * @return BWFS_OK o código BWFS_ERR_*
+ */
+int bwfs_inode_trim(bwfs_bitmap_t *bm,
+                    bwfs_inode_t   *inode,
+                    uint32_t        keep,
+                    const char     *fs_dir);
+
+/**
+ * \brief Traslada los bloques lógicos `[first, first+count)` a los físicos
+ *        `[physical, physical+count)`, ya reservados y con los datos
+ *        escritos, y libera los antiguos.  Persiste bitmap e inodo.
+ *
+ * Es la base de las escrituras fuera de sitio del modo log y del
+ * limpiador de segmentos (\ref segment.h).
+ *
+ * @param unwritten  true → los bloques nuevos se leen como ceros.
+ * @return BWFS_OK o código BWFS_ERR_*
+ */
+int bwfs_inode_remap(bwfs_bitmap_t *bm,
+                     bwfs_inode_t   *inode,
+                     uint32_t        first,
+                     uint32_t        count,
+                     uint32_t        physical,
+                     bool            unwritten,
+                     const char     *fs_dir);
+
+/**
+ * \brief Siguiente posición desde `off` (< tamaño) con datos (`data`) o en
+ *        un hueco, según SEEK_DATA / SEEK_HOLE de `lseek(2)`.
+ *
+ * Los huecos y los bloques «sin escribir» son huecos; EOF cuenta como
+ * hueco.  Coste proporcional al número de extents (\ref bwfs_extent_seek).
+ *
+ * @param[out] out  Posición en bytes; UINT64_MAX si no hay datos desde `off`.
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_inode_seek(const bwfs_inode_t *inode,
+                    uint64_t            off,
+                    bool                data,
+                    const char         *fs_dir,
+                    uint64_t           *out);
+
+/**
+ * \brief Empaqueta la cola de un archivo en un bloque de fragmentos
+ *        (\ref frag.h) y libera su último bloque de datos.
+ *
+ * Solo actúa si el último bloque está a medias, la cola no supera
+ * #BWFS_FRAG_MAX y no hay bloques preasignados tras EOF ni un hueco justo
+ * antes de la cola; una cola de un archivo sin más bloques que quepa en
+ * #BWFS_INLINE_MAX pasa al inodo.  En cualquier otro caso no hace nada y
+ * devuelve BWFS_OK.  Se llama al cerrar
+ * el archivo: mientras está abierto la cola vive en un bloque normal.
+ *
+ * @return BWFS_OK o código BWFS_ERR_*
+ */
+int bwfs_inode_pack_tail(bwfs_bitmap_t *bm,
+                         bwfs_inode_t   *inode,
+                         const char     *fs_dir);
+
+/**
+ * \brief Devuelve una cola empaquetada (#BWFS_INODE_FRAG) a un bloque de
+ *        datos propio antes de escribir en ella; persiste bitmap e inodo.
+ *        Sin cola empaquetada no hace nada.
+ *
+ * @return BWFS_OK o código BWFS_ERR_*
+ */
+int bwfs_inode_unpack_tail(bwfs_bitmap_t *bm,
+                           bwfs_inode_t   *inode,
+                           const char     *fs_dir);
+
+/* ------------------------------------------------------------------------- */
+/* Lectura por lotes                                                         */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * \brief Caché de un bloque de tabla para leer muchos inodos seguidos
+ *        (p.ej. los de un directorio) con una sola lectura de disco.
+ */
+typedef struct {
+    uint32_t  blk;   /**< Bloque de tabla en `buf` (UINT32_MAX = ninguno) */
+    uint8_t  *buf;   /**< BWFS_BLOCK_SIZE_BYTES o NULL                    */
+} bwfs_inode_batch_t;
+
+void bwfs_inode_batch_init(bwfs_inode_batch_t *batch);
+
+/**
+ * \brief Como \ref bwfs_read_inode, pero reutiliza el bloque de tabla
+ *        cargado si `ino` cae en él.
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_inode_batch_read(bwfs_inode_batch_t *batch,
+                          uint32_t            ino,
+                          bwfs_inode_t       *inode,
+                          const char         *fs_dir);
+
+void bwfs_inode_batch_release(bwfs_inode_batch_t *batch);
+
 #endif /* BWFS_INODE_H */
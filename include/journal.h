@@ -0,0 +1,132 @@
+#ifndef BWFS_JOURNAL_H
+#define BWFS_JOURNAL_H
+/**
+ * \file journal.h
+ * \brief Diario de metadatos con confirmación en grupo.
+ *
+ * Mientras el disco está montado, las escrituras de metadatos no van a su
+ * bloque: se quedan en memoria (ganchos de util.h) y forman parte de la
+ * transacción en curso.  Cada operación FUSE es un manejador
+ * (\ref bwfs_journal_begin / \ref bwfs_journal_end): una transacción solo
+ * se confirma cuando no queda ninguno abierto, así que tras un corte una
+ * operación está entera o no está.  Eso es todo lo que da: no se puede
+ * deshacer un manejador, y una operación que devuelve error a medias
+ * confirma lo que ya escribió.
+ *
+ * Confirmar escribe de una vez los rangos cambiados de todas las
+ * operaciones acumuladas en el registro circular del diario
+ * (\ref bwfs_journal_hdr_t) y sincroniza solo esos bloques.  Llevar los
+ * metadatos a su sitio (checkpoint) lo hace después un hilo propio, con un
+ * único syncfs por tanda; un bloque escrito por muchas operaciones se
+ * escribe ahí una sola vez.  Al montar se reproducen las transacciones
+ * completas que no llegaron a su sitio.
+ *
+ * Los datos de archivo no pasan por el diario: el hilo los marca con
+ * \ref bwfs_journal_bypass y van directos a su bloque, salvo que ese
+ * bloque aún tenga metadatos en el diario (se acaba de liberar), para no
+ * adelantar a su versión anterior al reproducir.  Por lo mismo, un bloque
+ * liberado no vuelve al asignador hasta que se confirma la transacción
+ * que lo libera (\ref bwfs_journal_free_tag): si otro archivo lo
+ * reutilizara antes, tras un corte el anterior leería sus datos.
+ *
+ * Al abrir, el superbloque se persiste con #BWFS_FEAT_INCOMPAT_RECOVER
+ * antes de registrar nada; tras un corte, \ref bwfs_journal_replay (montaje,
+ * fsck, migrate) aplica lo confirmado.
+ */
+
+#include "bwfs_common.h"
+
+/** Espacio de registro que reserva mkfs por defecto. */
+#define BWFS_JOURNAL_DEFAULT_BYTES  (4U * 1024U * 1024U)
+
+/** Intervalo entre confirmaciones (y checkpoints) sin que nadie las pida. */
+#define BWFS_JOURNAL_COMMIT_MS      5000U
+
+/**
+ * \brief Deja vacío el diario de `sb` (mkfs): cabecera con la cola en 0 y
+ *        secuencia 1.  Los bloques del registro deben estar a cero.
+ * @return BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_journal_format(const bwfs_superblock_t *sb, const char *fs_dir);
+
+/**
+ * \brief Aplica las transacciones completas que quedaron en el diario tras
+ *        un corte y lo deja vacío.
+ *
+ * No hace nada si `sb` no tiene diario o no está marcado
+ * #BWFS_FEAT_INCOMPAT_RECOVER.  Si no, vuelve a leer `sb` (la
+ * reproducción puede haberlo cambiado), le quita la marca y lo persiste.
+ * Debe ir antes de leer cualquier otro metadato.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_journal_replay(bwfs_superblock_t *sb, const char *fs_dir);
+
+/**
+ * \brief Empieza a registrar: arranca el hilo de confirmación e instala
+ *        los ganchos.  Sin diario en `sb` no hace nada.
+ *
+ * El diario debe estar vacío (\ref bwfs_journal_replay).  Antes de
+ * instalar los ganchos marca `sb` con #BWFS_FEAT_INCOMPAT_RECOVER y lo
+ * persiste.  `sb` debe seguir vivo hasta \ref bwfs_journal_close.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_journal_open(bwfs_superblock_t *sb, const char *fs_dir);
+
+/**
+ * \brief Confirma lo pendiente, lo lleva a su sitio, para el hilo y retira
+ *        los ganchos.  Quita la marca de recuperación de `sb` (el llamador
+ *        lo persiste después).
+ */
+void bwfs_journal_close(void);
+
+/** \brief ¿Está registrando (entre \ref bwfs_journal_open y close)? */
+bool bwfs_journal_ready(void);
+
+/** \brief Abre un manejador en el hilo actual (admite anidarse). */
+void bwfs_journal_begin(void);
+
+/** \brief Cierra el manejador de \ref bwfs_journal_begin. */
+void bwfs_journal_end(void);
+
+/**
+ * \brief Con `on`, las escrituras del hilo actual son datos de archivo y
+ *        van directas a su bloque.
+ * @return El valor anterior, para restaurarlo
+ */
+bool bwfs_journal_bypass(bool on);
+
+/** \brief ¿Escribe datos de archivo el hilo actual? */
+bool bwfs_journal_bypassing(void);
+
+/**
+ * \brief La próxima escritura de `blk` desde este hilo va al diario aunque
+ *        sea de datos.  La usan las instantáneas tras copiar un bloque
+ *        compartido: hasta que se confirme su mapa, la versión antigua
+ *        solo está en el propio bloque.
+ */
+void bwfs_journal_keep(uint32_t blk);
+
+/**
+ * \brief Marca para los `blocks` bloques que el hilo actual libera ahora:
+ *        la confirmación con la que entran en disco
+ *        (\ref bwfs_bitmap_t::free_tag).  Muchos piden confirmar antes.
+ * @return La marca, o 0 sin diario (se pueden reutilizar ya)
+ */
+uint64_t bwfs_journal_free_tag(uint32_t blocks);
+
+/** \brief ¿Se confirmó ya lo liberado con la marca `tag`? */
+bool bwfs_journal_settled(uint64_t tag);
+
+/**
+ * \brief Confirma las operaciones ya terminadas y espera a que estén en
+ *        disco.  Las llamadas simultáneas comparten la misma confirmación.
+ *
+ * No debe llamarse con un manejador abierto.  Sin diario devuelve BWFS_OK.
+ *
+ * @return BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_journal_commit(void);
+
+#endif /* BWFS_JOURNAL_H */
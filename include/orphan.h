@@ -0,0 +1,51 @@
+#ifndef BWFS_ORPHAN_H
+#define BWFS_ORPHAN_H
+/**
+ * \file orphan.h
+ * \brief Borrado diferido: lista persistente de inodos por liberar.
+ *
+ * `unlink` y `rmdir` solo quitan la entrada y encadenan el inodo en la
+ * lista de huérfanos del superbloque (`orphan_head`, y cada inodo apunta al
+ * siguiente con `next_orphan`); liberar sus bloques, que en un archivo de
+ * muchos extents lleva tiempo, lo hace después un recolector por pasos de
+ * #BWFS_ORPHAN_REAP_BUDGET bloques.  Un archivo grande se recorta desde el
+ * final, un tramo por paso, antes de borrar el inodo.
+ *
+ * Mientras la lista no está vacía el disco lleva la característica
+ * ro_compat `ORPHAN`: un programa que no la conozca podría reutilizar esos
+ * inodos.  Al montar se terminan los que quedaron pendientes.
+ */
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+
+/** Bloques liberados como mucho por cada paso del recolector. */
+#define BWFS_ORPHAN_REAP_BUDGET  256U
+
+/**
+ * \brief Encadena `inode`, ya sin entrada en su directorio, al principio
+ *        de la lista.  Persiste inodo y superbloque.
+ * @return BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_orphan_add(bwfs_superblock_t *sb, bwfs_inode_t *inode,
+                    const char *fs_dir);
+
+/**
+ * \brief Un paso del recolector: libera bloques de los primeros huérfanos
+ *        hasta gastar `budget` (cada inodo cuenta uno) y saca de la lista
+ *        los que quedan vacíos.  Persiste bitmap, inodos y superbloque.
+ *
+ * Con `budget` = UINT32_MAX vacía la lista entera.
+ *
+ * @return Bloques liberados (0 si la lista estaba vacía) o BWFS_ERR_*
+ */
+int bwfs_orphan_reap(bwfs_bitmap_t *bm, bwfs_superblock_t *sb,
+                     const char *fs_dir, uint32_t budget);
+
+/** \brief ¿Quedan huérfanos por liberar? */
+static inline bool bwfs_orphan_pending(const bwfs_superblock_t *sb)
+{
+    return sb->orphan_head != 0;
+}
+
+#endif /* BWFS_ORPHAN_H */
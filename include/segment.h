@@ -0,0 +1,47 @@
+#ifndef BWFS_SEGMENT_H
+#define BWFS_SEGMENT_H
+/**
+ * \file segment.h
+ * \brief Limpiador de segmentos del modo log (#BWFS_ALLOC_LOG).
+ *
+ * Con la política log los bloques nuevos se añaden siempre en la cabeza
+ * del log y, al llenar un segmento de #BWFS_SEG_BLOCKS bloques, la cabeza
+ * salta al siguiente segmento limpio; las sobrescrituras tampoco se hacen
+ * en su sitio (\ref bwfs_inode_remap).  Lo que queda detrás son segmentos
+ * a medias: el limpiador elige el menos vivo, mueve sus bloques de datos a
+ * la cabeza y lo deja limpio para reutilizarlo.
+ *
+ * La ocupación de cada segmento sale del bitmap, así que no hay tabla de
+ * uso en disco.  Solo se mueven bloques de datos de archivos; los de
+ * metadatos (tabla de inodos, directorios, hojas de extents, fragmentos)
+ * se quedan donde están.
+ */
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+
+/** Bloques movidos como mucho por cada llamada al limpiador. */
+#define BWFS_SEG_CLEAN_BUDGET   32U
+
+/** \brief Segmentos limpios (todos sus bloques libres) del bitmap. */
+uint32_t bwfs_seg_clean_count(const bwfs_bitmap_t *bm);
+
+/**
+ * \brief Un paso de limpieza si quedan pocos segmentos limpios (menos de
+ *        uno de cada ocho, y al menos uno).
+ *
+ * Víctima: el segmento menos vivo, con como mucho tres cuartos de sus
+ * bloques en uso, que no sea el de la cabeza.  Sus bloques de datos
+ * (hasta `budget`) se copian a la cabeza y cada archivo se remapea.  Para
+ * encontrar sus dueños se recorre la tabla de inodos, por lo que solo se
+ * llama fuera del camino de las escrituras (en el hilo de
+ * mantenimiento, tras cerrar un archivo).
+ *
+ * Sin la política log no hace nada.
+ *
+ * @return Bloques movidos (≥ 0) o código BWFS_ERR_*
+ */
+int bwfs_seg_clean(bwfs_bitmap_t *bm, const bwfs_superblock_t *sb,
+                   const char *fs_dir, uint32_t budget);
+
+#endif /* BWFS_SEGMENT_H */
@@ -0,0 +1,102 @@
+#ifndef BWFS_SNAPSHOT_H
+#define BWFS_SNAPSHOT_H
+/**
+ * \file snapshot.h
+ * \brief Instantáneas de solo lectura del disco montado.
+ *
+ * Una instantánea comparte con el disco vivo todos los bloques que estaban
+ * en uso al crearla; crearla solo escribe su bitmap de bloques compartidos
+ * y su registro en la tabla (\ref bwfs_snap_rec_t), sin recorrer archivos
+ * ni directorios.
+ *
+ * El copiado se hace bloque a bloque, por debajo de inodos, extents y
+ * directorios (ganchos de util.h):
+ *  - antes de la primera escritura en un bloque compartido, su contenido
+ *    se copia a un bloque nuevo que pasa a ser de la instantánea;
+ *  - un bloque compartido que el disco vivo libera no vuelve al bitmap: se
+ *    queda tal cual como versión de la instantánea (bwfs_bitmap_t::retain).
+ * Cada versión sirve a todas las instantáneas que aún compartían ese
+ * bloque; se libera al borrar la última que la usa.
+ *
+ * Para leer una instantánea, el hilo activa su vista (\ref bwfs_snap_view)
+ * y usa las funciones de siempre: las lecturas de bloques que el disco
+ * vivo ya cambió se desvían a su versión guardada.  Con una vista activa
+ * no se debe escribir nada.
+ *
+ * El superbloque y los bitmaps de bloques e inodos no se comparten: la
+ * vista usa los del disco vivo.
+ *
+ * Crear y borrar no se solapan con nada: el conjunto de bloques
+ * compartidos debe ser el de un instante, así que bwfs.c las ejecuta con
+ * el cerrojo de mantenimiento en exclusiva.  Mientras tanto las escrituras
+ * esperan; la espera crece con el tamaño del disco (copiar y recorrer los
+ * bitmaps), no con el número de archivos.
+ */
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+
+/**
+ * \brief Carga las instantáneas del disco e instala los ganchos de E/S.
+ *
+ * `sb` y `bm` deben seguir vivos mientras el módulo esté abierto: crear o
+ * borrar instantáneas reserva y libera bloques en `bm` y actualiza
+ * `snap_table` y la característica #BWFS_FEAT_RO_COMPAT_SNAP de `sb`.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO (tabla dañada)
+ */
+int bwfs_snap_open(bwfs_superblock_t *sb, bwfs_bitmap_t *bm, const char *fs_dir);
+
+/** \brief Retira los ganchos y libera el estado de \ref bwfs_snap_open. */
+void bwfs_snap_close(void);
+
+/** \brief Instantáneas existentes. */
+uint32_t bwfs_snap_count(void);
+
+/** \brief Registro de la instantánea `idx` (< \ref bwfs_snap_count). */
+const bwfs_snap_rec_t *bwfs_snap_get(uint32_t idx);
+
+/** \brief Índice de la instantánea `name`, o -1 si no existe. */
+int bwfs_snap_find(const char *name);
+
+/**
+ * \brief Crea la instantánea `name` del estado actual del disco.
+ *
+ * El nombre debe ser nuevo y de 1 a #BWFS_SNAP_NAME_MAX bytes.
+ *
+ * @return BWFS_OK, BWFS_ERR_FULL (ya hay #BWFS_SNAP_MAX o no quedan
+ *         bloques), BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+int bwfs_snap_create(const char *name, const char *fs_dir);
+
+/**
+ * \brief Borra la instantánea `idx` y libera las versiones que solo ella
+ *        usaba.  La vista de los hilos que la estén leyendo deja de valer.
+ *
+ * @return BWFS_OK o BWFS_ERR_IO
+ */
+int bwfs_snap_delete(uint32_t idx, const char *fs_dir);
+
+/**
+ * \brief Vista de lectura del hilo actual: la instantánea `idx`, o el
+ *        disco vivo con -1.
+ */
+void bwfs_snap_view(int idx);
+
+/** \brief true si el hilo actual lee una instantánea. */
+bool bwfs_snap_viewing(void);
+
+/**
+ * \brief Llama a `fn` con cada bloque que pertenece a las instantáneas
+ *        (tabla, bitmaps compartidos, bloques de mapa y versiones); una
+ *        versión usada por varias se visita una vez por cada una.
+ *
+ * No necesita \ref bwfs_snap_open (lo usa fsck).  Un `fn` distinto de 0
+ * corta el recorrido y se devuelve.
+ *
+ * @return BWFS_OK, BWFS_ERR_NOMEM, BWFS_ERR_IO o lo que devuelva `fn`
+ */
+int bwfs_snap_walk(const bwfs_superblock_t *sb, const char *fs_dir,
+                   int (*fn)(uint32_t blk, void *arg), void *arg);
+
+#endif /* BWFS_SNAPSHOT_H */
@@ -0,0 +1,66 @@
+#ifndef BWFS_TXN_H
+#define BWFS_TXN_H
+/**
+ * \file txn.h
+ * \brief Transacción de metadatos por operación: cada bloque, una vez.
+ *
+ * Una operación FUSE escribe a menudo el mismo bloque varias veces (el
+ * bitmap por cada asignación, el inodo del padre antes y después de
+ * añadir la entrada...).  Con una transacción abierta en el hilo, esas
+ * escrituras se quedan en memoria (ganchos de util.h, antes que los de
+ * las instantáneas y el diario) y las lecturas del mismo hilo las ven;
+ * al cerrarla se escribe cada bloque distinto una sola vez, solo con los
+ * rangos tocados.
+ *
+ * El orden de escritura es seguro también sin diario: primero los bitmaps
+ * (un corte deja bloques perdidos, nunca asignados dos veces), luego el
+ * contenido (directorios, hojas de extents, fragmentos...), después la
+ * tabla de inodos que los apunta y por último el superbloque.
+ *
+ * La transacción es del hilo, como la vista de \ref bwfs_snap_view, así
+ * que no hay que pasarla por inode.c, dir.c ni allocation.c.  Los datos de
+ * archivo (\ref bwfs_journal_bypass) no se retienen.
+ *
+ * Orden de cerrojos de una operación: manejador del diario, cerrojos de
+ * inodo (\ref ilock.h) y, el último, el del asignador
+ * (\ref bwfs_txn_lock_alloc).
+ */
+
+#include "bwfs_common.h"
+
+/** Bloques retenidos como mucho; al pasar se escriben los que hay. */
+#define BWFS_TXN_MAX_BLOCKS  64U
+
+/**
+ * \brief Instala los ganchos; a partir de aquí \ref bwfs_txn_begin retiene.
+ *
+ * `sb` debe seguir vivo hasta \ref bwfs_txn_close (da el orden).
+ */
+void bwfs_txn_open(const bwfs_superblock_t *sb, const char *fs_dir);
+
+/** \brief Retira los ganchos. */
+void bwfs_txn_close(void);
+
+/** \brief Abre una transacción en el hilo actual (admite anidarse). */
+void bwfs_txn_begin(void);
+
+/**
+ * \brief Cierra la transacción de \ref bwfs_txn_begin; la más externa
+ *        escribe lo retenido.
+ * @return BWFS_OK o BWFS_ERR_IO (se deja de escribir en el primer fallo)
+ */
+int bwfs_txn_end(void);
+
+/**
+ * \brief Toma el cerrojo del asignador hasta el final de la transacción.
+ *
+ * Lo llaman las funciones que tocan estado común a todos los archivos:
+ * bitmap de bloques y de inodos, fragmentos, segmentos, instantáneas y
+ * superbloque.  Se suelta en \ref bwfs_txn_end después de escribir lo
+ * retenido, así que las imágenes de esos bloques llegan a disco en el
+ * mismo orden en que se cambiaron.  Sin transacción abierta no hace nada
+ * (mkfs, fsck y el arranque del montaje tienen un solo hilo).
+ */
+void bwfs_txn_lock_alloc(void);
+
+#endif /* BWFS_TXN_H */
@@ -3,6 +3,7 @@
 #define UTIL_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
@@ -50,4 +51,124 @@ int util_write_block(const char *fs_dir, uint32_t block_id, const uint8_t *data,
  */
 int util_read_block(const char *fs_dir, uint32_t block_id, uint8_t *out, size_t len);
 
+/**
+ * Read a byte range of a block file without touching the rest of it.
+ * @param fs_dir   Filesystem directory
+ * @param block_id Block index
+ * @param offset   Byte offset inside the block
+ * @param out      Buffer to receive data (must be at least len bytes)
+ * @param len      Length of data to read (offset + len <= BWFS_BLOCK_SIZE_BYTES)
+ * @return 0 on success, -1 on failure
+ */
+int util_read_block_range(const char *fs_dir, uint32_t block_id,
+                          size_t offset, uint8_t *out, size_t len);
+
+/**
+ * Overwrite a byte range of an existing block file in place.
+ * Unlike util_write_block() nothing outside [offset, offset+len) is
+ * rewritten and the file is never truncated.
+ * @param fs_dir   Filesystem directory
+ * @param block_id Block index
+ * @param offset   Byte offset inside the block
+ * @param data     Data to write
+ * @param len      Length of data (offset + len <= BWFS_BLOCK_SIZE_BYTES)
+ * @return 0 on success, -1 on failure
+ */
+int util_write_block_range(const char *fs_dir, uint32_t block_id,
+                           size_t offset, const uint8_t *data, size_t len);
+
+/*
+ * Block I/O hooks, installed by the snapshot layer (snapshot.h) while a
+ * disk is mounted; both are NULL otherwise.
+ *  - remap: block actually read when `block_id` is requested.
+ *  - before_write: runs before anything is written to `block_id`; a
+ *    non-zero return fails the write without touching the block.
+ */
+typedef uint32_t (*util_read_remap_fn)(uint32_t block_id);
+typedef int (*util_before_write_fn)(const char *fs_dir, uint32_t block_id);
+
+/** Install (or, with NULLs, remove) the block I/O hooks. */
+void util_set_block_hooks(util_read_remap_fn remap, util_before_write_fn hook);
+
+/*
+ * Block cache hooks, installed by the metadata journal (journal.h) while a
+ * disk is mounted; both are NULL otherwise.
+ *  - read: runs after the snapshot remap; returns 1 if it served the
+ *    read from memory, 0 to read the block file, -1 on error.
+ *  - write: runs after before_write; `whole` means util_write_block()
+ *    (the rest of the block becomes zeros).  Returns 1 if it kept the
+ *    write in memory, 0 to write the block file, -1 on error.
+ */
+typedef int (*util_read_hook_fn)(uint32_t block_id, size_t offset,
+                                 uint8_t *out, size_t len);
+typedef int (*util_write_hook_fn)(uint32_t block_id, size_t offset,
+                                  const uint8_t *data, size_t len, int whole);
+
+/** Install (or, with NULLs, remove) the block cache hooks. */
+void util_set_cache_hooks(util_read_hook_fn read, util_write_hook_fn write);
+
+/*
+ * Transaction hooks, installed by the per-operation metadata transaction
+ * (txn.h) while a disk is mounted; all are NULL otherwise.  Same
+ * signatures and return values as the cache hooks, but they run first:
+ * the write hook before before_write, the read hook only for blocks the
+ * snapshot remap leaves alone.
+ *  - held: true if the calling thread's transaction holds a write to
+ *    `block_id` that has not reached the layers below yet.
+ */
+typedef bool (*util_held_fn)(uint32_t block_id);
+
+/** Install (or, with NULLs, remove) the transaction hooks. */
+void util_set_txn_hooks(util_read_hook_fn read, util_write_hook_fn write,
+                        util_held_fn held);
+
+/**
+ * Whether a write to `block_id` is still held by the calling thread's
+ * transaction (so rewriting it costs nothing and is not yet visible on
+ * disk).  False when no transaction hooks are installed.
+ */
+bool util_block_held(uint32_t block_id);
+
+/**
+ * Read a byte range of the block file itself: no remap, no cache hook.
+ * Only for the journal (and whoever works below it).
+ * @return 0 on success, -1 on failure
+ */
+int util_read_block_direct(const char *fs_dir, uint32_t block_id,
+                           size_t offset, uint8_t *out, size_t len);
+
+/**
+ * Write a byte range of the block file itself, skipping every hook.
+ * Only for the journal (replay, checkpoint and its own blocks).
+ * @return 0 on success, -1 on failure
+ */
+int util_write_block_direct(const char *fs_dir, uint32_t block_id,
+                            size_t offset, const uint8_t *data, size_t len);
+
+/**
+ * Flush one block file to stable storage (fdatasync).
+ * @return 0 on success, -1 on failure
+ */
+int util_sync_block(const char *fs_dir, uint32_t block_id);
+
+/**
+ * Flush everything written so far to the host filesystem holding fs_dir
+ * (one syncfs() for any number of blocks).
+ * @return 0 on success, -1 on failure
+ */
+int util_sync_fs(const char *fs_dir);
+
+/*
+ * Whole-block helpers.  They work on bwfs_geom.bytes bytes; the common
+ * geometries (1000x1000, 512x512, 256x256, 256x128) get copies compiled
+ * with a constant length so the compiler can unroll/vectorise them, any
+ * other size uses the runtime length.  Buffers need not be aligned.
+ */
+
+/** Fill a block buffer with zeros. */
+void util_block_zero(void *blk);
+
+/** Copy one block buffer onto another (they must not overlap). */
+void util_block_copy(void *dst, const void *src);
+
 #endif // UTIL_H
\ No newline at end of file
@@ -0,0 +1,426 @@
+// -----------------------------------------------------------------------------
+// File: src/bench/alloc_bench.c
+// -----------------------------------------------------------------------------
+/**
+ * \file alloc_bench.c
+ * \brief Banco de pruebas comparativo de las políticas de asignación.
+ *
+ * Uso:
+ *     alloc_bench [-b bloques] [-n operaciones] [-s semilla] [-p política]
+ *                 [-t traza]
+ *
+ * Reproduce una traza de reservas/liberaciones contra un bitmap en RAM (no
+ * toca disco) con cada política y reporta:
+ *
+ *  - Latencia de `bwfs_alloc_blocks` (media, p99 y máxima).
+ *  - Peticiones fallidas (ENOSPC) y archivos incompletos.
+ *  - Fragmentación final del espacio libre: nº de regiones libres, la mayor
+ *    de ellas y `1 - mayor/libres`.
+ *  - Contigüidad de los archivos: extents medios por archivo y porcentaje de
+ *    archivos en una sola región.
+ *
+ * Formato de traza (`-t`), una operación por línea, `#` comenta:
+ *     a <id> <bloques>   crea el archivo <id> con <bloques> bloques
+ *     g <id> <bloques>   crece el archivo <id> (append) en <bloques>
+ *     f <id>             libera el archivo <id>
+ *
+ * Sin `-t` se genera una traza sintética reproducible (`-s`) que mezcla
+ * archivos pequeños, medianos y grandes, *appends* y borrados, manteniendo
+ * la ocupación entre ~60 % y ~85 %.
+ *
+ * La reserva de un archivo imita a un asignador de extents: primero pide la
+ * región completa y, si no existe, divide la petición a la mitad hasta que
+ * encaja.  Los crecimientos se fusionan con el último extent cuando la
+ * política devuelve el bloque inmediatamente siguiente.
+ */
+
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime, getopt */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+#include "allocation.h"
+
+#define DEFAULT_BLOCKS  65536U
+#define DEFAULT_OPS     20000U
+#define DEFAULT_SEED    42U
+
+/** Mayor id aceptado en una traza: la tabla de archivos se indexa por id. */
+#define TRACE_MAX_ID    (1U << 20)
+
+/* ------------------------------------------------------------------------- */
+/* Traza                                                                     */
+/* ------------------------------------------------------------------------- */
+
+typedef struct {
+    char     op;        /**< 'a', 'g' o 'f'                              */
+    uint32_t id;        /**< Identificador de archivo                    */
+    uint32_t count;     /**< Bloques (ignorado en 'f')                   */
+} trace_op_t;
+
+typedef struct {
+    trace_op_t *ops;
+    size_t      len, cap;
+    uint32_t    max_id;
+} trace_t;
+
+static int trace_push(trace_t *t, char op, uint32_t id, uint32_t count)
+{
+    if (t->len == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 1024;
+        trace_op_t *n = realloc(t->ops, cap * sizeof *n);
+        if (!n) return -1;
+        t->ops = n;
+        t->cap = cap;
+    }
+    t->ops[t->len++] = (trace_op_t){ op, id, count };
+    if (id > t->max_id) t->max_id = id;
+    return 0;
+}
+
+static int trace_load(trace_t *t, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+
+    char line[256];
+    unsigned long lineno = 0;
+    while (fgets(line, sizeof line, f)) {
+        ++lineno;
+        char op;
+        unsigned id, count = 0;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        int n = sscanf(line, " %c %u %u", &op, &id, &count);
+        if (n < 2 || (op != 'f' && (n < 3 || count == 0)) ||
+            (op != 'a' && op != 'g' && op != 'f')) {
+            fprintf(stderr, "%s:%lu: línea inválida\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        if (id > TRACE_MAX_ID) {
+            fprintf(stderr, "%s:%lu: id %u mayor que %u\n",
+                    path, lineno, id, TRACE_MAX_ID);
+            fclose(f);
+            return -1;
+        }
+        if (trace_push(t, op, id, count) != 0) { fclose(f); return -1; }
+    }
+    fclose(f);
+    return 0;
+}
+
+/** PRNG xorshift32: reproducible e independiente de la libc. */
+static uint32_t rng_next(uint32_t *s)
+{
+    uint32_t x = *s;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return *s = x;
+}
+
+/**
+ * \brief Genera una traza sintética de `nops` operaciones.
+ *
+ * Tamaños: 70 % pequeños (1–4 bloques), 25 % medianos (8–64) y 5 % grandes
+ * (128 bloques a 1/64 del disco).  Se lleva la ocupación *estimada* para
+ * alternar entre fases de llenado y de borrado.
+ */
+static int trace_generate(trace_t *t, uint32_t total, uint32_t nops,
+                          uint32_t seed)
+{
+    uint32_t s = seed ? seed : 1;
+    uint32_t *live = malloc(nops * sizeof *live);
+    uint32_t *size = calloc(nops + 1, sizeof *size);
+    if (!live || !size) { free(live); free(size); return -1; }
+
+    uint32_t nlive = 0, next_id = 1;
+    uint64_t used = 0;
+    uint32_t big  = total / 64 > 128 ? total / 64 : 128;
+
+    for (uint32_t i = 0; i < nops; ++i) {
+        uint32_t r   = rng_next(&s) % 100;
+        double   occ = (double)used / total;
+
+        if (nlive > 0 && (occ > 0.85 || (occ > 0.60 && r < 45))) {
+            /* Borrar un archivo vivo al azar */
+            uint32_t k  = rng_next(&s) % nlive;
+            uint32_t id = live[k];
+            live[k] = live[--nlive];
+            used -= size[id];
+            trace_push(t, 'f', id, 0);
+        } else if (nlive > 0 && r < 60) {
+            /* Append a un archivo vivo */
+            uint32_t id = live[rng_next(&s) % nlive];
+            uint32_t c  = 1 + rng_next(&s) % 4;
+            size[id] += c;
+            used     += c;
+            trace_push(t, 'g', id, c);
+        } else {
+            uint32_t c, q = rng_next(&s) % 100;
+            if (q < 70)      c = 1 + rng_next(&s) % 4;
+            else if (q < 95) c = 8 + rng_next(&s) % 57;
+            else             c = 128 + rng_next(&s) % (big - 127);
+            uint32_t id = next_id++;
+            live[nlive++] = id;
+            size[id] = c;
+            used    += c;
+            trace_push(t, 'a', id, c);
+        }
+    }
+    free(live);
+    free(size);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Estado de la simulación                                                   */
+/* ------------------------------------------------------------------------- */
+
+typedef struct { uint32_t start, len; } extent_t;
+
+typedef struct {
+    extent_t *ext;
+    uint32_t  n, cap;
+    uint8_t   live;
+    uint8_t   incomplete;
+} file_t;
+
+typedef struct {
+    uint64_t *lat;          /**< Latencias (ns) de cada llamada          */
+    size_t    nlat, caplat;
+    uint32_t  failed;       /**< Llamadas que devolvieron UINT32_MAX     */
+    uint32_t  incomplete;   /**< Archivos que no obtuvieron todo         */
+} stats_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t timed_alloc(bwfs_bitmap_t *bm, uint32_t count, stats_t *st)
+{
+    uint64_t t0  = now_ns();
+    uint32_t blk = bwfs_alloc_blocks(bm, count);
+    uint64_t dt  = now_ns() - t0;
+
+    if (st->nlat == st->caplat) {
+        size_t cap = st->caplat ? st->caplat * 2 : 4096;
+        uint64_t *n = realloc(st->lat, cap * sizeof *n);
+        if (n) { st->lat = n; st->caplat = cap; }
+    }
+    if (st->nlat < st->caplat)
+        st->lat[st->nlat++] = dt;
+    if (blk == UINT32_MAX)
+        st->failed++;
+    return blk;
+}
+
+static int file_add_extent(file_t *f, uint32_t start, uint32_t len)
+{
+    if (f->n > 0 && f->ext[f->n - 1].start + f->ext[f->n - 1].len == start) {
+        f->ext[f->n - 1].len += len;       /* físicamente contiguo */
+        return 0;
+    }
+    if (f->n == f->cap) {
+        uint32_t cap = f->cap ? f->cap * 2 : 4;
+        extent_t *n = realloc(f->ext, cap * sizeof *n);
+        if (!n) return -1;
+        f->ext = n;
+        f->cap = cap;
+    }
+    f->ext[f->n++] = (extent_t){ start, len };
+    return 0;
+}
+
+/** Reserva `count` bloques para `f` partiendo la petición si es necesario. */
+static void file_alloc(bwfs_bitmap_t *bm, file_t *f, uint32_t count,
+                       stats_t *st)
+{
+    uint32_t want = count;
+    while (count > 0) {
+        uint32_t req = want < count ? want : count;
+        uint32_t blk = timed_alloc(bm, req, st);
+        if (blk == UINT32_MAX) {
+            if (req == 1) {                 /* disco lleno */
+                f->incomplete = 1;
+                return;
+            }
+            want = req / 2;
+            continue;
+        }
+        file_add_extent(f, blk, req);
+        count -= req;
+    }
+}
+
+static void file_free(bwfs_bitmap_t *bm, file_t *f)
+{
+    for (uint32_t i = 0; i < f->n; ++i)
+        bwfs_free_blocks(bm, f->ext[i].start, f->ext[i].len);
+    f->n    = 0;
+    f->live = 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Ejecución por política                                                    */
+/* ------------------------------------------------------------------------- */
+
+static int run_policy(uint32_t policy, const trace_t *t, uint32_t total)
+{
+    bwfs_bitmap_t bm = {
+        .bits_per_block = BWFS_BLOCK_SIZE_BITS,
+        .total_blocks   = total,
+        .policy         = policy,
+    };
+    bm.map = calloc(1, (total + 7) / 8);
+    file_t *files = calloc((size_t)t->max_id + 1, sizeof *files);
+    stats_t st = { 0 };
+    if (!bm.map || !files) { free(bm.map); free(files); return -1; }
+
+    /* Igual que mkfs: superbloque y bitmap reservados */
+    bwfs_bm_set(&bm, BWFS_SUPERBLOCK_BLK, 1);
+    bwfs_bm_set(&bm, BWFS_BITMAP_BLK,     1);
+
+    for (size_t i = 0; i < t->len; ++i) {
+        const trace_op_t *op = &t->ops[i];
+        file_t *f = &files[op->id];
+        switch (op->op) {
+            case 'a':
+                if (f->live) file_free(&bm, f);
+                f->live = 1;
+                f->incomplete = 0;
+                file_alloc(&bm, f, op->count, &st);
+                break;
+            case 'g':
+                if (f->live) file_alloc(&bm, f, op->count, &st);
+                break;
+            case 'f':
+                if (f->live) file_free(&bm, f);
+                break;
+        }
+    }
+
+    /* ---- Fragmentación del espacio libre ------------------------------ */
+    uint32_t free_blocks = 0, free_runs = 0, largest = 0, cur = 0;
+    for (uint32_t b = 0; b < total; ++b) {
+        if (!bwfs_bm_test(&bm, b)) {
+            ++free_blocks;
+            ++cur;
+        } else if (cur) {
+            ++free_runs;
+            if (cur > largest) largest = cur;
+            cur = 0;
+        }
+    }
+    if (cur) { ++free_runs; if (cur > largest) largest = cur; }
+    double frag = free_blocks ? 1.0 - (double)largest / free_blocks : 0.0;
+
+    /* ---- Contigüidad de los archivos vivos ---------------------------- */
+    uint64_t extents = 0;
+    uint32_t nfiles = 0, single = 0;
+    for (uint32_t id = 0; id <= t->max_id; ++id) {
+        if (files[id].live && files[id].n > 0) {
+            ++nfiles;
+            extents += files[id].n;
+            single  += files[id].n == 1;
+        }
+        st.incomplete += files[id].incomplete;
+    }
+
+    /* ---- Latencias ---------------------------------------------------- */
+    uint64_t sum = 0, p99 = 0, max = 0;
+    if (st.nlat) {
+        qsort(st.lat, st.nlat, sizeof *st.lat, cmp_u64);
+        for (size_t i = 0; i < st.nlat; ++i) sum += st.lat[i];
+        p99 = st.lat[(st.nlat * 99) / 100];
+        max = st.lat[st.nlat - 1];
+    }
+
+    printf("%-6s %9.0f %9llu %9llu %7u %6u | %7u %8u %6.3f | %7.2f %6.1f%%\n",
+           bwfs_alloc_policy_name(policy),
+           st.nlat ? (double)sum / st.nlat : 0.0,
+           (unsigned long long)p99, (unsigned long long)max,
+           st.failed, st.incomplete,
+           free_runs, largest, frag,
+           nfiles ? (double)extents / nfiles : 0.0,
+           nfiles ? 100.0 * single / nfiles : 0.0);
+
+    for (uint32_t id = 0; id <= t->max_id; ++id)
+        free(files[id].ext);
+    free(files);
+    free(st.lat);
+    free(bm.map);
+    return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* main                                                                      */
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+    uint32_t    total  = DEFAULT_BLOCKS;
+    uint32_t    nops   = DEFAULT_OPS;
+    uint32_t    seed   = DEFAULT_SEED;
+    int         only   = -1;
+    const char *tpath  = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:n:s:p:t:")) != -1) {
+        switch (opt) {
+            case 'b': total = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 'n': nops  = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 's': seed  = (uint32_t)strtoul(optarg, NULL, 10); break;
+            case 't': tpath = optarg; break;
+            case 'p':
+                only = bwfs_alloc_policy_from_name(optarg);
+                if (only < 0) {
+                    fprintf(stderr, "Política desconocida: %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, "Uso: %s [-b bloques] [-n ops] [-s semilla] "
+                        "[-p política] [-t traza]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (total < 256 || total > BWFS_BLOCK_SIZE_BITS) {
+        fprintf(stderr, "-b debe estar entre 256 y %u\n", BWFS_BLOCK_SIZE_BITS);
+        return EXIT_FAILURE;
+    }
+
+    trace_t t = { 0 };
+    int rc = tpath ? trace_load(&t, tpath) : trace_generate(&t, total, nops, seed);
+    if (rc != 0) {
+        free(t.ops);
+        return EXIT_FAILURE;
+    }
+
+    printf("Traza: %zu operaciones%s%s, %u bloques\n\n", t.len,
+           tpath ? " de " : " sintéticas", tpath ? tpath : "", total);
+    printf("%-6s %9s %9s %9s %7s %6s | %7s %8s %6s | %7s %7s\n",
+           "", "media ns", "p99 ns", "max ns", "fallos", "incomp",
+           "huecos", "mayor", "frag", "ext/arch", "contig");
+
+    for (uint32_t p = 0; p < BWFS_ALLOC_POLICY_COUNT; ++p)
+        if (only < 0 || (uint32_t)only == p)
+            run_policy(p, &t, total);
+
+    free(t.ops);
+    return EXIT_SUCCESS;
+}
@@ -9,7 +9,8 @@
  *     fsck_bwfs [-f] [-y] <directorio_FS>
  *
  * Opciones:
- *   -f  Force: verificar incluso si el FS parece limpio
+ *   -f  Force: verificar incluso si el FS parece limpio (desmontado
+ *       limpiamente, véase BWFS_STATE_CLEAN)
  *   -y  Yes: reparar automáticamente sin preguntar
  *
  * Códigos de salida:
@@ -32,7 +33,11 @@
 #include "bwfs_common.h"
 #include "bitmap.h"
 #include "inode.h"
+#include "extent.h"
+#include "frag.h"
 #include "dir.h"
+#include "journal.h"
+#include "snapshot.h"
 #include "util.h"
 
 /* ------------------------------------------------------------------------- */
@@ -55,6 +60,8 @@ typedef struct {
     bwfs_bitmap_t bitmap;
     uint8_t *inode_used;     /* Bitmap de inodos encontrados */
     uint8_t *block_used;     /* Bitmap de bloques realmente referenciados */
+    uint8_t *frag_blocks;    /* Bloques de la lista de fragmentos */
+    uint32_t bitmap_blk;     /* Bloque del bitmap de bloques */
 } fsck_context_t;
 
 #define FSCK_ERROR   0x01
@@ -117,6 +124,23 @@ static int check_superblock(fsck_context_t *ctx)
         return -1;
     }
     
+    /* Repararlo implica escribir: también las características ro_compat */
+    if (bwfs_features_check(&ctx->sb, true) != BWFS_OK) {
+        fsck_log(ctx, FSCK_ERROR, "Características no soportadas (ro_compat=0x%08x)",
+                 ctx->sb.feature_ro_compat);
+        return -1;
+    }
+
+    /* Lo confirmado en el diario va antes que cualquier otra lectura */
+    if (ctx->sb.feature_incompat & BWFS_FEAT_INCOMPAT_RECOVER) {
+        if (bwfs_journal_replay(&ctx->sb, ctx->fs_dir) != BWFS_OK) {
+            fsck_log(ctx, FSCK_ERROR, "No se pudo reproducir el diario");
+            return -1;
+        }
+        fsck_log(ctx, FSCK_INFO, "Diario reproducido");
+    }
+    ctx->bitmap_blk = bwfs_sb_bitmap_blk(&ctx->sb);
+    
     /* Verificar magic number */
     if (ctx->sb.magic != BWFS_MAGIC) {
         fsck_log(ctx, FSCK_ERROR, "Magic number inválido: 0x%08x (esperado 0x%08x)",
@@ -124,29 +148,37 @@ static int check_superblock(fsck_context_t *ctx)
         return -1;
     }
     
-    /* Verificar tamaño de bloque */
-    if (ctx->sb.block_size != BWFS_BLOCK_SIZE_BITS) {
-        fsck_log(ctx, FSCK_ERROR, "Tamaño de bloque inválido: %u (esperado %u)",
-                 ctx->sb.block_size, BWFS_BLOCK_SIZE_BITS);
+    /* La geometría ya se validó al leerlo; el bitmap ocupa un solo bloque */
+    if (ctx->sb.total_blocks > BWFS_BLOCK_SIZE_BITS) {
+        fsck_log(ctx, FSCK_ERROR, "Demasiados bloques: %u (el bitmap admite %u)",
+                 ctx->sb.total_blocks, BWFS_BLOCK_SIZE_BITS);
         return -1;
     }
     
     /* Verificar cantidad mínima de bloques */
-    if (ctx->sb.total_blocks < 3) {
-        fsck_log(ctx, FSCK_ERROR, "Muy pocos bloques: %u (mínimo 3)",
-                 ctx->sb.total_blocks);
+    if (ctx->sb.total_blocks < ctx->sb.inode_table_blk + ctx->sb.inode_table_blocks) {
+        fsck_log(ctx, FSCK_ERROR, "Muy pocos bloques: %u (la tabla de inodos acaba en %u)",
+                 ctx->sb.total_blocks,
+                 ctx->sb.inode_table_blk + ctx->sb.inode_table_blocks);
         return -1;
     }
     
     /* Verificar que root_inode esté en rango válido */
-    if (ctx->sb.root_inode >= ctx->sb.total_blocks) {
+    if (ctx->sb.root_inode == 0 || ctx->sb.root_inode >= ctx->sb.inode_count) {
         fsck_log(ctx, FSCK_ERROR, "Inodo raíz fuera de rango: %u >= %u",
-                 ctx->sb.root_inode, ctx->sb.total_blocks);
+                 ctx->sb.root_inode, ctx->sb.inode_count);
         return -1;
     }
     
-    fsck_log(ctx, FSCK_INFO, "Superbloque OK (%u bloques, raíz=%u)",
-             ctx->sb.total_blocks, ctx->sb.root_inode);
+    fsck_log(ctx, FSCK_INFO, "Superbloque OK (v%u, %u bloques de %ux%u px, %u inodos, raíz=%u)",
+             ctx->sb.version, ctx->sb.total_blocks, bwfs_geom.width, bwfs_geom.height,
+             ctx->sb.inode_count, ctx->sb.root_inode);
+    fsck_log(ctx, FSCK_INFO, "Características compat=0x%x incompat=0x%x ro_compat=0x%x, "
+             "%u montajes",
+             ctx->sb.feature_compat, ctx->sb.feature_incompat,
+             ctx->sb.feature_ro_compat, ctx->sb.mount_count);
+    if (!(ctx->sb.state & BWFS_STATE_CLEAN))
+        fsck_log(ctx, FSCK_WARNING, "El filesystem no se desmontó limpiamente");
     return 0;
 }
 
@@ -158,6 +190,8 @@ static int check_bitmap(fsck_context_t *ctx)
     printf("Verificando bitmap de bloques...\n");
     
     ctx->bitmap.total_blocks = ctx->sb.total_blocks;
+    ctx->bitmap.bitmap_blk   = ctx->bitmap_blk;
+    ctx->bitmap.alt_blk      = ctx->sb.bitmap_alt_blk;
     if (bwfs_read_bitmap(&ctx->bitmap, ctx->fs_dir) != BWFS_OK) {
         fsck_log(ctx, FSCK_ERROR, "No se pudo leer el bitmap");
         return -1;
@@ -172,19 +206,47 @@ static int check_bitmap(fsck_context_t *ctx)
         }
     }
     
-    if (!bwfs_bm_test(&ctx->bitmap, BWFS_BITMAP_BLK)) {
+    if (!bwfs_bm_test(&ctx->bitmap, ctx->bitmap_blk)) {
         fsck_log(ctx, FSCK_ERROR, "Bloque del bitmap marcado como libre");
         if (fsck_ask_repair(ctx, "Marcar bloque del bitmap como ocupado")) {
-            bwfs_bm_set(&ctx->bitmap, BWFS_BITMAP_BLK, 1);
+            bwfs_bm_set(&ctx->bitmap, ctx->bitmap_blk, 1);
             ctx->errors_fixed++;
         }
     }
     
-    if (!bwfs_bm_test(&ctx->bitmap, ctx->sb.root_inode)) {
-        fsck_log(ctx, FSCK_ERROR, "Inodo raíz marcado como libre");
-        if (fsck_ask_repair(ctx, "Marcar inodo raíz como ocupado")) {
-            bwfs_bm_set(&ctx->bitmap, ctx->sb.root_inode, 1);
-            ctx->errors_fixed++;
+    /* Copias B del superbloque y del bitmap */
+    uint32_t alt[2] = { BWFS_SUPERBLOCK_ALT_BLK, ctx->bitmap.alt_blk };
+    for (uint32_t i = 0; ctx->bitmap.alt_blk && i < 2; ++i) {
+        if (!bwfs_bm_test(&ctx->bitmap, alt[i])) {
+            fsck_log(ctx, FSCK_ERROR, "Copia B de metadatos %u marcada como libre", alt[i]);
+            if (fsck_ask_repair(ctx, "Marcar bloque como ocupado")) {
+                bwfs_bm_set(&ctx->bitmap, alt[i], 1);
+                ctx->errors_fixed++;
+            }
+        }
+    }
+
+    /* Bitmap de inodos y tabla: metadatos fijos, siempre ocupados */
+    uint32_t meta_end = ctx->sb.inode_table_blk + ctx->sb.inode_table_blocks;
+    for (uint32_t blk = ctx->sb.inode_bitmap_blk; blk < meta_end; ++blk) {
+        if (!bwfs_bm_test(&ctx->bitmap, blk)) {
+            fsck_log(ctx, FSCK_ERROR, "Bloque de metadatos de inodos %u marcado como libre", blk);
+            if (fsck_ask_repair(ctx, "Marcar bloque como ocupado")) {
+                bwfs_bm_set(&ctx->bitmap, blk, 1);
+                ctx->errors_fixed++;
+            }
+        }
+    }
+
+    /* Diario: tampoco se libera nunca */
+    uint32_t jnl_end = ctx->sb.journal_blk + ctx->sb.journal_blocks;
+    for (uint32_t blk = ctx->sb.journal_blk; blk < jnl_end; ++blk) {
+        if (!bwfs_bm_test(&ctx->bitmap, blk)) {
+            fsck_log(ctx, FSCK_ERROR, "Bloque del diario %u marcado como libre", blk);
+            if (fsck_ask_repair(ctx, "Marcar bloque como ocupado")) {
+                bwfs_bm_set(&ctx->bitmap, blk, 1);
+                ctx->errors_fixed++;
+            }
         }
     }
     
@@ -198,13 +260,235 @@ static int check_bitmap(fsck_context_t *ctx)
     
     /* Marcar bloques críticos como usados */
     ctx->block_used[BWFS_SUPERBLOCK_BLK / 8] |= (1 << (BWFS_SUPERBLOCK_BLK % 8));
-    ctx->block_used[BWFS_BITMAP_BLK / 8]     |= (1 << (BWFS_BITMAP_BLK % 8));
-    ctx->block_used[ctx->sb.root_inode / 8]  |= (1 << (ctx->sb.root_inode % 8));
+    ctx->block_used[ctx->bitmap_blk / 8]     |= (1 << (ctx->bitmap_blk % 8));
+    for (uint32_t i = 0; ctx->bitmap.alt_blk && i < 2; ++i)
+        ctx->block_used[alt[i] / 8] |= (1 << (alt[i] % 8));
+    for (uint32_t blk = ctx->sb.inode_bitmap_blk; blk < meta_end; ++blk)
+        ctx->block_used[blk / 8] |= (1 << (blk % 8));
+    for (uint32_t blk = ctx->sb.journal_blk; blk < jnl_end; ++blk)
+        ctx->block_used[blk / 8] |= (1 << (blk % 8));
+    
+    /* Bitmap de inodos en RAM (lo usan las verificaciones siguientes) */
+    if (bwfs_itable_open(&ctx->sb, ctx->fs_dir) != BWFS_OK) {
+        fsck_log(ctx, FSCK_ERROR, "No se pudo leer el bitmap de inodos");
+        return -1;
+    }
     
     fsck_log(ctx, FSCK_INFO, "Bitmap cargado correctamente");
     return 0;
 }
 
+/** Estado del recorrido de los bloques del árbol de un directorio. */
+typedef struct {
+    fsck_context_t *ctx;
+    uint32_t        ino;
+    uint32_t        count;
+} tree_walk_t;
+
+static int mark_tree_block(uint32_t blk, void *arg)
+{
+    tree_walk_t *tw = (tree_walk_t *)arg;
+    if (blk >= tw->ctx->sb.total_blocks) {
+        fsck_log(tw->ctx, FSCK_ERROR, "Inodo %u: bloque %u fuera de rango",
+                 tw->ino, blk);
+        return -1;
+    }
+    tw->ctx->block_used[blk / 8] |= (1 << (blk % 8));
+    tw->count++;
+    return BWFS_OK;
+}
+
+/**
+ * \brief Recorre el mapa de extents de un archivo: comprueba rangos y orden,
+ *        marca datos y bloques hoja/índice como usados.
+ *
+ * @param blocks  Salida: fin del último extent (`block_count` esperado; los
+ *                huecos intermedios cuentan, no ocupan bloques).
+ * @return 0 o -1 si el mapa es ilegible o inválido
+ */
+static int check_extents(fsck_context_t *ctx, uint32_t ino,
+                         const bwfs_inode_t *inode, uint32_t *blocks)
+{
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+    if (bwfs_extent_load(inode, ctx->fs_dir, &map) != BWFS_OK) {
+        fsck_log(ctx, FSCK_ERROR, "Inodo %u: árbol de extents ilegible", ino);
+        bwfs_extent_map_free(&map);
+        return -1;
+    }
+
+    int      rc   = 0;
+    uint32_t next = 0;                      /* primer lógico libre */
+    *blocks = 0;
+    for (uint32_t i = 0; i < map.meta_count && rc == 0; ++i) {
+        uint32_t blk = map.meta[i];
+        if (blk == 0 || blk >= ctx->sb.total_blocks) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: bloque de extents %u fuera de rango",
+                     ino, blk);
+            rc = -1;
+        } else {
+            ctx->block_used[blk / 8] |= (1 << (blk % 8));
+        }
+    }
+    for (uint32_t i = 0; i < map.count && rc == 0; ++i) {
+        const bwfs_extent_t *e = &map.ext[i];
+        uint32_t len = e->len & BWFS_EXT_LEN_MASK;
+
+        if (len == 0 || e->logical < next) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: extent %u desordenado o solapado",
+                     ino, i);
+            rc = -1;
+        } else if (e->physical == 0 || e->physical >= ctx->sb.total_blocks ||
+                   len > ctx->sb.total_blocks - e->physical) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: extent %u..%u fuera de rango",
+                     ino, e->physical, e->physical + len - 1);
+            rc = -1;
+        } else {
+            for (uint32_t b = e->physical; b < e->physical + len; ++b)
+                ctx->block_used[b / 8] |= (1 << (b % 8));
+            next    = e->logical + len;
+            *blocks = next;
+        }
+    }
+
+    bwfs_extent_map_free(&map);
+    return rc;
+}
+
+static int mark_snap_block(uint32_t blk, void *arg)
+{
+    fsck_context_t *ctx = (fsck_context_t *)arg;
+    if (blk >= ctx->sb.total_blocks) {
+        fsck_log(ctx, FSCK_ERROR, "Instantáneas: bloque %u fuera de rango", blk);
+        return -1;
+    }
+    ctx->block_used[blk / 8] |= (1 << (blk % 8));
+    return BWFS_OK;
+}
+
+/**
+ * \brief Marca como usados los bloques de las instantáneas (tabla, bitmaps
+ *        compartidos, mapas y versiones guardadas).
+ */
+static int check_snapshots(fsck_context_t *ctx)
+{
+    if (ctx->sb.snap_table == 0)
+        return 0;
+    printf("Verificando instantáneas...\n");
+    if (bwfs_snap_walk(&ctx->sb, ctx->fs_dir, mark_snap_block, ctx) != BWFS_OK) {
+        fsck_log(ctx, FSCK_ERROR, "Tabla de instantáneas dañada");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief Recorre la lista de bloques de fragmentos desde `frag_head`: los
+ *        marca como usados y comprueba su cabecera y su cuenta de unidades.
+ */
+static int check_fragment_list(fsck_context_t *ctx)
+{
+    printf("Verificando bloques de fragmentos...\n");
+
+    ctx->frag_blocks = (uint8_t *)calloc(1, (ctx->sb.total_blocks + 7) / 8);
+    uint8_t *hdr     = (uint8_t *)malloc(BWFS_FRAG_HDR_SIZE);
+    if (!ctx->frag_blocks || !hdr) {
+        free(hdr);
+        fsck_log(ctx, FSCK_ERROR, "Sin memoria para la lista de fragmentos");
+        return -1;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t blk = ctx->sb.frag_head; blk != 0; ) {
+        bwfs_frag_block_t fb;
+        if (blk >= ctx->sb.total_blocks ||
+            (ctx->frag_blocks[blk / 8] & (1 << (blk % 8))) ||
+            util_read_block_range(ctx->fs_dir, blk, 0, hdr, BWFS_FRAG_HDR_SIZE) != 0) {
+            fsck_log(ctx, FSCK_ERROR, "Lista de fragmentos: bloque %u inválido o repetido", blk);
+            break;
+        }
+        memcpy(&fb, hdr, sizeof fb);
+        if (fb.magic != BWFS_FRAG_MAGIC) {
+            fsck_log(ctx, FSCK_ERROR, "Bloque de fragmentos %u sin marca", blk);
+            break;
+        }
+        ctx->frag_blocks[blk / 8] |= (1 << (blk % 8));
+        ctx->block_used[blk / 8]  |= (1 << (blk % 8));
+        count++;
+
+        uint32_t owned = 0;
+        for (uint32_t u = BWFS_FRAG_FIRST; u < BWFS_FRAG_UNITS; ++u) {
+            uint32_t o;
+            memcpy(&o, hdr + sizeof fb + (size_t)u * 4U, sizeof o);
+            owned += o != 0;
+        }
+        if (owned != fb.used) {
+            fsck_log(ctx, FSCK_WARNING, "Bloque de fragmentos %u: %u unidades usadas, cabecera dice %u",
+                     blk, owned, fb.used);
+            if (fsck_ask_repair(ctx, "Corregir cuenta de unidades") &&
+                util_write_block_range(ctx->fs_dir, blk, offsetof(bwfs_frag_block_t, used),
+                                       (const uint8_t *)&owned, sizeof owned) == 0) {
+                ctx->errors_fixed++;
+            }
+        }
+        blk = fb.next;
+    }
+    free(hdr);
+
+    if (count > 0)
+        fsck_log(ctx, FSCK_INFO, "%u bloques de fragmentos", count);
+    return 0;
+}
+
+/**
+ * \brief Comprueba la cola empaquetada de un inodo #BWFS_INODE_FRAG: que
+ *        esté en un bloque de la lista y que sus unidades sean suyas.
+ */
+static int check_fragment(fsck_context_t *ctx, uint32_t ino,
+                          const bwfs_inode_t *inode)
+{
+    uint64_t base = (uint64_t)inode->block_count * BWFS_BLOCK_SIZE_BYTES;
+    uint64_t size = bwfs_inode_size(inode);
+    uint32_t blk  = inode->frag_block;
+    uint32_t unit = inode->frag_unit;
+
+    if (size <= base || size - base > BWFS_FRAG_MAX) {
+        fsck_log(ctx, FSCK_ERROR, "Inodo %u: cola empaquetada de %llu bytes no válida",
+                 ino, (unsigned long long)(size > base ? size - base : 0));
+        return -1;
+    }
+    uint32_t n = bwfs_frag_units((uint32_t)(size - base));
+    if (blk >= ctx->sb.total_blocks || !(ctx->frag_blocks[blk / 8] & (1 << (blk % 8)))) {
+        fsck_log(ctx, FSCK_ERROR, "Inodo %u: bloque de fragmentos %u fuera de la lista",
+                 ino, blk);
+        return -1;
+    }
+    if (unit < BWFS_FRAG_FIRST || unit >= BWFS_FRAG_UNITS || n > BWFS_FRAG_UNITS - unit) {
+        fsck_log(ctx, FSCK_ERROR, "Inodo %u: unidad de fragmento %u fuera de rango",
+                 ino, unit);
+        return -1;
+    }
+
+    uint32_t *owner = (uint32_t *)malloc((size_t)n * 4U);
+    if (!owner ||
+        util_read_block_range(ctx->fs_dir, blk, sizeof(bwfs_frag_block_t) + (size_t)unit * 4U,
+                              (uint8_t *)owner, (size_t)n * 4U) != 0) {
+        free(owner);
+        fsck_log(ctx, FSCK_ERROR, "Inodo %u: no se pudo leer su fragmento", ino);
+        return -1;
+    }
+    int rc = 0;
+    for (uint32_t i = 0; i < n && rc == 0; ++i) {
+        if (owner[i] != ino) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: la unidad %u del bloque %u es del inodo %u",
+                     ino, unit + i, blk, owner[i]);
+            rc = -1;
+        }
+    }
+    free(owner);
+    return rc;
+}
+
 /**
  * \brief Verifica la validez de un inodo individual.
  */
@@ -216,6 +500,15 @@ static int check_single_inode(fsck_context_t *ctx, uint32_t ino)
         return -1;
     }
     
+    /* Un inodo alcanzable debe figurar en el bitmap de inodos */
+    if (!bwfs_inode_in_use(ino)) {
+        fsck_log(ctx, FSCK_ERROR, "Inodo %u en uso pero marcado como libre", ino);
+        if (fsck_ask_repair(ctx, "Marcar inodo como ocupado") &&
+            bwfs_inode_set_used(ino, true, ctx->fs_dir) == BWFS_OK) {
+            ctx->errors_fixed++;
+        }
+    }
+    
     /* Verificar consistencia básica */
     if (inode.ino != ino) {
         fsck_log(ctx, FSCK_ERROR, "Inodo %u: número incorrecto en metadatos (%u)",
@@ -228,9 +521,45 @@ static int check_single_inode(fsck_context_t *ctx, uint32_t ino)
         }
     }
     
+    /* Datos en línea: no hay punteros a bloques que recorrer */
+    if (inode.flags & BWFS_INODE_INLINE) {
+        if (inode.flags & BWFS_INODE_DIR) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: directorio marcado como en línea", ino);
+            return -1;
+        }
+        if (inode.block_count != 0 || inode.size > BWFS_INLINE_MAX) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: en línea con block_count=%u y tamaño %u",
+                     ino, inode.block_count, inode.size);
+            if (fsck_ask_repair(ctx, "Ajustar inodo en línea")) {
+                inode.block_count = 0;
+                if (inode.size > BWFS_INLINE_MAX) inode.size = BWFS_INLINE_MAX;
+                if (bwfs_write_inode(&inode, ctx->fs_dir) == BWFS_OK) {
+                    ctx->errors_fixed++;
+                }
+            }
+        }
+        return 0;
+    }
+    
     /* Verificar que block_count coincida con bloques asignados */
     uint32_t real_blocks = 0;
-    for (uint32_t i = 0; i < BWFS_DIRECT_BLOCKS && inode.blocks[i] != 0; ++i) {
+    if ((inode.flags & BWFS_INODE_DIR) && inode.block_count > 0) {
+        /* Directorio: hojas y nodos del árbol B+ */
+        tree_walk_t tw = { .ctx = ctx, .ino = ino };
+        if (bwfs_dir_for_each_block(&inode, ctx->fs_dir, mark_tree_block, &tw) != BWFS_OK) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: árbol de directorio ilegible", ino);
+            return -1;
+        }
+        real_blocks = tw.count;
+    }
+    if (inode.flags & BWFS_INODE_EXTENTS) {
+        if (check_extents(ctx, ino, &inode, &real_blocks) != 0)
+            return -1;
+    }
+    if ((inode.flags & BWFS_INODE_FRAG) && check_fragment(ctx, ino, &inode) != 0)
+        return -1;
+    for (uint32_t i = 0; !(inode.flags & (BWFS_INODE_DIR | BWFS_INODE_EXTENTS)) &&
+                         i < BWFS_DIRECT_BLOCKS && inode.blocks[i] != 0; ++i) {
         real_blocks++;
         
         /* Verificar que el bloque esté en rango */
@@ -256,14 +585,18 @@ static int check_single_inode(fsck_context_t *ctx, uint32_t ino)
         }
     }
     
-    /* Verificar tamaño vs bloques para archivos */
-    if (!(inode.flags & BWFS_INODE_DIR)) {
-        uint32_t max_size = inode.block_count * BWFS_BLOCK_SIZE_BYTES;
-        if (inode.size > max_size) {
-            fsck_log(ctx, FSCK_ERROR, "Inodo %u: tamaño %u excede capacidad %u",
-                     ino, inode.size, max_size);
+    /* Verificar tamaño vs bloques para archivos (con extents, lo que pase
+     * del último es un hueco) */
+    if (!(inode.flags & (BWFS_INODE_DIR | BWFS_INODE_EXTENTS))) {
+        uint64_t max_size = (uint64_t)inode.block_count * BWFS_BLOCK_SIZE_BYTES;
+        if (inode.flags & BWFS_INODE_FRAG)
+            max_size += BWFS_FRAG_MAX;
+        uint64_t size     = bwfs_inode_size(&inode);
+        if (size > max_size) {
+            fsck_log(ctx, FSCK_ERROR, "Inodo %u: tamaño %llu excede capacidad %llu",
+                     ino, (unsigned long long)size, (unsigned long long)max_size);
             if (fsck_ask_repair(ctx, "Truncar archivo al tamaño máximo")) {
-                inode.size = max_size;
+                bwfs_inode_set_size(&inode, max_size);
                 if (bwfs_write_inode(&inode, ctx->fs_dir) == BWFS_OK) {
                     ctx->errors_fixed++;
                 }
@@ -274,6 +607,102 @@ static int check_single_inode(fsck_context_t *ctx, uint32_t ino)
     return 0;
 }
 
+static int check_directory_recursive(fsck_context_t *ctx, uint32_t dir_ino, int depth);
+
+/** Estado del recorrido de un directorio (callback de bwfs_dir_iterate). */
+typedef struct {
+    fsck_context_t     *ctx;
+    const bwfs_inode_t *dir;
+    int                 depth;
+    uint32_t            entry_bytes;
+} dir_walk_t;
+
+/**
+ * \brief Verifica la copia de atributos de una entrada y el enlace del hijo
+ *        con ella (solo en hojas del formato actual).
+ */
+static void check_dirent_attr(dir_walk_t *w, const bwfs_dirent_t *e,
+                              const bwfs_inode_t *child)
+{
+    fsck_context_t *ctx = w->ctx;
+    if (!bwfs_dirent_has_attr(e))
+        return;
+
+    if (e->type != bwfs_dir_ftype(child) ||
+        e->size != bwfs_inode_size(child) || e->blocks != child->block_count ||
+        e->atime_ns != child->atime_ns || e->mtime_ns != child->mtime_ns ||
+        e->ctime_ns != child->ctime_ns) {
+        fsck_log(ctx, FSCK_WARNING,
+                 "Directorio %u: atributos de '%s' desfasados (%llu bytes, %u bloques; inodo: %llu, %u)",
+                 w->dir->ino, e->name, (unsigned long long)e->size, e->blocks,
+                 (unsigned long long)bwfs_inode_size(child), child->block_count);
+        if (fsck_ask_repair(ctx, "Copiar atributos del inodo a la entrada") &&
+            bwfs_dir_update_attr(w->dir, ctx->fs_dir, e->hash, child) == BWFS_OK) {
+            ctx->errors_fixed++;
+        }
+    }
+
+    /* Con varios nombres para un inodo basta con que el enlace lleve a uno */
+    if (child->parent != w->dir->ino || child->name_hash != e->hash) {
+        bwfs_inode_t linked;
+        if (child->parent != 0 &&
+            bwfs_read_inode(child->parent, &linked, ctx->fs_dir) == BWFS_OK &&
+            (linked.flags & BWFS_INODE_DIR) &&
+            bwfs_dir_has_link(&linked, ctx->fs_dir, child->name_hash, child->ino) == BWFS_OK)
+            return;
+        fsck_log(ctx, FSCK_WARNING, "Inodo %u: enlace con su entrada '%s' incorrecto",
+                 child->ino, e->name);
+        if (fsck_ask_repair(ctx, "Enlazar inodo con su entrada") &&
+            bwfs_inode_set_link(child->ino, w->dir->ino, e->hash, ctx->fs_dir) == BWFS_OK) {
+            ctx->errors_fixed++;
+        }
+    }
+}
+
+static int check_dir_entry(const bwfs_dirent_t *e, void *arg)
+{
+    dir_walk_t     *w   = (dir_walk_t *)arg;
+    fsck_context_t *ctx = w->ctx;
+    uint32_t dir_ino    = w->dir->ino;
+    uint32_t child_ino  = e->ino;
+    
+    w->entry_bytes += e->rec_len;
+    
+    /* Verificar que el inodo hijo exista */
+    if (child_ino >= ctx->sb.inode_count) {
+        fsck_log(ctx, FSCK_ERROR, "Directorio %u: entrada '%s' apunta a inodo inválido %u",
+                 dir_ino, e->name, child_ino);
+        return 0;
+    }
+    
+    /* La entrada debe ser localizable a través del índice hash */
+    if (bwfs_dir_lookup(w->dir, ctx->fs_dir, e->name) != child_ino) {
+        fsck_log(ctx, FSCK_ERROR, "Directorio %u: '%s' no se encuentra por el índice hash",
+                 dir_ino, e->name);
+    }
+    
+    /* Verificar inodo hijo */
+    if (check_single_inode(ctx, child_ino) != 0) {
+        return 0;
+    }
+    
+    /* Si es directorio, verificar recursivamente */
+    bwfs_inode_t child;
+    if (bwfs_read_inode(child_ino, &child, ctx->fs_dir) == BWFS_OK) {
+        if (e->type != BWFS_FT_UNKNOWN && e->type != bwfs_dir_ftype(&child)) {
+            fsck_log(ctx, FSCK_WARNING, "Directorio %u: tipo de '%s' no coincide con su inodo",
+                     dir_ino, e->name);
+        }
+        check_dirent_attr(w, e, &child);
+        if (child.flags & BWFS_INODE_DIR) {
+            check_directory_recursive(ctx, child_ino, w->depth + 1);
+        }
+        /* Marcar como encontrado */
+        ctx->inode_used[child_ino / 8] |= (1 << (child_ino % 8));
+    }
+    return 0;
+}
+
 /**
  * \brief Verifica recursivamente la estructura de directorios.
  */
@@ -303,59 +732,79 @@ static int check_directory_recursive(fsck_context_t *ctx, uint32_t dir_ino, int
         return 0;
     }
     
-    /* Leer entradas del directorio */
-    size_t max_entries = BWFS_BLOCK_SIZE_BYTES / sizeof(bwfs_dir_entry_t);
-    bwfs_dir_entry_t *entries = malloc(max_entries * sizeof(bwfs_dir_entry_t));
-    if (!entries) {
-        fsck_log(ctx, FSCK_ERROR, "Sin memoria para leer directorio %u", dir_ino);
-        return -1;
-    }
-    
-    if (util_read_block(ctx->fs_dir, dir_inode.blocks[0],
-                        (uint8_t *)entries, BWFS_BLOCK_SIZE_BYTES) != 0) {
+    /* Recorrer entradas del directorio */
+    dir_walk_t walk = { .ctx = ctx, .dir = &dir_inode, .depth = depth };
+    if (bwfs_dir_iterate(&dir_inode, ctx->fs_dir, check_dir_entry, &walk) != BWFS_OK) {
         fsck_log(ctx, FSCK_ERROR, "No se pudo leer bloque de directorio %u", dir_ino);
-        free(entries);
         return -1;
     }
     
-    uint32_t entry_count = 0;
-    for (size_t i = 0; i < max_entries; ++i) {
-        if (entries[i].ino == 0) continue;
-        
-        entry_count++;
-        uint32_t child_ino = entries[i].ino;
-        
-        /* Verificar que el inodo hijo exista */
-        if (child_ino >= ctx->sb.total_blocks) {
-            fsck_log(ctx, FSCK_ERROR, "Directorio %u: entrada '%s' apunta a inodo inválido %u",
-                     dir_ino, entries[i].name, child_ino);
-            continue;
-        }
-        
-        /* Verificar inodo hijo */
-        if (check_single_inode(ctx, child_ino) != 0) {
-            continue;
-        }
-        
-        /* Si es directorio, verificar recursivamente */
-        bwfs_inode_t child;
-        if (bwfs_read_inode(child_ino, &child, ctx->fs_dir) == BWFS_OK) {
-            if (child.flags & BWFS_INODE_DIR) {
-                check_directory_recursive(ctx, child_ino, depth + 1);
-            }
-            /* Marcar como encontrado */
-            ctx->inode_used[child_ino / 8] |= (1 << (child_ino % 8));
-        }
-    }
-    
     /* Verificar consistencia del tamaño del directorio */
-    uint32_t expected_size = entry_count * sizeof(bwfs_dir_entry_t);
+    uint32_t expected_size = walk.entry_bytes;
     if (dir_inode.size != expected_size) {
         fsck_log(ctx, FSCK_WARNING, "Directorio %u: tamaño inconsistente (%u vs %u esperado)",
                  dir_ino, dir_inode.size, expected_size);
     }
     
-    free(entries);
+    return 0;
+}
+
+/**
+ * \brief Recorre la lista de inodos borrados pendientes de liberar
+ *        (\ref orphan.h): sus bloques siguen ocupados y ellos no son
+ *        huérfanos perdidos.  Una lista rota se corta en el primer
+ *        eslabón malo y lo que siga se verá como huérfano.
+ */
+static int check_orphan_list(fsck_context_t *ctx)
+{
+    uint32_t prev = 0, n = 0;
+    for (uint32_t ino = ctx->sb.orphan_head; ino != 0; ) {
+        bwfs_inode_t inode;
+        const char  *why = NULL;
+        if (ino >= ctx->sb.inode_count || n >= ctx->sb.inode_count)
+            why = "fuera de rango o en bucle";
+        else if (ctx->inode_used[ino / 8] & (1 << (ino % 8)))
+            why = "alcanzable desde un directorio";
+        else if (bwfs_inode_in_use(ino) &&
+                 (bwfs_read_inode(ino, &inode, ctx->fs_dir) != BWFS_OK ||
+                  !(inode.flags & BWFS_INODE_ORPHAN)))
+            why = "no es un inodo borrado";
+
+        if (why || !bwfs_inode_in_use(ino)) {
+            /* Ya libre: un corte sin diario a mitad de liberarlo */
+            if (why)
+                fsck_log(ctx, FSCK_ERROR, "Lista de huérfanos: inodo %u %s", ino, why);
+            else
+                fsck_log(ctx, FSCK_WARNING, "Lista de huérfanos: el inodo %u ya "
+                         "se liberó (borrado interrumpido)", ino);
+            if (fsck_ask_repair(ctx, "Cortar la lista de huérfanos")) {
+                int rc;
+                if (prev == 0) {
+                    ctx->sb.orphan_head = 0;
+                    ctx->sb.feature_ro_compat &= ~(uint32_t)BWFS_FEAT_RO_COMPAT_ORPHAN;
+                    rc = bwfs_write_superblock(&ctx->sb, ctx->fs_dir);
+                } else {
+                    bwfs_inode_t last;
+                    rc = bwfs_read_inode(prev, &last, ctx->fs_dir);
+                    last.next_orphan = 0;
+                    if (rc == BWFS_OK)
+                        rc = bwfs_write_inode(&last, ctx->fs_dir);
+                }
+                if (rc == BWFS_OK)
+                    ctx->errors_fixed++;
+            }
+            break;
+        }
+
+        if (check_single_inode(ctx, ino) != 0)
+            return -1;
+        ctx->inode_used[ino / 8] |= (1 << (ino % 8));
+        prev = ino;
+        ino  = inode.next_orphan;
+        n++;
+    }
+    if (n > 0)
+        fsck_log(ctx, FSCK_INFO, "%u inodos borrados pendientes de liberar", n);
     return 0;
 }
 
@@ -411,6 +860,54 @@ static int check_bitmap_consistency(fsck_context_t *ctx)
     return 0;
 }
 
+/**
+ * \brief Compara los contadores del superbloque con los recuentos reales.
+ *
+ * Solo son fiables tras un desmontaje limpio; si el disco está sucio se
+ * recalculan sin contarlo como error (el montaje los habría recontado).
+ */
+static int check_counters(fsck_context_t *ctx)
+{
+    printf("Verificando contadores del superbloque...\n");
+    
+    uint32_t free_blocks = bwfs_bitmap_count_free(&ctx->bitmap);
+    uint32_t free_inodes = bwfs_itable_free_count();
+    bool trusted = (ctx->sb.state & BWFS_STATE_CLEAN) &&
+                   (ctx->sb.feature_compat & BWFS_FEAT_COMPAT_COUNTERS);
+    
+    if (trusted && (ctx->sb.free_blocks != free_blocks ||
+                    ctx->sb.free_inodes != free_inodes)) {
+        fsck_log(ctx, FSCK_ERROR, "Contadores incorrectos: %u/%u bloques, %u/%u inodos libres",
+                 ctx->sb.free_blocks, free_blocks, ctx->sb.free_inodes, free_inodes);
+        if (!fsck_ask_repair(ctx, "Corregir contadores"))
+            return 0;
+        ctx->errors_fixed++;
+    }
+    
+    ctx->sb.free_blocks = free_blocks;
+    ctx->sb.free_inodes = free_inodes;
+    fsck_log(ctx, FSCK_INFO, "%u bloques y %u inodos libres", free_blocks, free_inodes);
+    return 0;
+}
+
+/**
+ * \brief Sin errores pendientes: guarda los contadores y marca el disco
+ *        limpio para que el próximo montaje no recuente.
+ */
+static int mark_clean(fsck_context_t *ctx)
+{
+    if (ctx->errors_fixed != ctx->errors_found)
+        return 0;
+    
+    bwfs_features_upgrade(&ctx->sb);
+    ctx->sb.state |= BWFS_STATE_CLEAN;
+    if (bwfs_write_superblock(&ctx->sb, ctx->fs_dir) != BWFS_OK) {
+        fsck_log(ctx, FSCK_ERROR, "No se pudo escribir el superbloque");
+        return -1;
+    }
+    return 0;
+}
+
 /* ------------------------------------------------------------------------- */
 /* Función principal de verificación                                         */
 /* ------------------------------------------------------------------------- */
@@ -424,13 +921,22 @@ static int run_fsck(fsck_context_t *ctx)
         return -1;
     }
     
+    if ((ctx->sb.state & BWFS_STATE_CLEAN) && !ctx->force_check) {
+        fsck_log(ctx, FSCK_INFO, "Desmontado limpiamente; use -f para forzar la verificación");
+        return 0;
+    }
+    
     /* 2. Cargar y verificar bitmap */
     if (check_bitmap(ctx) != 0) {
         return -1;
     }
     
+    if (check_fragment_list(ctx) != 0 || check_snapshots(ctx) != 0) {
+        return -1;
+    }
+    
     /* 3. Preparar bitmap de inodos encontrados */
-    size_t inode_bytes = (ctx->sb.total_blocks + 7) / 8;
+    size_t inode_bytes = (ctx->sb.inode_count + 7) / 8;
     ctx->inode_used = (uint8_t *)calloc(1, inode_bytes);
     if (!ctx->inode_used) {
         fsck_log(ctx, FSCK_ERROR, "Sin memoria para bitmap de inodos");
@@ -439,27 +945,25 @@ static int run_fsck(fsck_context_t *ctx)
     
     /* 4. Verificar estructura de directorios desde la raíz */
     printf("Verificando estructura de directorios...\n");
-    if (check_directory_recursive(ctx, ctx->sb.root_inode, 0) != 0) {
+    if (check_single_inode(ctx, ctx->sb.root_inode) != 0 ||
+        check_directory_recursive(ctx, ctx->sb.root_inode, 0) != 0 ||
+        check_orphan_list(ctx) != 0) {
         return -1;
     }
     
     /* 5. Verificar consistencia del bitmap */
-    if (check_bitmap_consistency(ctx) != 0) {
+    if (check_bitmap_consistency(ctx) != 0 || check_counters(ctx) != 0) {
         return -1;
     }
     
     /* 6. Buscar inodos huérfanos */
     printf("Buscando inodos huérfanos...\n");
     uint32_t orphans = 0;
-    for (uint32_t i = 2; i < ctx->sb.total_blocks; ++i) {  /* Empezar después del bitmap */
-        if (bwfs_bm_test(&ctx->bitmap, i) && !(ctx->inode_used[i / 8] & (1 << (i % 8)))) {
-            /* Verificar si realmente es un inodo válido */
-            bwfs_inode_t test;
-            if (bwfs_read_inode(i, &test, ctx->fs_dir) == BWFS_OK && test.ino == i) {
-                fsck_log(ctx, FSCK_WARNING, "Inodo huérfano encontrado: %u", i);
-                orphans++;
-                /* Nota: en un fsck real, aquí se movería a lost+found */
-            }
+    for (uint32_t i = 1; i < ctx->sb.inode_count; ++i) {   /* el inodo 0 no existe */
+        if (bwfs_inode_in_use(i) && !(ctx->inode_used[i / 8] & (1 << (i % 8)))) {
+            fsck_log(ctx, FSCK_WARNING, "Inodo huérfano encontrado: %u", i);
+            orphans++;
+            /* Nota: en un fsck real, aquí se movería a lost+found */
         }
     }
     
@@ -467,7 +971,7 @@ static int run_fsck(fsck_context_t *ctx)
         fsck_log(ctx, FSCK_INFO, "No se encontraron inodos huérfanos");
     }
     
-    return 0;
+    return mark_clean(ctx);
 }
 
 static void print_summary(fsck_context_t *ctx)
@@ -491,6 +995,8 @@ static void cleanup(fsck_context_t *ctx)
     if (ctx->bitmap.map) free(ctx->bitmap.map);
     if (ctx->block_used) free(ctx->block_used);
     if (ctx->inode_used) free(ctx->inode_used);
+    if (ctx->frag_blocks) free(ctx->frag_blocks);
+    bwfs_itable_close();
 }
 
 /* ------------------------------------------------------------------------- */
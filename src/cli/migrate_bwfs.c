@@ -0,0 +1,885 @@
+// -----------------------------------------------------------------------------
+// File: src/cli/migrate_bwfs.c
+// -----------------------------------------------------------------------------
+/**
+ * \file migrate_bwfs.c
+ * \brief Migra un disco BWFS v1 al formato actual sin pasar por FUSE.
+ *
+ * Uso:
+ *     migrate_bwfs [-j <hilos>] [-c <checkpoint>] <origen_v1> <destino>
+ *
+ *  - El destino se formatea antes con mkfs_bwfs (bloques, inodos y
+ *    política a elección; la geometría debe ser la de v1, 1000x1000) y ha
+ *    de estar vacío, salvo que se reanude una migración interrumpida.
+ *  - `-j` fija los hilos de las fases paralelas (por defecto 4).
+ *  - `-c` cambia el checkpoint (por defecto `<destino>/migrate.ckpt`).
+ *
+ * En v1 cada inodo ocupa un bloque propio (su número es el del bloque), los
+ * archivos tienen diez punteros directos y cada directorio es un único
+ * bloque de registros \ref bwfs_dir_entry_t.  El origen solo se lee.
+ *
+ * Fases:
+ *  1. Escaneo: recorre el árbol v1 por niveles desde la raíz; los inodos y
+ *     bloques-directorio de cada nivel se leen en paralelo.
+ *  2. Metadatos: crea inodos y entradas en orden (padres antes que hijos) y
+ *     dimensiona cada archivo; los de hasta #BWFS_INLINE_MAX bytes quedan
+ *     ya copiados en el inodo.
+ *  3. Datos: copia los bloques en paralelo, por lotes de #DATA_BATCH
+ *     archivos; tras cada lote empaqueta las colas y registra el avance.
+ *  4. Verificación: compara en paralelo tipo, tamaño, entradas y contenido
+ *     de cada nodo con el origen.
+ *
+ * El checkpoint es un registro de texto que solo crece: una cabecera que
+ * identifica el origen, "I <nodo> <inodo>" al crear cada nodo y "D <nodo>"
+ * al terminar sus datos.  Al reanudar se salta lo registrado; un nodo
+ * creado pero sin registrar se reaprovecha buscando su nombre en el
+ * directorio padre, y sus datos se vuelven a copiar.  SIGINT y SIGTERM
+ * detienen la migración en el siguiente nodo, con el checkpoint al día.
+ *
+ * Códigos de salida:
+ *   0 - Migrado y verificado
+ *   1 - La verificación encontró diferencias
+ *   8 - Error operacional (origen ilegible, destino lleno, E/S...)
+ */
+
+#define _POSIX_C_SOURCE 200809L   /* fsync(), fileno(), sigaction() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>     /* PATH_MAX, UINT32_MAX */
+#include <pthread.h>
+#include <signal.h>
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+#include "inode.h"
+#include "extent.h"
+#include "frag.h"
+#include "dir.h"
+#include "journal.h"
+#include "util.h"
+
+#define DEFAULT_JOBS   4U
+#define MAX_JOBS       64U
+#define DATA_BATCH     64U              /* archivos por punto de control */
+#define CKPT_NAME      "migrate.ckpt"
+#define CKPT_MAGIC     "BWFS-MIGRATE 1"
+
+/* ------------------------------------------------------------------------- */
+/* Estado de la migración                                                    */
+/* ------------------------------------------------------------------------- */
+
+/** Un archivo o directorio del árbol v1. */
+typedef struct {
+    uint32_t          src_ino;    /**< Inodo (= bloque) v1               */
+    uint32_t          parent;     /**< Nodo padre (UINT32_MAX en la raíz) */
+    uint32_t          children;   /**< Entradas del directorio v1        */
+    uint32_t          v2_ino;     /**< Inodo creado (0 = pendiente)      */
+    bool              copied;     /**< Datos completos en el destino     */
+    bwfs_inode_t      v1;         /**< Inodo de origen                   */
+    bwfs_dir_entry_t *dirents;    /**< Entradas v1 (solo en el escaneo)  */
+    char              name[BWFS_NAME_MAX + 1];
+} node_t;
+
+typedef struct {
+    const char        *src;
+    const char        *dst;
+    uint32_t           jobs;
+    bwfs_superblock_t  src_sb;
+    bwfs_superblock_t  sb;         /**< Superbloque del destino          */
+    bwfs_bitmap_t      bm;
+
+    node_t            *nodes;      /**< Orden BFS: padres antes que hijos */
+    uint32_t           count;
+    uint32_t           cap;
+    uint8_t           *seen;       /**< Inodos v1 ya enlazados           */
+
+    FILE              *ckpt;
+    char               ckpt_path[PATH_MAX];
+    bool               resumed;
+
+    pthread_mutex_t    lock;       /**< ckpt, mismatches y el reparto    */
+    uint32_t           mismatches;
+} migrate_t;
+
+/** Puesto por SIGINT/SIGTERM: las fases paran antes del siguiente nodo. */
+static volatile sig_atomic_t stop_requested;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+/** Trabajo sobre un nodo; `scratch` son dos bloques propios del hilo. */
+typedef int (*node_fn)(migrate_t *m, uint32_t idx, uint8_t *scratch);
+
+/* ------------------------------------------------------------------------- */
+/* Utilidades                                                                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * \brief Ruta absoluta de un nodo (para los mensajes).
+ * @return false si no cabe en `sz` bytes (el escaneo lo descarta antes)
+ */
+static bool node_path(const migrate_t *m, uint32_t idx, char *out, size_t sz)
+{
+    if (m->nodes[idx].parent == UINT32_MAX)
+        return snprintf(out, sz, "/") == 1 && sz > 1;
+    char parent[PATH_MAX];
+    if (!node_path(m, m->nodes[idx].parent, parent, sizeof parent))
+        return false;
+    int n = snprintf(out, sz, "%s%s%s", parent, strcmp(parent, "/") ? "/" : "",
+                     m->nodes[idx].name);
+    return n >= 0 && (size_t)n < sz;
+}
+
+/**
+ * \brief Añade un registro al checkpoint (sin forzarlo a disco): nodo
+ *        creado como `ino` o, con `ino` 0, datos del nodo completos.
+ */
+static void ckpt_log(migrate_t *m, uint32_t idx, uint32_t ino)
+{
+    pthread_mutex_lock(&m->lock);
+    if (ino != 0)
+        fprintf(m->ckpt, "I %u %u\n", idx, ino);
+    else
+        fprintf(m->ckpt, "D %u\n", idx);
+    pthread_mutex_unlock(&m->lock);
+}
+
+/** \brief Punto de control: lo registrado sobrevive a una interrupción. */
+static int ckpt_sync(migrate_t *m)
+{
+    if (fflush(m->ckpt) != 0 || fsync(fileno(m->ckpt)) != 0) {
+        fprintf(stderr, "Error escribiendo %s\n", m->ckpt_path);
+        return BWFS_ERR_IO;
+    }
+    return BWFS_OK;
+}
+
+/** Reparto de los nodos `[next, end)` entre los hilos. */
+typedef struct {
+    migrate_t *m;
+    node_fn    fn;
+    uint32_t   next;
+    uint32_t   end;
+    int        rc;
+} pool_t;
+
+static void *pool_worker(void *arg)
+{
+    pool_t  *p       = (pool_t *)arg;
+    uint8_t *scratch = (uint8_t *)malloc(2 * (size_t)BWFS_BLOCK_SIZE_BYTES);
+
+    for (;;) {
+        pthread_mutex_lock(&p->m->lock);
+        if (!scratch && p->rc == BWFS_OK)
+            p->rc = BWFS_ERR_NOMEM;
+        if (stop_requested && p->rc == BWFS_OK)
+            p->rc = BWFS_ERR_IO;
+        uint32_t idx = p->rc == BWFS_OK ? p->next++ : p->end;
+        pthread_mutex_unlock(&p->m->lock);
+        if (idx >= p->end)
+            break;
+
+        int rc = p->fn(p->m, idx, scratch);
+        if (rc != BWFS_OK) {
+            pthread_mutex_lock(&p->m->lock);
+            if (p->rc == BWFS_OK)
+                p->rc = rc;
+            pthread_mutex_unlock(&p->m->lock);
+        }
+    }
+    free(scratch);
+    return NULL;
+}
+
+/**
+ * \brief Aplica `fn` a los nodos `[first, end)` con hasta `m->jobs` hilos.
+ * @return BWFS_OK o el primer error (los hilos dejan de tomar trabajo)
+ */
+static int run_parallel(migrate_t *m, uint32_t first, uint32_t end, node_fn fn)
+{
+    pool_t    p = { m, fn, first, end, BWFS_OK };
+    pthread_t tid[MAX_JOBS];
+    uint32_t  want = end - first < m->jobs ? end - first : m->jobs;
+    uint32_t  started = 0;
+
+    while (started < want &&
+           pthread_create(&tid[started], NULL, pool_worker, &p) == 0)
+        ++started;
+    if (started == 0)
+        pool_worker(&p);            /* sin hilos: todo en el llamante */
+    for (uint32_t t = 0; t < started; ++t)
+        pthread_join(tid[t], NULL);
+    return p.rc;
+}
+
+/**
+ * \brief Lee `len` bytes del bloque lógico `b` de un archivo del destino
+ *        (en línea, cola empaquetada o extents).
+ */
+static int read_v2_block(const migrate_t *m, bwfs_inode_t *inode, uint32_t b,
+                         uint8_t *out, size_t len)
+{
+    if (inode->flags & BWFS_INODE_INLINE) {
+        memcpy(out, bwfs_inode_inline_data(inode), len);
+        return BWFS_OK;
+    }
+    if ((inode->flags & BWFS_INODE_FRAG) && b == inode->block_count)
+        return util_read_block_range(m->dst, inode->frag_block,
+                                     bwfs_frag_offset(inode->frag_unit),
+                                     out, len) ? BWFS_ERR_IO : BWFS_OK;
+
+    bwfs_extent_t ext;
+    int rc = bwfs_extent_lookup(inode, m->dst, b, &ext);
+    if (rc != BWFS_OK)
+        return rc;
+    if (ext.physical == 0 || (ext.len & BWFS_EXT_UNWRITTEN)) {
+        memset(out, 0, len);
+        return BWFS_OK;
+    }
+    return util_read_block_range(m->dst, ext.physical, 0, out, len)
+           ? BWFS_ERR_IO : BWFS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fase 1: escaneo del árbol v1                                              */
+/* ------------------------------------------------------------------------- */
+
+static int add_node(migrate_t *m, uint32_t src_ino, uint32_t parent,
+                    const char *name)
+{
+    if (src_ino < BWFS_INODE_BITMAP_BLK || src_ino >= m->src_sb.total_blocks) {
+        fprintf(stderr, "Origen: inodo v1 %u fuera de rango\n", src_ino);
+        return BWFS_ERR_IO;
+    }
+    if (m->seen[src_ino / 8] & (1U << (src_ino % 8))) {
+        fprintf(stderr, "Origen: inodo v1 %u enlazado dos veces\n", src_ino);
+        return BWFS_ERR_IO;
+    }
+    m->seen[src_ino / 8] |= (uint8_t)(1U << (src_ino % 8));
+
+    if (m->count == m->cap) {
+        uint32_t cap = m->cap ? m->cap * 2U : 256U;
+        node_t *grown = (node_t *)realloc(m->nodes, cap * sizeof *grown);
+        if (!grown)
+            return BWFS_ERR_NOMEM;
+        m->nodes = grown;
+        m->cap   = cap;
+    }
+
+    node_t *n = &m->nodes[m->count++];
+    memset(n, 0, sizeof *n);
+    n->src_ino = src_ino;
+    n->parent  = parent;
+    snprintf(n->name, sizeof n->name, "%s", name);
+    return BWFS_OK;
+}
+
+/** \brief Lee y valida un inodo v1 y, si es directorio, sus entradas. */
+static int scan_node(migrate_t *m, uint32_t idx, uint8_t *scratch)
+{
+    node_t  *n     = &m->nodes[idx];
+    uint32_t total = m->src_sb.total_blocks;
+
+    if (util_read_block_range(m->src, n->src_ino, 0, (uint8_t *)&n->v1,
+                              sizeof n->v1) != 0)
+        return BWFS_ERR_IO;
+
+    bool ok = n->v1.ino == n->src_ino &&
+              n->v1.block_count <= BWFS_DIRECT_BLOCKS &&
+              n->v1.size <= (uint64_t)n->v1.block_count * BWFS_BLOCK_SIZE_BYTES;
+    for (uint32_t i = 0; ok && i < n->v1.block_count; ++i)
+        ok = n->v1.blocks[i] > BWFS_BITMAP_BLK && n->v1.blocks[i] < total;
+    if (ok && idx == 0)
+        ok = (n->v1.flags & BWFS_INODE_DIR) != 0;
+    if (!ok) {
+        fprintf(stderr, "Origen: inodo v1 %u inválido\n", n->src_ino);
+        return BWFS_ERR_IO;
+    }
+
+    if (!(n->v1.flags & BWFS_INODE_DIR) || n->v1.block_count == 0)
+        return BWFS_OK;
+
+    const bwfs_dir_entry_t *ents = (const bwfs_dir_entry_t *)scratch;
+    size_t max = BWFS_BLOCK_SIZE_BYTES / sizeof *ents;
+    if (util_read_block(m->src, n->v1.blocks[0], scratch,
+                        BWFS_BLOCK_SIZE_BYTES) != 0)
+        return BWFS_ERR_IO;
+
+    for (size_t i = 0; i < max; ++i)
+        n->children += ents[i].ino != 0;
+    if (n->children == 0)
+        return BWFS_OK;
+
+    n->dirents = (bwfs_dir_entry_t *)malloc(n->children * sizeof *ents);
+    if (!n->dirents)
+        return BWFS_ERR_NOMEM;
+    for (size_t i = 0, k = 0; i < max; ++i) {
+        if (ents[i].ino == 0)
+            continue;
+        n->dirents[k] = ents[i];
+        n->dirents[k].name[BWFS_NAME_MAX] = '\0';
+        ++k;
+    }
+    return BWFS_OK;
+}
+
+static int scan_tree(migrate_t *m)
+{
+    printf("Escaneando árbol v1...\n");
+
+    int rc = add_node(m, m->src_sb.root_inode, UINT32_MAX, "");
+    uint32_t level = 0, first = 0;
+    char path[PATH_MAX];
+
+    while (rc == BWFS_OK && first < m->count) {
+        uint32_t end = m->count;
+        rc = run_parallel(m, first, end, scan_node);
+
+        /* Los hijos se añaden en serie: `nodes` puede crecer */
+        for (uint32_t i = first; i < end; ++i) {
+            bwfs_dir_entry_t *ents = m->nodes[i].dirents;
+            for (uint32_t k = 0; rc == BWFS_OK && k < m->nodes[i].children; ++k)
+                if (ents[k].name[0] == '\0' ||
+                    strchr(ents[k].name, '/') != NULL) {
+                    fprintf(stderr, "Origen: nombre inválido en el inodo v1 %u\n",
+                            m->nodes[i].src_ino);
+                    rc = BWFS_ERR_IO;
+                } else if ((rc = add_node(m, ents[k].ino, i, ents[k].name)) == BWFS_OK &&
+                           !node_path(m, m->count - 1U, path, sizeof path)) {
+                    /* Las rutas de los mensajes no se truncan */
+                    fprintf(stderr, "Origen: ruta demasiado larga bajo el inodo v1 %u\n",
+                            m->nodes[i].src_ino);
+                    rc = BWFS_ERR_IO;
+                }
+            free(m->nodes[i].dirents);
+            m->nodes[i].dirents = NULL;
+        }
+        first = end;
+        ++level;
+    }
+
+    if (rc == BWFS_OK)
+        printf("        %u nodos en %u niveles\n", m->count, level);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Checkpoint                                                                */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * \brief Abre el checkpoint: si existe aplica lo registrado, si no exige
+ *        un destino vacío y escribe la cabecera.
+ */
+static int ckpt_open(migrate_t *m)
+{
+    FILE *f = fopen(m->ckpt_path, "r");
+    if (f) {
+        char     line[128];
+        uint32_t total = 0, root = 0, count = 0;
+        if (!fgets(line, sizeof line, f) ||
+            sscanf(line, CKPT_MAGIC " %u %u %u", &total, &root, &count) != 3 ||
+            total != m->src_sb.total_blocks || root != m->src_sb.root_inode ||
+            count != m->count) {
+            fprintf(stderr, "%s no corresponde a este origen\n", m->ckpt_path);
+            fclose(f);
+            return BWFS_ERR_IO;
+        }
+
+        /* Una línea cortada por la interrupción no cumple el formato */
+        uint32_t idx, ino, created = 0, copied = 0;
+        while (fgets(line, sizeof line, f)) {
+            if (sscanf(line, "I %u %u", &idx, &ino) == 2 && idx < m->count) {
+                m->nodes[idx].v2_ino = ino;
+                ++created;
+            } else if (sscanf(line, "D %u", &idx) == 1 && idx < m->count) {
+                m->nodes[idx].copied = true;
+                ++copied;
+            }
+        }
+        fclose(f);
+        m->resumed = true;
+        printf("Reanudando: %u nodos creados, %u copiados\n", created, copied);
+    } else {
+        bwfs_inode_t root;
+        if (bwfs_read_inode(m->sb.root_inode, &root, m->dst) != BWFS_OK)
+            return BWFS_ERR_IO;
+        if (bwfs_inode_size(&root) != 0) {
+            fprintf(stderr, "El destino no está vacío (y no hay %s)\n",
+                    m->ckpt_path);
+            return BWFS_ERR_FULL;
+        }
+    }
+
+    m->ckpt = fopen(m->ckpt_path, "a");
+    if (!m->ckpt) {
+        perror(m->ckpt_path);
+        return BWFS_ERR_IO;
+    }
+    if (!m->resumed) {
+        fprintf(m->ckpt, CKPT_MAGIC " %u %u %u\n", m->src_sb.total_blocks,
+                m->src_sb.root_inode, m->count);
+        return ckpt_sync(m);
+    }
+    return BWFS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fase 2: metadatos                                                         */
+/* ------------------------------------------------------------------------- */
+
+/** \brief Bloques e inodos que faltan por crear, contra lo libre. */
+static int check_space(const migrate_t *m)
+{
+    uint64_t blocks = 0;
+    uint32_t inodes = 0;
+
+    for (uint32_t i = 0; i < m->count; ++i) {
+        const node_t *n = &m->nodes[i];
+        if (n->v2_ino != 0)
+            continue;
+        ++inodes;
+        if (!(n->v1.flags & BWFS_INODE_DIR) && n->v1.size > BWFS_INLINE_MAX)
+            blocks += n->v1.block_count;
+    }
+    if (inodes > bwfs_itable_free_count() || blocks > m->bm.free_blocks) {
+        fprintf(stderr, "Destino sin espacio: hacen falta %u inodos y %llu "
+                "bloques; hay %u y %u libres\n", inodes,
+                (unsigned long long)blocks, bwfs_itable_free_count(),
+                m->bm.free_blocks);
+        return BWFS_ERR_FULL;
+    }
+    return BWFS_OK;
+}
+
+static int create_node(migrate_t *m, uint32_t idx)
+{
+    node_t *n      = &m->nodes[idx];
+    bool    is_dir = (n->v1.flags & BWFS_INODE_DIR) != 0;
+
+    if (n->v2_ino != 0)
+        return BWFS_OK;
+
+    uint32_t     ino = m->sb.root_inode;
+    bwfs_inode_t inode;
+
+    if (idx != 0) {
+        bwfs_inode_t pdir;
+        if (bwfs_read_inode(m->nodes[n->parent].v2_ino, &pdir, m->dst) != BWFS_OK)
+            return BWFS_ERR_IO;
+
+        /* Creado antes de una interrupción pero sin registrar: se reutiliza */
+        ino = bwfs_dir_lookup(&pdir, m->dst, n->name);
+        if (ino == UINT32_MAX) {
+            ino = bwfs_create_inode(is_dir, pdir.ino, m->dst);
+            if (ino == UINT32_MAX)
+                return BWFS_ERR_FULL;
+            if (bwfs_dir_add(&m->bm, &pdir, m->dst, n->name, ino,
+                             is_dir ? BWFS_FT_DIR : BWFS_FT_REG) != BWFS_OK) {
+                bwfs_inode_set_used(ino, false, m->dst);
+                return BWFS_ERR_IO;
+            }
+        }
+    }
+
+    if (bwfs_read_inode(ino, &inode, m->dst) != BWFS_OK)
+        return BWFS_ERR_IO;
+    if (((inode.flags & BWFS_INODE_DIR) != 0) != is_dir) {
+        char path[PATH_MAX];
+        if (node_path(m, idx, path, sizeof path))
+            fprintf(stderr, "Destino: %s existe con otro tipo\n", path);
+        else
+            fprintf(stderr, "Destino: inodo v1 %u existe con otro tipo\n",
+                    n->src_ino);
+        return BWFS_ERR_IO;
+    }
+
+    if (!is_dir && n->v1.size <= BWFS_INLINE_MAX) {
+        /* Cabe en el inodo: se copia ya, sin pasar por la fase de datos */
+        if ((inode.flags & BWFS_INODE_INLINE) && n->v1.size > 0) {
+            if (util_read_block_range(m->src, n->v1.blocks[0], 0,
+                                      bwfs_inode_inline_data(&inode),
+                                      n->v1.size) != 0)
+                return BWFS_ERR_IO;
+            bwfs_inode_set_size(&inode, n->v1.size);
+            if (bwfs_write_inode(&inode, m->dst) != BWFS_OK)
+                return BWFS_ERR_IO;
+        }
+        n->copied = true;
+    } else if (!is_dir) {
+        /* Crecer solo fija el tamaño: los bloques se reservan aparte, ya
+         * escritos porque la fase de datos los llena todos.  Al reanudar
+         * no hay huecos que rellenar (ni bloques si la cola ya se empaquetó) */
+        uint32_t nblk = (uint32_t)((n->v1.size + BWFS_BLOCK_SIZE_BYTES - 1) /
+                                   BWFS_BLOCK_SIZE_BYTES);
+        int rc = bwfs_inode_size(&inode) == n->v1.size ? BWFS_OK
+               : bwfs_inode_resize(&m->bm, &inode, n->v1.size, m->dst);
+        if (rc == BWFS_OK && !(inode.flags & BWFS_INODE_FRAG)) {
+            rc = bwfs_inode_fill_holes(&m->bm, &inode, 0, nblk, false, m->dst);
+            if (rc == BWFS_OK && bwfs_write_inode(&inode, m->dst) != BWFS_OK)
+                rc = BWFS_ERR_IO;
+        }
+        if (rc != BWFS_OK)
+            return rc;
+    }
+
+    n->v2_ino = ino;
+    ckpt_log(m, idx, ino);
+    if (n->copied)
+        ckpt_log(m, idx, 0);
+    return BWFS_OK;
+}
+
+static int create_tree(migrate_t *m)
+{
+    printf("Creando inodos y directorios...\n");
+
+    int rc = check_space(m);
+    for (uint32_t i = 0; rc == BWFS_OK && i < m->count; ++i) {
+        rc = stop_requested ? BWFS_ERR_IO : create_node(m, i);
+        if (rc == BWFS_OK && (i + 1) % 1024U == 0)
+            rc = ckpt_sync(m);
+    }
+    if (rc == BWFS_OK)
+        rc = ckpt_sync(m);
+    if (rc != BWFS_OK)
+        fprintf(stderr, "Error creando nodos (%d)\n", rc);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fase 3: datos                                                             */
+/* ------------------------------------------------------------------------- */
+
+/** \brief Copia los bloques v1 de un archivo a los ya reservados. */
+static int copy_node(migrate_t *m, uint32_t idx, uint8_t *scratch)
+{
+    node_t *n = &m->nodes[idx];
+    if ((n->v1.flags & BWFS_INODE_DIR) || n->copied)
+        return BWFS_OK;
+
+    bwfs_inode_t inode;
+    if (bwfs_read_inode(n->v2_ino, &inode, m->dst) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    const size_t  bsz   = BWFS_BLOCK_SIZE_BYTES;
+    uint32_t      nblk  = (uint32_t)((n->v1.size + bsz - 1) / bsz);
+    bwfs_extent_t ext   = { 0, 0, 0 };
+
+    for (uint32_t b = 0; b < nblk; ++b) {
+        size_t len = b + 1 < nblk ? bsz : n->v1.size - (size_t)b * bsz;
+        if (util_read_block_range(m->src, n->v1.blocks[b], 0, scratch, len) != 0)
+            return BWFS_ERR_IO;
+
+        /* Cola ya empaquetada antes de una interrupción */
+        if ((inode.flags & BWFS_INODE_FRAG) && b == inode.block_count) {
+            if (util_write_block_range(m->dst, inode.frag_block,
+                                       bwfs_frag_offset(inode.frag_unit),
+                                       scratch, len) != 0)
+                return BWFS_ERR_IO;
+            continue;
+        }
+
+        uint32_t elen = ext.len & BWFS_EXT_LEN_MASK;
+        if (b < ext.logical || b - ext.logical >= elen) {
+            int rc = bwfs_extent_lookup(&inode, m->dst, b, &ext);
+            if (rc != BWFS_OK)
+                return rc;
+            if (ext.physical == 0)
+                return BWFS_ERR_IO;
+        }
+        if (len < bsz)
+            memset(scratch + len, 0, bsz - len);
+        if (util_write_block(m->dst, ext.physical + (b - ext.logical),
+                             scratch, bsz) != 0)
+            return BWFS_ERR_IO;
+    }
+    return BWFS_OK;
+}
+
+static int copy_data(migrate_t *m)
+{
+    printf("Copiando datos (%u hilos)...\n", m->jobs);
+
+    uint32_t files = 0;
+    for (uint32_t first = 0; first < m->count; first += DATA_BATCH) {
+        uint32_t end = first + DATA_BATCH < m->count ? first + DATA_BATCH
+                                                     : m->count;
+        int rc = run_parallel(m, first, end, copy_node);
+
+        /* Empaquetar colas toca bitmap y fragmentos: en serie */
+        for (uint32_t i = first; rc == BWFS_OK && i < end; ++i) {
+            node_t *n = &m->nodes[i];
+            if ((n->v1.flags & BWFS_INODE_DIR) || n->copied)
+                continue;
+            bwfs_inode_t inode;
+            rc = bwfs_read_inode(n->v2_ino, &inode, m->dst);
+            if (rc == BWFS_OK)
+                rc = bwfs_inode_pack_tail(&m->bm, &inode, m->dst);
+            if (rc == BWFS_OK) {
+                n->copied = true;
+                ckpt_log(m, i, 0);
+                ++files;
+            }
+        }
+        if (rc == BWFS_OK)
+            rc = ckpt_sync(m);
+        if (rc != BWFS_OK) {
+            fprintf(stderr, "Error copiando datos (%d)\n", rc);
+            return rc;
+        }
+    }
+    printf("        %u archivos copiados\n", files);
+    return BWFS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fase 4: verificación                                                      */
+/* ------------------------------------------------------------------------- */
+
+static void mismatch(migrate_t *m, uint32_t idx, const char *what)
+{
+    char path[PATH_MAX];
+    if (!node_path(m, idx, path, sizeof path))
+        snprintf(path, sizeof path, "(inodo v1 %u)", m->nodes[idx].src_ino);
+    pthread_mutex_lock(&m->lock);
+    printf("[DIFF]  %s: %s\n", path, what);
+    m->mismatches++;
+    pthread_mutex_unlock(&m->lock);
+}
+
+static int count_entry(const bwfs_dirent_t *entry, void *arg)
+{
+    (void)entry;
+    ++*(uint32_t *)arg;
+    return 0;
+}
+
+static int verify_node(migrate_t *m, uint32_t idx, uint8_t *scratch)
+{
+    node_t      *n = &m->nodes[idx];
+    bwfs_inode_t inode;
+
+    if (bwfs_read_inode(n->v2_ino, &inode, m->dst) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    if (idx != 0) {
+        bwfs_inode_t pdir;
+        if (bwfs_read_inode(m->nodes[n->parent].v2_ino, &pdir, m->dst) != BWFS_OK)
+            return BWFS_ERR_IO;
+        if (bwfs_dir_lookup(&pdir, m->dst, n->name) != n->v2_ino)
+            mismatch(m, idx, "entrada ausente en el directorio padre");
+    }
+
+    if (n->v1.flags & BWFS_INODE_DIR) {
+        uint32_t entries = 0;
+        if (!(inode.flags & BWFS_INODE_DIR))
+            mismatch(m, idx, "no es un directorio");
+        else if (bwfs_dir_iterate(&inode, m->dst, count_entry, &entries) != BWFS_OK)
+            return BWFS_ERR_IO;
+        else if (entries != n->children)
+            mismatch(m, idx, "número de entradas distinto");
+        return BWFS_OK;
+    }
+
+    if (inode.flags & BWFS_INODE_DIR) {
+        mismatch(m, idx, "es un directorio");
+        return BWFS_OK;
+    }
+    if (bwfs_inode_size(&inode) != n->v1.size) {
+        mismatch(m, idx, "tamaño distinto");
+        return BWFS_OK;
+    }
+
+    const size_t bsz  = BWFS_BLOCK_SIZE_BYTES;
+    uint32_t     nblk = (uint32_t)((n->v1.size + bsz - 1) / bsz);
+    for (uint32_t b = 0; b < nblk; ++b) {
+        size_t len = b + 1 < nblk ? bsz : n->v1.size - (size_t)b * bsz;
+        if (util_read_block_range(m->src, n->v1.blocks[b], 0, scratch, len) != 0)
+            return BWFS_ERR_IO;
+        int rc = read_v2_block(m, &inode, b, scratch + bsz, len);
+        if (rc != BWFS_OK)
+            return rc;
+        if (memcmp(scratch, scratch + bsz, len) != 0) {
+            mismatch(m, idx, "contenido distinto");
+            break;
+        }
+    }
+    return BWFS_OK;
+}
+
+static int verify_tree(migrate_t *m)
+{
+    printf("Verificando contra el origen (%u hilos)...\n", m->jobs);
+
+    int rc = run_parallel(m, 0, m->count, verify_node);
+    if (rc != BWFS_OK) {
+        fprintf(stderr, "Error verificando (%d)\n", rc);
+        return rc;
+    }
+    printf("        %u diferencias\n", m->mismatches);
+    return BWFS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Apertura y cierre                                                         */
+/* ------------------------------------------------------------------------- */
+
+static int open_disks(migrate_t *m)
+{
+    /* El destino fija la geometría activa; v1 solo conoce 1000 × 1000 */
+    if (bwfs_read_superblock(&m->sb, m->dst) != BWFS_OK ||
+        bwfs_features_check(&m->sb, true) != BWFS_OK) {
+        fprintf(stderr, "Destino: superbloque inválido (¿formateado con mkfs_bwfs?)\n");
+        return BWFS_ERR_IO;
+    }
+    if (bwfs_journal_replay(&m->sb, m->dst) != BWFS_OK) {
+        fprintf(stderr, "Destino: no se pudo reproducir el diario\n");
+        return BWFS_ERR_IO;
+    }
+    if (bwfs_geom.width != BWFS_BLOCK_PX || bwfs_geom.height != BWFS_BLOCK_PX) {
+        fprintf(stderr, "Destino: geometría %ux%u; v1 usa %ux%u\n",
+                bwfs_geom.width, bwfs_geom.height, BWFS_BLOCK_PX, BWFS_BLOCK_PX);
+        return BWFS_ERR_FULL;
+    }
+
+    /* v1 no tenía campo de versión: ahí quedaba un reservado a 0 */
+    if (util_read_block_range(m->src, BWFS_SUPERBLOCK_BLK, 0,
+                              (uint8_t *)&m->src_sb, sizeof m->src_sb) != 0 ||
+        m->src_sb.magic != BWFS_MAGIC || m->src_sb.version != 0 ||
+        m->src_sb.block_size != BWFS_BLOCK_SIZE_BITS ||
+        m->src_sb.root_inode >= m->src_sb.total_blocks) {
+        fprintf(stderr, "Origen: no es un disco BWFS v1\n");
+        return BWFS_ERR_IO;
+    }
+    m->seen = (uint8_t *)calloc(1, (m->src_sb.total_blocks + 7) / 8);
+    if (!m->seen)
+        return BWFS_ERR_NOMEM;
+
+    m->bm.total_blocks = m->sb.total_blocks;
+    m->bm.bitmap_blk   = bwfs_sb_bitmap_blk(&m->sb);
+    m->bm.alt_blk      = m->sb.bitmap_alt_blk;
+    m->bm.policy       = m->sb.alloc_policy;
+    if (bwfs_read_bitmap(&m->bm, m->dst) != BWFS_OK) {
+        free(m->bm.map);
+        m->bm.map = NULL;
+        return BWFS_ERR_IO;
+    }
+    m->bm.free_blocks = (m->sb.state & BWFS_STATE_CLEAN) &&
+                        (m->sb.feature_compat & BWFS_FEAT_COMPAT_COUNTERS)
+                        ? m->sb.free_blocks : bwfs_bitmap_count_free(&m->bm);
+
+    if (bwfs_itable_open(&m->sb, m->dst) != BWFS_OK)
+        return BWFS_ERR_IO;
+    if (bwfs_frag_open(&m->sb, m->dst) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    /* Como un montaje: sucio hasta terminar */
+    bwfs_features_upgrade(&m->sb);
+    m->sb.state &= ~(uint32_t)BWFS_STATE_CLEAN;
+    return bwfs_write_superblock(&m->sb, m->dst);
+}
+
+static void close_disks(migrate_t *m, bool clean)
+{
+    if (clean && bwfs_frag_ready()) {
+        m->sb.free_blocks = m->bm.free_blocks;
+        m->sb.free_inodes = bwfs_itable_free_count();
+        m->sb.state      |= BWFS_STATE_CLEAN;
+        bwfs_write_superblock(&m->sb, m->dst);
+    }
+    bwfs_frag_close();
+    bwfs_itable_close();
+    if (m->ckpt)
+        fclose(m->ckpt);
+    for (uint32_t i = 0; i < m->count; ++i)
+        free(m->nodes[i].dirents);
+    free(m->nodes);
+    free(m->seen);
+    free(m->bm.map);
+}
+
+/* ------------------------------------------------------------------------- */
+/* main                                                                      */
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+    migrate_t   m = { 0 };
+    const char *ckpt = NULL;
+
+    m.jobs = DEFAULT_JOBS;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:c:")) != -1) {
+        switch (opt) {
+            case 'j':
+                m.jobs = (uint32_t)strtoul(optarg, NULL, 10);
+                if (m.jobs == 0 || m.jobs > MAX_JOBS) {
+                    fprintf(stderr, "Hilos fuera de rango (1..%u)\n", MAX_JOBS);
+                    return 8;
+                }
+                break;
+            case 'c':
+                ckpt = optarg;
+                break;
+            default:
+                fprintf(stderr, "Uso: %s [-j hilos] [-c checkpoint] "
+                        "<origen_v1> <destino>\n", argv[0]);
+                return 8;
+        }
+    }
+    if (optind != argc - 2) {
+        fprintf(stderr, "Faltan <origen_v1> y <destino>\n");
+        return 8;
+    }
+    m.src = argv[optind];
+    m.dst = argv[optind + 1];
+    if (ckpt)
+        snprintf(m.ckpt_path, sizeof m.ckpt_path, "%s", ckpt);
+    else
+        snprintf(m.ckpt_path, sizeof m.ckpt_path, "%s/" CKPT_NAME, m.dst);
+
+    printf("=== MIGRATE.BWFS - %s (v1) → %s (v%u) ===\n", m.src, m.dst,
+           BWFS_VERSION);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    pthread_mutex_init(&m.lock, NULL);
+    int rc = open_disks(&m);
+    if (rc == BWFS_OK) rc = scan_tree(&m);
+    if (rc == BWFS_OK) rc = ckpt_open(&m);
+    if (rc == BWFS_OK) rc = create_tree(&m);
+    if (rc == BWFS_OK) rc = copy_data(&m);
+    if (rc == BWFS_OK) rc = verify_tree(&m);
+
+    bool ok = rc == BWFS_OK && m.mismatches == 0;
+    if (ok) {
+        fprintf(m.ckpt, "V\n");
+        rc = ckpt_sync(&m);
+    }
+    close_disks(&m, rc == BWFS_OK);
+    pthread_mutex_destroy(&m.lock);
+
+    if (rc != BWFS_OK) {
+        if (stop_requested)
+            printf("Detenida por una señal\n");
+        printf("Migración INTERRUMPIDA: vuelva a ejecutar para reanudar\n");
+        return 8;
+    }
+    printf(ok ? "Migración COMPLETA\n" : "Migración CON DIFERENCIAS\n");
+    return ok ? 0 : 1;
+}
@@ -6,11 +6,22 @@
  * \brief Formatea un directorio como Black & White Filesystem.
  *
  * Uso:
- *     mkfs_bwfs [-b <bloques>] <directorio_FS>
+ *     mkfs_bwfs [-b <bloques>] [-i <inodos>] [-a <política>] [-g <ancho>x<alto>]
+ *               [-j <bloques>] <directorio_FS>
  *
  *  - Crea los archivos block<N>.bin (uno por bloque lógico).
- *  - Inicializa superbloque (bloque 0), bitmap (bloque 1) e inodo raíz.
- *  - El tamaño de cada bloque es BWFS_BLOCK_SIZE_BYTES.
+ *  - `-a` fija la política de asignación persistida en el superbloque
+ *    (worst | first | next | best | buddy | log; por defecto worst).
+ *  - `-i` dimensiona la tabla de inodos (por defecto, uno por bloque; se
+ *    redondea a bloques de tabla completos).
+ *  - Inicializa superbloque (bloque 0), bitmap (bloque 1), bitmap de inodos
+ *    (bloque 2), tabla de inodos (bloques 3..) e inodo raíz.
+ *  - `-g` fija la geometría de los bloques-imagen en px (por defecto
+ *    1000x1000 = 125 000 bytes; p.ej. 512x512 = 32 KiB para archivos
+ *    pequeños).  Cada lado debe ser múltiplo de 8 y el bloque medir entre
+ *    4 KiB y 512 KiB.
+ *  - `-j` fija los bloques del diario de metadatos, tras la tabla de inodos
+ *    (por defecto ~4 MiB, como mucho 1/16 del disco; 0 lo desactiva).
  */
 
 #include <stdio.h>
@@ -25,6 +36,8 @@
 #include "bwfs_common.h"
 #include "bitmap.h"
 #include "inode.h"
+#include "allocation.h"
+#include "journal.h"
 #include "util.h"
 
 #define DEFAULT_BLOCKS 1024U   /* valor por defecto si no se usa -b */
@@ -40,23 +53,63 @@ static int create_all_blocks(const char *dir, uint32_t total)
     return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/* Tamaño del diario por defecto: cabecera + BWFS_JOURNAL_DEFAULT_BYTES,     */
+/* sin pasar de 1/16 del disco; si no llega a un bloque de registro, nada.   */
+/* ------------------------------------------------------------------------- */
+static uint32_t default_journal_blocks(uint32_t total)
+{
+    uint32_t want = 1U + (BWFS_JOURNAL_DEFAULT_BYTES + BWFS_BLOCK_SIZE_BYTES - 1U)
+                         / BWFS_BLOCK_SIZE_BYTES;
+    if (want > total / 16U)
+        want = total / 16U;
+    return want >= 2U ? want : 0U;
+}
+
 /* ------------------------------------------------------------------------- */
 /* main                                                                      */
 /* ------------------------------------------------------------------------- */
 int main(int argc, char *argv[])
 {
     uint32_t total_blocks = DEFAULT_BLOCKS;
+    uint32_t inode_count  = 0;             /* 0 → uno por bloque */
+    int      policy       = BWFS_ALLOC_WORST_FIT;
+    uint32_t width        = BWFS_BLOCK_PX;
+    uint32_t height       = BWFS_BLOCK_PX;
+    int64_t  journal      = -1;            /* -1 → por defecto */
 
     /* -------------------- Parsear argumentos --------------------------- */
     int opt;
-    while ((opt = getopt(argc, argv, "b:")) != -1) {
+    while ((opt = getopt(argc, argv, "b:i:a:g:j:")) != -1) {
         switch (opt) {
             case 'b':
                 total_blocks = (uint32_t)strtoul(optarg, NULL, 10);
                 break;
+            case 'i':
+                inode_count = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'a':
+                policy = bwfs_alloc_policy_from_name(optarg);
+                if (policy < 0) {
+                    fprintf(stderr, "Política desconocida: %s "
+                            "(worst|first|next|best|buddy|log)\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'g':
+                if (sscanf(optarg, "%ux%u", &width, &height) != 2) {
+                    fprintf(stderr, "Geometría inválida: %s (<ancho>x<alto>)\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'j':
+                journal = (int64_t)strtoul(optarg, NULL, 10);
+                break;
             default:
                 fprintf(stderr,
-                    "Uso: %s [-b bloques] <directorio_FS>\n", argv[0]);
+                    "Uso: %s [-b bloques] [-i inodos] [-a política] "
+                    "[-g anchoxalto] [-j bloques] <directorio_FS>\n",
+                    argv[0]);
                 return EXIT_FAILURE;
         }
     }
@@ -66,51 +119,119 @@ int main(int argc, char *argv[])
     }
     const char *fs_dir = argv[optind];
 
+    if (bwfs_geometry_set(width, height) != BWFS_OK) {
+        fprintf(stderr, "Geometría %ux%u no válida: lados múltiplo de %u y "
+                "bloque de %u a %u bytes\n", width, height, BWFS_BLOCK_PX_ALIGN,
+                BWFS_BLOCK_BITS_MIN / 8U, BWFS_BLOCK_BITS_MAX / 8U);
+        return EXIT_FAILURE;
+    }
+    if (total_blocks > BWFS_BITMAP_DUAL_MAX) {
+        fprintf(stderr, "Error: el bitmap de %ux%u px admite como mucho %u bloques\n",
+                width, height, BWFS_BITMAP_DUAL_MAX);
+        return EXIT_FAILURE;
+    }
+    if (journal < 0)
+        journal = default_journal_blocks(total_blocks);
+    if (journal == 1 || journal > total_blocks) {
+        fprintf(stderr, "Error: el diario necesita 0 o al menos 2 bloques "
+                "(cabecera y registro)\n");
+        return EXIT_FAILURE;
+    }
+
     /* -------------------- Crear directorio destino --------------------- */
     if (mkdir(fs_dir, 0755) && errno != EEXIST) {
         BWFS_LOG_ERROR("mkdir %s", fs_dir);
         return EXIT_FAILURE;
     }
 
+    /* -------------------- Generar archivos-bloque vacíos --------------- */
+    /* Antes que los metadatos: util_create_empty_block() deja el bloque a 0 */
+    if (create_all_blocks(fs_dir, total_blocks) != 0) {
+        fprintf(stderr, "Error creando bloques de datos\n");
+        return EXIT_FAILURE;
+    }
+
     /* -------------------- Inicializar superbloque ---------------------- */
     bwfs_superblock_t sb;
-    bwfs_init_superblock(&sb, total_blocks);
+    bwfs_init_superblock(&sb, total_blocks,
+                         inode_count ? inode_count : total_blocks);
+    sb.alloc_policy = (uint32_t)policy;
+    sb.journal_blk    = sb.inode_table_blk + sb.inode_table_blocks;
+    sb.journal_blocks = (uint32_t)journal;
+    if (journal)
+        sb.feature_compat |= BWFS_FEAT_COMPAT_JOURNAL;
+
+    /* Copias A/B: la B del superbloque en el bloque 1, las dos del bitmap
+     * tras el diario */
+    sb.feature_incompat |= BWFS_FEAT_INCOMPAT_DUAL;
+    sb.block_bitmap_blk  = sb.journal_blk + sb.journal_blocks;
+    sb.bitmap_alt_blk    = sb.block_bitmap_blk + 1U;
+
+    if ((uint64_t)sb.bitmap_alt_blk >= total_blocks) {
+        fprintf(stderr, "Error: %u bloques no bastan para %u bloques de "
+                "tabla de inodos, %u de diario y las dos copias del bitmap\n",
+                total_blocks, sb.inode_table_blocks, sb.journal_blocks);
+        return EXIT_FAILURE;
+    }
 
     /* -------------------- Preparar bitmap en RAM ----------------------- */
     bwfs_bitmap_t bm = {
         .bits_per_block = BWFS_BLOCK_SIZE_BITS,
-        .total_blocks   = total_blocks
+        .total_blocks   = total_blocks,
+        .policy         = (uint32_t)policy,
+        .bitmap_blk     = sb.block_bitmap_blk,
+        .alt_blk        = sb.bitmap_alt_blk
     };
     size_t bm_bytes = (total_blocks + 7) / 8;
     bm.map = calloc(1, bm_bytes);
     if (!bm.map) { perror("calloc"); return EXIT_FAILURE; }
 
-    /* Reservar bloques 0 (super) y 1 (bitmap)                             */
+    /* Reservar super, bitmaps, tabla de inodos y diario                   */
     bwfs_bm_set(&bm, BWFS_SUPERBLOCK_BLK, 1);
-    bwfs_bm_set(&bm, BWFS_BITMAP_BLK,     1);
+    bwfs_bm_set(&bm, BWFS_SUPERBLOCK_ALT_BLK, 1);
+    bwfs_bm_set(&bm, sb.block_bitmap_blk, 1);
+    bwfs_bm_set(&bm, sb.bitmap_alt_blk, 1);
+    bwfs_bm_set(&bm, sb.inode_bitmap_blk, 1);
+    for (uint32_t i = 0; i < sb.inode_table_blocks; ++i)
+        bwfs_bm_set(&bm, sb.inode_table_blk + i, 1);
+    for (uint32_t i = 0; i < sb.journal_blocks; ++i)
+        bwfs_bm_set(&bm, sb.journal_blk + i, 1);
 
     /* -------------------- Crear inodo raíz ----------------------------- */
-    uint32_t root_blk = bwfs_create_inode(&bm, /*is_dir=*/true, fs_dir);
-    if (root_blk == UINT32_MAX) {
-        fprintf(stderr, "Error: sin espacio para inodo raíz\n");
+    if (bwfs_itable_format(&sb, fs_dir) != BWFS_OK ||
+        bwfs_itable_open(&sb, fs_dir)   != BWFS_OK) {
+        fprintf(stderr, "Error inicializando la tabla de inodos\n");
         free(bm.map); return EXIT_FAILURE;
     }
+    if (bwfs_journal_format(&sb, fs_dir) != BWFS_OK) {
+        fprintf(stderr, "Error inicializando el diario\n");
+        bwfs_itable_close(); free(bm.map); return EXIT_FAILURE;
+    }
 
-    /* -------------------- Persistir superbloque y bitmap --------------- */
-    sb.root_inode = root_blk;
-    if (bwfs_write_superblock(&sb, fs_dir) != BWFS_OK ||
-        bwfs_write_bitmap(&bm,    fs_dir) != BWFS_OK) {
+    uint32_t root_ino = bwfs_create_inode(/*is_dir=*/true, 0, fs_dir);
+    sb.free_inodes = bwfs_itable_free_count();
+    bwfs_itable_close();
+    if (root_ino != BWFS_ROOT_INO) {
+        fprintf(stderr, "Error: no se pudo crear el inodo raíz\n");
         free(bm.map); return EXIT_FAILURE;
     }
 
-    /* -------------------- Generar archivos-bloque vacíos --------------- */
-    if (create_all_blocks(fs_dir, total_blocks) != 0) {
-        fprintf(stderr, "Error creando bloques de datos\n");
+    /* -------------------- Persistir superbloque y bitmap --------------- */
+    /* Dos veces: las copias A y B quedan válidas desde el principio */
+    sb.root_inode  = root_ino;
+    sb.free_blocks = bwfs_bitmap_count_free(&bm);   /* estado CLEAN */
+    if (bwfs_write_bitmap(&bm,    fs_dir) != BWFS_OK ||
+        bwfs_write_bitmap(&bm,    fs_dir) != BWFS_OK ||
+        bwfs_write_superblock(&sb, fs_dir) != BWFS_OK ||
+        bwfs_write_superblock(&sb, fs_dir) != BWFS_OK) {
         free(bm.map); return EXIT_FAILURE;
     }
 
-    printf("BWFS formateado en \"%s\" con %u bloques (inodo raíz %u)\n",
-           fs_dir, total_blocks, root_blk);
+    printf("BWFS formateado en \"%s\" con %u bloques de %ux%u px (%u bytes), "
+           "%u inodos (inodo raíz %u, asignación %s), diario de %u bloques\n",
+           fs_dir, total_blocks, width, height, BWFS_BLOCK_SIZE_BYTES,
+           sb.inode_count, root_ino, bwfs_alloc_policy_name(sb.alloc_policy),
+           sb.journal_blocks);
 
     free(bm.map);
     return EXIT_SUCCESS;
@@ -7,6 +7,11 @@
  *
  * Ejemplo:
  *     mount_bwfs <directorio_FS> <punto_montaje> -f -o allow_other
+ *
+ * Opciones propias (se retiran antes de pasar el resto a FUSE):
+ *     -o alloc=<worst|first|next|best|buddy|log>
+ *         Sustituye, solo durante este montaje, la política de asignación
+ *         guardada en el superbloque.
  */
 
 #define _GNU_SOURCE     /* Para realpath() y otras funciones GNU */
@@ -15,10 +20,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <stddef.h>     /* offsetof */
 
 #define FUSE_USE_VERSION 35
 #include <fuse3/fuse.h>
 
+#include "allocation.h"
+
 extern struct fuse_operations bwfs_ops; /* declarado en src/fuse/bwfs.c */
 const char *fs_dir;                      /* visible en bwfs.c via 'extern' */
 
@@ -29,6 +37,17 @@ const char *fs_dir;                      /* visible en bwfs.c via 'extern' */
 
 extern struct fuse_operations bwfs_ops; /* declarado en src/fuse/bwfs.c */
 const char *fs_dir;                      /* visible en bwfs.c via 'extern' */
+int alloc_policy_override = -1;          /* -1 → usar la del superbloque  */
+
+/** Opciones `-o` específicas de BWFS. */
+struct bwfs_mount_opts {
+    char *alloc;
+};
+
+static const struct fuse_opt bwfs_mount_optspec[] = {
+    { "alloc=%s", offsetof(struct bwfs_mount_opts, alloc), 0 },
+    FUSE_OPT_END
+};
 
 int main(int argc, char *argv[])
 {
@@ -47,5 +66,23 @@ int main(int argc, char *argv[])
     fs_dir = fs_dir_buf;
 
     /* Desplazar argumentos para FUSE:  argv[2…] son los suyos */
-    return fuse_main(argc - 1, &argv[1], &bwfs_ops, NULL);
+    struct fuse_args args = FUSE_ARGS_INIT(argc - 1, &argv[1]);
+    struct bwfs_mount_opts opts = { 0 };
+    if (fuse_opt_parse(&args, &opts, bwfs_mount_optspec, NULL) != 0)
+        return EXIT_FAILURE;
+
+    if (opts.alloc) {
+        alloc_policy_override = bwfs_alloc_policy_from_name(opts.alloc);
+        if (alloc_policy_override < 0) {
+            fprintf(stderr, "Política desconocida: %s "
+                    "(worst|first|next|best|buddy|log)\n", opts.alloc);
+            fuse_opt_free_args(&args);
+            return EXIT_FAILURE;
+        }
+        free(opts.alloc);
+    }
+
+    int rc = fuse_main(args.argc, args.argv, &bwfs_ops, NULL);
+    fuse_opt_free_args(&args);
+    return rc;
 }
\ No newline at end of file
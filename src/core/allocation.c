@@ -3,69 +3,349 @@
 // -----------------------------------------------------------------------------
 /**
  * \file allocation.c
- * \brief Reservas y liberaciones de bloques usando estrategia *Worst-Fit*.
+ * \brief Reservas y liberaciones de bloques con políticas intercambiables.
  *
- * El algoritmo recorre el bitmap para localizar la región libre contigua más
- * grande (`best_len`).  Si existen varias del mismo tamaño se queda con la
- * primera encontrada.  Devuelve el índice del bloque inicial o UINT32_MAX si
- * no hay hueco suficiente.
+ * Todas las políticas trabajan sobre *regiones libres* (secuencias maximales
+ * de bits a 0 en el bitmap) y devuelven el índice del bloque inicial o
+ * UINT32_MAX si no hay hueco suficiente:
+ *
+ *  - **Worst-Fit** (histórica): la región libre más grande.
+ *  - **First-Fit**: la primera región donde quepa la petición.
+ *  - **Next-Fit**: como First-Fit, pero empezando en un cursor rotativo que
+ *    avanza tras cada reserva (reparte el desgaste y evita re-escanear el
+ *    principio del disco, ya lleno).
+ *  - **Best-Fit**: la región más pequeña donde quepa la petición.
+ *  - **Buddy**: descompone cada región en bloques alineados de 2^k y usa el
+ *    de menor orden que alcance; conserva intactos los bloques grandes.
+ *  - **Log**: escribe siempre a continuación de la cabeza del log dentro de
+ *    su segmento, y al llenarlo salta al siguiente segmento limpio; las
+ *    escrituras salen secuenciales aunque el disco esté fragmentado.
  */
 
 #include "allocation.h"
 #include <limits.h>   /* UINT32_MAX */
+#include <stdlib.h>   /* calloc, realloc */
+#include <string.h>   /* strcmp, memmove */
 #include "bitmap.h"
+#include "txn.h"
 
 /* ------------------------------------------------------------------------- */
 /* Funciones internas auxiliares                                             */
 /* ------------------------------------------------------------------------- */
 
 /**
- * \brief Encuentra la región contigua libre más larga.
+ * \brief Localiza la siguiente región libre a partir de `from`.
+ *
+ * Los bytes completamente ocupados (0xFF) se saltan de golpe, lo que hace el
+ * recorrido de discos casi llenos ~8 veces más rápido que bit a bit.
  *
  * \param bm        Bitmap.
- * \param min_len   Longitud mínima deseada.
- * \param[out] out_start  Primer bloque de la región encontrada.
- * \param[out] out_len    Longitud de la región encontrada.
+ * \param from      Primer bloque a examinar.
+ * \param limit     Bloque (exclusivo) donde detener la búsqueda.
+ * \param[out] out_start  Primer bloque de la región.
+ * \param[out] out_len    Longitud de la región (acotada por `limit`).
+ * \return 1 si se halló una región, 0 si no quedan.
+ */
+static int next_free_run(const bwfs_bitmap_t *bm,
+                         uint32_t             from,
+                         uint32_t             limit,
+                         uint32_t            *out_start,
+                         uint32_t            *out_len)
+{
+    uint32_t i = from;
+
+    while (i < limit) {
+        if ((i % 8) == 0 && bm->map[_BWFS_BM_INDEX(i)] == 0xFF) {
+            i += 8;
+            continue;
+        }
+        if (!bwfs_bm_test(bm, i))
+            break;
+        ++i;
+    }
+    if (i >= limit)
+        return 0;
+
+    uint32_t start = i;
+    while (i < limit) {
+        if ((i % 8) == 0 && i + 8 <= limit && bm->map[_BWFS_BM_INDEX(i)] == 0) {
+            i += 8;
+            continue;
+        }
+        if (bwfs_bm_test(bm, i))
+            break;
+        ++i;
+    }
+
+    *out_start = start;
+    *out_len   = i - start;
+    return 1;
+}
+
+/** \brief Primera región libre (en orden de bloque) de al menos `count`. */
+static uint32_t find_first_fit(const bwfs_bitmap_t *bm, uint32_t count)
+{
+    uint32_t pos = 0, start, len;
+
+    while (next_free_run(bm, pos, bm->total_blocks, &start, &len)) {
+        if (len >= count)
+            return start;
+        pos = start + len;
+    }
+    return UINT32_MAX;
+}
+
+/**
+ * \brief First-Fit desde `bm->cursor`, dando la vuelta al final del disco.
+ *
+ * Una región que cruza el cursor se considera solo desde el cursor; su parte
+ * anterior se examina en la segunda pasada.
+ */
+static uint32_t find_next_fit(const bwfs_bitmap_t *bm, uint32_t count)
+{
+    uint32_t cursor = bm->cursor < bm->total_blocks ? bm->cursor : 0;
+    uint32_t pos = cursor, start, len;
+
+    while (next_free_run(bm, pos, bm->total_blocks, &start, &len)) {
+        if (len >= count)
+            return start;
+        pos = start + len;
+    }
+
+    /* Segunda pasada: [0, cursor + count) para no perder la región partida */
+    uint32_t limit = cursor + count < bm->total_blocks ? cursor + count
+                                                       : bm->total_blocks;
+    pos = 0;
+    while (next_free_run(bm, pos, limit, &start, &len)) {
+        if (len >= count)
+            return start;
+        pos = start + len;
+    }
+    return UINT32_MAX;
+}
+
+/** \brief Región libre más pequeña que admita `count` bloques. */
+static uint32_t find_best_fit(const bwfs_bitmap_t *bm, uint32_t count)
+{
+    uint32_t best_start = UINT32_MAX, best_len = UINT32_MAX;
+    uint32_t pos = 0, start, len;
+
+    while (next_free_run(bm, pos, bm->total_blocks, &start, &len)) {
+        if (len >= count && len < best_len) {
+            best_start = start;
+            best_len   = len;
+            if (len == count)       /* ajuste exacto: imposible mejorarlo */
+                break;
+        }
+        pos = start + len;
+    }
+    return best_start;
+}
+
+/**
+ * \brief Encuentra la región contigua libre más larga.
+ *
+ * Si existen varias del mismo tamaño se queda con la primera encontrada.
  */
-static void find_worst_fit(const bwfs_bitmap_t *bm,
-                           uint32_t             min_len,
-                           uint32_t            *out_start,
-                           uint32_t            *out_len)
+static uint32_t find_worst_fit(const bwfs_bitmap_t *bm, uint32_t count)
 {
     uint32_t best_start = UINT32_MAX, best_len = 0;
-    uint32_t cur_start  = 0,          cur_len  = 0;
-
-    for (uint32_t i = 0; i < bm->total_blocks; ++i) {
-        if (!bwfs_bm_test(bm, i)) {              /* bloque libre */
-            if (cur_len == 0) cur_start = i;
-            ++cur_len;
-        } else {                                 /* bloque ocupado */
-            if (cur_len >= min_len && cur_len > best_len) {
-                best_start = cur_start;
-                best_len   = cur_len;
+    uint32_t pos = 0, start, len;
+
+    while (next_free_run(bm, pos, bm->total_blocks, &start, &len)) {
+        if (len >= count && len > best_len) {
+            best_start = start;
+            best_len   = len;
+        }
+        pos = start + len;
+    }
+    return best_start;
+}
+
+/**
+ * \brief Sistema *buddy* binario sobre el bitmap.
+ *
+ * Cada región libre se descompone de forma voraz en bloques alineados de
+ * tamaño 2^j (exactamente las entradas que tendrían las listas libres de un
+ * buddy clásico).  Se elige el bloque de menor orden j >= ⌈log2(count)⌉ y,
+ * a igualdad, el de menor dirección.  Solo se marcan `count` bloques: el resto
+ * del bloque 2^k queda libre pero la alineación se conserva.
+ */
+static uint32_t find_buddy(const bwfs_bitmap_t *bm, uint32_t count)
+{
+    uint32_t order = 0;
+    while (order < 31 && (1U << order) < count)
+        ++order;
+
+    uint32_t best_start = UINT32_MAX, best_order = 32;
+    uint32_t pos = 0, start, len;
+
+    while (next_free_run(bm, pos, bm->total_blocks, &start, &len)) {
+        uint32_t p = start, end = start + len;
+
+        while (p < end && best_order > order) {
+            /* Mayor orden j con p alineado a 2^j y p + 2^j <= end */
+            uint32_t j = 0;
+            while (j < 31 && (p & ((1U << (j + 1)) - 1)) == 0 &&
+                   (uint64_t)p + (1U << (j + 1)) <= end)
+                ++j;
+
+            if (j >= order && j < best_order) {
+                best_start = p;
+                best_order = j;
             }
-            cur_len = 0;
+            p += 1U << j;
         }
+        if (best_order == order)    /* bloque exacto: no hay nada mejor */
+            break;
+        pos = end;
     }
+    return best_start;
+}
+
+/**
+ * \brief Log: a continuación de la cabeza (`bm->cursor`) si cabe en su
+ *        segmento; si no, en el siguiente segmento limpio (todos sus
+ *        bloques libres), dando la vuelta al disco.
+ *
+ * Una petición mayor que un segmento necesita varios limpios seguidos.
+ * Los huecos de los segmentos a medias no se usan: los recupera el
+ * limpiador (segment.h).  Sin segmentos limpios se recurre a Next-Fit.
+ */
+static uint32_t find_log(const bwfs_bitmap_t *bm, uint32_t count)
+{
+    uint32_t total = bm->total_blocks;
+    uint32_t head  = bm->cursor < total ? bm->cursor : 0;
+    uint32_t start, len;
+
+    /* 1) Seguir el segmento abierto */
+    uint32_t seg_end = head - head % BWFS_SEG_BLOCKS + BWFS_SEG_BLOCKS;
+    if (head % BWFS_SEG_BLOCKS != 0 && count <= seg_end - head &&
+        head + count <= total &&
+        next_free_run(bm, head, head + count, &start, &len) &&
+        start == head && len == count)
+        return head;
 
-    /* Comprobar región al final del bitmap */
-    if (cur_len >= min_len && cur_len > best_len) {
-        best_start = cur_start;
-        best_len   = cur_len;
+    /* 2) Primer segmento limpio desde la cabeza; luego desde el principio */
+    for (int pass = 0; pass < 2; ++pass) {
+        uint32_t pos = pass == 0 ? head : 0;
+        while (next_free_run(bm, pos, total, &start, &len)) {
+            if (pass == 1 && start >= head)
+                break;
+            uint32_t end = start + len;
+            uint32_t p   = (start + BWFS_SEG_BLOCKS - 1) / BWFS_SEG_BLOCKS
+                           * BWFS_SEG_BLOCKS;
+            if (p < end) {
+                uint32_t seg  = total - p < BWFS_SEG_BLOCKS ? total - p
+                                                            : BWFS_SEG_BLOCKS;
+                uint32_t need = count > seg ? count : seg;
+                if (end - p >= need)
+                    return p;
+            }
+            pos = end;
+        }
     }
+    return find_next_fit(bm, count);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Liberaciones diferidas                                                    */
+/* ------------------------------------------------------------------------- */
 
-    *out_start = best_start;
-    *out_len   = best_len;
+static inline bool pending_test(const bwfs_bitmap_t *bm, uint32_t blk)
+{
+    return bm->pending &&
+           (bm->pending[_BWFS_BM_INDEX(blk)] & _BWFS_BM_MASK(blk));
 }
 
+/**
+ * \brief Aparta `blk` hasta que se acepte `tag`: lo añade al último tramo
+ *        si lo continúa con la misma marca o abre uno nuevo.
+ * \return false sin memoria (el llamador lo libera ya)
+ */
+static bool defer_free(bwfs_bitmap_t *bm, uint32_t blk, uint64_t tag)
+{
+    if (!bm->pending) {
+        bm->pending = (uint8_t *)calloc((bm->total_blocks + 7) / 8, 1);
+        if (!bm->pending)
+            return false;
+    }
+
+    bwfs_pending_free_t *last = bm->npend ? &bm->pend[bm->npend - 1] : NULL;
+    if (last && last->tag == tag && last->start + last->count == blk) {
+        last->count++;
+    } else {
+        if (bm->npend == bm->pend_cap) {
+            uint32_t cap = bm->pend_cap ? bm->pend_cap * 2U : 64U;
+            bwfs_pending_free_t *p = (bwfs_pending_free_t *)
+                realloc(bm->pend, cap * sizeof *p);
+            if (!p)
+                return false;
+            bm->pend     = p;
+            bm->pend_cap = cap;
+        }
+        bm->pend[bm->npend++] = (bwfs_pending_free_t){ blk, 1, tag };
+    }
+    bm->pending[_BWFS_BM_INDEX(blk)] |= _BWFS_BM_MASK(blk);
+    return true;
+}
+
+/**
+ * \brief Devuelve al asignador los tramos cuya marca ya se acepta.  Se
+ *        para en el primero que no: los siguientes se liberaron después.
+ */
+static void release_pending(bwfs_bitmap_t *bm)
+{
+    uint32_t n = 0;
+    while (n < bm->npend && bm->settled(bm->pend[n].tag)) {
+        const bwfs_pending_free_t *p = &bm->pend[n++];
+        for (uint32_t b = p->start; b < p->start + p->count; ++b) {
+            bwfs_bm_set(bm, b, 0);
+            bm->pending[_BWFS_BM_INDEX(b)] &= (uint8_t)~_BWFS_BM_MASK(b);
+        }
+    }
+    if (n == 0)
+        return;
+    memmove(bm->pend, bm->pend + n, (bm->npend - n) * sizeof *bm->pend);
+    bm->npend -= n;
+}
+
+/** Tabla de búsqueda indexada por #bwfs_alloc_policy_t. */
+static uint32_t (*const finders[BWFS_ALLOC_POLICY_COUNT])(const bwfs_bitmap_t *,
+                                                          uint32_t) = {
+    [BWFS_ALLOC_WORST_FIT] = find_worst_fit,
+    [BWFS_ALLOC_FIRST_FIT] = find_first_fit,
+    [BWFS_ALLOC_NEXT_FIT]  = find_next_fit,
+    [BWFS_ALLOC_BEST_FIT]  = find_best_fit,
+    [BWFS_ALLOC_BUDDY]     = find_buddy,
+    [BWFS_ALLOC_LOG]       = find_log,
+};
+
+/** Nombres aceptados por mkfs (`-a`) y mount (`-o alloc=`). */
+static const char *const policy_names[BWFS_ALLOC_POLICY_COUNT] = {
+    [BWFS_ALLOC_WORST_FIT] = "worst",
+    [BWFS_ALLOC_FIRST_FIT] = "first",
+    [BWFS_ALLOC_NEXT_FIT]  = "next",
+    [BWFS_ALLOC_BEST_FIT]  = "best",
+    [BWFS_ALLOC_BUDDY]     = "buddy",
+    [BWFS_ALLOC_LOG]       = "log",
+};
+
 /* ------------------------------------------------------------------------- */
 /* API pública                                                               */
 /* ------------------------------------------------------------------------- */
 
 uint32_t bwfs_alloc_blocks(bwfs_bitmap_t *bm, uint32_t count)
 {
-    uint32_t start, len;
-    find_worst_fit(bm, count, &start, &len);
+    if (count == 0)
+        return UINT32_MAX;
+
+    bwfs_txn_lock_alloc();
+    if (bm->npend > 0)
+        release_pending(bm);
+    uint32_t policy = bm->policy < BWFS_ALLOC_POLICY_COUNT ? bm->policy
+                                                           : BWFS_ALLOC_WORST_FIT;
+    uint32_t start = finders[policy](bm, count);
 
     if (start == UINT32_MAX)  /* sin hueco grande suficiente */
         return UINT32_MAX;
@@ -73,11 +353,36 @@ uint32_t bwfs_alloc_blocks(bwfs_bitmap_t *bm, uint32_t count)
     for (uint32_t i = 0; i < count; ++i)
         bwfs_bm_set(bm, start + i, 1);
 
+    bm->free_blocks -= bm->free_blocks >= count ? count : bm->free_blocks;
+    bm->cursor = start + count;
     return start;
 }
 
 void bwfs_free_blocks(bwfs_bitmap_t *bm, uint32_t start, uint32_t count)
 {
-    for (uint32_t i = 0; i < count; ++i)
-        bwfs_bm_set(bm, start + i, 0);
+    bwfs_txn_lock_alloc();
+    uint64_t tag = bm->free_tag ? bm->free_tag(count) : 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t b = start + i;
+        if (!bwfs_bm_test(bm, b) || pending_test(bm, b))
+            continue;           /* doble liberación: no descuadrar el contador */
+        if (bm->retain && bm->retain(b))
+            continue;           /* pasa a una instantánea */
+        if (tag == 0 || !defer_free(bm, b, tag))
+            bwfs_bm_set(bm, b, 0);
+        ++bm->free_blocks;
+    }
+}
+
+int bwfs_alloc_policy_from_name(const char *name)
+{
+    for (int p = 0; p < BWFS_ALLOC_POLICY_COUNT; ++p)
+        if (strcmp(name, policy_names[p]) == 0)
+            return p;
+    return -1;
+}
+
+const char *bwfs_alloc_policy_name(uint32_t policy)
+{
+    return policy < BWFS_ALLOC_POLICY_COUNT ? policy_names[policy] : "?";
 }
@@ -5,14 +5,60 @@
  * \file bitmap.c
  * \brief Persistencia y carga del mapa de bits de bloques BWFS.
  *
- * El mapa de bits se guarda íntegro en el **bloque lógico 1**.  Cada bit
- * representa el estado (0 = libre, 1 = ocupado) de un bloque lógico de datos.
+ * El mapa de bits se guarda íntegro en un bloque (el 1 salvo que el
+ * superbloque diga otra cosa en `block_bitmap_blk`).  Cada bit representa el
+ * estado (0 = libre, 1 = ocupado) de un bloque lógico de datos.
+ *
+ * Con copia B (`alt_blk`, #BWFS_FEAT_INCOMPAT_DUAL) cada escritura va a la
+ * copia que no es la vigente, con una cola (\ref bwfs_bitmap_tail_t) de
+ * secuencia y checksum al final del bloque; al leer gana la válida de mayor
+ * secuencia.  Un corte a medias de una escritura deja la anterior entera.
  */
 
 #include "bitmap.h"
+#include "txn.h"
 #include "util.h"
 
 #include <stdlib.h>   /* malloc, free */
+#include <string.h>   /* memcpy, memset */
+
+/** Secuencia de la copia vigente (par en A, impar en B). */
+static uint32_t bm_seq;
+
+/** Bloque donde vive el bitmap (0 = el histórico). */
+static uint32_t bitmap_block(const bwfs_bitmap_t *bm)
+{
+    return bm->bitmap_blk ? bm->bitmap_blk : BWFS_BITMAP_BLK;
+}
+
+/** Copia que toca a la secuencia `seq`. */
+static uint32_t slot_blk(const bwfs_bitmap_t *bm, uint32_t seq)
+{
+    return (seq & 1U) ? bm->alt_blk : bitmap_block(bm);
+}
+
+static uint32_t tail_sum(const uint8_t *map, size_t bytes, bwfs_bitmap_tail_t t)
+{
+    t.checksum = 0;
+    return bwfs_checksum(bwfs_checksum(BWFS_CHECKSUM_SEED, map, bytes), &t, sizeof t);
+}
+
+/** \brief Lee la copia `blk` en `map`; false si no es válida. */
+static bool read_slot(const bwfs_bitmap_t *bm, const char *fs_dir, uint32_t blk,
+                      uint8_t *map, uint32_t *seq)
+{
+    size_t bytes = (bm->total_blocks + 7) / 8;
+    bwfs_bitmap_tail_t t;
+
+    if (util_read_block_range(fs_dir, blk, BWFS_BLOCK_SIZE_BYTES - sizeof t,
+                              (uint8_t *)&t, sizeof t) != 0 ||
+        t.magic != BWFS_BITMAP_TAIL_MAGIC || slot_blk(bm, t.seq) != blk ||
+        util_read_block(fs_dir, blk, map, bytes) != 0 ||
+        t.checksum != tail_sum(map, bytes, t))
+        return false;
+    *seq = t.seq;
+    return true;
+}
 
 /* ------------------------------------------------------------------------- */
 /* Operaciones públicas                                                      */
@@ -24,13 +70,41 @@
  * \param[in] bm     Bitmap en memoria (con `total_blocks` y `map` válidos).
  * \param[in] fs_dir Directorio raíz del sistema de archivos.
  * \retval BWFS_OK       Éxito.
- * \retval BWFS_ERR_IO   No se pudo escribir el bloque 1.
+ * \retval BWFS_ERR_IO   No se pudo escribir el bloque del bitmap.
  */
 int bwfs_write_bitmap(const bwfs_bitmap_t *bm, const char *fs_dir)
 {
     size_t bytes = (bm->total_blocks + 7) / 8;
 
-    if (util_write_block(fs_dir, BWFS_BITMAP_BLK, bm->map, bytes) != 0)
+    bwfs_txn_lock_alloc();
+    uint8_t *buf = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!buf)
+        return BWFS_ERR_NOMEM;
+
+    /* Los bloques apartados hasta confirmar su liberación ya van libres */
+    memcpy(buf, bm->map, bytes);
+    if (bm->npend > 0)
+        for (size_t i = 0; i < bytes; ++i)
+            buf[i] &= (uint8_t)~bm->pending[i];
+
+    int rc;
+    if (bm->alt_blk == 0) {
+        rc = util_write_block(fs_dir, bitmap_block(bm), buf, bytes);
+    } else {
+        /* La vigente solo se pisa mientras no haya salido de memoria */
+        if (!util_block_held(slot_blk(bm, bm_seq)))
+            bm_seq++;
+
+        bwfs_bitmap_tail_t t = { BWFS_BITMAP_TAIL_MAGIC, bm_seq, 0, 0 };
+        t.checksum = tail_sum(buf, bytes, t);
+        memset(buf + bytes, 0, BWFS_BLOCK_SIZE_BYTES - bytes - sizeof t);
+        memcpy(buf + BWFS_BLOCK_SIZE_BYTES - sizeof t, &t, sizeof t);
+
+        rc = util_write_block(fs_dir, slot_blk(bm, bm_seq), buf,
+                              BWFS_BLOCK_SIZE_BYTES);
+    }
+    free(buf);
+    if (rc != 0)
         return BWFS_ERR_IO;
 
     BWFS_LOG_INFO("Bitmap escrito (%u bloques gestionados)", bm->total_blocks);
@@ -41,13 +115,14 @@ int bwfs_write_bitmap(const bwfs_bitmap_t *bm, const char *fs_dir)
  * \brief Carga el mapa de bits desde disco.
  *
  * La función reserva memoria para `bm->map`; el llamante debe liberarla con
- * `free()` cuando ya no sea necesaria.
+ * `free()` cuando ya no sea necesaria.  No toca `free_blocks`: el llamante
+ * lo toma del superbloque o lo recalcula con \ref bwfs_bitmap_count_free.
  *
  * \param[in,out] bm  Estructura a rellenar (debe traer `total_blocks`).
  * \param[in]     fs_dir Directorio raíz del FS.
  * \retval BWFS_OK        Éxito.
  * \retval BWFS_ERR_NOMEM Memoria insuficiente para el buffer.
- * \retval BWFS_ERR_IO    Fallo de lectura del bloque 1.
+ * \retval BWFS_ERR_IO    Fallo de lectura del bloque del bitmap.
  */
 int bwfs_read_bitmap(bwfs_bitmap_t *bm, const char *fs_dir)
 {
@@ -57,11 +132,61 @@ int bwfs_read_bitmap(bwfs_bitmap_t *bm, const char *fs_dir)
     if (!bm->map)
         return BWFS_ERR_NOMEM;
 
-    if (util_read_block(fs_dir, BWFS_BITMAP_BLK, bm->map, bytes) != 0) {
-        free(bm->map);
-        return BWFS_ERR_IO;
+    if (bm->alt_blk == 0) {
+        if (util_read_block(fs_dir, bitmap_block(bm), bm->map, bytes) != 0) {
+            free(bm->map);
+            bm->map = NULL;
+            return BWFS_ERR_IO;
+        }
+    } else {
+        uint8_t *b = (uint8_t *)malloc(bytes);
+        if (!b) {
+            free(bm->map);
+            bm->map = NULL;
+            return BWFS_ERR_NOMEM;
+        }
+        uint32_t sa = 0, sb = 0;
+        bool a_ok = read_slot(bm, fs_dir, bitmap_block(bm), bm->map, &sa);
+        bool b_ok = read_slot(bm, fs_dir, bm->alt_blk, b, &sb);
+        if (b_ok && (!a_ok || (int32_t)(sb - sa) > 0)) {
+            if (!a_ok)
+                BWFS_LOG_INFO("Bitmap: copia A dañada, se usa la B (secuencia %u)", sb);
+            memcpy(bm->map, b, bytes);
+            sa = sb;
+        }
+        free(b);
+        if (!a_ok && !b_ok) {
+            BWFS_LOG_ERROR("Bitmap: ninguna copia válida (bloques %u y %u)",
+                           bitmap_block(bm), bm->alt_blk);
+            free(bm->map);
+            bm->map = NULL;
+            return BWFS_ERR_IO;
+        }
+        bm_seq = sa;
     }
 
     bm->bits_per_block = BWFS_BLOCK_SIZE_BITS;
     return BWFS_OK;
 }
+
+/**
+ * \brief Cuenta los bloques libres recorriendo el mapa completo.
+ *
+ * Solo hace falta tras un desmontaje no limpio o en fsck; el resto del
+ * tiempo `free_blocks` se mantiene al reservar y liberar.
+ *
+ * \param[in] bm  Bitmap cargado.
+ * \return Número de bits a 0 entre 0 y `total_blocks`.
+ */
+uint32_t bwfs_bitmap_count_free(const bwfs_bitmap_t *bm)
+{
+    uint32_t full  = bm->total_blocks / 8;
+    uint32_t used  = 0;
+
+    for (uint32_t i = 0; i < full; ++i)
+        used += (uint32_t)__builtin_popcount(bm->map[i]);
+    for (uint32_t b = full * 8; b < bm->total_blocks; ++b)
+        used += bwfs_bm_test(bm, b) ? 1U : 0U;
+
+    return bm->total_blocks - used;
+}
@@ -8,19 +8,147 @@
  *
  * El superbloque es la “cabecera” del disco: contiene la cuenta total de
  * bloques, la ubicación del inodo raíz y banderas globales.  Reside
- * *siempre* en el **bloque lógico 0** (véase BWFS_SUPERBLOCK_BLK).
+ * *siempre* en el **bloque lógico 0** (véase BWFS_SUPERBLOCK_BLK); con
+ * #BWFS_FEAT_INCOMPAT_DUAL hay además una copia B en el bloque 1 y cada
+ * escritura alterna entre las dos (secuencia par en A, impar en B).
  *
  * Todas las operaciones de E/S delegan en los helpers genéricos declarados en
  * `util.h` (`util_write_block`, `util_read_block`), los cuales tratan cada
- * bloque como un archivo-PNG contenedor de 1000 × 1000 bits en blanco y negro.
+ * bloque como un archivo-imagen de `width × height` bits en blanco y negro
+ * (1000 × 1000 por defecto; véase \ref bwfs_geom).
  */
 
 #include "bwfs_common.h"
+#include "txn.h"
 #include "util.h"
 
 #include <string.h>   /* memset */
 #include <stdio.h>    /* NULL */
 
+/* ------------------------------------------------------------------------- */
+/* Geometría                                                                 */
+/* ------------------------------------------------------------------------- */
+
+bwfs_geometry_t bwfs_geom = {
+    BWFS_BLOCK_PX, BWFS_BLOCK_PX,
+    BWFS_BLOCK_PX * BWFS_BLOCK_PX, BWFS_BLOCK_PX * BWFS_BLOCK_PX / 8U,
+    4096U
+};
+
+int bwfs_geometry_set(uint32_t width, uint32_t height)
+{
+    uint64_t bits = (uint64_t)width * height;
+
+    if (width == 0 || height == 0 ||
+        width % BWFS_BLOCK_PX_ALIGN != 0 || height % BWFS_BLOCK_PX_ALIGN != 0 ||
+        bits < BWFS_BLOCK_BITS_MIN || bits > BWFS_BLOCK_BITS_MAX)
+        return BWFS_ERR_FULL;
+
+    uint32_t bytes   = (uint32_t)(bits / 8U);
+    uint32_t buckets = 1;
+    while (buckets * 2U <= bytes / 24U)
+        buckets *= 2U;
+
+    bwfs_geom.width       = width;
+    bwfs_geom.height      = height;
+    bwfs_geom.bits        = (uint32_t)bits;
+    bwfs_geom.bytes       = bytes;
+    bwfs_geom.dir_buckets = buckets;
+    return BWFS_OK;
+}
+
+int bwfs_geometry_load(const bwfs_superblock_t *sb)
+{
+    /* Discos anteriores a la geometría variable: 1000 × 1000 */
+    if (sb->block_width == 0 && sb->block_height == 0)
+        return sb->block_size == BWFS_BLOCK_PX * BWFS_BLOCK_PX
+             ? bwfs_geometry_set(BWFS_BLOCK_PX, BWFS_BLOCK_PX) : BWFS_ERR_FULL;
+
+    if ((uint64_t)sb->block_width * sb->block_height != sb->block_size)
+        return BWFS_ERR_FULL;
+    return bwfs_geometry_set(sb->block_width, sb->block_height);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Copias A/B                                                                */
+/* ------------------------------------------------------------------------- */
+
+/** Secuencia de la copia vigente (la última leída o escrita). */
+static uint32_t sb_seq;
+
+uint32_t bwfs_checksum(uint32_t h, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    while (len--) {
+        h ^= *p++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+static uint32_t sb_sum(const bwfs_superblock_t *sb)
+{
+    bwfs_superblock_t c = *sb;
+    c.checksum = 0;
+    return bwfs_checksum(BWFS_CHECKSUM_SEED, &c, sizeof c);
+}
+
+static uint32_t slot_blk(uint32_t seq)
+{
+    return (seq & 1U) ? BWFS_SUPERBLOCK_ALT_BLK : BWFS_SUPERBLOCK_BLK;
+}
+
+uint32_t bwfs_sb_current_blk(const bwfs_superblock_t *sb)
+{
+    return (sb->feature_incompat & BWFS_FEAT_INCOMPAT_DUAL)
+           ? slot_blk(sb_seq) : BWFS_SUPERBLOCK_BLK;
+}
+
+/** \brief Lee la copia de `blk`; false si no es un superbloque DUAL válido. */
+static bool read_slot(const char *fs_dir, uint32_t blk, bwfs_superblock_t *sb)
+{
+    return util_read_block_range(fs_dir, blk, 0, (uint8_t *)sb, sizeof *sb) == 0 &&
+           sb->magic == BWFS_MAGIC &&
+           (sb->feature_incompat & BWFS_FEAT_INCOMPAT_DUAL) &&
+           slot_blk(sb->seq) == blk && sb->checksum == sb_sum(sb);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Características                                                           */
+/* ------------------------------------------------------------------------- */
+
+int bwfs_features_check(const bwfs_superblock_t *sb, bool writable)
+{
+    uint32_t incompat = sb->feature_incompat  & ~BWFS_FEAT_INCOMPAT_SUPP;
+    uint32_t ro       = sb->feature_ro_compat & ~BWFS_FEAT_RO_COMPAT_SUPP;
+
+    if (incompat) {
+        BWFS_LOG_ERROR("Características incompatibles desconocidas: 0x%08x",
+                       incompat);
+        return BWFS_ERR_FULL;
+    }
+    if (writable && ro) {
+        BWFS_LOG_ERROR("Características desconocidas (solo lectura): 0x%08x",
+                       ro);
+        return BWFS_ERR_FULL;
+    }
+    return BWFS_OK;
+}
+
+void bwfs_features_upgrade(bwfs_superblock_t *sb)
+{
+    sb->feature_compat   |= BWFS_FEAT_COMPAT_COUNTERS;
+    sb->feature_incompat |= BWFS_FEAT_INCOMPAT_INLINE  |
+                            BWFS_FEAT_INCOMPAT_EXTENTS |
+                            BWFS_FEAT_INCOMPAT_DIRVAR  |
+                            BWFS_FEAT_INCOMPAT_FRAG    |
+                            BWFS_FEAT_INCOMPAT_DIRATTR;
+    if (bwfs_geom.width != BWFS_BLOCK_PX || bwfs_geom.height != BWFS_BLOCK_PX)
+        sb->feature_incompat |= BWFS_FEAT_INCOMPAT_GEOMETRY;
+    if (sb->block_bitmap_blk == 0)
+        sb->block_bitmap_blk = BWFS_BITMAP_BLK;
+}
+
 /* ------------------------------------------------------------------------- */
 /* API pública                                                               */
 /* ------------------------------------------------------------------------- */
@@ -33,16 +161,38 @@
  *
  * \param[out] sb           Puntero a la estructura a inicializar.
  * \param[in]  total_blocks Cantidad de bloques lógicos del nuevo disco.
+ * \param[in]  inode_count  Inodos deseados (se redondea a bloques llenos).
  */
-void bwfs_init_superblock(bwfs_superblock_t *sb, uint32_t total_blocks)
+void bwfs_init_superblock(bwfs_superblock_t *sb, uint32_t total_blocks,
+                          uint32_t inode_count)
 {
+    uint32_t table_blocks = (inode_count + BWFS_INODES_PER_BLOCK - 1)
+                            / BWFS_INODES_PER_BLOCK;
+    if (table_blocks == 0)
+        table_blocks = 1;
+    /* El bitmap de inodos es un único bloque: a lo sumo 1 bit por inodo */
+    if ((uint64_t)table_blocks * BWFS_INODES_PER_BLOCK > BWFS_BLOCK_SIZE_BITS)
+        table_blocks = BWFS_BLOCK_SIZE_BITS / BWFS_INODES_PER_BLOCK;
+
     memset(sb, 0, sizeof *sb);
 
     sb->magic        = BWFS_MAGIC;
     sb->total_blocks = total_blocks;
     sb->root_inode   = 0;                    /* se fijará tras crear el raíz   */
-    sb->block_size   = BWFS_BLOCK_SIZE_BITS; /* constante del formato          */
+    sb->block_size   = BWFS_BLOCK_SIZE_BITS; /* geometría activa               */
     sb->flags        = 0;                    /* sin cifrado ni resize por def. */
+    sb->alloc_policy = 0;                    /* Worst-Fit (comportamiento v1)  */
+    sb->version      = BWFS_VERSION;
+
+    sb->inode_count        = table_blocks * BWFS_INODES_PER_BLOCK;
+    sb->inode_bitmap_blk   = BWFS_INODE_BITMAP_BLK;
+    sb->inode_table_blk    = BWFS_INODE_TABLE_BLK;
+    sb->inode_table_blocks = table_blocks;
+    sb->block_width        = bwfs_geom.width;
+    sb->block_height       = bwfs_geom.height;
+    sb->block_bitmap_blk   = BWFS_BITMAP_BLK;
+    sb->state              = BWFS_STATE_CLEAN;   /* mkfs fija los contadores */
+    bwfs_features_upgrade(sb);
 }
 
 /**
@@ -55,10 +205,23 @@ void bwfs_init_superblock(bwfs_superblock_t *sb, uint32_t total_blocks)
  */
 int bwfs_write_superblock(const bwfs_superblock_t *sb, const char *fs_dir)
 {
+    bwfs_txn_lock_alloc();
+    bwfs_superblock_t c   = *sb;
+    uint32_t          blk = BWFS_SUPERBLOCK_BLK;
+
+    if (sb->feature_incompat & BWFS_FEAT_INCOMPAT_DUAL) {
+        /* La vigente solo se pisa mientras no haya salido de memoria */
+        if (!util_block_held(slot_blk(sb_seq)))
+            sb_seq++;
+        c.seq      = sb_seq;
+        c.checksum = sb_sum(&c);
+        blk        = slot_blk(sb_seq);
+    }
+
     if (util_write_block(fs_dir,
-                         BWFS_SUPERBLOCK_BLK,
-                         (const uint8_t *)sb,
-                         sizeof *sb) != 0)
+                         blk,
+                         (const uint8_t *)&c,
+                         sizeof c) != 0)
     {
         return BWFS_ERR_IO;
     }
@@ -73,31 +236,100 @@ int bwfs_write_superblock(const bwfs_superblock_t *sb, const char *fs_dir)
  *
  * Se comprueban:
  *  - Número mágico (\c BWFS_MAGIC).
- *  - Tamaño de bloque (\c BWFS_BLOCK_SIZE_BITS).
+ *  - Geometría de bloque, que pasa a ser la activa (\ref bwfs_geom).
+ *  - Revisión del formato (\c BWFS_VERSION) y características
+ *    incompatibles (las `ro_compat` las comprueba quien vaya a escribir).
+ *
+ * Se lee solo la cabecera del bloque 0, así que no hace falta conocer de
+ * antemano el tamaño de bloque.  Con #BWFS_FEAT_INCOMPAT_DUAL (o si el
+ * bloque 0 no se puede leer) se mira también la copia del bloque 1 y gana
+ * la válida de mayor secuencia.
  *
  * \param[out] sb     Estructura en la que se colocarán los datos leídos.
  * \param[in]  fs_dir Directorio del sistema de archivos.
  * \retval BWFS_OK        Lectura satisfactoria y validación exitosa.
  * \retval BWFS_ERR_IO    Fallo de lectura del bloque 0.
- * \retval BWFS_ERR_FULL  Disco no es BWFS o el tamaño de bloque no coincide.
+ * \retval BWFS_ERR_FULL  Disco no es BWFS, la geometría no es válida, el
+ *                       formato es de otra revisión o usa características
+ *                       incompatibles desconocidas.
  */
 int bwfs_read_superblock(bwfs_superblock_t *sb, const char *fs_dir)
 {
-    if (util_read_block(fs_dir,
-                        BWFS_SUPERBLOCK_BLK,
-                        (uint8_t *)sb,
-                        sizeof *sb) != 0)
+    bool a_io = util_read_block_range(fs_dir,
+                                      BWFS_SUPERBLOCK_BLK,
+                                      0,
+                                      (uint8_t *)sb,
+                                      sizeof *sb) != 0;
+
+    if (a_io || sb->magic != BWFS_MAGIC ||
+        (sb->feature_incompat & BWFS_FEAT_INCOMPAT_DUAL))
     {
-        return BWFS_ERR_IO;
+        /* Un corte escribiendo una copia la deja a medias: vale la otra */
+        bwfs_superblock_t b;
+        bool a_ok = !a_io && read_slot(fs_dir, BWFS_SUPERBLOCK_BLK, sb);
+        bool b_ok = read_slot(fs_dir, BWFS_SUPERBLOCK_ALT_BLK, &b);
+        if (b_ok && (!a_ok || (int32_t)(b.seq - sb->seq) > 0)) {
+            if (!a_ok)
+                BWFS_LOG_INFO("Superbloque: copia A dañada, se usa la B "
+                              "(secuencia %u)", b.seq);
+            *sb = b;
+        } else if (!a_ok) {
+            if (a_io)
+                return BWFS_ERR_IO;
+            BWFS_LOG_ERROR("Superbloque inválido: magic=0x%08x, ninguna copia "
+                           "válida", sb->magic);
+            return BWFS_ERR_FULL;
+        }
+        sb_seq = sb->seq;
     }
 
     if (sb->magic != BWFS_MAGIC ||
-        sb->block_size != BWFS_BLOCK_SIZE_BITS)
+        bwfs_geometry_load(sb) != BWFS_OK)
     {
         BWFS_LOG_ERROR("Superbloque inválido: magic=0x%08x, block_size=%u",
                        sb->magic, sb->block_size);
         return BWFS_ERR_FULL;
     }
 
+    if (sb->version != BWFS_VERSION) {
+        BWFS_LOG_ERROR("Formato BWFS v%u no soportado (se espera v%u)",
+                       sb->version ? sb->version : 1U, BWFS_VERSION);
+        return BWFS_ERR_FULL;
+    }
+
+    if (bwfs_features_check(sb, false) != BWFS_OK)
+        return BWFS_ERR_FULL;
+
+    if (sb->inode_table_blk + sb->inode_table_blocks > sb->total_blocks ||
+        bwfs_sb_bitmap_blk(sb) >= sb->total_blocks ||
+        sb->inode_count > sb->inode_table_blocks * BWFS_INODES_PER_BLOCK ||
+        sb->root_inode == 0 || sb->root_inode >= sb->inode_count)
+    {
+        BWFS_LOG_ERROR("Superbloque inválido: tabla de inodos %u+%u, %u inodos, raíz %u",
+                       sb->inode_table_blk, sb->inode_table_blocks,
+                       sb->inode_count, sb->root_inode);
+        return BWFS_ERR_FULL;
+    }
+
+    if ((sb->feature_incompat & BWFS_FEAT_INCOMPAT_DUAL) &&
+        (sb->bitmap_alt_blk <= BWFS_SUPERBLOCK_ALT_BLK ||
+         sb->bitmap_alt_blk >= sb->total_blocks ||
+         sb->bitmap_alt_blk == bwfs_sb_bitmap_blk(sb) ||
+         sb->total_blocks > BWFS_BITMAP_DUAL_MAX))
+    {
+        BWFS_LOG_ERROR("Superbloque inválido: copia B del bitmap en %u",
+                       sb->bitmap_alt_blk);
+        return BWFS_ERR_FULL;
+    }
+
+    if (sb->journal_blocks != 0 &&
+        ((uint64_t)sb->journal_blk + sb->journal_blocks > sb->total_blocks ||
+         sb->journal_blocks < 2))
+    {
+        BWFS_LOG_ERROR("Superbloque inválido: diario %u+%u",
+                       sb->journal_blk, sb->journal_blocks);
+        return BWFS_ERR_FULL;
+    }
+
     return BWFS_OK;
 }
@@ -5,65 +5,979 @@
  * \file dir.c
  * \brief Manipulación de directorios para BWFS
  *
- *  - Cada directorio se almacena inicialmente en **un solo bloque** de datos
- *    que contiene un arreglo fijo de registros \ref bwfs_dir_entry_t.
+ *  - Cada bloque-directorio (\ref bwfs_dir_block_t) es una tabla hash de
+ *    #BWFS_DIR_BUCKETS cubetas con sondeo lineal (4096 en bloques de
+ *    1000 × 1000) seguida de un heap de registros de longitud variable
+ *    (\ref bwfs_dirent_t, alineados a 8 bytes): un nombre corto ocupa 56
+ *    bytes en vez de 260.  Dentro del bloque, buscar, insertar y borrar
+ *    tocan O(1) registros: se lee la tabla (16 KB) y después solo los
+ *    registros cuyo hash coincide, con E/S por rangos.
+ *    Borrar compacta el heap, así que readdir lo recorre sin huecos.
+ *  - Cada registro copia el tipo, el tamaño, los bloques y las marcas de
+ *    tiempo del hijo:
+ *    readdir rellena `struct stat` sin leer inodos.  El hijo recuerda su
+ *    padre y el hash de su nombre, que bastan para volver a su registro
+ *    (\ref bwfs_dir_update_attr) aunque divisiones y compactaciones lo
+ *    muevan.
+ *  - Un directorio empieza con un único bloque; al llenarse se convierte en
+ *    un **árbol B+** indexado por hash (\ref bwfs_dir_node_t) cuyas hojas
+ *    son esos bloques.  Las hojas se dividen por la mediana al llenarse y
+ *    se fusionan con su hermana al vaciarse, de una en una.
+ *  - Los bloques antiguos de registros fijos (arreglo lineal de 480 sin
+ *    cabecera, o 464 tras la tabla hash) y las hojas de registros variables
+ *    sin atributos se siguen leyendo; la primera inserción o borrado los
+ *    convierte al formato actual (dividiendo la hoja si ya no cabe).
  *  - El bloque se asigna bajo demanda cuando se inserta la primera entrada.
- *  - Para la versión mínima NO se soporta la expansión a múltiples bloques;
- *    si el bloque se llena, la función devuelve \c BWFS_ERR_FULL.
  */
 
 #include "dir.h"
+#include "inode.h"
 #include "bitmap.h"
 #include "util.h"
 #include "allocation.h"
 
-#include <string.h>   /* strncpy, strcmp */
+#include <string.h>   /* memcpy, memcmp, strncmp */
 #include <stdlib.h>   /* malloc, calloc, free */
+#include <stddef.h>   /* offsetof */
+
+#define BUCKET_MASK (BWFS_DIR_BUCKETS - 1U)
+
+/** Niveles máximos del árbol (con miles de hijos por nodo sobran). */
+#define DIR_MAX_DEPTH   8
+
+/** Cubetas leídas de una vez al buscar una entrada por su inodo. */
+#define ATTR_WINDOW     32U
+
+/** Hijos por nodo interno antes de dividirlo. */
+#ifndef DIR_NODE_MAX
+#define DIR_NODE_MAX    BWFS_DIR_NODE_CAP
+#endif
+
+/** Una hoja con menos bytes que esto intenta fusionarse... */
+#define DIR_MERGE_BELOW (BWFS_DIR_HEAP_SIZE / 4U)
+/** ...si con su hermana no supera esto (histéresis frente a la división). */
+#define DIR_MERGE_BYTES (BWFS_DIR_HEAP_SIZE * 3U / 4U)
+#define DIR_MERGE_MAX   (BWFS_DIR_HASH_ENTRIES * 3U / 4U)
+
+/** Claves e hijos de un nodo interno cargado en memoria. */
+#define KEYS(node)      bwfs_dir_node_keys(node)
+#define CHILDREN(node)  bwfs_dir_node_children(node)
+
+/* ------------------------------------------------------------------------- */
+/* Hash de nombres (xxHash32, semilla 0)                                     */
+/* ------------------------------------------------------------------------- */
+
+#define XXH_P1 0x9E3779B1U
+#define XXH_P2 0x85EBCA77U
+#define XXH_P3 0xC2B2AE3DU
+#define XXH_P4 0x27D4EB2FU
+#define XXH_P5 0x165667B1U
+
+static inline uint32_t rotl32(uint32_t x, unsigned r)
+{
+    return (x << r) | (x >> (32U - r));
+}
+
+/** Lectura little-endian: el hash queda en disco y no debe depender del host. */
+static inline uint32_t read_le32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t xxh_round(uint32_t acc, uint32_t in)
+{
+    return rotl32(acc + in * XXH_P2, 13) * XXH_P1;
+}
+
+uint32_t bwfs_dir_name_hash(const char *name)
+{
+    const uint8_t *p   = (const uint8_t *)name;
+    size_t         len = strlen(name);
+    const uint8_t *end = p + len;
+    uint32_t       h;
+
+    if (len >= 16) {
+        uint32_t v1 = XXH_P1 + XXH_P2, v2 = XXH_P2, v3 = 0, v4 = 0U - XXH_P1;
+        do {
+            v1 = xxh_round(v1, read_le32(p));      p += 4;
+            v2 = xxh_round(v2, read_le32(p));      p += 4;
+            v3 = xxh_round(v3, read_le32(p));      p += 4;
+            v4 = xxh_round(v4, read_le32(p));      p += 4;
+        } while (p + 16 <= end);
+        h = rotl32(v1, 1) + rotl32(v2, 7) + rotl32(v3, 12) + rotl32(v4, 18);
+    } else {
+        h = XXH_P5;
+    }
+
+    h += (uint32_t)len;
+    for (; p + 4 <= end; p += 4)
+        h = rotl32(h + read_le32(p) * XXH_P3, 17) * XXH_P4;
+    for (; p < end; ++p)
+        h = rotl32(h + *p * XXH_P5, 11) * XXH_P1;
+
+    h ^= h >> 15;  h *= XXH_P2;
+    h ^= h >> 13;  h *= XXH_P3;
+    h ^= h >> 16;
+    return h;
+}
 
 /* ------------------------------------------------------------------------- */
 /* Helpers                                                                   */
 /* ------------------------------------------------------------------------- */
 
-/** Número máximo de entradas por bloque-directorio. */
-static inline size_t max_entries_per_block(void)
+/** Número de registros de un bloque-directorio lineal (formato antiguo). */
+static inline size_t max_legacy_entries(void)
 {
     return BWFS_BLOCK_SIZE_BYTES / sizeof(bwfs_dir_entry_t);
 }
 
+/** Desplazamiento del primer registro dentro del bloque. */
+#define HEAP_OFF   BWFS_DIR_INDEX_SIZE
+
+/** Registro más largo posible (nombre de BWFS_NAME_MAX bytes). */
+#define RECORD_MAX BWFS_DIRENT_LEN(BWFS_NAME_MAX)
+
+/** Espacio para un registro completo, con la cabecera alineada. */
+typedef union {
+    bwfs_dirent_t de;
+    uint8_t       raw[RECORD_MAX];
+} dirent_buf_t;
+
+static inline uint32_t bucket_make(uint32_t hash, size_t off)
+{
+    return ((hash & 0xFFFFU) << 16) | (uint32_t)(off / 8U);
+}
+
+static inline uint32_t bucket_home(uint32_t bucket)
+{
+    return (bucket >> 16) & BUCKET_MASK;
+}
+
+/** Desplazamiento (en el bloque) del registro al que apunta la cubeta. */
+static inline size_t bucket_off(uint32_t bucket)
+{
+    return (size_t)(bucket & 0xFFFFU) * 8U;
+}
+
+/** \brief Reserva espacio para la cabecera y la tabla de cubetas. */
+static bwfs_dir_index_t *index_alloc(void)
+{
+    return (bwfs_dir_index_t *)malloc(BWFS_DIR_INDEX_SIZE);
+}
+
+/** \brief Lee la cabecera y la tabla de cubetas (primeros 16 KB de la hoja). */
+static int load_index(uint32_t leaf, const char *fs_dir, bwfs_dir_index_t *idx)
+{
+    return util_read_block_range(fs_dir, leaf, 0,
+                                 (uint8_t *)idx, BWFS_DIR_INDEX_SIZE) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+static int store_index(uint32_t leaf, const char *fs_dir, const bwfs_dir_index_t *idx)
+{
+    return util_write_block_range(fs_dir, leaf, 0,
+                                  (const uint8_t *)idx, BWFS_DIR_INDEX_SIZE) ? BWFS_ERR_IO : BWFS_OK;
+}
+
 /**
- * \brief Lee todas las entradas del bloque-directorio a un buffer reservado.
- *
- * \param dir_inode  Inodo del directorio (debe tener \c block_count>0).
- * \param fs_dir     Ruta al disco BWFS.
- * \param[out] out   Buffer destino (tamaño \c max_entries_per_block()).
- * \retval BWFS_OK o código BWFS_ERR_*
+ * \brief Comprueba que el registro en `p` (con `avail` bytes disponibles)
+ *        esté completo y termine su nombre en NUL.
  */
-static int load_entries(const bwfs_inode_t *dir_inode,
-                        const char         *fs_dir,
-                        bwfs_dir_entry_t   *out)
-{
-    if (util_read_block(fs_dir,
-                        dir_inode->blocks[0],
-                        (uint8_t *)out,
-                        BWFS_BLOCK_SIZE_BYTES) != 0)
+static bool record_ok(const bwfs_dirent_t *de, size_t avail)
+{
+    return avail >= sizeof *de &&
+           de->rec_len >= BWFS_DIRENT_LEN(de->name_len) &&
+           de->rec_len <= avail &&
+           de->name[de->name_len] == '\0';
+}
+
+/** \brief Construye en `r` el registro de `name` → `ino`. */
+static void make_record(dirent_buf_t *r, const char *name, uint32_t ino, uint8_t type)
+{
+    size_t len = strlen(name);
+    if (len > BWFS_NAME_MAX) len = BWFS_NAME_MAX;
+
+    memset(r->raw, 0, sizeof r->raw);
+    r->de.ino      = ino;
+    r->de.name_len = (uint8_t)len;
+    r->de.type     = type;
+    r->de.rec_len  = BWFS_DIRENT_LEN(len);
+    r->de.blocks   = BWFS_DIRENT_NOATTR;
+    memcpy(r->de.name, name, len);
+    r->de.hash     = bwfs_dir_name_hash(r->de.name);
+}
+
+/** \brief Copia en el registro el tamaño, los bloques y los tiempos de `child`. */
+static inline void record_set_attr(bwfs_dirent_t *de, const bwfs_inode_t *child)
+{
+    de->size     = bwfs_inode_size(child);
+    de->blocks   = child->block_count;
+    de->atime_ns = child->atime_ns;
+    de->mtime_ns = child->mtime_ns;
+    de->ctime_ns = child->ctime_ns;
+}
+
+/** \brief Igual que \ref record_ok para un registro sin atributos. */
+static bool short_ok(const bwfs_dirent_short_t *de, size_t avail)
+{
+    return avail >= sizeof *de &&
+           de->rec_len >= ((sizeof *de + de->name_len + 1U + 7U) & ~7U) &&
+           de->rec_len <= avail &&
+           de->name[de->name_len] == '\0';
+}
+
+/**
+ * \brief Lee el registro que empieza en el byte `off` de la hoja.  En una
+ *        hoja #BWFS_DIR_SHORT_MAGIC se traduce (sin atributos, conservando
+ *        su `rec_len`).
+ */
+static int read_record(uint32_t leaf, const char *fs_dir, uint32_t magic,
+                       size_t off, dirent_buf_t *r)
+{
+    size_t len = BWFS_BLOCK_SIZE_BYTES - off;
+    if (len > sizeof r->raw) len = sizeof r->raw;
+
+    if (util_read_block_range(fs_dir, leaf, off, r->raw, len) != 0)
         return BWFS_ERR_IO;
+    if (magic != BWFS_DIR_SHORT_MAGIC)
+        return record_ok(&r->de, len) ? BWFS_OK : BWFS_ERR_IO;
 
+    dirent_buf_t sr = *r;
+    const bwfs_dirent_short_t *sd = (const bwfs_dirent_short_t *)sr.raw;
+    if (!short_ok(sd, len))
+        return BWFS_ERR_IO;
+    make_record(r, sd->name, sd->ino, sd->type);
+    r->de.rec_len = sd->rec_len;
     return BWFS_OK;
 }
 
+static int write_record(uint32_t leaf, const char *fs_dir, size_t off,
+                        const bwfs_dirent_t *de)
+{
+    return util_write_block_range(fs_dir, leaf, off, (const uint8_t *)de,
+                                  de->rec_len) ? BWFS_ERR_IO : BWFS_OK;
+}
+
 /**
- * \brief Graba el arreglo completo de entradas al bloque-directorio.
+ * \brief Siguiente registro del heap de una hoja cargada en memoria.
+ * \return El registro en `*pos` (y avanza `*pos`), o NULL al final o si el
+ *         registro está dañado.
  */
-static int store_entries(const bwfs_inode_t *dir_inode,
-                         const char         *fs_dir,
-                         const bwfs_dir_entry_t *entries)
+static const bwfs_dirent_t *heap_next(bwfs_dir_block_t *blk, size_t *pos)
+{
+    size_t used = blk->used <= BWFS_DIR_HEAP_SIZE ? blk->used : BWFS_DIR_HEAP_SIZE;
+    if (*pos >= used)
+        return NULL;
+
+    const bwfs_dirent_t *de = (const bwfs_dirent_t *)(bwfs_dir_heap(blk) + *pos);
+    if (!record_ok(de, used - *pos))
+        return NULL;
+    *pos += de->rec_len;
+    return de;
+}
+
+/** \brief \ref heap_next para una hoja #BWFS_DIR_SHORT_MAGIC. */
+static const bwfs_dirent_short_t *short_next(bwfs_dir_block_t *blk, size_t *pos)
+{
+    size_t used = blk->used <= BWFS_DIR_HEAP_SIZE ? blk->used : BWFS_DIR_HEAP_SIZE;
+    if (*pos >= used)
+        return NULL;
+
+    const bwfs_dirent_short_t *de =
+        (const bwfs_dirent_short_t *)(bwfs_dir_heap(blk) + *pos);
+    if (!short_ok(de, used - *pos))
+        return NULL;
+    *pos += de->rec_len;
+    return de;
+}
+
+static int read_block(uint32_t blk, const char *fs_dir, void *buf)
+{
+    return util_read_block(fs_dir, blk, (uint8_t *)buf,
+                           BWFS_BLOCK_SIZE_BYTES) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+static int write_block(uint32_t blk, const char *fs_dir, const void *buf)
 {
-    return util_write_block(fs_dir,
-                            dir_inode->blocks[0],
-                            (const uint8_t *)entries,
+    return util_write_block(fs_dir, blk, (const uint8_t *)buf,
                             BWFS_BLOCK_SIZE_BYTES) ? BWFS_ERR_IO : BWFS_OK;
 }
 
+/**
+ * \brief Busca `name` en la tabla hash de una hoja.
+ *
+ * \param[out] pos  Cubeta de la entrada, o primera cubeta vacía del sondeo.
+ * \param[out] rec  Registro encontrado (solo si se encontró).
+ * \return 1 encontrado, 0 no encontrado, BWFS_ERR_IO en error de lectura.
+ */
+static int probe(uint32_t leaf, const char *fs_dir,
+                 const bwfs_dir_index_t *idx, const char *name, uint32_t hash,
+                 uint32_t *pos, dirent_buf_t *rec)
+{
+    uint32_t p = hash & BUCKET_MASK;
+
+    for (uint32_t n = 0; n < BWFS_DIR_BUCKETS; ++n, p = (p + 1) & BUCKET_MASK) {
+        uint32_t b = idx->buckets[p];
+        if (b == 0) {
+            *pos = p;
+            return 0;
+        }
+        if ((b >> 16) != (hash & 0xFFFFU))
+            continue;                       /* hash distinto: sin leer */
+
+        if (read_record(leaf, fs_dir, idx->magic, bucket_off(b), rec) != BWFS_OK)
+            return BWFS_ERR_IO;
+        if (rec->de.hash == hash &&
+            strncmp(rec->de.name, name, BWFS_NAME_MAX) == 0) {
+            *pos = p;
+            return 1;
+        }
+    }
+    *pos = UINT32_MAX;                      /* tabla llena (no ocurre) */
+    return 0;
+}
+
+static void index_insert(bwfs_dir_index_t *idx, uint32_t hash, size_t off)
+{
+    uint32_t p = hash & BUCKET_MASK;
+    while (idx->buckets[p] != 0)
+        p = (p + 1) & BUCKET_MASK;
+    idx->buckets[p] = bucket_make(hash, off);
+}
+
+/**
+ * \brief Vacía la cubeta `p` con borrado por desplazamiento hacia atrás:
+ *        no deja lápidas, así que las búsquedas siguen siendo cortas.
+ */
+static void index_delete(bwfs_dir_index_t *idx, uint32_t p)
+{
+    for (;;) {
+        idx->buckets[p] = 0;
+        uint32_t q = p;
+        for (;;) {
+            q = (q + 1) & BUCKET_MASK;
+            if (idx->buckets[q] == 0)
+                return;
+            uint32_t home = bucket_home(idx->buckets[q]);
+            /* ¿home cae cíclicamente en (p, q]?  Entonces se queda. */
+            bool stays = (p <= q) ? (p < home && home <= q)
+                                  : (p < home || home <= q);
+            if (!stays)
+                break;
+        }
+        idx->buckets[p] = idx->buckets[q];
+        p = q;
+    }
+}
+
+/** \brief ¿Cabe un registro de `rec_len` bytes más en la hoja? */
+static inline bool leaf_fits(const bwfs_dir_index_t *idx, size_t rec_len)
+{
+    return idx->count < BWFS_DIR_HASH_ENTRIES &&
+           idx->used + rec_len <= BWFS_DIR_HEAP_SIZE;
+}
+
+/** \brief Añade `de` al final del heap de una hoja cargada en memoria. */
+static void leaf_append(bwfs_dir_block_t *leaf, const bwfs_dirent_t *de)
+{
+    memcpy(bwfs_dir_heap(leaf) + leaf->used, de, de->rec_len);
+    index_insert(leaf, de->hash, HEAP_OFF + leaf->used);
+    leaf->used += de->rec_len;
+    leaf->count++;
+}
+
+/**
+ * \brief Registros fijos de un bloque en formato antiguo (lineal o hash de
+ *        registros fijos) ya cargado en memoria.
+ *
+ * \param[out] n     Registros a examinar (los de `ino == 0` están libres).
+ * \param[out] next  Hoja siguiente (0 en el formato lineal).
+ */
+static const bwfs_dir_entry_t *old_entries(const uint8_t *blk, size_t *n, uint32_t *next)
+{
+    uint32_t hdr[3];
+    memcpy(hdr, blk, sizeof hdr);
+
+    if (hdr[0] == BWFS_DIR_FIXED_MAGIC) {
+        /* Solo existe en bloques de 1000 × 1000; acotado por si acaso */
+        size_t fit = BWFS_BLOCK_SIZE_BYTES > BWFS_DIR_FIXED_OFF
+                   ? (BWFS_BLOCK_SIZE_BYTES - BWFS_DIR_FIXED_OFF) / sizeof(bwfs_dir_entry_t) : 0;
+        if (fit > BWFS_DIR_FIXED_ENTRIES) fit = BWFS_DIR_FIXED_ENTRIES;
+        *n    = hdr[1] <= fit ? hdr[1] : fit;
+        *next = hdr[2];
+        return (const bwfs_dir_entry_t *)(blk + BWFS_DIR_FIXED_OFF);
+    }
+    *n    = max_legacy_entries();
+    *next = 0;
+    return (const bwfs_dir_entry_t *)blk;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Árbol B+                                                                  */
+/* ------------------------------------------------------------------------- */
+
+/** Camino raíz → hoja: nodos internos visitados y el hijo elegido en cada uno. */
+typedef struct {
+    uint32_t blk[DIR_MAX_DEPTH];
+    uint32_t slot[DIR_MAX_DEPTH];
+    int      depth;
+} dir_path_t;
+
+/** \brief Lee los 16 bytes de cabecera comunes a hojas y nodos internos. */
+static int read_header(uint32_t blk, const char *fs_dir, uint32_t hdr[4])
+{
+    return util_read_block_range(fs_dir, blk, 0, (uint8_t *)hdr,
+                                 4 * sizeof(uint32_t)) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+/**
+ * \brief Desciende desde la raíz hasta la hoja que cubre `hash`.
+ *
+ * En cada nivel solo se leen la cabecera, las claves (búsqueda binaria) y
+ * el puntero del hijo elegido.
+ *
+ * \param[out] path   Nodos internos recorridos (puede ser NULL).
+ * \param[out] leaf   Bloque de la hoja.
+ * \param[out] magic  Marca de la hoja (distinta de #BWFS_DIR_HASH_MAGIC si
+ *                    es un bloque lineal antiguo).
+ */
+static int descend(const bwfs_inode_t *dir_inode, const char *fs_dir,
+                   uint32_t hash, dir_path_t *path,
+                   uint32_t *leaf, uint32_t *magic)
+{
+    uint32_t blk = dir_inode->blocks[0];
+    int      depth = 0;
+
+    for (;;) {
+        uint32_t hdr[4];
+        if (read_header(blk, fs_dir, hdr) != BWFS_OK)
+            return BWFS_ERR_IO;
+
+        if (hdr[0] != BWFS_DIR_NODE_MAGIC) {
+            if (path) path->depth = depth;
+            *leaf  = blk;
+            *magic = hdr[0];
+            return BWFS_OK;
+        }
+
+        uint32_t n = hdr[2];
+        if (depth == DIR_MAX_DEPTH || n == 0 || n > BWFS_DIR_NODE_CAP)
+            return BWFS_ERR_IO;                 /* nodo corrupto */
+
+        uint32_t *keys = (uint32_t *)malloc(n * sizeof *keys);
+        if (!keys) return BWFS_ERR_NOMEM;
+        if (util_read_block_range(fs_dir, blk, BWFS_DIR_NODE_KEYS_OFF,
+                                  (uint8_t *)keys, n * sizeof *keys) != 0) {
+            free(keys);
+            return BWFS_ERR_IO;
+        }
+
+        /* Mayor i con keys[i] <= hash */
+        uint32_t lo = 0, hi = n;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (keys[mid] <= hash) lo = mid + 1;
+            else                   hi = mid;
+        }
+        free(keys);
+        uint32_t i = lo ? lo - 1 : 0;
+
+        uint32_t child;
+        if (util_read_block_range(fs_dir, blk,
+                                  BWFS_DIR_NODE_CHILDREN_OFF + i * sizeof child,
+                                  (uint8_t *)&child, sizeof child) != 0)
+            return BWFS_ERR_IO;
+
+        if (path) {
+            path->blk[depth]  = blk;
+            path->slot[depth] = i;
+        }
+        ++depth;
+        blk = child;
+    }
+}
+
+/** \brief Reserva un bloque para el árbol del directorio. */
+static uint32_t tree_alloc(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode)
+{
+    uint32_t blk = bwfs_alloc_blocks(bm, 1);
+    if (blk != UINT32_MAX)
+        dir_inode->block_count++;
+    return blk;
+}
+
+static void tree_free(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode, uint32_t blk)
+{
+    bwfs_free_blocks(bm, blk, 1);
+    dir_inode->block_count--;
+}
+
+/** Bloques reservados para dividir una hoja (\ref tree_reserve). */
+typedef struct {
+    uint32_t blk[DIR_MAX_DEPTH + 2];
+    int      n;
+} tree_res_t;
+
+/** \brief Saca un bloque de la reserva (UINT32_MAX si está vacía). */
+static uint32_t tree_take(tree_res_t *res)
+{
+    return res->n > 0 ? res->blk[--res->n] : UINT32_MAX;
+}
+
+/** \brief Devuelve al bitmap lo que quede en la reserva. */
+static void tree_unreserve(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode,
+                           tree_res_t *res)
+{
+    while (res->n > 0)
+        tree_free(bm, dir_inode, res->blk[--res->n]);
+}
+
+/**
+ * \brief Reserva todos los bloques que necesita dividir la hoja de `path`:
+ *        la hoja nueva, un hermano por cada nodo lleno que habrá que
+ *        partir hacia arriba y la raíz nueva si se parten todos.
+ *
+ * Todo o nada: si faltara espacio a media división quedaría una hoja
+ * partida sin su separador en el padre, y la mitad de sus nombres dejaría
+ * de encontrarse.
+ *
+ * @return BWFS_OK, BWFS_ERR_FULL (sin reservar nada), BWFS_ERR_NOMEM o
+ *         BWFS_ERR_IO
+ */
+static int tree_reserve(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode,
+                        const char *fs_dir, const dir_path_t *path,
+                        tree_res_t *res)
+{
+    bwfs_dir_node_t *node = (bwfs_dir_node_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!node) return BWFS_ERR_NOMEM;
+
+    int need = 1, d;
+    for (d = path->depth - 1; d >= 0; --d) {
+        if (read_block(path->blk[d], fs_dir, node) != BWFS_OK) {
+            free(node);
+            return BWFS_ERR_IO;
+        }
+        if (node->count < DIR_NODE_MAX) break;
+        ++need;
+    }
+    free(node);
+    if (d < 0) ++need;                  /* raíz nueva */
+
+    for (res->n = 0; res->n < need; ++res->n) {
+        uint32_t blk = tree_alloc(bm, dir_inode);
+        if (blk == UINT32_MAX) {
+            tree_unreserve(bm, dir_inode, res);
+            return BWFS_ERR_FULL;
+        }
+        res->blk[res->n] = blk;
+    }
+    return BWFS_OK;
+}
+
+/**
+ * \brief Inserta el separador `(key, right)` tras dividir un hijo del nodo
+ *        `path->blk[d]`, partiendo nodos internos llenos hacia arriba.
+ *
+ * Si `d < 0` el hijo dividido era la raíz: se crea una raíz nueva con los
+ * dos hijos y se actualiza `blocks[0]` del inodo.  Los bloques nuevos
+ * salen de `res`.
+ */
+static int parent_insert(bwfs_inode_t *dir_inode, const char *fs_dir,
+                         const dir_path_t *path, int d, tree_res_t *res,
+                         uint32_t key, uint32_t left, uint32_t right,
+                         uint32_t child_level)
+{
+    bwfs_dir_node_t *node = (bwfs_dir_node_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    bwfs_dir_node_t *sib  = (bwfs_dir_node_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    int rc = BWFS_OK;
+
+    if (!node || !sib) { rc = BWFS_ERR_NOMEM; goto out; }
+
+    for (;;) {
+        if (d < 0) {
+            /* Nueva raíz */
+            uint32_t root = tree_take(res);
+            if (root == UINT32_MAX) { rc = BWFS_ERR_FULL; goto out; }
+
+            util_block_zero(node);
+            node->magic       = BWFS_DIR_NODE_MAGIC;
+            node->level       = child_level + 1;
+            node->count       = 2;
+            KEYS(node)[0]     = 0;
+            CHILDREN(node)[0] = left;
+            KEYS(node)[1]     = key;
+            CHILDREN(node)[1] = right;
+            rc = write_block(root, fs_dir, node);
+            if (rc == BWFS_OK)
+                dir_inode->blocks[0] = root;
+            goto out;
+        }
+
+        uint32_t blk = path->blk[d];
+        if ((rc = read_block(blk, fs_dir, node)) != BWFS_OK) goto out;
+
+        uint32_t at = path->slot[d] + 1;
+
+        if (node->count < DIR_NODE_MAX) {
+            memmove(&KEYS(node)[at + 1], &KEYS(node)[at],
+                    (node->count - at) * sizeof(uint32_t));
+            memmove(&CHILDREN(node)[at + 1], &CHILDREN(node)[at],
+                    (node->count - at) * sizeof(uint32_t));
+            KEYS(node)[at]     = key;
+            CHILDREN(node)[at] = right;
+            node->count++;
+            rc = write_block(blk, fs_dir, node);
+            goto out;
+        }
+
+        /* Nodo lleno: mitad superior a un hermano nuevo */
+        uint32_t sblk = tree_take(res);
+        if (sblk == UINT32_MAX) { rc = BWFS_ERR_FULL; goto out; }
+
+        uint32_t mid = node->count / 2;
+        util_block_zero(sib);
+        sib->magic = BWFS_DIR_NODE_MAGIC;
+        sib->level = node->level;
+        sib->count = node->count - mid;
+        memcpy(KEYS(sib), &KEYS(node)[mid], sib->count * sizeof(uint32_t));
+        memcpy(CHILDREN(sib), &CHILDREN(node)[mid], sib->count * sizeof(uint32_t));
+        node->count = mid;
+
+        bwfs_dir_node_t *dst = at >= mid ? sib : node;
+        uint32_t         pos = at >= mid ? at - mid : at;
+        memmove(&KEYS(dst)[pos + 1], &KEYS(dst)[pos],
+                (dst->count - pos) * sizeof(uint32_t));
+        memmove(&CHILDREN(dst)[pos + 1], &CHILDREN(dst)[pos],
+                (dst->count - pos) * sizeof(uint32_t));
+        KEYS(dst)[pos]     = key;
+        CHILDREN(dst)[pos] = right;
+        dst->count++;
+
+        if ((rc = write_block(sblk, fs_dir, sib))  != BWFS_OK ||
+            (rc = write_block(blk,  fs_dir, node)) != BWFS_OK)
+            goto out;
+
+        /* Subir el separador del nodo partido */
+        key         = KEYS(sib)[0];
+        left        = blk;
+        right       = sblk;
+        child_level = node->level;
+        --d;
+    }
+out:
+    free(node);
+    free(sib);
+    return rc;
+}
+
+static int cmp_record_hash(const void *a, const void *b)
+{
+    uint32_t x = (*(const bwfs_dirent_t *const *)a)->hash;
+    uint32_t y = (*(const bwfs_dirent_t *const *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+/** \brief ¿Caben los `n` registros de `recs` en una sola hoja? */
+static bool records_fit(const bwfs_dirent_t **recs, uint32_t n)
+{
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < n; ++i)
+        bytes += recs[i]->rec_len;
+    return n <= BWFS_DIR_HASH_ENTRIES && bytes <= BWFS_DIR_HEAP_SIZE;
+}
+
+/**
+ * \brief Reescribe la hoja `leaf` con los registros `recs`, enlazada con
+ *        `next`.
+ *
+ * Si `split`, o si no caben en una hoja, se dividen por la mediana de los
+ * hashes: los registros con hash < clave se quedan en la hoja y el resto
+ * pasa a una hoja nueva encadenada justo detrás.
+ *
+ * \retval BWFS_ERR_FULL si todas comparten hash (no hay punto de corte),
+ *                       alguna mitad sigue sin caber o no quedan bloques
+ *                       libres (o `bm` es NULL).
+ */
+static int leaf_rebuild(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode,
+                        const char *fs_dir, const dir_path_t *path,
+                        uint32_t leaf, uint32_t next,
+                        const bwfs_dirent_t **recs, uint32_t n, bool split)
+{
+    bwfs_dir_block_t *lo = (bwfs_dir_block_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+    bwfs_dir_block_t *hi = (bwfs_dir_block_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+    tree_res_t res = { .n = 0 };
+    int rc = BWFS_OK;
+
+    if (!lo || !hi) { rc = BWFS_ERR_NOMEM; goto out; }
+    lo->magic = hi->magic = BWFS_DIR_HASH_MAGIC;
+
+    if (!split && records_fit(recs, n)) {
+        for (uint32_t i = 0; i < n; ++i)
+            leaf_append(lo, recs[i]);
+        lo->next = next;
+        rc = write_block(leaf, fs_dir, lo);
+        goto out;
+    }
+    if (!bm) { rc = BWFS_ERR_FULL; goto out; }
+
+    qsort(recs, n, sizeof *recs, cmp_record_hash);
+
+    /* Clave de corte: la mediana, sin separar nunca hashes iguales (la
+     * búsqueda los manda todos a la derecha).  Se avanza desde la mediana
+     * y, si se llega al final, se retrocede */
+    uint32_t m = n / 2;
+    while (m > 0 && m < n && recs[m]->hash == recs[m - 1]->hash)
+        ++m;
+    if (m == n) {
+        m = n / 2;
+        while (m > 0 && recs[m]->hash == recs[m - 1]->hash)
+            --m;
+    }
+    if (m == 0 || m == n ||
+        !records_fit(recs, m) || !records_fit(recs + m, n - m)) {
+        rc = BWFS_ERR_FULL;
+        goto out;
+    }
+    uint32_t key = recs[m]->hash;
+
+    /* Nada se escribe hasta tener todos los bloques de la división */
+    if ((rc = tree_reserve(bm, dir_inode, fs_dir, path, &res)) != BWFS_OK)
+        goto out;
+    uint32_t right = tree_take(&res);
+
+    for (uint32_t i = 0; i < n; ++i)
+        leaf_append(i < m ? lo : hi, recs[i]);
+    hi->next = next;
+    lo->next = right;
+
+    if ((rc = write_block(right, fs_dir, hi)) != BWFS_OK ||
+        (rc = write_block(leaf,  fs_dir, lo)) != BWFS_OK)
+        goto out;
+
+    rc = parent_insert(dir_inode, fs_dir, path, path->depth - 1, &res,
+                       key, leaf, right, 0);
+out:
+    if (bm)
+        tree_unreserve(bm, dir_inode, &res);
+    free(lo);
+    free(hi);
+    return rc;
+}
+
+/** \brief Divide una hoja llena por la mediana de los hashes. */
+static int leaf_split(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode,
+                      const char *fs_dir, const dir_path_t *path, uint32_t leaf)
+{
+    bwfs_dir_block_t     *old  = (bwfs_dir_block_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    const bwfs_dirent_t **recs = (const bwfs_dirent_t **)
+                                 malloc(BWFS_DIR_HASH_ENTRIES * sizeof *recs);
+    int rc = BWFS_OK;
+
+    if (!old || !recs) { rc = BWFS_ERR_NOMEM; goto out; }
+    if ((rc = read_block(leaf, fs_dir, old)) != BWFS_OK) goto out;
+
+    uint32_t n = 0;
+    size_t   pos = 0;
+    while (n < BWFS_DIR_HASH_ENTRIES && (recs[n] = heap_next(old, &pos)) != NULL)
+        ++n;
+    if (n != old->count) { rc = BWFS_ERR_IO; goto out; }
+
+    rc = leaf_rebuild(bm, dir_inode, fs_dir, path, leaf, old->next, recs, n, true);
+out:
+    free(old);
+    free(recs);
+    return rc;
+}
+
+/** Registros de una hoja antigua en conversión (\ref upgrade_old). */
+typedef struct {
+    uint8_t              *heap;    /**< Registros nuevos, uno tras otro   */
+    size_t                used;
+    const bwfs_dirent_t **recs;
+    uint32_t              n;
+    bwfs_inode_batch_t    batch;   /**< Inodos hijos, por bloque de tabla */
+} upgrade_t;
+
+/** \brief Añade a `up` el registro de `name` con los atributos del hijo. */
+static void upgrade_add(upgrade_t *up, const char *name, uint32_t ino,
+                        uint8_t type, const char *fs_dir)
+{
+    dirent_buf_t r;
+    make_record(&r, name, ino, type);
+
+    bwfs_inode_t child;
+    if (bwfs_inode_batch_read(&up->batch, ino, &child, fs_dir) == BWFS_OK &&
+        child.ino == ino) {
+        record_set_attr(&r.de, &child);
+        if (r.de.type == BWFS_FT_UNKNOWN)
+            r.de.type = bwfs_dir_ftype(&child);
+    }
+
+    bwfs_dirent_t *de = (bwfs_dirent_t *)(up->heap + up->used);
+    memcpy(de, &r.de, r.de.rec_len);
+    up->recs[up->n++] = de;
+    up->used += r.de.rec_len;
+}
+
+/**
+ * \brief Convierte una hoja de formato antiguo (lineal, de registros fijos
+ *        o de registros sin atributos) al actual, conservando su enlace
+ *        `next`.
+ *
+ * Los atributos se leen de los inodos hijos, cuyo enlace pasa a apuntar a
+ * la hoja convertida.  Si los registros ya no caben en una hoja se divide.
+ * Ajusta `dir_inode->size` (no lo escribe).
+ *
+ * \retval BWFS_OK, BWFS_ERR_FULL (no caben ni divididos), BWFS_ERR_NOMEM
+ *         o BWFS_ERR_IO
+ */
+static int upgrade_old(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode,
+                       const char *fs_dir, const dir_path_t *path,
+                       uint32_t blkno)
+{
+    size_t   cap = BWFS_DIR_HASH_ENTRIES;
+    if (cap < max_legacy_entries()) cap = max_legacy_entries();
+
+    /* Crecen como mucho 16 bytes por registro (o se encogen, los fijos):
+     * dos bloques bastan. */
+    uint8_t  *old = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    upgrade_t up  = { .heap = (uint8_t *)malloc(2U * BWFS_BLOCK_SIZE_BYTES),
+                      .recs = (const bwfs_dirent_t **)
+                              malloc(cap * sizeof(const bwfs_dirent_t *)) };
+    bwfs_inode_batch_init(&up.batch);
+    int rc = BWFS_OK;
+
+    if (!old || !up.heap || !up.recs) { rc = BWFS_ERR_NOMEM; goto out; }
+    if (read_block(blkno, fs_dir, old) != BWFS_OK) { rc = BWFS_ERR_IO; goto out; }
+
+    uint32_t next, old_bytes = 0;
+    bwfs_dir_block_t *sblk = (bwfs_dir_block_t *)old;
+
+    if (sblk->magic == BWFS_DIR_SHORT_MAGIC) {
+        size_t pos = 0;
+        for (const bwfs_dirent_short_t *de;
+             up.n < cap && (de = short_next(sblk, &pos)) != NULL; ) {
+            if (de->ino != 0)
+                upgrade_add(&up, de->name, de->ino, de->type, fs_dir);
+        }
+        if (up.n != sblk->count) { rc = BWFS_ERR_IO; goto out; }
+        next      = sblk->next;
+        old_bytes = sblk->used;
+    } else {
+        size_t n;
+        const bwfs_dir_entry_t *e = old_entries(old, &n, &next);
+        for (size_t i = 0; i < n; ++i) {
+            if (e[i].ino == 0)
+                continue;
+
+            char name[BWFS_NAME_MAX + 1];
+            memcpy(name, e[i].name, BWFS_NAME_MAX);
+            name[BWFS_NAME_MAX] = '\0';
+            upgrade_add(&up, name, e[i].ino, BWFS_FT_UNKNOWN, fs_dir);
+            old_bytes += sizeof(bwfs_dir_entry_t);
+        }
+    }
+
+    rc = leaf_rebuild(bm, dir_inode, fs_dir, path, blkno, next, up.recs, up.n, false);
+    if (rc != BWFS_OK) goto out;
+    dir_inode->size = dir_inode->size - old_bytes + (uint32_t)up.used;
+
+    for (uint32_t i = 0; i < up.n && rc == BWFS_OK; ++i)
+        if (bwfs_dirent_has_attr(up.recs[i]))
+            rc = bwfs_inode_set_link(up.recs[i]->ino, dir_inode->ino,
+                                     up.recs[i]->hash, fs_dir);
+out:
+    bwfs_inode_batch_release(&up.batch);
+    free(old);
+    free(up.heap);
+    free(up.recs);
+    return rc;
+}
+
+/**
+ * \brief Fusiona una hoja poco poblada con su hermana (mismo padre) si
+ *        entre las dos caben holgadamente en una.
+ *
+ * La hoja derecha del par se vuelca en la izquierda, sale del padre y se
+ * libera.  Una raíz interna que queda con un solo hijo se elimina.
+ */
+static int leaf_merge(bwfs_bitmap_t *bm, bwfs_inode_t *dir_inode,
+                      const char *fs_dir, const dir_path_t *path)
+{
+    int d = path->depth - 1;
+    bwfs_dir_node_t  *node = (bwfs_dir_node_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    bwfs_dir_block_t *l    = (bwfs_dir_block_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    bwfs_dir_block_t *r    = (bwfs_dir_block_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    int rc = BWFS_OK;
+
+    if (!node || !l || !r) { rc = BWFS_ERR_NOMEM; goto out; }
+    if ((rc = read_block(path->blk[d], fs_dir, node)) != BWFS_OK) goto out;
+    if (node->count < 2) goto out;
+
+    uint32_t s  = path->slot[d];
+    uint32_t ls = (s + 1 < node->count) ? s : s - 1;
+    uint32_t lb = CHILDREN(node)[ls], rb = CHILDREN(node)[ls + 1];
+
+    if ((rc = read_block(lb, fs_dir, l)) != BWFS_OK ||
+        (rc = read_block(rb, fs_dir, r)) != BWFS_OK)
+        goto out;
+    if (l->magic != BWFS_DIR_HASH_MAGIC || r->magic != BWFS_DIR_HASH_MAGIC ||
+        l->count + r->count > DIR_MERGE_MAX ||
+        l->used  + r->used  > DIR_MERGE_BYTES)
+        goto out;                               /* no compensa */
+
+    size_t pos = 0;
+    for (const bwfs_dirent_t *de; (de = heap_next(r, &pos)) != NULL; )
+        leaf_append(l, de);
+    l->next = r->next;
+    if ((rc = write_block(lb, fs_dir, l)) != BWFS_OK) goto out;
+
+    memmove(&KEYS(node)[ls + 1], &KEYS(node)[ls + 2],
+            (node->count - ls - 2) * sizeof(uint32_t));
+    memmove(&CHILDREN(node)[ls + 1], &CHILDREN(node)[ls + 2],
+            (node->count - ls - 2) * sizeof(uint32_t));
+    node->count--;
+    tree_free(bm, dir_inode, rb);
+
+    if (d == 0 && node->count == 1) {           /* raíz con un solo hijo */
+        dir_inode->blocks[0] = CHILDREN(node)[0];
+        tree_free(bm, dir_inode, path->blk[0]);
+    } else {
+        rc = write_block(path->blk[d], fs_dir, node);
+    }
+out:
+    free(node);
+    free(l);
+    free(r);
+    return rc;
+}
+
+/** \brief Recorre en profundidad todos los bloques del árbol (hijos antes). */
+static int walk_blocks(uint32_t blk, const char *fs_dir, int depth,
+                       int (*fn)(uint32_t blk, void *arg), void *arg)
+{
+    uint32_t hdr[4];
+    if (read_header(blk, fs_dir, hdr) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    if (hdr[0] == BWFS_DIR_NODE_MAGIC) {
+        uint32_t n = hdr[2];
+        if (depth == DIR_MAX_DEPTH || n == 0 || n > BWFS_DIR_NODE_CAP)
+            return BWFS_ERR_IO;
+
+        uint32_t *children = (uint32_t *)malloc(n * sizeof *children);
+        if (!children) return BWFS_ERR_NOMEM;
+        int rc = util_read_block_range(fs_dir, blk, BWFS_DIR_NODE_CHILDREN_OFF,
+                                       (uint8_t *)children, n * sizeof *children)
+                 ? BWFS_ERR_IO : BWFS_OK;
+        for (uint32_t i = 0; rc == BWFS_OK && i < n; ++i)
+            rc = walk_blocks(children[i], fs_dir, depth + 1, fn, arg);
+        free(children);
+        if (rc != BWFS_OK) return rc;
+    }
+    return fn(blk, arg);
+}
+
 /* ------------------------------------------------------------------------- */
 /* API pública                                                               */
 /* ------------------------------------------------------------------------- */
@@ -72,8 +986,14 @@ int bwfs_dir_add(bwfs_bitmap_t *bm,
                  bwfs_inode_t  *dir_inode,
                  const char    *fs_dir,
                  const char    *name,
-                 uint32_t       child_ino)
+                 uint32_t       child_ino,
+                 uint8_t        type)
 {
+    /* Atributos que copiará el registro */
+    bwfs_inode_t child;
+    if (bwfs_read_inode(child_ino, &child, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+
     /* ------------------------------------------------------------------ */
     /* 1) Verificar/crear el primer bloque de datos del directorio        */
     /* ------------------------------------------------------------------ */
@@ -83,11 +1003,13 @@ int bwfs_dir_add(bwfs_bitmap_t *bm,
         uint32_t blk = bwfs_alloc_blocks(bm, 1);
         if (blk == UINT32_MAX) return BWFS_ERR_FULL;
 
-        /* Inicializar bloque a ceros */
-        uint8_t *zero = (uint8_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
-        if (!zero) { bwfs_free_blocks(bm, blk, 1); return BWFS_ERR_NOMEM; }
-        util_write_block(fs_dir, blk, zero, BWFS_BLOCK_SIZE_BYTES);
-        free(zero);
+        /* Inicializar bloque: tabla vacía y heap a cero */
+        bwfs_dir_block_t *fresh = (bwfs_dir_block_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+        if (!fresh) { bwfs_free_blocks(bm, blk, 1); return BWFS_ERR_NOMEM; }
+        fresh->magic = BWFS_DIR_HASH_MAGIC;
+        int wrc = write_block(blk, fs_dir, fresh);
+        free(fresh);
+        if (wrc != BWFS_OK) { bwfs_free_blocks(bm, blk, 1); return BWFS_ERR_IO; }
 
         dir_inode->blocks[0]   = blk;
         dir_inode->block_count = 1;
@@ -99,92 +1021,178 @@ int bwfs_dir_add(bwfs_bitmap_t *bm,
             return BWFS_ERR_IO;
     }
 
-    /* ------------------------------------------------------------------ */
-    /* 2) Cargar las entradas existentes                                  */
-    /* ------------------------------------------------------------------ */
-    const size_t max = max_entries_per_block();
-    bwfs_dir_entry_t *entries =
-        (bwfs_dir_entry_t *)malloc(max * sizeof *entries);
-    if (!entries) return BWFS_ERR_NOMEM;
+    bwfs_dir_index_t *idx = index_alloc();
+    if (!idx) return BWFS_ERR_NOMEM;
 
-    if (load_entries(dir_inode, fs_dir, entries) != BWFS_OK) {
-        free(entries);
-        return BWFS_ERR_IO;
-    }
+    dirent_buf_t rec, found_rec;
+    make_record(&rec, name, child_ino, type);
+    record_set_attr(&rec.de, &child);
 
-    /* ------------------------------------------------------------------ */
-    /* 3) Buscar espacio libre y evitar duplicados                        */
-    /* ------------------------------------------------------------------ */
-    size_t free_idx = max;
-    for (size_t i = 0; i < max; ++i) {
-        if (entries[i].ino == 0 && free_idx == max)
-            free_idx = i;                       /* primera ranura libre */
-        if (entries[i].ino != 0 &&
-            strncmp(entries[i].name, name, BWFS_NAME_MAX) == 0) {
-            free(entries);
-            return BWFS_ERR_FULL;               /* nombre ya existe    */
+    uint32_t hash = rec.de.hash;
+    uint32_t tree_blocks = dir_inode->block_count;
+    int      rc;
+
+    /* Cada vuelta que divide una hoja reintenta desde la raíz */
+    for (int attempt = 0; ; ++attempt) {
+        /* -------------------------------------------------------------- */
+        /* 2) Bajar hasta la hoja (convirtiendo un bloque antiguo, que    */
+        /*    puede dividirse: entonces se vuelve a bajar)                */
+        /* -------------------------------------------------------------- */
+        dir_path_t path;
+        uint32_t   leaf, magic;
+        rc = descend(dir_inode, fs_dir, hash, &path, &leaf, &magic);
+        if (rc == BWFS_OK && magic != BWFS_DIR_HASH_MAGIC) {
+            rc = upgrade_old(bm, dir_inode, fs_dir, &path, leaf);
+            if (rc != BWFS_OK) break;
+            continue;
+        }
+        if (rc == BWFS_OK)
+            rc = load_index(leaf, fs_dir, idx);
+        if (rc != BWFS_OK) break;
+
+        /* -------------------------------------------------------------- */
+        /* 3) Evitar duplicados                                           */
+        /* -------------------------------------------------------------- */
+        uint32_t pos;
+        int found = probe(leaf, fs_dir, idx, rec.de.name, hash, &pos, &found_rec);
+        if (found != 0) {
+            rc = found < 0 ? BWFS_ERR_IO : BWFS_ERR_FULL;  /* ya existe */
+            break;
+        }
+
+        /* -------------------------------------------------------------- */
+        /* 4) Hoja llena: dividir y volver a bajar                        */
+        /* -------------------------------------------------------------- */
+        if (!leaf_fits(idx, rec.de.rec_len)) {
+            if (!bm || attempt >= DIR_MAX_DEPTH) { rc = BWFS_ERR_FULL; break; }
+            rc = leaf_split(bm, dir_inode, fs_dir, &path, leaf);
+            if (rc != BWFS_OK) break;
+            continue;
         }
-    }
 
-    if (free_idx == max) {                      /* bloque lleno */
-        free(entries);
-        return BWFS_ERR_FULL;
+        /* -------------------------------------------------------------- */
+        /* 5) Nuevo registro al final del heap de la hoja                 */
+        /* -------------------------------------------------------------- */
+        size_t off = HEAP_OFF + idx->used;
+        idx->buckets[pos] = bucket_make(hash, off);
+        idx->used += rec.de.rec_len;
+        idx->count++;
+
+        rc = write_record(leaf, fs_dir, off, &rec.de);
+        if (rc == BWFS_OK)
+            rc = store_index(leaf, fs_dir, idx);
+        if (rc == BWFS_OK) {
+            dir_inode->size += rec.de.rec_len;
+            bwfs_inode_touch(dir_inode, BWFS_TOUCH_MTIME | BWFS_TOUCH_CTIME);
+            rc = bwfs_inode_set_link(child_ino, dir_inode->ino, hash, fs_dir);
+        }
+        break;
     }
+    free(idx);
 
     /* ------------------------------------------------------------------ */
-    /* 4) Rellenar nueva entrada                                           */
+    /* 6) Persistir bitmap (si el árbol creció) e inodo                   */
     /* ------------------------------------------------------------------ */
-    entries[free_idx].ino = child_ino;
-    strncpy(entries[free_idx].name, name, BWFS_NAME_MAX);
-    entries[free_idx].name[BWFS_NAME_MAX] = '\0';
+    if (dir_inode->block_count != tree_blocks &&
+        bwfs_write_bitmap(bm, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    if (bwfs_write_inode(dir_inode, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    return rc;
+}
 
-    dir_inode->size += sizeof(bwfs_dir_entry_t);
+/**
+ * \brief Quita `len` bytes en `off` del heap de la hoja desplazando hacia
+ *        atrás los registros siguientes; el final liberado queda a cero.
+ *        Las cubetas de los registros movidos se corrigen en `idx`.
+ */
+static int heap_compact(uint32_t leaf, const char *fs_dir,
+                        bwfs_dir_index_t *idx, size_t off, size_t len)
+{
+    size_t end  = HEAP_OFF + idx->used;
+    size_t tail = end - off - len;
 
-    /* ------------------------------------------------------------------ */
-    /* 5) Persistir bloque e inodo                                         */
-    /* ------------------------------------------------------------------ */
-    int rc = store_entries(dir_inode, fs_dir, entries);
-    free(entries);
+    uint8_t *buf = (uint8_t *)calloc(1, tail + len);
+    if (!buf) return BWFS_ERR_NOMEM;
+
+    int rc = BWFS_OK;
+    if (tail > 0 &&
+        util_read_block_range(fs_dir, leaf, off + len, buf, tail) != 0)
+        rc = BWFS_ERR_IO;
+    if (rc == BWFS_OK &&
+        util_write_block_range(fs_dir, leaf, off, buf, tail + len) != 0)
+        rc = BWFS_ERR_IO;
+    free(buf);
     if (rc != BWFS_OK) return rc;
 
-    return bwfs_write_inode(dir_inode, fs_dir);
+    for (uint32_t p = 0; p < BWFS_DIR_BUCKETS; ++p)
+        if (idx->buckets[p] != 0 && bucket_off(idx->buckets[p]) > off)
+            idx->buckets[p] -= (uint32_t)(len / 8U);
+
+    idx->used -= (uint32_t)len;
+    idx->count--;
+    return BWFS_OK;
 }
 
-int bwfs_dir_remove(bwfs_inode_t *dir_inode,
-                    const char   *fs_dir,
-                    const char   *name)
+int bwfs_dir_remove(bwfs_bitmap_t *bm,
+                    bwfs_inode_t  *dir_inode,
+                    const char    *fs_dir,
+                    const char    *name)
 {
     if (dir_inode->block_count == 0) return UINT32_MAX; /* directorio vacío */
 
-    const size_t max = max_entries_per_block();
-    bwfs_dir_entry_t *entries =
-        (bwfs_dir_entry_t *)malloc(max * sizeof *entries);
-    if (!entries) return BWFS_ERR_NOMEM;
+    uint32_t   hash = bwfs_dir_name_hash(name);
+    uint32_t   tree_blocks = dir_inode->block_count;
+    dir_path_t path;
+    uint32_t   leaf, magic;
+    int        rc = descend(dir_inode, fs_dir, hash, &path, &leaf, &magic);
+    if (rc == BWFS_OK && magic != BWFS_DIR_HASH_MAGIC) {
+        rc = upgrade_old(bm, dir_inode, fs_dir, &path, leaf);
+        if (rc == BWFS_OK)                      /* pudo dividirse */
+            rc = descend(dir_inode, fs_dir, hash, &path, &leaf, &magic);
+    }
+    if (rc != BWFS_OK)
+        return rc;
+
+    bwfs_dir_index_t *idx = index_alloc();
+    if (!idx) return BWFS_ERR_NOMEM;
 
-    if (load_entries(dir_inode, fs_dir, entries) != BWFS_OK) {
-        free(entries);
+    if (load_index(leaf, fs_dir, idx) != BWFS_OK) {
+        free(idx);
         return BWFS_ERR_IO;
     }
 
-    for (size_t i = 0; i < max; ++i) {
-        if (entries[i].ino != 0 &&
-            strncmp(entries[i].name, name, BWFS_NAME_MAX) == 0)
-        {
-            /* Marcar como libre */
-            entries[i].ino      = 0;
-            entries[i].name[0]  = '\0';
-            dir_inode->size    -= sizeof(bwfs_dir_entry_t);
+    uint32_t     pos;
+    dirent_buf_t rec;
+    int found = probe(leaf, fs_dir, idx, name, hash, &pos, &rec);
+    if (found <= 0) {
+        free(idx);
+        return found < 0 ? BWFS_ERR_IO : (int)UINT32_MAX;   /* no encontrado */
+    }
 
-            int rc = store_entries(dir_inode, fs_dir, entries);
-            free(entries);
-            if (rc != BWFS_OK) return rc;
+    /* Sin huecos: los registros siguientes retroceden `rec_len` bytes */
+    size_t off = bucket_off(idx->buckets[pos]);
+    index_delete(idx, pos);
+    rc = heap_compact(leaf, fs_dir, idx, off, rec.de.rec_len);
+    if (rc == BWFS_OK) {
+        dir_inode->size -= rec.de.rec_len;
+        bwfs_inode_touch(dir_inode, BWFS_TOUCH_MTIME | BWFS_TOUCH_CTIME);
+        rc = store_index(leaf, fs_dir, idx);
+    }
+    uint32_t used = idx->used;
+    free(idx);
+    if (rc != BWFS_OK) return rc;
 
-            return bwfs_write_inode(dir_inode, fs_dir);
-        }
+    /* Hoja casi vacía en un árbol: intentar fusionarla con su hermana */
+    if (bm && path.depth > 0 && used < DIR_MERGE_BELOW) {
+        rc = leaf_merge(bm, dir_inode, fs_dir, &path);
+        if (rc != BWFS_OK) return rc;
     }
+    if (dir_inode->block_count != tree_blocks &&
+        bwfs_write_bitmap(bm, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
 
-    free(entries);
-    return UINT32_MAX;                           /* no encontrado */
+    return bwfs_write_inode(dir_inode, fs_dir);
 }
 
 uint32_t bwfs_dir_lookup(const bwfs_inode_t *dir_inode,
@@ -193,25 +1201,236 @@ uint32_t bwfs_dir_lookup(const bwfs_inode_t *dir_inode,
 {
     if (dir_inode->block_count == 0) return UINT32_MAX;
 
-    const size_t max = max_entries_per_block();
-    bwfs_dir_entry_t *entries =
-        (bwfs_dir_entry_t *)malloc(max * sizeof *entries);
-    if (!entries) return UINT32_MAX;
+    uint32_t hash = bwfs_dir_name_hash(name);
+    uint32_t leaf, magic;
+    if (descend(dir_inode, fs_dir, hash, NULL, &leaf, &magic) != BWFS_OK)
+        return UINT32_MAX;
+
+    uint32_t found = UINT32_MAX;
+
+    if (magic == BWFS_DIR_HASH_MAGIC || magic == BWFS_DIR_SHORT_MAGIC) {
+        bwfs_dir_index_t *idx = index_alloc();
+        if (!idx) return UINT32_MAX;
 
-    if (load_entries(dir_inode, fs_dir, entries) != BWFS_OK) {
-        free(entries);
+        uint32_t     pos;
+        dirent_buf_t rec;
+        if (load_index(leaf, fs_dir, idx) == BWFS_OK &&
+            probe(leaf, fs_dir, idx, name, hash, &pos, &rec) == 1)
+            found = rec.de.ino;
+        free(idx);
+        return found;
+    }
+
+    /* Formatos antiguos de registros fijos: recorrido completo */
+    uint8_t *blk = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!blk) return UINT32_MAX;
+
+    if (read_block(leaf, fs_dir, blk) != BWFS_OK) {
+        free(blk);
         return UINT32_MAX;
     }
 
-    for (size_t i = 0; i < max; ++i) {
+    size_t   n;
+    uint32_t next;
+    const bwfs_dir_entry_t *entries = old_entries(blk, &n, &next);
+    for (size_t i = 0; i < n; ++i) {
         if (entries[i].ino != 0 &&
             strncmp(entries[i].name, name, BWFS_NAME_MAX) == 0) {
-            uint32_t found = entries[i].ino;
-            free(entries);
-            return found;
+            found = entries[i].ino;
+            break;
+        }
+    }
+
+    free(blk);
+    return found;
+}
+
+int bwfs_dir_iterate(const bwfs_inode_t *dir_inode,
+                     const char         *fs_dir,
+                     bwfs_dir_iter_fn    fn,
+                     void               *arg)
+{
+    if (dir_inode->block_count == 0) return BWFS_OK;
+
+    /* Hoja más a la izquierda: hash 0 siempre cae en el primer hijo */
+    uint32_t leaf, magic;
+    int rc = descend(dir_inode, fs_dir, 0, NULL, &leaf, &magic);
+    if (rc != BWFS_OK) return rc;
+
+    bwfs_dir_block_t *blk = (bwfs_dir_block_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!blk) return BWFS_ERR_NOMEM;
+
+    /* Las hojas se recorren por la cadena `next`, en orden de hash */
+    bool stop = false;
+    for (uint32_t hops = 0; leaf != 0 && !stop; ++hops) {
+        if (hops > dir_inode->block_count || read_block(leaf, fs_dir, blk) != BWFS_OK) {
+            rc = BWFS_ERR_IO;
+            break;
+        }
+
+        if (blk->magic == BWFS_DIR_HASH_MAGIC) {
+            /* Registros contiguos: se entregan sin copiarlos */
+            size_t pos = 0;
+            const bwfs_dirent_t *de;
+            while (!stop && (de = heap_next(blk, &pos)) != NULL)
+                if (de->ino != 0 && fn(de, arg) != 0)
+                    stop = true;
+            leaf = blk->next;
+            continue;
+        }
+
+        /* Formatos antiguos: se traduce cada registro; `rec_len` es el
+         * tamaño que ocupa en disco. */
+        if (blk->magic == BWFS_DIR_SHORT_MAGIC) {
+            size_t pos = 0;
+            const bwfs_dirent_short_t *de;
+            while (!stop && (de = short_next(blk, &pos)) != NULL) {
+                if (de->ino == 0)
+                    continue;
+                dirent_buf_t r;
+                make_record(&r, de->name, de->ino, de->type);
+                r.de.rec_len = de->rec_len;
+                if (fn(&r.de, arg) != 0)
+                    stop = true;
+            }
+            leaf = blk->next;
+            continue;
+        }
+
+        size_t n;
+        const bwfs_dir_entry_t *e = old_entries((const uint8_t *)blk, &n, &leaf);
+        for (size_t i = 0; i < n && !stop; ++i) {
+            if (e[i].ino == 0)
+                continue;
+            char name[BWFS_NAME_MAX + 1];
+            memcpy(name, e[i].name, BWFS_NAME_MAX);
+            name[BWFS_NAME_MAX] = '\0';
+
+            dirent_buf_t r;
+            make_record(&r, name, e[i].ino, BWFS_FT_UNKNOWN);
+            r.de.rec_len = sizeof(bwfs_dir_entry_t);
+            if (fn(&r.de, arg) != 0)
+                stop = true;
+        }
+    }
+
+    free(blk);
+    return rc;
+}
+
+/**
+ * \brief Busca en un directorio el registro de `ino` cuyo nombre tiene hash
+ *        `hash` (el enlace de un hijo).
+ *
+ * Sondeo lineal desde la cubeta de origen, leyendo las cubetas por
+ * ventanas en vez de la tabla entera; se compara el inodo, no el nombre,
+ * que el hijo no conoce.
+ *
+ * \param[out] leaf, off, rec  Hoja, desplazamiento y registro encontrados.
+ * \return 1 encontrado, 0 no (u hoja sin atributos), BWFS_ERR_IO o
+ *         BWFS_ERR_NOMEM
+ */
+static int find_link(const bwfs_inode_t *dir_inode, const char *fs_dir,
+                     uint32_t hash, uint32_t ino,
+                     uint32_t *leaf, size_t *off, dirent_buf_t *rec)
+{
+    if (dir_inode->block_count == 0) return 0;
+
+    uint32_t magic;
+    int rc = descend(dir_inode, fs_dir, hash, NULL, leaf, &magic);
+    if (rc != BWFS_OK) return rc;
+    if (magic != BWFS_DIR_HASH_MAGIC) return 0;
+
+    uint32_t win[ATTR_WINDOW];
+    uint32_t p = hash & BUCKET_MASK;
+
+    for (uint32_t seen = 0; seen < BWFS_DIR_BUCKETS; ) {
+        uint32_t cnt = BWFS_DIR_BUCKETS - p;
+        if (cnt > ATTR_WINDOW) cnt = ATTR_WINDOW;
+        if (util_read_block_range(fs_dir, *leaf,
+                                  offsetof(bwfs_dir_index_t, buckets) + p * 4U,
+                                  (uint8_t *)win, cnt * sizeof *win) != 0)
+            return BWFS_ERR_IO;
+
+        for (uint32_t i = 0; i < cnt; ++i) {
+            if (win[i] == 0)
+                return 0;
+            if ((win[i] >> 16) != (hash & 0xFFFFU))
+                continue;
+            *off = bucket_off(win[i]);
+            if (read_record(*leaf, fs_dir, magic, *off, rec) != BWFS_OK)
+                return BWFS_ERR_IO;
+            if (rec->de.ino == ino && rec->de.hash == hash)
+                return 1;
         }
+        seen += cnt;
+        p = (p + cnt) & BUCKET_MASK;
     }
+    return 0;
+}
+
+int bwfs_dir_has_link(const bwfs_inode_t *dir_inode,
+                      const char         *fs_dir,
+                      uint32_t            hash,
+                      uint32_t            ino)
+{
+    uint32_t     leaf = 0;
+    size_t       off  = 0;
+    dirent_buf_t rec;
+    int found = find_link(dir_inode, fs_dir, hash, ino, &leaf, &off, &rec);
+    return found == 1 ? BWFS_OK : found == 0 ? (int)UINT32_MAX : found;
+}
+
+int bwfs_dir_update_attr(const bwfs_inode_t *dir_inode,
+                         const char         *fs_dir,
+                         uint32_t            hash,
+                         const bwfs_inode_t *child)
+{
+    uint32_t     leaf = 0;
+    size_t       off  = 0;
+    dirent_buf_t rec;
+    int found = find_link(dir_inode, fs_dir, hash, child->ino, &leaf, &off, &rec);
+    if (found != 1)
+        return found == 0 ? (int)UINT32_MAX : found;
+
+    bwfs_dirent_t want = rec.de;
+    want.type = bwfs_dir_ftype(child);
+    record_set_attr(&want, child);
+    if (memcmp(&want, &rec.de, sizeof want) == 0)
+        return BWFS_OK;
+
+    rec.de = want;
+    return util_write_block_range(fs_dir, leaf, off, (const uint8_t *)&rec.de,
+                                  sizeof rec.de) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+int bwfs_dir_for_each_block(const bwfs_inode_t *dir_inode,
+                            const char         *fs_dir,
+                            int               (*fn)(uint32_t blk, void *arg),
+                            void               *arg)
+{
+    if (dir_inode->block_count == 0) return BWFS_OK;
+    return walk_blocks(dir_inode->blocks[0], fs_dir, 0, fn, arg);
+}
+
+/** Contexto de \ref bwfs_dir_release. */
+typedef struct { bwfs_bitmap_t *bm; } release_ctx_t;
+
+static int release_block(uint32_t blk, void *arg)
+{
+    bwfs_free_blocks(((release_ctx_t *)arg)->bm, blk, 1);
+    return BWFS_OK;
+}
+
+int bwfs_dir_release(bwfs_bitmap_t *bm,
+                     bwfs_inode_t  *dir_inode,
+                     const char    *fs_dir)
+{
+    release_ctx_t ctx = { bm };
+    int rc = bwfs_dir_for_each_block(dir_inode, fs_dir, release_block, &ctx);
+    if (rc != BWFS_OK) return rc;
 
-    free(entries);
-    return UINT32_MAX;                           /* no encontrado */
+    dir_inode->blocks[0]   = 0;
+    dir_inode->block_count = 0;
+    return bwfs_write_bitmap(bm, fs_dir);
 }
@@ -0,0 +1,302 @@
+// -----------------------------------------------------------------------------
+// File: src/core/dirty.c
+// -----------------------------------------------------------------------------
+/**
+ * \file dirty.c
+ * \brief Seguimiento de bloques sucios por inodo y sincronización en tandas.
+ *
+ *  - Cada inodo con algo pendiente tiene una entrada en una tabla hash con
+ *    la lista de sus bloques escritos (sin repetir el último, que es el
+ *    caso de las escrituras secuenciales pequeñas).  Si pasa de
+ *    #BWFS_DIRTY_INODE_MAX se descarta la lista y se marca «todo».
+ *  - Sincronizar mueve lo del inodo a la tanda en preparación.  Si no hay
+ *    ninguna en curso, quien llega la lanza (líder): toma la tanda entera,
+ *    suelta el cerrojo y sincroniza; al acabar despierta a todos.  Quien
+ *    llega con una tanda en curso espera a la siguiente.
+ *  - Un fallo se queda en los inodos de la tanda y lo recoge la siguiente
+ *    sincronización de cada uno.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "dirty.h"
+#include "journal.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>   /* malloc, realloc, free, qsort */
+
+#define DHASH_SIZE  256U
+
+/** Lo pendiente de un inodo. */
+typedef struct dnode {
+    uint32_t      ino;
+    uint32_t     *blk;
+    uint32_t      n, cap;
+    bool          all;     /**< demasiados bloques: syncfs      */
+    bool          meta;    /**< también confirmar el inodo      */
+    bool          err;     /**< una tanda con sus bloques falló */
+    struct dnode *next;
+} dnode_t;
+
+/** Lista de números (bloques o inodos) que crece a demanda. */
+typedef struct {
+    uint32_t *v;
+    uint32_t  n, cap;
+} ulist_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  done;
+    dnode_t        *hash[DHASH_SIZE];
+
+    /* Tanda en preparación */
+    ulist_t         blk;
+    ulist_t         ino;
+    bool            all;
+    bool            meta;
+
+    uint64_t        started;   /**< tandas lanzadas   */
+    uint64_t        finished;  /**< tandas terminadas */
+    bool            running;
+    bool            lost;      /**< sin memoria para apuntar: syncfs */
+} dt = { .lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+/* ------------------------------------------------------------------------- */
+/* Auxiliares                                                                */
+/* ------------------------------------------------------------------------- */
+
+static bool ulist_push(ulist_t *l, uint32_t x)
+{
+    if (l->n == l->cap) {
+        uint32_t cap = l->cap ? l->cap * 2U : 64U;
+        uint32_t *v = (uint32_t *)realloc(l->v, cap * sizeof *v);
+        if (!v)
+            return false;
+        l->v   = v;
+        l->cap = cap;
+    }
+    l->v[l->n++] = x;
+    return true;
+}
+
+static void ulist_free(ulist_t *l)
+{
+    free(l->v);
+    l->v = NULL;
+    l->n = l->cap = 0;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static dnode_t **slot(uint32_t ino)
+{
+    return &dt.hash[(ino * 2654435761U) >> 24];
+}
+
+static dnode_t *find(uint32_t ino)
+{
+    for (dnode_t *d = *slot(ino); d; d = d->next)
+        if (d->ino == ino)
+            return d;
+    return NULL;
+}
+
+static dnode_t *get(uint32_t ino)
+{
+    dnode_t *d = find(ino);
+    if (d)
+        return d;
+    d = (dnode_t *)calloc(1, sizeof *d);
+    if (!d) {
+        dt.lost = true;
+        return NULL;
+    }
+    d->ino  = ino;
+    d->next = *slot(ino);
+    *slot(ino) = d;
+    return d;
+}
+
+static void drop(uint32_t ino)
+{
+    for (dnode_t **p = slot(ino); *p; p = &(*p)->next) {
+        if ((*p)->ino == ino) {
+            dnode_t *d = *p;
+            *p = d->next;
+            free(d->blk);
+            free(d);
+            return;
+        }
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Tandas                                                                    */
+/* ------------------------------------------------------------------------- */
+
+/** \brief Sincroniza una tanda ya tomada (sin el cerrojo). */
+static int flush(ulist_t *blk, bool all, bool meta, const char *fs_dir)
+{
+    int rc = BWFS_OK;
+
+    /* Sin diario, los metadatos solo se alcanzan con un syncfs */
+    if (all || blk->n > BWFS_DIRTY_SYNC_MAX || (meta && !bwfs_journal_ready())) {
+        if (util_sync_fs(fs_dir) != 0)
+            rc = BWFS_ERR_IO;
+    } else if (blk->n > 0) {
+        qsort(blk->v, blk->n, sizeof *blk->v, cmp_u32);
+        for (uint32_t i = 0; i < blk->n && rc == BWFS_OK; ++i)
+            if ((i == 0 || blk->v[i] != blk->v[i - 1]) &&
+                util_sync_block(fs_dir, blk->v[i]) != 0)
+                rc = BWFS_ERR_IO;
+    }
+
+    /* Los datos antes que el inodo que los apunta */
+    if (rc == BWFS_OK && meta)
+        rc = bwfs_journal_commit();
+    return rc;
+}
+
+/** \brief Lanza la tanda en preparación como líder (con el cerrojo). */
+static void lead(const char *fs_dir)
+{
+    ulist_t blk = dt.blk, ino = dt.ino;
+    bool all  = dt.all || dt.lost;
+    bool meta = dt.meta;
+    dt.blk  = (ulist_t){ NULL, 0, 0 };
+    dt.ino  = (ulist_t){ NULL, 0, 0 };
+    dt.all  = dt.meta = dt.lost = false;
+    dt.running = true;
+    dt.started++;
+
+    pthread_mutex_unlock(&dt.lock);
+    int rc = flush(&blk, all, meta, fs_dir);
+    pthread_mutex_lock(&dt.lock);
+
+    if (rc != BWFS_OK) {
+        for (uint32_t i = 0; i < ino.n; ++i) {
+            dnode_t *d = get(ino.v[i]);
+            if (d)
+                d->err = true;
+        }
+    }
+    ulist_free(&blk);
+    ulist_free(&ino);
+
+    dt.finished = dt.started;
+    dt.running  = false;
+    pthread_cond_broadcast(&dt.done);
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+void bwfs_dirty_add(uint32_t ino, uint32_t blk)
+{
+    pthread_mutex_lock(&dt.lock);
+    dnode_t *d = get(ino);
+    if (d && !d->all && !(d->n > 0 && d->blk[d->n - 1] == blk)) {
+        if (d->n == d->cap && d->cap < BWFS_DIRTY_INODE_MAX) {
+            uint32_t cap = d->cap ? d->cap * 2U : 16U;
+            uint32_t *v = (uint32_t *)realloc(d->blk, cap * sizeof *v);
+            if (v) {
+                d->blk = v;
+                d->cap = cap;
+            }
+        }
+        if (d->n < d->cap) {
+            d->blk[d->n++] = blk;
+        } else {                        /* lleno o sin memoria */
+            free(d->blk);
+            d->blk = NULL;
+            d->n = d->cap = 0;
+            d->all = true;
+        }
+    }
+    pthread_mutex_unlock(&dt.lock);
+}
+
+void bwfs_dirty_meta(uint32_t ino)
+{
+    pthread_mutex_lock(&dt.lock);
+    dnode_t *d = get(ino);
+    if (d)
+        d->meta = true;
+    pthread_mutex_unlock(&dt.lock);
+}
+
+void bwfs_dirty_forget(uint32_t ino)
+{
+    pthread_mutex_lock(&dt.lock);
+    drop(ino);
+    pthread_mutex_unlock(&dt.lock);
+}
+
+int bwfs_dirty_sync(uint32_t ino, bool datasync, const char *fs_dir)
+{
+    pthread_mutex_lock(&dt.lock);
+
+    /* Lo del inodo pasa a la tanda siguiente */
+    bool add = !datasync;
+    dnode_t *d = find(ino);
+    if (d) {
+        add |= d->n > 0 || d->all || d->meta;
+        for (uint32_t i = 0; i < d->n; ++i)
+            if (!ulist_push(&dt.blk, d->blk[i]))
+                dt.lost = true;
+        dt.all  |= d->all;
+        dt.meta |= d->meta;
+        d->n   = 0;
+        d->all = d->meta = false;
+    }
+    if (add) {
+        dt.meta |= !datasync;
+        if (!ulist_push(&dt.ino, ino))
+            dt.lost = true;
+    }
+
+    /* Sin nada nuevo basta con que acabe la tanda en curso (puede llevar
+     * bloques suyos de otra llamada) */
+    uint64_t target = add ? dt.started + 1U
+                          : dt.running ? dt.started : dt.finished;
+    while (dt.finished < target) {
+        if (!dt.running)
+            lead(fs_dir);
+        else
+            pthread_cond_wait(&dt.done, &dt.lock);
+    }
+
+    int rc = BWFS_OK;
+    d = find(ino);
+    if (d && d->err) {
+        d->err = false;
+        rc = BWFS_ERR_IO;
+    }
+    if (d && d->n == 0 && !d->all && !d->meta)
+        drop(ino);
+    pthread_mutex_unlock(&dt.lock);
+    return rc;
+}
+
+void bwfs_dirty_close(void)
+{
+    pthread_mutex_lock(&dt.lock);
+    for (uint32_t i = 0; i < DHASH_SIZE; ++i) {
+        while (dt.hash[i]) {
+            dnode_t *d = dt.hash[i];
+            dt.hash[i] = d->next;
+            free(d->blk);
+            free(d);
+        }
+    }
+    ulist_free(&dt.blk);
+    ulist_free(&dt.ino);
+    dt.all = dt.meta = dt.lost = false;
+    pthread_mutex_unlock(&dt.lock);
+}
@@ -0,0 +1,703 @@
+// -----------------------------------------------------------------------------
+// File: src/core/extent.c
+// -----------------------------------------------------------------------------
+/**
+ * \file extent.c
+ * \brief Árbol de extents de los archivos BWFS.
+ *
+ *  - Hasta 3 extents viven en el propio inodo; después, una hoja de
+ *    10 415 extents y, si tampoco basta, un índice de hasta 15 623 hojas.
+ *  - Las modificaciones trabajan sobre el mapa completo en memoria y lo
+ *    reescriben (reutilizando los bloques hoja/índice que ya tenía).
+ *  - Las consultas (\ref bwfs_extent_lookup) leen solo el nivel necesario
+ *    y devuelven el tramo entero, no un bloque.
+ *  - Los archivos antiguos de 10 bloques directos se leen como extents y
+ *    se convierten al guardar su mapa por primera vez.
+ */
+
+#include "extent.h"
+#include "allocation.h"
+#include "util.h"
+
+#include <string.h>   /* memcpy, memmove, memset */
+#include <stdlib.h>   /* malloc, calloc, realloc, free */
+
+/* ------------------------------------------------------------------------- */
+/* Helpers                                                                   */
+/* ------------------------------------------------------------------------- */
+
+static inline uint32_t ext_len(const bwfs_extent_t *e)
+{
+    return e->len & BWFS_EXT_LEN_MASK;
+}
+
+static inline uint32_t ext_flag(const bwfs_extent_t *e)
+{
+    return e->len & BWFS_EXT_UNWRITTEN;
+}
+
+/** Cabecera y extents en línea (bytes 16..55 del inodo). */
+static inline uint8_t *inode_area(bwfs_inode_t *inode)
+{
+    return (uint8_t *)inode + BWFS_INLINE_OFF;
+}
+
+static void read_hdr(const bwfs_inode_t *inode, bwfs_extent_hdr_t *hdr)
+{
+    memcpy(hdr, (const uint8_t *)inode + BWFS_INLINE_OFF, sizeof *hdr);
+}
+
+static void read_inline(const bwfs_inode_t *inode, bwfs_extent_t ext[BWFS_EXT_INLINE])
+{
+    memcpy(ext, (const uint8_t *)inode + BWFS_INLINE_OFF + sizeof(bwfs_extent_hdr_t),
+           BWFS_EXT_INLINE * sizeof *ext);
+}
+
+static int map_reserve(bwfs_extent_map_t *map, uint32_t n)
+{
+    if (n <= map->cap)
+        return BWFS_OK;
+
+    uint32_t cap = map->cap ? map->cap : 8U;
+    while (cap < n)
+        cap *= 2U;
+
+    bwfs_extent_t *ext = (bwfs_extent_t *)realloc(map->ext, cap * sizeof *ext);
+    if (!ext)
+        return BWFS_ERR_NOMEM;
+    map->ext = ext;
+    map->cap = cap;
+    return BWFS_OK;
+}
+
+/** \brief ¿Puede `b` continuar a `a` dentro de un mismo extent? */
+static inline bool ext_joinable(const bwfs_extent_t *a, const bwfs_extent_t *b)
+{
+    return a->logical  + ext_len(a) == b->logical &&
+           a->physical + ext_len(a) == b->physical &&
+           ext_flag(a) == ext_flag(b) &&
+           (uint64_t)ext_len(a) + ext_len(b) <= BWFS_EXT_LEN_MASK;
+}
+
+/** \brief Añade un extent al final, fusionándolo con el último si es posible. */
+static int map_push(bwfs_extent_map_t *map, const bwfs_extent_t *e)
+{
+    if (map->count > 0) {
+        bwfs_extent_t *last = &map->ext[map->count - 1];
+        if (ext_joinable(last, e)) {
+            last->len += ext_len(e);
+            return BWFS_OK;
+        }
+    }
+    if (map_reserve(map, map->count + 1) != BWFS_OK)
+        return BWFS_ERR_NOMEM;
+    map->ext[map->count++] = *e;
+    return BWFS_OK;
+}
+
+/** \brief Fusiona los extents vecinos que se han vuelto contiguos. */
+static void map_normalize(bwfs_extent_map_t *map)
+{
+    uint32_t out = 0;
+    for (uint32_t i = 0; i < map->count; ++i) {
+        if (out > 0 && ext_joinable(&map->ext[out - 1], &map->ext[i]))
+            map->ext[out - 1].len += ext_len(&map->ext[i]);
+        else
+            map->ext[out++] = map->ext[i];
+    }
+    map->count = out;
+}
+
+static int meta_push(bwfs_extent_map_t *map, uint32_t blk)
+{
+    uint32_t *meta = (uint32_t *)realloc(map->meta,
+                                         (map->meta_count + 1) * sizeof *meta);
+    if (!meta)
+        return BWFS_ERR_NOMEM;
+    map->meta = meta;
+    map->meta[map->meta_count++] = blk;
+    return BWFS_OK;
+}
+
+/** \brief Libera los bloques hoja/índice `meta[keep..)`. */
+static void drop_meta(bwfs_bitmap_t *bm, bwfs_extent_map_t *map, uint32_t keep)
+{
+    for (uint32_t i = keep; i < map->meta_count; ++i)
+        bwfs_free_blocks(bm, map->meta[i], 1);
+    if (keep < map->meta_count)
+        map->meta_count = keep;
+}
+
+/**
+ * \brief Reserva bloques para los lógicos `[logical, logical+count)` y los
+ *        añade al final de `map`, que debe terminar antes de `logical`.
+ *
+ * Pide primero una sola región contigua y, si el bitmap no la tiene, va
+ * partiendo la petición a la mitad.  Si falla, lo ya reservado se queda en
+ * el mapa: deshacerlo le toca a quien llama.
+ */
+static int alloc_run(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                     uint32_t logical, uint32_t count, bool unwritten)
+{
+    uint32_t chunk = count;
+    uint32_t done  = 0;
+
+    while (done < count) {
+        uint32_t want  = chunk < count - done ? chunk : count - done;
+        uint32_t start = bwfs_alloc_blocks(bm, want);
+
+        if (start == UINT32_MAX) {
+            if (want == 1)
+                return BWFS_ERR_FULL;
+            chunk = want / 2;
+            continue;
+        }
+
+        bwfs_extent_t e = { logical + done, start,
+                            want | (unwritten ? BWFS_EXT_UNWRITTEN : 0U) };
+        if (map_push(map, &e) != BWFS_OK) {
+            bwfs_free_blocks(bm, start, want);
+            return BWFS_ERR_NOMEM;
+        }
+        done += want;
+    }
+    return BWFS_OK;
+}
+
+/** \brief Añade al mapa los extents de la hoja `blk`. */
+static int load_leaf(uint32_t blk, const char *fs_dir, bwfs_extent_map_t *map)
+{
+    uint32_t hdr[2];
+    if (util_read_block_range(fs_dir, blk, 0, (uint8_t *)hdr, sizeof hdr) != 0)
+        return BWFS_ERR_IO;
+    if (hdr[0] != BWFS_EXT_LEAF_MAGIC || hdr[1] > BWFS_EXT_LEAF_CAP)
+        return BWFS_ERR_IO;
+
+    if (map_reserve(map, map->count + hdr[1]) != BWFS_OK)
+        return BWFS_ERR_NOMEM;
+    if (hdr[1] > 0 &&
+        util_read_block_range(fs_dir, blk, offsetof(bwfs_extent_leaf_t, ext),
+                              (uint8_t *)(map->ext + map->count),
+                              hdr[1] * sizeof(bwfs_extent_t)) != 0)
+        return BWFS_ERR_IO;
+    map->count += hdr[1];
+    return BWFS_OK;
+}
+
+/**
+ * \brief Lee la cabecera y las entradas de un bloque índice.
+ * \param[out] idx  Entradas (malloc; libera quien llama).
+ */
+static int load_index(uint32_t blk, const char *fs_dir,
+                      uint32_t **idx, uint32_t *count)
+{
+    uint32_t hdr[2];
+    if (util_read_block_range(fs_dir, blk, 0, (uint8_t *)hdr, sizeof hdr) != 0)
+        return BWFS_ERR_IO;
+    if (hdr[0] != BWFS_EXT_INDEX_MAGIC || hdr[1] == 0 || hdr[1] > BWFS_EXT_INDEX_CAP)
+        return BWFS_ERR_IO;
+
+    *idx = (uint32_t *)malloc(hdr[1] * 2U * sizeof **idx);
+    if (!*idx)
+        return BWFS_ERR_NOMEM;
+    if (util_read_block_range(fs_dir, blk, offsetof(bwfs_extent_index_t, idx),
+                              (uint8_t *)*idx, hdr[1] * 2U * sizeof **idx) != 0) {
+        free(*idx);
+        return BWFS_ERR_IO;
+    }
+    *count = hdr[1];
+    return BWFS_OK;
+}
+
+/**
+ * \brief Tramo de `ext[0..n)` que contiene `lblk`, recortado (ver
+ *        \ref bwfs_extent_lookup).  `next_after` es el primer bloque lógico
+ *        asignado tras este arreglo (UINT32_MAX si ninguno).
+ */
+static void clip(const bwfs_extent_t *ext, uint32_t n, uint32_t lblk,
+                 uint32_t next_after, bwfs_extent_t *out)
+{
+    /* Número de extents con logical <= lblk */
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ext[mid].logical <= lblk) lo = mid + 1;
+        else                          hi = mid;
+    }
+
+    out->logical = lblk;
+    if (lo > 0) {
+        const bwfs_extent_t *e = &ext[lo - 1];
+        uint32_t d = lblk - e->logical;
+        if (d < ext_len(e)) {
+            out->physical = e->physical + d;
+            out->len      = (ext_len(e) - d) | ext_flag(e);
+            return;
+        }
+    }
+
+    uint32_t next = lo < n ? ext[lo].logical : next_after;
+    out->physical = 0;
+    out->len      = (next == UINT32_MAX || next - lblk > BWFS_EXT_LEN_MASK)
+                    ? BWFS_EXT_LEN_MASK : next - lblk;
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+void bwfs_extent_map_init(bwfs_extent_map_t *map)
+{
+    memset(map, 0, sizeof *map);
+}
+
+void bwfs_extent_map_free(bwfs_extent_map_t *map)
+{
+    free(map->ext);
+    free(map->meta);
+    bwfs_extent_map_init(map);
+}
+
+uint32_t bwfs_extent_mapped(const bwfs_extent_map_t *map)
+{
+    if (map->count == 0)
+        return 0;
+    const bwfs_extent_t *last = &map->ext[map->count - 1];
+    return last->logical + ext_len(last);
+}
+
+int bwfs_extent_load(const bwfs_inode_t *inode, const char *fs_dir,
+                     bwfs_extent_map_t *map)
+{
+    map->count      = 0;
+    map->meta_count = 0;
+
+    if (inode->flags & BWFS_INODE_INLINE)
+        return BWFS_OK;
+
+    /* Formato antiguo: bloques directos con su bit de «sin escribir» */
+    if (!(inode->flags & BWFS_INODE_EXTENTS)) {
+        for (uint32_t i = 0; i < inode->block_count && i < BWFS_DIRECT_BLOCKS; ++i) {
+            bwfs_extent_t e = { i, inode->blocks[i], 1U };
+            if (inode->unwritten & (1U << i))
+                e.len |= BWFS_EXT_UNWRITTEN;
+            if (map_push(map, &e) != BWFS_OK)
+                return BWFS_ERR_NOMEM;
+        }
+        return BWFS_OK;
+    }
+
+    bwfs_extent_hdr_t hdr;
+    read_hdr(inode, &hdr);
+
+    switch (hdr.depth) {
+    case 0: {
+        if (hdr.count > BWFS_EXT_INLINE)
+            return BWFS_ERR_IO;
+        bwfs_extent_t ext[BWFS_EXT_INLINE];
+        read_inline(inode, ext);
+        if (map_reserve(map, hdr.count) != BWFS_OK)
+            return BWFS_ERR_NOMEM;
+        if (hdr.count > 0)                 /* p.ej. solo cola empaquetada */
+            memcpy(map->ext, ext, hdr.count * sizeof *ext);
+        map->count = hdr.count;
+        return BWFS_OK;
+    }
+    case 1:
+        if (meta_push(map, inode->indirect) != BWFS_OK)
+            return BWFS_ERR_NOMEM;
+        return load_leaf(inode->indirect, fs_dir, map);
+    case 2: {
+        uint32_t *idx, n;
+        int rc = load_index(inode->indirect, fs_dir, &idx, &n);
+        if (rc != BWFS_OK)
+            return rc;
+        rc = meta_push(map, inode->indirect);
+        for (uint32_t k = 0; rc == BWFS_OK && k < n; ++k) {
+            rc = meta_push(map, idx[2 * k + 1]);
+            if (rc == BWFS_OK)
+                rc = load_leaf(idx[2 * k + 1], fs_dir, map);
+        }
+        free(idx);
+        return rc;
+    }
+    default:
+        return BWFS_ERR_IO;
+    }
+}
+
+int bwfs_extent_store(bwfs_bitmap_t *bm, bwfs_inode_t *inode,
+                      const char *fs_dir, bwfs_extent_map_t *map)
+{
+    uint32_t n      = map->count;
+    uint32_t leaves = n <= BWFS_EXT_INLINE ? 0
+                    : (n + BWFS_EXT_LEAF_CAP - 1) / BWFS_EXT_LEAF_CAP;
+    uint32_t need   = leaves <= 1 ? leaves : leaves + 1;
+
+    if (leaves > BWFS_EXT_INDEX_CAP)
+        return BWFS_ERR_FULL;
+
+    /* 1) Bloques hoja/índice: reutilizar los que había y pedir el resto */
+    uint32_t had = map->meta_count;
+    while (map->meta_count < need) {
+        uint32_t blk = bwfs_alloc_blocks(bm, 1);
+        int rc = blk == UINT32_MAX ? BWFS_ERR_FULL : meta_push(map, blk);
+        if (rc != BWFS_OK) {
+            if (blk != UINT32_MAX)
+                bwfs_free_blocks(bm, blk, 1);
+            drop_meta(bm, map, had);
+            return rc;
+        }
+    }
+
+    /* 2) Escribir hojas (e índice) */
+    if (need > 0) {
+        uint8_t *buf = (uint8_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+        if (!buf)
+            return BWFS_ERR_NOMEM;
+
+        int rc = BWFS_OK;
+        bwfs_extent_leaf_t  *leaf = (bwfs_extent_leaf_t *)buf;
+        bwfs_extent_index_t *index = (bwfs_extent_index_t *)buf;
+        uint32_t first_leaf = leaves == 1 ? 0 : 1;
+
+        for (uint32_t k = 0; rc == BWFS_OK && k < leaves; ++k) {
+            uint32_t from = k * (uint32_t)BWFS_EXT_LEAF_CAP;
+            uint32_t cnt  = n - from < BWFS_EXT_LEAF_CAP ? n - from
+                                                         : (uint32_t)BWFS_EXT_LEAF_CAP;
+            util_block_zero(buf);
+            leaf->magic = BWFS_EXT_LEAF_MAGIC;
+            leaf->count = cnt;
+            memcpy(leaf->ext, map->ext + from, cnt * sizeof *map->ext);
+            if (util_write_block(fs_dir, map->meta[first_leaf + k], buf,
+                                 BWFS_BLOCK_SIZE_BYTES) != 0)
+                rc = BWFS_ERR_IO;
+        }
+
+        if (rc == BWFS_OK && leaves > 1) {
+            util_block_zero(buf);
+            index->magic = BWFS_EXT_INDEX_MAGIC;
+            index->count = leaves;
+            for (uint32_t k = 0; k < leaves; ++k) {
+                index->idx[k].logical = map->ext[k * BWFS_EXT_LEAF_CAP].logical;
+                index->idx[k].block   = map->meta[1 + k];
+            }
+            if (util_write_block(fs_dir, map->meta[0], buf, BWFS_BLOCK_SIZE_BYTES) != 0)
+                rc = BWFS_ERR_IO;
+        }
+        free(buf);
+        if (rc != BWFS_OK) {
+            drop_meta(bm, map, had);
+            return rc;
+        }
+    }
+
+    /* 3) Soltar los bloques que sobran */
+    drop_meta(bm, map, need);
+
+    /* 4) Cabecera en el inodo (pisa los antiguos blocks[] y unwritten) */
+    bwfs_extent_hdr_t hdr = { (uint16_t)(leaves == 0 ? n : 0),
+                              (uint16_t)(leaves == 0 ? 0 : leaves == 1 ? 1 : 2) };
+    memset(inode_area(inode), 0, BWFS_INLINE_MAX);
+    memcpy(inode_area(inode), &hdr, sizeof hdr);
+    if (leaves == 0)
+        memcpy(inode_area(inode) + sizeof hdr, map->ext, n * sizeof *map->ext);
+    inode->indirect = need > 0 ? map->meta[0] : 0;
+    inode->flags   |= BWFS_INODE_EXTENTS;
+    return BWFS_OK;
+}
+
+int bwfs_extent_alloc(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                      uint32_t count, bool unwritten)
+{
+    uint32_t base = bwfs_extent_mapped(map);
+    int      rc   = alloc_run(bm, map, base, count, unwritten);
+    if (rc != BWFS_OK)
+        bwfs_extent_truncate(bm, map, base);
+    return rc;
+}
+
+int bwfs_extent_fill(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                     uint32_t first, uint32_t count, bool unwritten,
+                     bwfs_extent_map_t *added)
+{
+    uint64_t end = (uint64_t)first + count;
+    uint64_t pos = first;
+    uint32_t i   = 0;
+    int      rc  = BWFS_OK;
+
+    added->count = 0;
+    if (end > BWFS_EXT_LEN_MASK)
+        return BWFS_ERR_FULL;
+
+    /* Reservar cada hueco por separado, en orden */
+    while (rc == BWFS_OK && pos < end) {
+        while (i < map->count &&
+               map->ext[i].logical + ext_len(&map->ext[i]) <= pos)
+            ++i;
+        if (i < map->count && map->ext[i].logical <= pos) {
+            pos = map->ext[i].logical + ext_len(&map->ext[i]);
+            continue;
+        }
+        uint64_t gap_end = i < map->count && map->ext[i].logical < end
+                           ? map->ext[i].logical : end;
+        rc  = alloc_run(bm, added, (uint32_t)pos, (uint32_t)(gap_end - pos),
+                        unwritten);
+        pos = gap_end;
+    }
+    if (rc == BWFS_OK && added->count > 0 &&
+        map_reserve(map, map->count + added->count) != BWFS_OK)
+        rc = BWFS_ERR_NOMEM;
+    if (rc != BWFS_OK) {
+        for (uint32_t k = 0; k < added->count; ++k)
+            bwfs_free_blocks(bm, added->ext[k].physical, ext_len(&added->ext[k]));
+        added->count = 0;
+        return rc;
+    }
+
+    /* Intercalar los nuevos (ya ordenados) entre los existentes, desde
+     * el final para no pisar nada */
+    uint32_t a = map->count, b = added->count, n = a + b;
+    while (b > 0) {
+        if (a > 0 && map->ext[a - 1].logical > added->ext[b - 1].logical)
+            map->ext[--n] = map->ext[--a];
+        else
+            map->ext[--n] = added->ext[--b];
+    }
+    map->count += added->count;
+    map_normalize(map);
+    return BWFS_OK;
+}
+
+void bwfs_extent_truncate(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                          uint32_t from)
+{
+    while (map->count > 0) {
+        bwfs_extent_t *e   = &map->ext[map->count - 1];
+        uint32_t       len = ext_len(e);
+
+        if (e->logical >= from) {
+            bwfs_free_blocks(bm, e->physical, len);
+            map->count--;
+            continue;
+        }
+        if (e->logical + len > from) {
+            uint32_t keep = from - e->logical;
+            bwfs_free_blocks(bm, e->physical + keep, len - keep);
+            e->len = keep | ext_flag(e);
+        }
+        break;
+    }
+}
+
+int bwfs_extent_mark_written(bwfs_extent_map_t *map,
+                             uint32_t first, uint32_t count)
+{
+    uint64_t end = (uint64_t)first + count;
+
+    for (uint32_t i = 0; i < map->count; ++i) {
+        bwfs_extent_t e = map->ext[i];
+        if (!ext_flag(&e))
+            continue;
+
+        uint64_t s = e.logical, t = s + ext_len(&e);
+        if (t <= first || s >= end)
+            continue;
+
+        /* Trozos: [s,a) sin escribir, [a,b) escrito, [b,t) sin escribir */
+        uint32_t a = (uint32_t)(s > first ? s : first);
+        uint32_t b = (uint32_t)(t < end ? t : end);
+        uint32_t pieces = (a > s) + 1U + (b < t);
+
+        if (map_reserve(map, map->count + pieces - 1) != BWFS_OK)
+            return BWFS_ERR_NOMEM;
+        memmove(&map->ext[i + pieces], &map->ext[i + 1],
+                (map->count - i - 1) * sizeof *map->ext);
+        map->count += pieces - 1;
+
+        bwfs_extent_t *out = &map->ext[i];
+        if (a > s) {
+            out->logical  = e.logical;
+            out->physical = e.physical;
+            out->len      = (a - e.logical) | BWFS_EXT_UNWRITTEN;
+            ++out;
+        }
+        out->logical  = a;
+        out->physical = e.physical + (a - e.logical);
+        out->len      = b - a;
+        ++out;
+        if (b < t) {
+            out->logical  = b;
+            out->physical = e.physical + (b - e.logical);
+            out->len      = ((uint32_t)t - b) | BWFS_EXT_UNWRITTEN;
+        }
+        i += pieces - 1;
+    }
+
+    map_normalize(map);
+    return BWFS_OK;
+}
+
+int bwfs_extent_remap(bwfs_bitmap_t *bm, bwfs_extent_map_t *map,
+                      uint32_t first, uint32_t count, uint32_t physical,
+                      bool unwritten)
+{
+    uint64_t end = (uint64_t)first + count;
+    if (count == 0 || count > BWFS_EXT_LEN_MASK || end > bwfs_extent_mapped(map))
+        return BWFS_ERR_IO;
+
+    /* Solo se parten los extents de los bordes: dos tramos más, como mucho */
+    uint32_t       cap = map->count + 2U;
+    bwfs_extent_t *out = (bwfs_extent_t *)malloc(cap * sizeof *out);
+    if (!out)
+        return BWFS_ERR_NOMEM;
+
+    bwfs_extent_t repl = { first, physical,
+                           count | (unwritten ? BWFS_EXT_UNWRITTEN : 0U) };
+    uint32_t n = 0;
+    bool placed = false;
+    for (uint32_t i = 0; i < map->count; ++i) {
+        bwfs_extent_t e = map->ext[i];
+        uint64_t s = e.logical, t = s + ext_len(&e);
+        if (t <= first || s >= end) {
+            if (!placed && s >= end) {
+                out[n++] = repl;
+                placed = true;
+            }
+            out[n++] = e;
+            continue;
+        }
+
+        /* Trozos: [s,a) se queda, [a,b) se sustituye, [b,t) se queda */
+        uint32_t a = (uint32_t)(s > first ? s : first);
+        uint32_t b = (uint32_t)(t < end ? t : end);
+        if (a > s)
+            out[n++] = (bwfs_extent_t){ e.logical, e.physical,
+                                        (a - e.logical) | ext_flag(&e) };
+        if (!placed) {
+            out[n++] = repl;
+            placed = true;
+        }
+        bwfs_free_blocks(bm, e.physical + (a - e.logical), b - a);
+        if (b < t)
+            out[n++] = (bwfs_extent_t){ b, e.physical + (b - e.logical),
+                                        ((uint32_t)t - b) | ext_flag(&e) };
+    }
+    if (!placed)
+        out[n++] = repl;
+
+    free(map->ext);
+    map->ext   = out;
+    map->count = n;
+    map->cap   = cap;
+    map_normalize(map);
+    return BWFS_OK;
+}
+
+int bwfs_extent_lookup(const bwfs_inode_t *inode, const char *fs_dir,
+                       uint32_t lblk, bwfs_extent_t *out)
+{
+    bwfs_extent_hdr_t hdr;
+    read_hdr(inode, &hdr);
+
+    /* Antiguos y en línea: el mapa sale del inodo sin E/S */
+    if (!(inode->flags & BWFS_INODE_EXTENTS) || hdr.depth == 0) {
+        bwfs_extent_map_t map;
+        bwfs_extent_map_init(&map);
+        int rc = bwfs_extent_load(inode, fs_dir, &map);
+        if (rc == BWFS_OK)
+            clip(map.ext, map.count, lblk, UINT32_MAX, out);
+        bwfs_extent_map_free(&map);
+        return rc;
+    }
+
+    uint32_t leaf = inode->indirect, next_after = UINT32_MAX;
+
+    if (hdr.depth == 2) {
+        uint32_t *idx, n;
+        int rc = load_index(inode->indirect, fs_dir, &idx, &n);
+        if (rc != BWFS_OK)
+            return rc;
+
+        uint32_t lo = 0, hi = n;
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (idx[2 * mid] <= lblk) lo = mid + 1;
+            else                      hi = mid;
+        }
+        if (lo == 0) {                      /* antes de la primera hoja */
+            out->logical  = lblk;
+            out->physical = 0;
+            out->len      = idx[0] - lblk;
+            free(idx);
+            return BWFS_OK;
+        }
+        leaf       = idx[2 * (lo - 1) + 1];
+        next_after = lo < n ? idx[2 * lo] : UINT32_MAX;
+        free(idx);
+    } else if (hdr.depth != 1) {
+        return BWFS_ERR_IO;
+    }
+
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+    int rc = load_leaf(leaf, fs_dir, &map);
+    if (rc == BWFS_OK)
+        clip(map.ext, map.count, lblk, next_after, out);
+    bwfs_extent_map_free(&map);
+    return rc;
+}
+
+int bwfs_extent_seek(const bwfs_inode_t *inode, const char *fs_dir,
+                     uint32_t lblk, bool data, uint32_t *out)
+{
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+
+    int rc = bwfs_extent_load(inode, fs_dir, &map);
+    if (rc != BWFS_OK) {
+        bwfs_extent_map_free(&map);
+        return rc;
+    }
+
+    /* Un extent «sin escribir» se lee como ceros: cuenta como hueco */
+    uint32_t pos = lblk;
+    *out = data ? UINT32_MAX : pos;
+    for (uint32_t i = 0; i < map.count; ++i) {
+        const bwfs_extent_t *e = &map.ext[i];
+        uint32_t t = e->logical + ext_len(e);
+        if (t <= pos)
+            continue;
+        if (data) {
+            if (!ext_flag(e)) {
+                *out = e->logical > pos ? e->logical : pos;
+                break;
+            }
+        } else {
+            if (e->logical > pos || ext_flag(e))
+                break;
+            pos  = t;
+            *out = pos;
+        }
+    }
+
+    bwfs_extent_map_free(&map);
+    return BWFS_OK;
+}
+
+int bwfs_extent_release(bwfs_bitmap_t *bm, const bwfs_inode_t *inode,
+                        const char *fs_dir)
+{
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+
+    int rc = bwfs_extent_load(inode, fs_dir, &map);
+    if (rc == BWFS_OK) {
+        for (uint32_t i = 0; i < map.count; ++i)
+            bwfs_free_blocks(bm, map.ext[i].physical, ext_len(&map.ext[i]));
+        for (uint32_t i = 0; i < map.meta_count; ++i)
+            bwfs_free_blocks(bm, map.meta[i], 1);
+    }
+    bwfs_extent_map_free(&map);
+    return rc;
+}
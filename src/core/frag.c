@@ -0,0 +1,470 @@
+// -----------------------------------------------------------------------------
+// File: src/core/frag.c
+// -----------------------------------------------------------------------------
+/**
+ * \file frag.c
+ * \brief Asignador de fragmentos para las colas de los archivos.
+ *
+ *  - Cada bloque de fragmentos reparte 125 000 bytes en unidades de 64; la
+ *    tabla de dueños (un nº de inodo por unidad) ocupa las primeras.
+ *  - En RAM: la lista de bloques, en el mismo orden que en disco, y las
+ *    unidades ocupadas de cada uno.  Asignar lee la tabla de dueños de un
+ *    candidato y escribe solo las entradas tocadas y la cabecera.
+ *  - Los huecos que dejan los borrados se recuperan compactando: los
+ *    fragmentos del bloque más vacío se mueven a otros y el bloque se
+ *    libera.  Como cada unidad sabe de quién es, mover un fragmento solo
+ *    exige reescribir el inodo dueño.
+ */
+
+#include "frag.h"
+#include "inode.h"
+#include "allocation.h"
+#include "txn.h"
+#include "util.h"
+
+#include <string.h>   /* memcpy, memmove, memset */
+#include <stdlib.h>   /* malloc, calloc, realloc, free */
+
+/** Bloques con hueco que se prueban antes de añadir uno nuevo. */
+#define FRAG_PROBES     4U
+
+/* ------------------------------------------------------------------------- */
+/* Estado del disco abierto                                                  */
+/* ------------------------------------------------------------------------- */
+
+static struct {
+    bwfs_superblock_t *sb;     /**< Superbloque del montaje (frag_head)    */
+    uint32_t          *blk;    /**< Bloques de la lista, en orden          */
+    uint32_t          *used;   /**< Unidades con dueño de cada bloque      */
+    uint32_t           count;
+    uint32_t           cap;
+    uint32_t           hint;   /**< Índice del último bloque asignado      */
+} ftab;
+
+/** Unidades de datos de un bloque de fragmentos. */
+static inline uint32_t data_units(void)
+{
+    return BWFS_FRAG_UNITS - BWFS_FRAG_FIRST;
+}
+
+static int list_reserve(uint32_t n)
+{
+    if (n <= ftab.cap)
+        return BWFS_OK;
+
+    uint32_t cap = ftab.cap ? ftab.cap * 2U : 16U;
+    while (cap < n)
+        cap *= 2U;
+
+    uint32_t *blk  = (uint32_t *)realloc(ftab.blk, cap * sizeof *blk);
+    if (!blk)
+        return BWFS_ERR_NOMEM;
+    ftab.blk = blk;
+    uint32_t *used = (uint32_t *)realloc(ftab.used, cap * sizeof *used);
+    if (!used)
+        return BWFS_ERR_NOMEM;
+    ftab.used = used;
+    ftab.cap  = cap;
+    return BWFS_OK;
+}
+
+static uint32_t list_find(uint32_t blk)
+{
+    for (uint32_t i = 0; i < ftab.count; ++i)
+        if (ftab.blk[i] == blk)
+            return i;
+    return UINT32_MAX;
+}
+
+/* ------------------------------------------------------------------------- */
+/* E/S de cabecera y tabla de dueños                                         */
+/* ------------------------------------------------------------------------- */
+
+static int write_used(uint32_t idx, const char *fs_dir)
+{
+    return util_write_block_range(fs_dir, ftab.blk[idx],
+                                  offsetof(bwfs_frag_block_t, used),
+                                  (const uint8_t *)&ftab.used[idx],
+                                  sizeof(uint32_t)) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+static int read_owners(uint32_t blk, uint32_t first, uint32_t n,
+                       uint32_t *owner, const char *fs_dir)
+{
+    return util_read_block_range(fs_dir, blk,
+                                 sizeof(bwfs_frag_block_t) + (size_t)first * 4U,
+                                 (uint8_t *)owner, (size_t)n * 4U)
+           ? BWFS_ERR_IO : BWFS_OK;
+}
+
+/** \brief Pone `n` entradas de dueño a `ino` (0 = liberar) y las persiste. */
+static int write_owners(uint32_t blk, uint32_t first, uint32_t n, uint32_t ino,
+                        const char *fs_dir)
+{
+    uint32_t *owner = (uint32_t *)malloc((size_t)n * 4U);
+    if (!owner)
+        return BWFS_ERR_NOMEM;
+    for (uint32_t i = 0; i < n; ++i)
+        owner[i] = ino;
+
+    int rc = util_write_block_range(fs_dir, blk,
+                                    sizeof(bwfs_frag_block_t) + (size_t)first * 4U,
+                                    (const uint8_t *)owner, (size_t)n * 4U)
+             ? BWFS_ERR_IO : BWFS_OK;
+    free(owner);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Altas y bajas de bloques en la lista                                      */
+/* ------------------------------------------------------------------------- */
+
+/** \brief Crea un bloque de fragmentos vacío al principio de la lista. */
+static int add_block(bwfs_bitmap_t *bm, const char *fs_dir)
+{
+    if (list_reserve(ftab.count + 1) != BWFS_OK)
+        return BWFS_ERR_NOMEM;
+
+    uint32_t blk = bwfs_alloc_blocks(bm, 1);
+    if (blk == UINT32_MAX)
+        return BWFS_ERR_FULL;
+
+    bwfs_frag_block_t *hdr = (bwfs_frag_block_t *)calloc(1, BWFS_FRAG_HDR_SIZE);
+    if (!hdr) {
+        bwfs_free_blocks(bm, blk, 1);
+        return BWFS_ERR_NOMEM;
+    }
+    hdr->magic = BWFS_FRAG_MAGIC;
+    hdr->next  = ftab.sb->frag_head;
+
+    /* Bloque primero, luego bitmap y superbloque que lo enlazan */
+    int rc = util_write_block(fs_dir, blk, (const uint8_t *)hdr,
+                              BWFS_FRAG_HDR_SIZE) ? BWFS_ERR_IO : BWFS_OK;
+    free(hdr);
+
+    uint32_t old_head = ftab.sb->frag_head;
+    ftab.sb->frag_head = blk;
+    if (rc == BWFS_OK &&
+        (bwfs_write_bitmap(bm, fs_dir) != BWFS_OK ||
+         bwfs_write_superblock(ftab.sb, fs_dir) != BWFS_OK))
+        rc = BWFS_ERR_IO;
+    if (rc != BWFS_OK) {
+        ftab.sb->frag_head = old_head;
+        bwfs_free_blocks(bm, blk, 1);
+        return rc;
+    }
+
+    memmove(&ftab.blk[1],  &ftab.blk[0],  ftab.count * sizeof *ftab.blk);
+    memmove(&ftab.used[1], &ftab.used[0], ftab.count * sizeof *ftab.used);
+    ftab.blk[0]  = blk;
+    ftab.used[0] = 0;
+    ftab.count++;
+    ftab.hint = 0;
+    return BWFS_OK;
+}
+
+/** \brief Saca de la lista el bloque vacío `idx` y lo devuelve al bitmap. */
+static int drop_block(bwfs_bitmap_t *bm, uint32_t idx, const char *fs_dir)
+{
+    uint32_t next = idx + 1 < ftab.count ? ftab.blk[idx + 1] : 0;
+    int      rc;
+
+    if (idx == 0) {
+        ftab.sb->frag_head = next;
+        rc = bwfs_write_superblock(ftab.sb, fs_dir);
+    } else {
+        rc = util_write_block_range(fs_dir, ftab.blk[idx - 1],
+                                    offsetof(bwfs_frag_block_t, next),
+                                    (const uint8_t *)&next, sizeof next)
+             ? BWFS_ERR_IO : BWFS_OK;
+    }
+    if (rc != BWFS_OK)
+        return rc;
+
+    bwfs_free_blocks(bm, ftab.blk[idx], 1);
+    memmove(&ftab.blk[idx],  &ftab.blk[idx + 1],
+            (ftab.count - idx - 1) * sizeof *ftab.blk);
+    memmove(&ftab.used[idx], &ftab.used[idx + 1],
+            (ftab.count - idx - 1) * sizeof *ftab.used);
+    ftab.count--;
+    if (ftab.hint > idx || ftab.hint >= ftab.count)
+        ftab.hint = ftab.hint ? ftab.hint - 1 : 0;
+
+    return bwfs_write_bitmap(bm, fs_dir);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Asignación dentro de un bloque                                            */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * \brief Busca `n` unidades libres contiguas en el bloque `idx` y se las
+ *        asigna a `ino`.
+ * \retval BWFS_OK, BWFS_ERR_FULL (no hay tramo), BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+static int take_units(uint32_t idx, uint32_t ino, uint32_t n,
+                      const char *fs_dir, uint32_t *unit)
+{
+    uint32_t *owner = (uint32_t *)malloc((size_t)BWFS_FRAG_UNITS * 4U);
+    if (!owner)
+        return BWFS_ERR_NOMEM;
+
+    int rc = read_owners(ftab.blk[idx], 0, BWFS_FRAG_UNITS, owner, fs_dir);
+    uint32_t run = 0, start = 0;
+    for (uint32_t u = BWFS_FRAG_FIRST; rc == BWFS_OK && u < BWFS_FRAG_UNITS; ++u) {
+        if (owner[u] != 0) {
+            run = 0;
+            continue;
+        }
+        if (run++ == 0)
+            start = u;
+        if (run == n)
+            break;
+    }
+    free(owner);
+    if (rc != BWFS_OK)
+        return rc;
+    if (run < n)
+        return BWFS_ERR_FULL;
+
+    ftab.used[idx] += n;
+    rc = write_owners(ftab.blk[idx], start, n, ino, fs_dir);
+    if (rc == BWFS_OK)
+        rc = write_used(idx, fs_dir);
+    if (rc != BWFS_OK) {
+        ftab.used[idx] -= n;
+        return rc;
+    }
+    *unit = start;
+    return BWFS_OK;
+}
+
+/**
+ * \brief Coloca `n` unidades en algún bloque existente distinto de
+ *        `skip`: primero el de la última asignación, luego hasta
+ *        #FRAG_PROBES con hueco suficiente.
+ * \retval BWFS_OK, BWFS_ERR_FULL (ninguno sirve), BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+static int place(uint32_t ino, uint32_t n, uint32_t skip, const char *fs_dir,
+                 uint32_t *idx, uint32_t *unit)
+{
+    uint32_t probes = 0;
+    for (uint32_t k = 0; k <= ftab.count && probes < FRAG_PROBES; ++k) {
+        /* k = 0 es el bloque de la última asignación */
+        uint32_t i = k == 0 ? ftab.hint : k - 1;
+        if (i >= ftab.count || i == skip || (k > 0 && i == ftab.hint) ||
+            data_units() - ftab.used[i] < n)
+            continue;
+
+        probes++;
+        int rc = take_units(i, ino, n, fs_dir, unit);
+        if (rc == BWFS_OK) {
+            *idx = ftab.hint = i;
+            return BWFS_OK;
+        }
+        if (rc != BWFS_ERR_FULL)
+            return rc;
+    }
+    return BWFS_ERR_FULL;
+}
+
+/**
+ * \brief Copia la cola de `inode` (`n` unidades en `buf` desde `u`) a otro
+ *        bloque distinto de `skip` y reescribe el inodo; el tramo viejo
+ *        queda a cargo de quien llama.
+ * \retval BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+static int move_one(bwfs_inode_t *inode, uint32_t skip, uint32_t u, uint32_t n,
+                    const uint8_t *buf, const char *fs_dir)
+{
+    uint32_t idx, unit;
+    int rc = place(inode->ino, n, skip, fs_dir, &idx, &unit);
+    if (rc != BWFS_OK)
+        return rc;
+
+    if (util_write_block_range(fs_dir, ftab.blk[idx], bwfs_frag_offset(unit),
+                               buf + bwfs_frag_offset(u),
+                               (size_t)n * BWFS_FRAG_UNIT) != 0)
+        rc = BWFS_ERR_IO;
+    if (rc == BWFS_OK) {
+        inode->frag_block = ftab.blk[idx];
+        inode->frag_unit  = unit;
+        rc = bwfs_write_inode(inode, fs_dir);
+    }
+    return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+int bwfs_frag_open(bwfs_superblock_t *sb, const char *fs_dir)
+{
+    bwfs_frag_close();
+    ftab.sb = sb;
+
+    for (uint32_t blk = sb->frag_head; blk != 0; ) {
+        bwfs_frag_block_t hdr;
+        if (blk >= sb->total_blocks || ftab.count >= sb->total_blocks ||
+            util_read_block_range(fs_dir, blk, 0, (uint8_t *)&hdr, sizeof hdr) != 0 ||
+            hdr.magic != BWFS_FRAG_MAGIC || hdr.used > data_units()) {
+            BWFS_LOG_ERROR("Lista de fragmentos dañada en el bloque %u", blk);
+            bwfs_frag_close();
+            return BWFS_ERR_IO;
+        }
+        if (list_reserve(ftab.count + 1) != BWFS_OK) {
+            bwfs_frag_close();
+            return BWFS_ERR_NOMEM;
+        }
+        ftab.blk[ftab.count]  = blk;
+        ftab.used[ftab.count] = hdr.used;
+        ftab.count++;
+        blk = hdr.next;
+    }
+    return BWFS_OK;
+}
+
+void bwfs_frag_close(void)
+{
+    free(ftab.blk);
+    free(ftab.used);
+    memset(&ftab, 0, sizeof ftab);
+}
+
+bool bwfs_frag_ready(void)
+{
+    return ftab.sb != NULL;
+}
+
+int bwfs_frag_alloc(bwfs_bitmap_t *bm, uint32_t ino, uint32_t len,
+                    const char *fs_dir, uint32_t *blk, uint32_t *unit)
+{
+    uint32_t n = bwfs_frag_units(len);
+    if (!ftab.sb)
+        return BWFS_ERR_IO;
+    bwfs_txn_lock_alloc();
+    if (n == 0 || len > BWFS_FRAG_MAX || n > data_units())
+        return BWFS_ERR_FULL;
+
+    uint32_t idx;
+    int rc = place(ino, n, UINT32_MAX, fs_dir, &idx, unit);
+    if (rc == BWFS_ERR_FULL) {
+        idx = 0;                             /* el bloque nuevo va primero */
+        rc  = add_block(bm, fs_dir);
+        if (rc == BWFS_OK)
+            rc = take_units(idx, ino, n, fs_dir, unit);
+    }
+    if (rc != BWFS_OK)
+        return rc;
+
+    *blk = ftab.blk[idx];
+    return BWFS_OK;
+}
+
+int bwfs_frag_free(bwfs_bitmap_t *bm, uint32_t ino, uint32_t blk,
+                   uint32_t unit, const char *fs_dir)
+{
+    bwfs_txn_lock_alloc();
+    uint32_t idx = ftab.sb ? list_find(blk) : UINT32_MAX;
+    if (idx == UINT32_MAX || unit < BWFS_FRAG_FIRST || unit >= BWFS_FRAG_UNITS)
+        return BWFS_ERR_IO;
+
+    /* El tramo acaba donde cambia el dueño: no hace falta saber su longitud */
+    uint32_t max = bwfs_frag_units(BWFS_FRAG_MAX);
+    if (max > BWFS_FRAG_UNITS - unit)
+        max = BWFS_FRAG_UNITS - unit;
+
+    uint32_t *owner = (uint32_t *)malloc((size_t)max * 4U);
+    if (!owner)
+        return BWFS_ERR_NOMEM;
+    int rc = read_owners(blk, unit, max, owner, fs_dir);
+    uint32_t n = 0;
+    while (rc == BWFS_OK && n < max && owner[n] == ino)
+        n++;
+    free(owner);
+    if (rc != BWFS_OK)
+        return rc;
+    if (n == 0 || n > ftab.used[idx])
+        return BWFS_ERR_IO;
+
+    ftab.used[idx] -= n;
+    rc = write_owners(blk, unit, n, 0, fs_dir);
+    if (rc == BWFS_OK)
+        rc = write_used(idx, fs_dir);
+    if (rc == BWFS_OK && ftab.used[idx] == 0 && idx != ftab.hint)
+        rc = drop_block(bm, idx, fs_dir);
+    return rc;
+}
+
+int bwfs_frag_compact(bwfs_bitmap_t *bm, const char *fs_dir, uint32_t budget)
+{
+    if (!ftab.sb || ftab.count < 2)
+        return 0;
+    bwfs_txn_lock_alloc();
+
+    /* Víctima: el bloque menos ocupado por debajo de un cuarto, si el resto
+     * de bloques tiene hueco para todo lo que contiene */
+    uint32_t victim = UINT32_MAX;
+    uint64_t spare  = 0;
+    for (uint32_t i = 0; i < ftab.count; ++i) {
+        spare += data_units() - ftab.used[i];
+        if (i != ftab.hint && ftab.used[i] * 4U <= data_units() &&
+            (victim == UINT32_MAX || ftab.used[i] < ftab.used[victim]))
+            victim = i;
+    }
+    if (victim == UINT32_MAX ||
+        spare - (data_units() - ftab.used[victim]) < ftab.used[victim])
+        return 0;
+    if (ftab.used[victim] == 0)
+        return drop_block(bm, victim, fs_dir);
+
+    uint32_t  vblk  = ftab.blk[victim];
+    uint8_t  *buf   = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!buf)
+        return BWFS_ERR_NOMEM;
+    if (util_read_block(fs_dir, vblk, buf, BWFS_BLOCK_SIZE_BYTES) != 0) {
+        free(buf);
+        return BWFS_ERR_IO;
+    }
+    const uint8_t *owner_at = buf + sizeof(bwfs_frag_block_t);
+
+    int      rc    = BWFS_OK;
+    uint32_t moved = 0;
+    for (uint32_t u = BWFS_FRAG_FIRST; u < BWFS_FRAG_UNITS && moved < budget; ) {
+        uint32_t ino, n = 0;
+        memcpy(&ino, owner_at + (size_t)u * 4U, sizeof ino);
+        if (ino == 0) {
+            u++;
+            continue;
+        }
+        while (u + n < BWFS_FRAG_UNITS) {
+            uint32_t o;
+            memcpy(&o, owner_at + (size_t)(u + n) * 4U, sizeof o);
+            if (o != ino)
+                break;
+            n++;
+        }
+
+        /* Solo se mueve si el inodo sigue apuntando a este tramo */
+        bwfs_inode_t inode;
+        rc = bwfs_read_inode(ino, &inode, fs_dir);
+        if (rc != BWFS_OK)
+            break;
+        if (!(inode.flags & BWFS_INODE_FRAG) ||
+            inode.frag_block != vblk || inode.frag_unit != u) {
+            rc = bwfs_frag_free(bm, ino, vblk, u, fs_dir);  /* huérfano */
+        } else {
+            rc = move_one(&inode, victim, u, n, buf, fs_dir);
+            if (rc == BWFS_OK)
+                rc = bwfs_frag_free(bm, ino, vblk, u, fs_dir);
+            if (rc == BWFS_OK)
+                moved++;
+        }
+        if (rc != BWFS_OK || list_find(vblk) == UINT32_MAX)
+            break;                           /* la víctima ya se liberó */
+        u += n;
+    }
+
+    free(buf);
+    return rc == BWFS_OK || rc == BWFS_ERR_FULL ? (int)moved : rc;
+}
@@ -0,0 +1,159 @@
+// -----------------------------------------------------------------------------
+// File: src/core/ilock.c
+// -----------------------------------------------------------------------------
+/**
+ * \file ilock.c
+ * \brief Cerrojos por inodo bajo demanda (ver ilock.h).
+ *
+ *  - Cada cubeta de la tabla hash tiene su mutex y una lista de entradas
+ *    {ino, usuarios, rwlock}.  Se cuenta como usuario desde que se busca la
+ *    entrada, antes de esperar al rwlock, así que no se libera mientras
+ *    alguien la espera.
+ *  - El hilo apunta lo que tiene en una lista propia que crece a demanda;
+ *    soltar recorre esa lista, sin tocar la tabla más que para descontar.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ilock.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>   /* malloc, realloc, free */
+
+#define IHASH_SIZE  256U
+
+/** Cerrojo de un inodo. */
+typedef struct ientry {
+    uint32_t          ino;
+    uint32_t          users;   /**< lo tienen o lo esperan */
+    pthread_rwlock_t  rw;
+    struct ientry    *next;
+} ientry_t;
+
+static struct {
+    pthread_mutex_t lock;
+    ientry_t       *head;
+} ihash[IHASH_SIZE];
+
+static pthread_once_t ihash_once = PTHREAD_ONCE_INIT;
+
+/** Lo que tiene el hilo. */
+typedef struct {
+    ientry_t *e;
+    bool      write;
+} iheld_t;
+
+static __thread iheld_t  *t_held;
+static __thread uint32_t  t_n, t_cap;
+
+static void ihash_init(void)
+{
+    for (uint32_t i = 0; i < IHASH_SIZE; ++i)
+        pthread_mutex_init(&ihash[i].lock, NULL);
+}
+
+static inline uint32_t bucket(uint32_t ino)
+{
+    return (ino * 2654435761U) % IHASH_SIZE;
+}
+
+static iheld_t *find_held(uint32_t ino)
+{
+    for (uint32_t i = 0; i < t_n; ++i)
+        if (t_held[i].e->ino == ino)
+            return &t_held[i];
+    return NULL;
+}
+
+/** \brief Entrada de `ino` con un usuario más (la crea si no existe). */
+static ientry_t *get_entry(uint32_t ino)
+{
+    uint32_t  b = bucket(ino);
+    ientry_t *e;
+
+    pthread_mutex_lock(&ihash[b].lock);
+    for (e = ihash[b].head; e && e->ino != ino; e = e->next)
+        ;
+    if (!e && (e = (ientry_t *)malloc(sizeof *e)) != NULL) {
+        e->ino   = ino;
+        e->users = 0;
+        pthread_rwlock_init(&e->rw, NULL);
+        e->next  = ihash[b].head;
+        ihash[b].head = e;
+    }
+    if (e)
+        e->users++;
+    pthread_mutex_unlock(&ihash[b].lock);
+    return e;
+}
+
+/** \brief Un usuario menos; el último retira la entrada. */
+static void put_entry(ientry_t *e)
+{
+    uint32_t b = bucket(e->ino);
+
+    pthread_mutex_lock(&ihash[b].lock);
+    if (--e->users == 0) {
+        ientry_t **pp = &ihash[b].head;
+        while (*pp != e)
+            pp = &(*pp)->next;
+        *pp = e->next;
+        pthread_rwlock_destroy(&e->rw);
+        free(e);
+    }
+    pthread_mutex_unlock(&ihash[b].lock);
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+int bwfs_ilock(uint32_t ino, bool write)
+{
+    /* Subir de lectura a escritura podría interbloquearse con otro hilo
+     * que hiciera lo mismo: es un error del llamador */
+    iheld_t *h = find_held(ino);
+    if (h) {
+        if (!write || h->write)
+            return BWFS_OK;
+        BWFS_LOG_ERROR("Cerrojo del inodo %u: ya se tiene de lectura", ino);
+        return BWFS_ERR_LOCK;
+    }
+
+    if (t_n == t_cap) {
+        uint32_t cap = t_cap ? t_cap * 2U : 16U;
+        iheld_t *v   = (iheld_t *)realloc(t_held, cap * sizeof *v);
+        if (!v)
+            return BWFS_ERR_NOMEM;
+        t_held = v;
+        t_cap  = cap;
+    }
+
+    pthread_once(&ihash_once, ihash_init);
+    ientry_t *e = get_entry(ino);
+    if (!e)
+        return BWFS_ERR_NOMEM;
+    if (write)
+        pthread_rwlock_wrlock(&e->rw);
+    else
+        pthread_rwlock_rdlock(&e->rw);
+
+    t_held[t_n].e     = e;
+    t_held[t_n].write = write;
+    t_n++;
+    return BWFS_OK;
+}
+
+void bwfs_ilock_release(void)
+{
+    /* Al revés de como se tomaron */
+    while (t_n > 0) {
+        ientry_t *e = t_held[--t_n].e;
+        pthread_rwlock_unlock(&e->rw);
+        put_entry(e);
+    }
+    free(t_held);
+    t_held = NULL;
+    t_cap  = 0;
+}
@@ -5,128 +5,723 @@
  * \file inode.c
  * \brief Gestión completa de inodos (crear, leer, escribir, redimensionar).
  *
- * - Cada inodo ocupa exactamente **un bloque lógico** del disco.
- * - Para la versión mínima se admiten solo 10 bloques directos
- *   (no se implementa aún el bloque indirecto).
+ * - Los inodos viven empaquetados en la **tabla de inodos** (976 ranuras de
+ *   128 bytes por bloque); leer o escribir uno toca solo su ranura mediante
+ *   E/S por rangos.
+ * - Un bitmap de inodos (bloque `inode_bitmap_blk`) se mantiene en RAM
+ *   mientras el disco está abierto (\ref bwfs_itable_open).
+ * - Los inodos nuevos se colocan junto al de su directorio padre, de modo
+ *   que los de un mismo directorio comparten bloque de tabla.
+ * - Los archivos de hasta 48 bytes guardan sus datos en la propia ranura
+ *   (#BWFS_INODE_INLINE): leerlos no requiere más E/S que la del inodo.
+ * - Los demás archivos describen sus bloques con extents (\ref extent.h);
+ *   los antiguos de 10 bloques directos se convierten al cambiar de tamaño.
+ * - Al cerrarse, la cola de un archivo (su último bloque parcial, o todo él
+ *   si es pequeño) se empaqueta en un bloque de fragmentos compartido
+ *   (\ref frag.h); vuelve a un bloque propio en cuanto el archivo crece.
+ * - Cada inodo recuerda su directorio padre y el hash de su entrada: al
+ *   cambiar de tamaño o de bloques se refresca la copia de esos atributos
+ *   que guarda la entrada (readdir no necesita leer el inodo).
  * - Todas las escrituras de metadatos actualizan también el bitmap.
  */
 
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime */
+
 #include "inode.h"
+#include "dir.h"
+#include "extent.h"
+#include "frag.h"
 #include "allocation.h"
 #include "bitmap.h"
+#include "txn.h"
 #include "util.h"
 
 #include <string.h>   /* memset, strncpy */
-#include <stdlib.h>   /* calloc, free   */
+#include <stdlib.h>   /* calloc, free, malloc */
 #include <limits.h>   /* UINT32_MAX     */
+#include <stddef.h>   /* offsetof       */
+#include <time.h>     /* clock_gettime  */
+
+/* ------------------------------------------------------------------------- */
+/* Estado de la tabla de inodos del disco abierto                            */
+/* ------------------------------------------------------------------------- */
+
+static struct {
+    uint32_t  count;         /**< Inodos en la tabla (incluye el 0)      */
+    uint32_t  bitmap_blk;    /**< Bloque del bitmap de inodos            */
+    uint32_t  table_blk;     /**< Primer bloque de la tabla              */
+    uint32_t  table_blocks;  /**< Bloques de tabla                       */
+    uint8_t  *map;           /**< Bitmap de inodos ⌈count/8⌉ bytes       */
+    uint32_t *free_in_blk;   /**< Inodos libres por bloque de tabla      */
+} itab;
+
+static inline bool imap_test(uint32_t ino)
+{
+    return (itab.map[ino / 8] >> (ino % 8)) & 1U;
+}
+
+static inline void imap_set(uint32_t ino, bool used)
+{
+    if (used) itab.map[ino / 8] |=  (uint8_t)(1U << (ino % 8));
+    else      itab.map[ino / 8] &= (uint8_t)~(1U << (ino % 8));
+}
+
+/** \brief Persiste el byte del bitmap de inodos que contiene a `ino`. */
+static int imap_flush(uint32_t ino, const char *fs_dir)
+{
+    return util_write_block_range(fs_dir, itab.bitmap_blk, ino / 8,
+                                  &itab.map[ino / 8], 1) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+/** \brief Bloque y desplazamiento en disco de la ranura de `ino`. */
+static inline void slot_of(uint32_t ino, uint32_t *blk, size_t *off)
+{
+    *blk = itab.table_blk + ino / BWFS_INODES_PER_BLOCK;
+    *off = (size_t)(ino % BWFS_INODES_PER_BLOCK) * BWFS_INODE_SIZE;
+}
+
+static inline bool ino_valid(uint32_t ino)
+{
+    return itab.map && ino != 0 && ino < itab.count;
+}
+
+/** \brief Escribe la ranura tal cual, enlace incluido. */
+static int write_slot(const bwfs_inode_t *inode, const char *fs_dir)
+{
+    if (!ino_valid(inode->ino))
+        return BWFS_ERR_IO;
+
+    uint32_t blk;
+    size_t   off;
+    slot_of(inode->ino, &blk, &off);
+    return util_write_block_range(fs_dir, blk, off,
+                                  (const uint8_t *)inode,
+                                  sizeof *inode) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+/**
+ * \brief Elige un inodo libre cerca de `parent`.
+ *
+ * - Archivos: primer hueco del bloque de tabla del padre, y si está lleno,
+ *   de los siguientes (con vuelta al principio).
+ * - Directorios: el bloque de tabla con más inodos libres (a igualdad, el
+ *   más próximo al del padre), para dejar sitio a sus futuros hijos.
+ * - Sin padre (la raíz en mkfs): primer inodo libre, es decir, el 1.
+ *
+ * \return Número de inodo o UINT32_MAX si la tabla está llena.
+ */
+static uint32_t pick_free_ino(uint32_t parent, bool is_dir)
+{
+    uint32_t nblk = itab.table_blocks;
+    uint32_t goal = ino_valid(parent) ? parent / BWFS_INODES_PER_BLOCK : 0;
+
+    if (is_dir && ino_valid(parent)) {
+        uint32_t best = UINT32_MAX, best_free = 0;
+        for (uint32_t k = 0; k < nblk; ++k) {
+            uint32_t b = (goal + k) % nblk;
+            if (itab.free_in_blk[b] > best_free) {
+                best      = b;
+                best_free = itab.free_in_blk[b];
+            }
+        }
+        if (best == UINT32_MAX)
+            return UINT32_MAX;
+        goal = best;
+    }
+
+    for (uint32_t k = 0; k < nblk; ++k) {
+        uint32_t b = (goal + k) % nblk;
+        if (itab.free_in_blk[b] == 0)
+            continue;
+
+        uint32_t first = b * BWFS_INODES_PER_BLOCK;
+        uint32_t last  = first + BWFS_INODES_PER_BLOCK;
+        if (last > itab.count) last = itab.count;
+
+        for (uint32_t ino = first ? first : 1; ino < last; ++ino)
+            if (!imap_test(ino))
+                return ino;
+    }
+    return UINT32_MAX;
+}
 
 /* ------------------------------------------------------------------------- */
 /* Funciones auxiliares privadas                                             */
 /* ------------------------------------------------------------------------- */
 
 /**
- * \brief Cero-inicializa un rango de punteros de bloque en un inodo.
+ * \brief Saca los datos en línea de un inodo a su primer bloque de datos.
+ *
+ * Deja el inodo con un extent de un bloque escrito y sin
+ * #BWFS_INODE_INLINE (o sin ningún bloque si estaba vacío: todo hueco); no
+ * lo persiste (lo hace quien llama tras terminar de redimensionar).
+ *
+ * \retval BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+static int inline_to_blocks(bwfs_bitmap_t *bm, bwfs_inode_t *inode,
+                            const char *fs_dir)
+{
+    uint8_t *buf = (uint8_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+    if (!buf)
+        return BWFS_ERR_NOMEM;
+    memcpy(buf, bwfs_inode_inline_data(inode), inode->size);
+
+    bwfs_inode_t tmp = *inode;
+    tmp.flags &= (uint8_t)~BWFS_INODE_INLINE;
+
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+
+    int rc = inode->size == 0 ? BWFS_OK : bwfs_extent_alloc(bm, &map, 1, false);
+    if (rc == BWFS_OK && map.count > 0 &&
+        util_write_block(fs_dir, map.ext[0].physical, buf, BWFS_BLOCK_SIZE_BYTES) != 0)
+        rc = BWFS_ERR_IO;
+    if (rc == BWFS_OK)
+        rc = bwfs_extent_store(bm, &tmp, fs_dir, &map);   /* cabe en el inodo */
+    if (rc != BWFS_OK)
+        bwfs_extent_truncate(bm, &map, 0);
+
+    bwfs_extent_map_free(&map);
+    free(buf);
+    if (rc != BWFS_OK)
+        return rc;
+
+    tmp.block_count = inode->size == 0 ? 0 : 1;
+    *inode = tmp;
+    return BWFS_OK;
+}
+
+/** \brief Bytes de la cola empaquetada de un inodo #BWFS_INODE_FRAG. */
+static inline uint32_t frag_tail(const bwfs_inode_t *inode)
+{
+    return (uint32_t)(bwfs_inode_size(inode) -
+                      (uint64_t)inode->block_count * BWFS_BLOCK_SIZE_BYTES);
+}
+
+/** \brief Libera la cola empaquetada y quita #BWFS_INODE_FRAG (sin persistir). */
+static int drop_frag(bwfs_bitmap_t *bm, bwfs_inode_t *inode, const char *fs_dir)
+{
+    int rc = bwfs_frag_free(bm, inode->ino, inode->frag_block,
+                            inode->frag_unit, fs_dir);
+    inode->flags &= (uint8_t)~BWFS_INODE_FRAG;
+    inode->frag_block = 0;
+    inode->frag_unit  = 0;
+    return rc;
+}
+
+/**
+ * \brief Devuelve la cola empaquetada de un inodo a un bloque de datos
+ *        propio, añadido tras los `block_count` que ya tiene.
+ *
+ * No persiste el inodo (lo hace quien llama).
+ *
+ * \retval BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+static int frag_to_block(bwfs_bitmap_t *bm, bwfs_inode_t *inode,
+                         const char *fs_dir)
+{
+    uint8_t *buf = (uint8_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+    if (!buf)
+        return BWFS_ERR_NOMEM;
+
+    bwfs_inode_t tmp = *inode;
+    tmp.flags &= (uint8_t)~BWFS_INODE_FRAG;
+    tmp.frag_block = 0;
+    tmp.frag_unit  = 0;
+
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+
+    uint32_t cur = 0;
+    int rc = util_read_block_range(fs_dir, inode->frag_block,
+                                   bwfs_frag_offset(inode->frag_unit),
+                                   buf, frag_tail(inode)) ? BWFS_ERR_IO : BWFS_OK;
+    if (rc == BWFS_OK)
+        rc = bwfs_extent_load(&tmp, fs_dir, &map);
+    if (rc == BWFS_OK) {
+        cur = bwfs_extent_mapped(&map);
+        rc  = bwfs_extent_alloc(bm, &map, 1, false);
+    }
+    if (rc == BWFS_OK) {
+        const bwfs_extent_t *last = &map.ext[map.count - 1];
+        if (util_write_block(fs_dir, last->physical + (cur - last->logical),
+                             buf, BWFS_BLOCK_SIZE_BYTES) != 0)
+            rc = BWFS_ERR_IO;
+        if (rc == BWFS_OK)
+            rc = bwfs_extent_store(bm, &tmp, fs_dir, &map);
+        if (rc != BWFS_OK)
+            bwfs_extent_truncate(bm, &map, cur);
+    }
+
+    bwfs_extent_map_free(&map);
+    free(buf);
+    if (rc != BWFS_OK)
+        return rc;
+
+    tmp.block_count = cur + 1;
+    bwfs_frag_free(bm, inode->ino, inode->frag_block, inode->frag_unit, fs_dir);
+    *inode = tmp;
+    return BWFS_OK;
+}
+
+/**
+ * \brief Lleva el mapa de un archivo a `req` bloques: reserva al final
+ *        (`unwritten` indica si se leen como ceros) o libera lo que sobra,
+ *        y guarda el mapa en el inodo.
+ *
+ * Si falta espacio el mapa en disco no cambia.
+ *
+ * \retval BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
  */
-static void zero_blocks(bwfs_inode_t *inode, uint32_t from, uint32_t to)
+static int remap(bwfs_bitmap_t *bm, bwfs_inode_t *inode, uint32_t req,
+                 bool unwritten, const char *fs_dir)
 {
-    for (uint32_t i = from; i < to && i < BWFS_DIRECT_BLOCKS; ++i)
-        inode->blocks[i] = 0;
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+
+    int rc = bwfs_extent_load(inode, fs_dir, &map);
+    if (rc != BWFS_OK) {
+        bwfs_extent_map_free(&map);
+        return rc;
+    }
+
+    uint32_t cur = bwfs_extent_mapped(&map);
+    if (req > cur)
+        rc = bwfs_extent_alloc(bm, &map, req - cur, unwritten);
+    if (rc == BWFS_OK) {
+        if (req < cur)
+            bwfs_extent_truncate(bm, &map, req);
+        rc = bwfs_extent_store(bm, inode, fs_dir, &map);
+        if (rc != BWFS_OK && req > cur)
+            bwfs_extent_truncate(bm, &map, cur);  /* devolver lo reservado */
+    }
+    if (rc == BWFS_OK)
+        inode->block_count = bwfs_extent_mapped(&map);
+
+    bwfs_extent_map_free(&map);
+    return rc;
+}
+
+/**
+ * \brief Pone a cero el bloque que contiene el byte `from` desde ese byte
+ *        hasta su final (si está asignado y escrito).
+ *
+ * \retval BWFS_OK, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+static int zero_after(const bwfs_inode_t *inode, uint64_t from,
+                      const char *fs_dir)
+{
+    bwfs_extent_t ext;
+    uint32_t lblk = (uint32_t)(from / BWFS_BLOCK_SIZE_BYTES);
+    size_t   off  = (size_t)(from % BWFS_BLOCK_SIZE_BYTES);
+
+    int rc = bwfs_extent_lookup(inode, fs_dir, lblk, &ext);
+    if (rc != BWFS_OK || ext.physical == 0 || (ext.len & BWFS_EXT_UNWRITTEN))
+        return rc;
+
+    uint8_t *zero = (uint8_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES - off);
+    if (!zero)
+        return BWFS_ERR_NOMEM;
+    rc = util_write_block_range(fs_dir, ext.physical, off, zero,
+                                BWFS_BLOCK_SIZE_BYTES - off) ? BWFS_ERR_IO : BWFS_OK;
+    free(zero);
+    return rc;
+}
+
+/**
+ * \brief Reserva los huecos de los bloques lógicos `[first, first+count)`
+ *        y guarda el mapa en el inodo (sin persistir nada).
+ *
+ * @param[out] filled  true si había algún hueco.
+ * \retval BWFS_OK, BWFS_ERR_FULL, BWFS_ERR_NOMEM o BWFS_ERR_IO
+ */
+static int fill_holes(bwfs_bitmap_t *bm, bwfs_inode_t *inode, uint32_t first,
+                      uint32_t count, bool unwritten, const char *fs_dir,
+                      bool *filled)
+{
+    bwfs_extent_map_t map, added;
+    bwfs_extent_map_init(&map);
+    bwfs_extent_map_init(&added);
+
+    *filled = false;
+    int rc = bwfs_extent_load(inode, fs_dir, &map);
+    if (rc == BWFS_OK)
+        rc = bwfs_extent_fill(bm, &map, first, count, unwritten, &added);
+    if (rc == BWFS_OK && added.count > 0) {
+        rc = bwfs_extent_store(bm, inode, fs_dir, &map);
+        if (rc != BWFS_OK) {                    /* devolver lo reservado */
+            for (uint32_t i = 0; i < added.count; ++i)
+                bwfs_free_blocks(bm, added.ext[i].physical,
+                                 added.ext[i].len & BWFS_EXT_LEN_MASK);
+        } else {
+            inode->block_count = bwfs_extent_mapped(&map);
+            *filled = true;
+        }
+    }
+
+    bwfs_extent_map_free(&added);
+    bwfs_extent_map_free(&map);
+    return rc;
 }
 
 /* ------------------------------------------------------------------------- */
 /* API pública                                                               */
 /* ------------------------------------------------------------------------- */
 
-uint32_t bwfs_create_inode(bwfs_bitmap_t *bm,
-                           bool           is_dir,
-                           const char    *fs_dir)
+int bwfs_itable_format(const bwfs_superblock_t *sb, const char *fs_dir)
+{
+    size_t   bytes = (sb->inode_count + 7) / 8;
+    uint8_t *map   = (uint8_t *)calloc(1, bytes);
+    if (!map)
+        return BWFS_ERR_NOMEM;
+
+    map[0] = 0x01;                          /* el inodo 0 nunca se asigna */
+    int rc = util_write_block(fs_dir, sb->inode_bitmap_blk, map, bytes)
+             ? BWFS_ERR_IO : BWFS_OK;
+    free(map);
+    return rc;
+}
+
+int bwfs_itable_open(const bwfs_superblock_t *sb, const char *fs_dir)
 {
-    /* 1. Reservar UN bloque para el inodo (sus metadatos). */
-    uint32_t ino_blk = bwfs_alloc_blocks(bm, 1);
-    if (ino_blk == UINT32_MAX)
+    bwfs_itable_close();
+
+    size_t bytes = (sb->inode_count + 7) / 8;
+    itab.map         = (uint8_t *)malloc(bytes);
+    itab.free_in_blk = (uint32_t *)calloc(sb->inode_table_blocks,
+                                          sizeof *itab.free_in_blk);
+    if (!itab.map || !itab.free_in_blk) {
+        bwfs_itable_close();
+        return BWFS_ERR_NOMEM;
+    }
+
+    if (util_read_block_range(fs_dir, sb->inode_bitmap_blk, 0,
+                              itab.map, bytes) != 0) {
+        bwfs_itable_close();
+        return BWFS_ERR_IO;
+    }
+
+    itab.count        = sb->inode_count;
+    itab.bitmap_blk   = sb->inode_bitmap_blk;
+    itab.table_blk    = sb->inode_table_blk;
+    itab.table_blocks = sb->inode_table_blocks;
+
+    for (uint32_t ino = 0; ino < itab.count; ++ino)
+        if (!imap_test(ino))
+            itab.free_in_blk[ino / BWFS_INODES_PER_BLOCK]++;
+
+    return BWFS_OK;
+}
+
+void bwfs_itable_close(void)
+{
+    free(itab.map);
+    free(itab.free_in_blk);
+    memset(&itab, 0, sizeof itab);
+}
+
+uint32_t bwfs_itable_free_count(void)
+{
+    uint32_t total = 0;
+    for (uint32_t b = 0; b < itab.table_blocks; ++b)
+        total += itab.free_in_blk[b];
+    return total;
+}
+
+bool bwfs_inode_in_use(uint32_t ino)
+{
+    return ino_valid(ino) && imap_test(ino);
+}
+
+int bwfs_inode_set_used(uint32_t ino, bool used, const char *fs_dir)
+{
+    if (!ino_valid(ino))
+        return BWFS_ERR_IO;
+    bwfs_txn_lock_alloc();
+    if (imap_test(ino) == used)
+        return BWFS_OK;
+
+    imap_set(ino, used);
+    if (used) itab.free_in_blk[ino / BWFS_INODES_PER_BLOCK]--;
+    else      itab.free_in_blk[ino / BWFS_INODES_PER_BLOCK]++;
+    return imap_flush(ino, fs_dir);
+}
+
+uint32_t bwfs_create_inode(bool        is_dir,
+                           uint32_t    parent_ino,
+                           const char *fs_dir)
+{
+    /* 1. Reservar una ranura de la tabla, cerca del padre. */
+    bwfs_txn_lock_alloc();
+    uint32_t ino = pick_free_ino(parent_ino, is_dir);
+    if (ino == UINT32_MAX)
         return UINT32_MAX;
 
     /* 2. Construir la estructura en memoria. */
     bwfs_inode_t inode;
     memset(&inode, 0, sizeof inode);
 
-    inode.ino         = ino_blk;
+    inode.ino         = ino;
     inode.size        = 0;
     inode.block_count = 0;
-    inode.flags       = is_dir ? BWFS_INODE_DIR : 0;
+    inode.flags       = is_dir ? BWFS_INODE_DIR : BWFS_INODE_INLINE;
+    inode.atime_ns    = inode.mtime_ns = inode.ctime_ns = bwfs_now_ns();
+    inode.generation  = 1;
     /* blocks[] e indirect ya quedaron en cero vía memset */
 
-    /* 3. Persistir (inodo + bitmap). */
-    if (bwfs_write_inode(&inode, fs_dir) != BWFS_OK ||
-        bwfs_write_bitmap(bm, fs_dir)   != BWFS_OK)
+    /* 3. Persistir (ranura + byte del bitmap de inodos). */
+    if (write_slot(&inode, fs_dir) != BWFS_OK ||
+        bwfs_inode_set_used(ino, true, fs_dir) != BWFS_OK)
     {
-        /* Roll-back: liberar el bloque si algo falla. */
-        bwfs_free_blocks(bm, ino_blk, 1);
-        bwfs_write_bitmap(bm, fs_dir);      /* mejor esfuerzo */
+        bwfs_inode_set_used(ino, false, fs_dir);   /* mejor esfuerzo */
         return UINT32_MAX;
     }
 
-    return ino_blk;
+    return ino;
+}
+
+int bwfs_delete_inode(bwfs_bitmap_t *bm,
+                      bwfs_inode_t   *inode,
+                      const char     *fs_dir)
+{
+    int rc = BWFS_OK;
+    if ((inode->flags & BWFS_INODE_FRAG) &&
+        bwfs_frag_free(bm, inode->ino, inode->frag_block,
+                       inode->frag_unit, fs_dir) != BWFS_OK)
+        rc = BWFS_ERR_IO;
+    if (inode->flags & BWFS_INODE_EXTENTS) {
+        rc = bwfs_extent_release(bm, inode, fs_dir);
+    } else if (!(inode->flags & BWFS_INODE_INLINE)) {
+        for (uint32_t i = 0; i < inode->block_count && i < BWFS_DIRECT_BLOCKS; ++i)
+            bwfs_free_blocks(bm, inode->blocks[i], 1);
+    }
+
+    if (inode->block_count > 0 && bwfs_write_bitmap(bm, fs_dir) != BWFS_OK)
+        rc = BWFS_ERR_IO;
+
+    /* Ranura a cero: un inodo libre nunca conserva punteros a bloques */
+    uint32_t ino = inode->ino;
+    memset(inode, 0, sizeof *inode);
+    inode->ino = ino;
+    if (write_slot(inode, fs_dir) != BWFS_OK ||
+        bwfs_inode_set_used(ino, false, fs_dir) != BWFS_OK)
+        rc = BWFS_ERR_IO;
+
+    return rc;
+}
+
+/** \brief ¿Cambió algún atributo que la entrada del padre guarda? */
+static inline bool dirent_attr_changed(const bwfs_inode_t *a, const bwfs_inode_t *b)
+{
+    return a->size != b->size || a->size_hi != b->size_hi ||
+           a->block_count != b->block_count ||
+           a->atime_ns != b->atime_ns || a->mtime_ns != b->mtime_ns ||
+           a->ctime_ns != b->ctime_ns ||
+           ((a->flags ^ b->flags) & BWFS_INODE_DIR) != 0;
 }
 
 int bwfs_write_inode(const bwfs_inode_t *inode, const char *fs_dir)
 {
-    return util_write_block(fs_dir,
-                            inode->ino,
-                            (const uint8_t *)inode,
-                            sizeof *inode) ? BWFS_ERR_IO : BWFS_OK;
+    bwfs_inode_t old;
+    if (bwfs_read_inode(inode->ino, &old, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    bwfs_inode_t cur = *inode;
+    cur.parent    = old.parent;
+    cur.name_hash = old.name_hash;
+    if (write_slot(&cur, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    if (cur.parent == 0 || !dirent_attr_changed(&old, &cur))
+        return BWFS_OK;
+
+    bwfs_inode_t dir;
+    if (bwfs_read_inode(cur.parent, &dir, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    if (!(dir.flags & BWFS_INODE_DIR))
+        return BWFS_OK;
+
+    /* Entrada no encontrada (hoja de formato antiguo): nada que copiar */
+    int rc = bwfs_dir_update_attr(&dir, fs_dir, cur.name_hash, &cur);
+    return (rc == BWFS_ERR_IO || rc == BWFS_ERR_NOMEM) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+uint64_t bwfs_now_ns(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0)
+        return 0;
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void bwfs_inode_touch(bwfs_inode_t *inode, unsigned what)
+{
+    uint64_t now = bwfs_now_ns();
+    if (what & BWFS_TOUCH_ATIME) inode->atime_ns = now;
+    if (what & BWFS_TOUCH_CTIME) inode->ctime_ns = now;
+    if (what & BWFS_TOUCH_MTIME) {
+        inode->mtime_ns = now;
+        inode->generation++;
+    }
+}
+
+int bwfs_inode_set_link(uint32_t ino, uint32_t parent, uint32_t name_hash,
+                        const char *fs_dir)
+{
+    if (!ino_valid(ino))
+        return BWFS_ERR_IO;
+
+    uint32_t blk;
+    size_t   off;
+    slot_of(ino, &blk, &off);
+    uint32_t link[2] = { parent, name_hash };
+    return util_write_block_range(fs_dir, blk, off + offsetof(bwfs_inode_t, parent),
+                                  (const uint8_t *)link,
+                                  sizeof link) ? BWFS_ERR_IO : BWFS_OK;
 }
 
 int bwfs_read_inode(uint32_t ino, bwfs_inode_t *inode, const char *fs_dir)
 {
-    return util_read_block(fs_dir,
-                           ino,
-                           (uint8_t *)inode,
-                           sizeof *inode) ? BWFS_ERR_IO : BWFS_OK;
+    if (!ino_valid(ino))
+        return BWFS_ERR_IO;
+
+    uint32_t blk;
+    size_t   off;
+    slot_of(ino, &blk, &off);
+    return util_read_block_range(fs_dir, blk, off,
+                                 (uint8_t *)inode,
+                                 sizeof *inode) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+void bwfs_inode_batch_init(bwfs_inode_batch_t *batch)
+{
+    batch->blk = UINT32_MAX;
+    batch->buf = NULL;
+}
+
+int bwfs_inode_batch_read(bwfs_inode_batch_t *batch,
+                          uint32_t            ino,
+                          bwfs_inode_t       *inode,
+                          const char         *fs_dir)
+{
+    if (!ino_valid(ino))
+        return BWFS_ERR_IO;
+
+    uint32_t blk;
+    size_t   off;
+    slot_of(ino, &blk, &off);
+
+    if (batch->blk != blk) {
+        if (!batch->buf) {
+            batch->buf = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+            if (!batch->buf)
+                return BWFS_ERR_NOMEM;
+        }
+        if (util_read_block(fs_dir, blk, batch->buf, BWFS_BLOCK_SIZE_BYTES) != 0) {
+            batch->blk = UINT32_MAX;
+            return BWFS_ERR_IO;
+        }
+        batch->blk = blk;
+    }
+
+    memcpy(inode, batch->buf + off, sizeof *inode);
+    return BWFS_OK;
+}
+
+void bwfs_inode_batch_release(bwfs_inode_batch_t *batch)
+{
+    free(batch->buf);
+    bwfs_inode_batch_init(batch);
 }
 
 int bwfs_inode_resize(bwfs_bitmap_t *bm,
                       bwfs_inode_t   *inode,
-                      uint32_t        new_size,
+                      uint64_t        new_size,
                       const char     *fs_dir)
 {
-    /* Cálculo de bloques actuales y requeridos */
-    uint32_t cur_blocks = inode->block_count;
-    uint32_t req_blocks = (new_size + BWFS_BLOCK_SIZE_BYTES - 1)
+    /* Cálculo de bloques requeridos */
+    uint64_t req_blocks = (new_size + BWFS_BLOCK_SIZE_BYTES - 1)
                           / BWFS_BLOCK_SIZE_BYTES;
 
-    if (req_blocks > BWFS_DIRECT_BLOCKS)
-        return BWFS_ERR_FULL; /* indirectos aún no soportados */
+    if (req_blocks > BWFS_EXT_LEN_MASK)
+        return BWFS_ERR_FULL;
 
     /* ------------------------------------------------------------------ */
-    /* Expansión                                                          */
+    /* Datos en línea: mientras quepan, solo cambia la ranura del inodo   */
     /* ------------------------------------------------------------------ */
-    if (req_blocks > cur_blocks) {
-        uint32_t add = req_blocks - cur_blocks;
-        for (uint32_t i = 0; i < add; ++i) {
-            uint32_t blk = bwfs_alloc_blocks(bm, 1);
-            if (blk == UINT32_MAX) {
-                /* Rollback parcial si falta espacio */
-                bwfs_free_blocks(bm, inode->blocks[cur_blocks], i);
-                bwfs_write_bitmap(bm, fs_dir);
-                return BWFS_ERR_FULL;
-            }
-            inode->blocks[cur_blocks + i] = blk;
+    bwfs_inode_t orig     = *inode;
+    bool         migrated = false;
+    uint64_t     old_size = bwfs_inode_size(inode);
+
+    if (inode->flags & BWFS_INODE_INLINE) {
+        if (new_size <= BWFS_INLINE_MAX) {
+            if (new_size < old_size)
+                memset(bwfs_inode_inline_data(inode) + new_size, 0,
+                       (size_t)(old_size - new_size));
+            bwfs_inode_set_size(inode, new_size);
+            return bwfs_write_inode(inode, fs_dir);
         }
-        inode->block_count = req_blocks;
+
+        int rc = inline_to_blocks(bm, inode, fs_dir);
+        if (rc != BWFS_OK)
+            return rc == BWFS_ERR_IO ? BWFS_ERR_IO : BWFS_ERR_FULL;
+        migrated = true;
     }
+
     /* ------------------------------------------------------------------ */
-    /* Contracción                                                        */
+    /* Cola empaquetada: encoger dentro de ella solo cambia `size`; si se */
+    /* corta antes, se descarta, y si crece vuelve a un bloque propio     */
     /* ------------------------------------------------------------------ */
-    else if (req_blocks < cur_blocks) {
-        for (uint32_t i = req_blocks; i < cur_blocks; ++i)
-            bwfs_free_blocks(bm, inode->blocks[i], 1);
+    if (inode->flags & BWFS_INODE_FRAG) {
+        uint64_t base = (uint64_t)inode->block_count * BWFS_BLOCK_SIZE_BYTES;
+        if (new_size > base && new_size <= old_size) {
+            bwfs_inode_set_size(inode, new_size);
+            return bwfs_write_inode(inode, fs_dir);
+        }
+        int rc = new_size <= base ? drop_frag(bm, inode, fs_dir)
+                                  : bwfs_inode_unpack_tail(bm, inode, fs_dir);
+        if (rc != BWFS_OK)
+            return rc == BWFS_ERR_IO ? BWFS_ERR_IO : BWFS_ERR_FULL;
+    }
+
+    /* ------------------------------------------------------------------ */
+    /* Crecer no reserva nada: lo nuevo es un hueco hasta que se escriba. */
+    /* Al encoger se libera todo lo que queda tras el nuevo EOF, también  */
+    /* lo preasignado, y se ponen a cero los bytes cortados del último    */
+    /* bloque para que no reaparezcan si vuelve a crecer                  */
+    /* ------------------------------------------------------------------ */
+    uint32_t cur_blocks = inode->block_count;
+    uint32_t target     = cur_blocks;
+    if (new_size < old_size && req_blocks < cur_blocks)
+        target = (uint32_t)req_blocks;
 
-        zero_blocks(inode, req_blocks, cur_blocks);
-        inode->block_count = req_blocks;
+    if (new_size < old_size && new_size % BWFS_BLOCK_SIZE_BYTES != 0 &&
+        new_size / BWFS_BLOCK_SIZE_BYTES < target) {
+        int rc = zero_after(inode, new_size, fs_dir);
+        if (rc != BWFS_OK)
+            return rc;
     }
 
-    inode->size = new_size;
+    if (target != cur_blocks || !(inode->flags & BWFS_INODE_EXTENTS)) {
+        int rc = remap(bm, inode, target, false, fs_dir);
+        if (rc != BWFS_OK) {
+            if (migrated) {                 /* deshacer la migración */
+                bwfs_extent_release(bm, inode, fs_dir);
+                *inode = orig;
+            }
+            return rc == BWFS_ERR_IO ? BWFS_ERR_IO : BWFS_ERR_FULL;
+        }
+    }
+
+    /* Pequeño y sin bloques: vuelve a guardarse en línea (todo ceros) */
+    if (inode->block_count == 0 && new_size <= BWFS_INLINE_MAX &&
+        !(inode->flags & (BWFS_INODE_DIR | BWFS_INODE_INLINE))) {
+        memset(bwfs_inode_inline_data(inode), 0, BWFS_INLINE_MAX);
+        inode->indirect = 0;
+        inode->flags = (uint8_t)((inode->flags & ~BWFS_INODE_EXTENTS) | BWFS_INODE_INLINE);
+    }
+
+    bwfs_inode_set_size(inode, new_size);
 
     /* Persistir cambios (bitmap + inodo). */
     if (bwfs_write_bitmap(bm, fs_dir) != BWFS_OK ||
@@ -135,3 +730,286 @@ int bwfs_inode_resize(bwfs_bitmap_t *bm,
 
     return BWFS_OK;
 }
+
+int bwfs_inode_fallocate(bwfs_bitmap_t *bm,
+                         bwfs_inode_t   *inode,
+                         uint64_t        offset,
+                         uint64_t        len,
+                         bool            keep_size,
+                         const char     *fs_dir)
+{
+    uint64_t end        = offset + len;
+    uint64_t req_blocks = (end + BWFS_BLOCK_SIZE_BYTES - 1)
+                          / BWFS_BLOCK_SIZE_BYTES;
+
+    if (end < offset || req_blocks > BWFS_EXT_LEN_MASK)
+        return BWFS_ERR_FULL;
+
+    /* En línea: los bytes tras `size` ya son ceros, basta con ajustar el
+     * tamaño si el rango cabe; si no, primero hay que pasar a bloques. */
+    bwfs_inode_t orig     = *inode;
+    bool         migrated = false;
+    if (inode->flags & BWFS_INODE_INLINE) {
+        if (end <= BWFS_INLINE_MAX) {
+            if (!keep_size && end > bwfs_inode_size(inode))
+                bwfs_inode_set_size(inode, end);
+            return bwfs_write_inode(inode, fs_dir);
+        }
+        int rc = inline_to_blocks(bm, inode, fs_dir);
+        if (rc != BWFS_OK)
+            return rc == BWFS_ERR_IO ? BWFS_ERR_IO : BWFS_ERR_FULL;
+        migrated = true;
+    }
+    if (inode->flags & BWFS_INODE_FRAG) {
+        int rc = bwfs_inode_unpack_tail(bm, inode, fs_dir);
+        if (rc != BWFS_OK)
+            return rc == BWFS_ERR_IO ? BWFS_ERR_IO : BWFS_ERR_FULL;
+    }
+
+    /* Solo metadatos: los bloques nuevos quedan «sin escribir» y se leen
+     * como ceros, así que no hace falta tocarlos en disco.  Solo se
+     * reservan los huecos del rango pedido. */
+    uint32_t first  = (uint32_t)(offset / BWFS_BLOCK_SIZE_BYTES);
+    bool     filled = false;
+    if (req_blocks > first) {
+        int rc = fill_holes(bm, inode, first, (uint32_t)req_blocks - first,
+                            true, fs_dir, &filled);
+        if (rc != BWFS_OK) {
+            if (migrated) {
+                bwfs_extent_release(bm, inode, fs_dir);
+                *inode = orig;
+            }
+            return rc == BWFS_ERR_IO ? BWFS_ERR_IO : BWFS_ERR_FULL;
+        }
+    }
+
+    if (!keep_size && end > bwfs_inode_size(inode))
+        bwfs_inode_set_size(inode, end);
+
+    if (((migrated || filled) &&
+         bwfs_write_bitmap(bm, fs_dir) != BWFS_OK) ||
+        bwfs_write_inode(inode, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    return BWFS_OK;
+}
+
+int bwfs_inode_fill_holes(bwfs_bitmap_t *bm,
+                          bwfs_inode_t   *inode,
+                          uint32_t        first,
+                          uint32_t        count,
+                          bool            unwritten,
+                          const char     *fs_dir)
+{
+    bool filled = false;
+    int  rc     = fill_holes(bm, inode, first, count, unwritten, fs_dir, &filled);
+    if (rc != BWFS_OK || !filled)
+        return rc;
+    return bwfs_write_bitmap(bm, fs_dir) == BWFS_OK ? BWFS_OK : BWFS_ERR_IO;
+}
+
+int bwfs_inode_mark_written(bwfs_bitmap_t *bm,
+                            bwfs_inode_t   *inode,
+                            uint32_t        first,
+                            uint32_t        count,
+                            const char     *fs_dir)
+{
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+
+    int rc = bwfs_extent_load(inode, fs_dir, &map);
+    uint32_t meta_before = map.meta_count;
+    if (rc == BWFS_OK)
+        rc = bwfs_extent_mark_written(&map, first, count);
+    if (rc == BWFS_OK)
+        rc = bwfs_extent_store(bm, inode, fs_dir, &map);
+    bool meta_changed = map.meta_count != meta_before;
+    bwfs_extent_map_free(&map);
+    if (rc != BWFS_OK)
+        return rc;
+
+    /* Partir un extent puede exigir (o liberar) una hoja */
+    if (meta_changed && bwfs_write_bitmap(bm, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    return bwfs_write_inode(inode, fs_dir);
+}
+
+int bwfs_inode_trim(bwfs_bitmap_t *bm,
+                    bwfs_inode_t   *inode,
+                    uint32_t        keep,
+                    const char     *fs_dir)
+{
+    if (!(inode->flags & BWFS_INODE_EXTENTS) || inode->block_count <= keep)
+        return BWFS_OK;
+
+    /* La cola va tras el último bloque: con menos bloques ya no cuadraría
+     * con el tamaño, así que se suelta antes */
+    int rc = (inode->flags & BWFS_INODE_FRAG) ? drop_frag(bm, inode, fs_dir)
+                                              : BWFS_OK;
+    if (rc == BWFS_OK)
+        rc = remap(bm, inode, keep, false, fs_dir);
+    if (rc != BWFS_OK)
+        return rc;
+    if (bwfs_write_bitmap(bm, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    return bwfs_write_inode(inode, fs_dir);
+}
+
+int bwfs_inode_remap(bwfs_bitmap_t *bm,
+                     bwfs_inode_t   *inode,
+                     uint32_t        first,
+                     uint32_t        count,
+                     uint32_t        physical,
+                     bool            unwritten,
+                     const char     *fs_dir)
+{
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+
+    int rc = bwfs_extent_load(inode, fs_dir, &map);
+    if (rc == BWFS_OK)
+        rc = bwfs_extent_remap(bm, &map, first, count, physical, unwritten);
+    if (rc == BWFS_OK)
+        rc = bwfs_extent_store(bm, inode, fs_dir, &map);
+    bwfs_extent_map_free(&map);
+    if (rc != BWFS_OK)
+        return rc;
+
+    /* Reserva de los bloques nuevos y liberación de los viejos */
+    if (bwfs_write_bitmap(bm, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    return bwfs_write_inode(inode, fs_dir);
+}
+
+int bwfs_inode_seek(const bwfs_inode_t *inode,
+                    uint64_t            off,
+                    bool                data,
+                    const char         *fs_dir,
+                    uint64_t           *out)
+{
+    uint64_t size = bwfs_inode_size(inode);
+
+    /* En línea todo son datos */
+    if (inode->flags & BWFS_INODE_INLINE) {
+        *out = data ? off : size;
+        return BWFS_OK;
+    }
+
+    /* Desde `tail` solo queda la cola empaquetada, que también son datos */
+    uint64_t tail = (inode->flags & BWFS_INODE_FRAG)
+                    ? (uint64_t)inode->block_count * BWFS_BLOCK_SIZE_BYTES : size;
+    uint64_t pos  = UINT64_MAX;
+    if (off < tail) {
+        uint32_t blk;
+        int rc = bwfs_extent_seek(inode, fs_dir,
+                                  (uint32_t)(off / BWFS_BLOCK_SIZE_BYTES),
+                                  data, &blk);
+        if (rc != BWFS_OK)
+            return rc;
+        if (blk != UINT32_MAX) {
+            pos = (uint64_t)blk * BWFS_BLOCK_SIZE_BYTES;
+            if (pos < off)
+                pos = off;
+        }
+    }
+
+    if (data) {
+        if (pos >= tail && (inode->flags & BWFS_INODE_FRAG))
+            pos = off > tail ? off : tail;
+        *out = pos < size ? pos : UINT64_MAX;
+    } else {
+        *out = pos < tail ? pos : size;       /* siempre hay hueco en EOF */
+    }
+    return BWFS_OK;
+}
+
+int bwfs_inode_pack_tail(bwfs_bitmap_t *bm,
+                         bwfs_inode_t   *inode,
+                         const char     *fs_dir)
+{
+    if (!bwfs_frag_ready() ||
+        (inode->flags & (BWFS_INODE_DIR | BWFS_INODE_INLINE | BWFS_INODE_FRAG)))
+        return BWFS_OK;
+
+    /* Solo si el último bloque es parcial y no hay nada preasignado detrás */
+    uint64_t size = bwfs_inode_size(inode);
+    uint64_t full = size / BWFS_BLOCK_SIZE_BYTES;
+    uint32_t tail = (uint32_t)(size % BWFS_BLOCK_SIZE_BYTES);
+    if (tail == 0 || tail > BWFS_FRAG_MAX || inode->block_count != full + 1)
+        return BWFS_OK;
+
+    bwfs_extent_t ext;
+    int rc = BWFS_OK;
+
+    /* La cola va justo tras `block_count`: no puede quedar un hueco antes */
+    if (full > 0) {
+        rc = bwfs_extent_lookup(inode, fs_dir, (uint32_t)full - 1, &ext);
+        if (rc != BWFS_OK || ext.physical == 0)
+            return rc;
+    }
+    rc = bwfs_extent_lookup(inode, fs_dir, (uint32_t)full, &ext);
+    if (rc != BWFS_OK || ext.physical == 0)
+        return rc;
+
+    uint8_t *buf = (uint8_t *)calloc(1, tail);
+    if (!buf)
+        return BWFS_ERR_NOMEM;
+    if (!(ext.len & BWFS_EXT_UNWRITTEN) &&
+        util_read_block_range(fs_dir, ext.physical, 0, buf, tail) != 0) {
+        free(buf);
+        return BWFS_ERR_IO;
+    }
+
+    /* Un archivo que cabe en el inodo no necesita ni fragmento */
+    bwfs_inode_t tmp = *inode;
+    if (full == 0 && tail <= BWFS_INLINE_MAX) {
+        rc = remap(bm, &tmp, 0, false, fs_dir);
+        if (rc == BWFS_OK) {
+            memset(bwfs_inode_inline_data(&tmp), 0, BWFS_INLINE_MAX);
+            memcpy(bwfs_inode_inline_data(&tmp), buf, tail);
+            tmp.flags = (uint8_t)((tmp.flags & ~BWFS_INODE_EXTENTS) | BWFS_INODE_INLINE);
+        }
+    } else {
+        uint32_t fblk = 0, funit = 0;
+        rc = bwfs_frag_alloc(bm, inode->ino, tail, fs_dir, &fblk, &funit);
+        bool taken = rc == BWFS_OK;
+        if (rc == BWFS_OK &&
+            util_write_block_range(fs_dir, fblk, bwfs_frag_offset(funit),
+                                   buf, tail) != 0)
+            rc = BWFS_ERR_IO;
+        if (rc == BWFS_OK)
+            rc = remap(bm, &tmp, (uint32_t)full, false, fs_dir);
+        if (rc == BWFS_OK) {
+            tmp.flags     |= BWFS_INODE_FRAG;
+            tmp.frag_block = fblk;
+            tmp.frag_unit  = funit;
+        } else if (taken) {
+            bwfs_frag_free(bm, inode->ino, fblk, funit, fs_dir);
+        }
+    }
+    free(buf);
+    if (rc != BWFS_OK)
+        return rc;
+
+    *inode = tmp;
+    if (bwfs_write_bitmap(bm, fs_dir) != BWFS_OK ||
+        bwfs_write_inode(inode, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    return BWFS_OK;
+}
+
+int bwfs_inode_unpack_tail(bwfs_bitmap_t *bm,
+                           bwfs_inode_t   *inode,
+                           const char     *fs_dir)
+{
+    if (!(inode->flags & BWFS_INODE_FRAG))
+        return BWFS_OK;
+
+    int rc = frag_to_block(bm, inode, fs_dir);
+    if (rc != BWFS_OK)
+        return rc;
+    if (bwfs_write_bitmap(bm, fs_dir) != BWFS_OK ||
+        bwfs_write_inode(inode, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    return BWFS_OK;
+}
@@ -0,0 +1,860 @@
+// -----------------------------------------------------------------------------
+// File: src/core/journal.c
+// -----------------------------------------------------------------------------
+/**
+ * \file journal.c
+ * \brief Diario de metadatos: transacción en curso en memoria, confirmación
+ *        en grupo y checkpoint en segundo plano.
+ *
+ *  - Cada bloque tocado tiene una entrada con hasta dos imágenes completas:
+ *    `run` (transacción en curso) y `done` (última versión confirmada que
+ *    aún no está en su sitio).  Las lecturas ven `run`, si no `done`, y si
+ *    no hay entrada, el bloque.
+ *  - De `run` se registra solo el rango que cambió: cada escritura se
+ *    compara con la imagen y el rango crece hasta el primer y el último
+ *    byte distintos.  Reescribir un bloque entero para cambiar un bit
+ *    registra un byte.
+ *  - Solo el hilo del diario confirma y hace checkpoint, así que nunca se
+ *    solapan: mientras escribe las `done` a su sitio, las operaciones
+ *    siguen trabajando sobre copias `run`.
+ *  - Confirmar espera a que no quede ningún manejador abierto y no deja
+ *    abrir otros hasta terminar; el registro se escribe sin el cerrojo.
+ *  - No hay aborto: un manejador que falla a medias confirma lo que llegó
+ *    a escribir.  El diario solo garantiza que un corte no deja una
+ *    operación a medias.
+ */
+
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime */
+
+#include "journal.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>   /* malloc, calloc, realloc, free */
+#include <string.h>   /* memcpy, memset */
+#include <errno.h>    /* ETIMEDOUT */
+#include <time.h>     /* clock_gettime */
+
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+/** Cubetas de la tabla de entradas (potencia de 2). */
+#define JHASH_BITS      10U
+#define JHASH_SLOTS     (1U << JHASH_BITS)
+
+/** Bloques en la transacción en curso a partir de los que se pide confirmar
+ *  y a partir de los que una operación nueva espera a que se confirme. */
+#define JRUN_SOFT       256U
+#define JRUN_HARD       512U
+
+/** Fracción del disco liberada en la transacción en curso a partir de la
+ *  que se pide confirmar: hasta entonces esos bloques no se reutilizan. */
+#define JFREE_SOFT_DIV  16U
+
+/** Versiones confirmadas en memoria que piden un checkpoint. */
+#define JDONE_MAX       256U
+
+/* ------------------------------------------------------------------------- */
+/* Estado                                                                    */
+/* ------------------------------------------------------------------------- */
+
+/** Bloque con escrituras en el diario. */
+typedef struct jent {
+    uint32_t     blk;
+    uint8_t     *run;            /**< Imagen de la transacción en curso */
+    uint8_t     *done;           /**< Última confirmada, aún no en su sitio */
+    uint32_t     run_lo, run_hi; /**< Cambiado en la transacción en curso */
+    uint32_t     ck_lo, ck_hi;   /**< Cambiado desde el último checkpoint */
+    struct jent *hnext;          /**< Cadena de la cubeta                */
+    struct jent *rnext;          /**< Lista de la transacción en curso   */
+} jent_t;
+
+static struct {
+    bool               ready;
+    bwfs_superblock_t *sb;
+    const char        *fs_dir;
+    uint32_t           first;        /**< Bloque de la cabecera          */
+    uint32_t           blocks;
+    uint64_t           cap;          /**< Bytes del registro circular    */
+    uint64_t           head, tail;   /**< Posiciones absolutas           */
+    uint64_t           seq;          /**< Secuencia de la siguiente      */
+    jent_t            *hash[JHASH_SLOTS];
+    jent_t            *running;      /**< Entradas con `run`             */
+    uint32_t           nrun, ndone;
+    uint64_t           run_bytes;    /**< Lo que ocuparía confirmar ya   */
+    uint32_t           run_freed;    /**< Bloques liberados sin confirmar*/
+    uint32_t           handles;      /**< Manejadores abiertos           */
+    uint64_t           gen;          /**< Confirmaciones hechas          */
+    int                last_rc;      /**< Resultado de la última         */
+    bool               committing, want_commit, stop;
+    pthread_mutex_t    lock;
+    pthread_cond_t     wake;         /**< Despierta al hilo del diario   */
+    pthread_cond_t     idle;         /**< Fin de confirmación / manejador*/
+    pthread_t          thread;
+} jnl;
+
+/** Manejadores abiertos por el hilo, si escribe datos de archivo y el
+ *  bloque de datos que aun así va al diario (\ref bwfs_journal_keep). */
+static __thread int      t_depth;
+static __thread bool     t_bypass;
+static __thread uint32_t t_keep = UINT32_MAX;
+
+/* ------------------------------------------------------------------------- */
+/* Formato                                                                   */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t hdr_sum(const bwfs_journal_hdr_t *h)
+{
+    bwfs_journal_hdr_t c = *h;
+    c.checksum = 0;
+    return bwfs_checksum(BWFS_CHECKSUM_SEED, &c, sizeof c);
+}
+
+static uint32_t txn_sum(const bwfs_journal_txn_t *t, const uint8_t *recs)
+{
+    bwfs_journal_txn_t c = *t;
+    c.checksum = 0;
+    return bwfs_checksum(bwfs_checksum(BWFS_CHECKSUM_SEED, &c, sizeof c), recs, t->bytes);
+}
+
+/** \brief Escribe y sincroniza la cabecera del diario. */
+static int write_hdr(const char *fs_dir, uint32_t first, uint32_t blocks,
+                     uint64_t tail, uint64_t tail_seq)
+{
+    bwfs_journal_hdr_t h;
+    memset(&h, 0, sizeof h);
+    h.magic    = BWFS_JOURNAL_MAGIC;
+    h.blocks   = blocks;
+    h.tail     = tail;
+    h.tail_seq = tail_seq;
+    h.checksum = hdr_sum(&h);
+    if (util_write_block_direct(fs_dir, first, 0, (const uint8_t *)&h, sizeof h) != 0 ||
+        util_sync_block(fs_dir, first) != 0)
+        return BWFS_ERR_IO;
+    return BWFS_OK;
+}
+
+static int read_hdr(const bwfs_superblock_t *sb, const char *fs_dir,
+                    bwfs_journal_hdr_t *h)
+{
+    if (util_read_block_direct(fs_dir, sb->journal_blk, 0, (uint8_t *)h,
+                               sizeof *h) != 0)
+        return BWFS_ERR_IO;
+    if (h->magic != BWFS_JOURNAL_MAGIC || h->blocks != sb->journal_blocks ||
+        h->blocks < 2U || h->checksum != hdr_sum(h)) {
+        BWFS_LOG_ERROR("Cabecera del diario dañada (bloque %u)", sb->journal_blk);
+        return BWFS_ERR_IO;
+    }
+    return BWFS_OK;
+}
+
+/** \brief Bloque y desplazamiento de la posición `pos` del registro. */
+static void log_locate(uint32_t first, uint64_t cap, uint64_t pos,
+                       uint32_t *blk, uint32_t *off)
+{
+    uint64_t q = pos % cap;
+    *blk = first + 1U + (uint32_t)(q / BWFS_BLOCK_SIZE_BYTES);
+    *off = (uint32_t)(q % BWFS_BLOCK_SIZE_BYTES);
+}
+
+/** \brief Lee (`out`) o escribe (`in`) `len` bytes del registro en `pos`. */
+static int log_io(const char *fs_dir, uint32_t first, uint64_t cap,
+                  uint64_t pos, uint8_t *out, const uint8_t *in, size_t len)
+{
+    while (len > 0) {
+        uint32_t blk, off;
+        log_locate(first, cap, pos, &blk, &off);
+        size_t n = MIN((size_t)(BWFS_BLOCK_SIZE_BYTES - off), len);
+        int rc = out ? util_read_block_direct(fs_dir, blk, off, out, n)
+                     : util_write_block_direct(fs_dir, blk, off, in, n);
+        if (rc != 0)
+            return BWFS_ERR_IO;
+        pos += n;
+        len -= n;
+        if (out) out += n; else in += n;
+    }
+    return BWFS_OK;
+}
+
+/** \brief Sincroniza los bloques del registro que cubren `[pos, pos+len)`. */
+static int log_sync(uint64_t pos, size_t len)
+{
+    uint64_t end = pos + len;
+    while (pos < end) {
+        uint32_t blk, off;
+        log_locate(jnl.first, jnl.cap, pos, &blk, &off);
+        if (util_sync_block(jnl.fs_dir, blk) != 0)
+            return BWFS_ERR_IO;
+        pos += BWFS_BLOCK_SIZE_BYTES - off;
+    }
+    return BWFS_OK;
+}
+
+int bwfs_journal_format(const bwfs_superblock_t *sb, const char *fs_dir)
+{
+    if (sb->journal_blocks == 0)
+        return BWFS_OK;
+    return write_hdr(fs_dir, sb->journal_blk, sb->journal_blocks, 0, 1);
+}
+
+/** \brief Aplica los registros de una transacción ya validada. */
+static int apply_txn(const bwfs_superblock_t *sb, const char *fs_dir,
+                     const bwfs_journal_txn_t *t, const uint8_t *recs)
+{
+    size_t pos = 0;
+    for (uint32_t i = 0; i < t->nrec; ++i) {
+        bwfs_journal_rec_t r;
+        if (t->bytes - pos < sizeof r)
+            return BWFS_ERR_IO;
+        memcpy(&r, recs + pos, sizeof r);
+        pos += sizeof r;
+        if (r.blk >= sb->total_blocks || t->bytes - pos < r.len ||
+            r.off > BWFS_BLOCK_SIZE_BYTES || r.len > BWFS_BLOCK_SIZE_BYTES - r.off ||
+            util_write_block_direct(fs_dir, r.blk, r.off, recs + pos, r.len) != 0)
+            return BWFS_ERR_IO;
+        pos += r.len;
+    }
+    return BWFS_OK;
+}
+
+int bwfs_journal_replay(bwfs_superblock_t *sb, const char *fs_dir)
+{
+    if (sb->journal_blocks == 0 ||
+        !(sb->feature_incompat & BWFS_FEAT_INCOMPAT_RECOVER))
+        return BWFS_OK;
+
+    bwfs_journal_hdr_t h;
+    int rc = read_hdr(sb, fs_dir, &h);
+    if (rc != BWFS_OK)
+        return rc;
+
+    uint64_t cap = (uint64_t)(h.blocks - 1U) * BWFS_BLOCK_SIZE_BYTES;
+    uint64_t pos = h.tail, seq = h.tail_seq;
+    uint8_t *recs = NULL;
+    uint32_t applied = 0;
+
+    /* Hasta la primera transacción incompleta o de otra vuelta */
+    for (;;) {
+        bwfs_journal_txn_t t;
+        uint64_t used = pos - h.tail;
+        if (cap - used < sizeof t)
+            break;
+        rc = log_io(fs_dir, sb->journal_blk, cap, pos,
+                    (uint8_t *)&t, NULL, sizeof t);
+        if (rc != BWFS_OK)
+            goto out;
+        if (t.magic != BWFS_JOURNAL_TXN_MAGIC || t.seq != seq ||
+            t.bytes > cap - used - sizeof t)
+            break;
+
+        uint8_t *grown = (uint8_t *)realloc(recs, t.bytes ? t.bytes : 1U);
+        if (!grown) { rc = BWFS_ERR_NOMEM; goto out; }
+        recs = grown;
+        rc = log_io(fs_dir, sb->journal_blk, cap, pos + sizeof t, recs, NULL,
+                    t.bytes);
+        if (rc != BWFS_OK)
+            goto out;
+        if (t.checksum != txn_sum(&t, recs))
+            break;                      /* cortada a medio escribir */
+
+        rc = apply_txn(sb, fs_dir, &t, recs);
+        if (rc != BWFS_OK) {
+            BWFS_LOG_ERROR("Diario: transacción %llu no aplicable",
+                           (unsigned long long)seq);
+            goto out;
+        }
+        pos += sizeof t + t.bytes;
+        seq++;
+        applied++;
+    }
+
+    /* Primero todo en su sitio; luego el diario vacío */
+    if (applied > 0 && util_sync_fs(fs_dir) != 0) { rc = BWFS_ERR_IO; goto out; }
+    rc = write_hdr(fs_dir, sb->journal_blk, h.blocks, pos, seq);
+    if (rc != BWFS_OK)
+        goto out;
+    BWFS_LOG_INFO("Diario: %u transacciones reproducidas", applied);
+
+    rc = bwfs_read_superblock(sb, fs_dir);
+    if (rc == BWFS_OK) {
+        sb->feature_incompat &= ~(uint32_t)BWFS_FEAT_INCOMPAT_RECOVER;
+        rc = bwfs_write_superblock(sb, fs_dir);
+    }
+out:
+    free(recs);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Entradas                                                                  */
+/* ------------------------------------------------------------------------- */
+
+static jent_t **slot(uint32_t blk)
+{
+    return &jnl.hash[(blk * 2654435761U) >> (32U - JHASH_BITS)];
+}
+
+static jent_t *find(uint32_t blk)
+{
+    for (jent_t *e = *slot(blk); e; e = e->hnext)
+        if (e->blk == blk)
+            return e;
+    return NULL;
+}
+
+/** \brief Quita de la tabla una entrada sin imágenes. */
+static void drop(jent_t *e)
+{
+    jent_t **p = slot(e->blk);
+    while (*p != e)
+        p = &(*p)->hnext;
+    *p = e->hnext;
+    free(e);
+}
+
+/**
+ * \brief Crea la imagen en curso a partir de la confirmada o del bloque.
+ *
+ * Si el bloque no se puede leer (p. ej. la copia dañada de un superbloque
+ * o bitmap A/B) y `whole` dice que se va a reescribir entero, la imagen
+ * parte de ceros y se registra completa.
+ */
+static int make_run(jent_t *e, bool whole)
+{
+    bool unreadable = false;
+    e->run = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!e->run)
+        return BWFS_ERR_NOMEM;
+    if (e->done) {
+        util_block_copy(e->run, e->done);
+    } else if (util_read_block_direct(jnl.fs_dir, e->blk, 0, e->run,
+                                      BWFS_BLOCK_SIZE_BYTES) != 0) {
+        if (!whole) {
+            free(e->run);
+            e->run = NULL;
+            return BWFS_ERR_IO;
+        }
+        memset(e->run, 0, BWFS_BLOCK_SIZE_BYTES);
+        unreadable = true;
+    }
+    e->run_lo = e->run_hi = 0;
+    if (unreadable) {
+        e->run_hi = BWFS_BLOCK_SIZE_BYTES;
+        jnl.run_bytes += sizeof(bwfs_journal_rec_t) + BWFS_BLOCK_SIZE_BYTES;
+    }
+    e->rnext    = jnl.running;
+    jnl.running = e;
+    jnl.nrun++;
+    return BWFS_OK;
+}
+
+/**
+ * \brief Copia `len` bytes de `src` (NULL = ceros) en la imagen en curso
+ *        desde `off` y amplía su rango con lo que de verdad cambió.
+ */
+static void run_apply(jent_t *e, uint32_t off, const uint8_t *src, uint32_t len)
+{
+    uint8_t *img = e->run + off;
+    uint32_t lo = 0, hi = len;
+
+    if (src) {
+        while (lo < hi && img[lo] == src[lo])         lo++;
+        while (hi > lo && img[hi - 1] == src[hi - 1]) hi--;
+        memcpy(img + lo, src + lo, hi - lo);
+    } else {
+        while (lo < hi && img[lo] == 0)      lo++;
+        while (hi > lo && img[hi - 1] == 0)  hi--;
+        memset(img + lo, 0, hi - lo);
+    }
+    if (lo == hi)
+        return;
+
+    lo += off;
+    hi += off;
+    uint32_t before = e->run_hi - e->run_lo;
+    if (before == 0) {
+        e->run_lo = lo;
+        e->run_hi = hi;
+        jnl.run_bytes += sizeof(bwfs_journal_rec_t);
+    } else {
+        if (lo < e->run_lo) e->run_lo = lo;
+        if (hi > e->run_hi) e->run_hi = hi;
+    }
+    jnl.run_bytes += (e->run_hi - e->run_lo) - before;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Ganchos de E/S                                                            */
+/* ------------------------------------------------------------------------- */
+
+static int hook_read(uint32_t blk, size_t off, uint8_t *out, size_t len)
+{
+    pthread_mutex_lock(&jnl.lock);
+    jent_t  *e   = find(blk);
+    uint8_t *img = e ? (e->run ? e->run : e->done) : NULL;
+    if (img)
+        memcpy(out, img + off, len);
+    pthread_mutex_unlock(&jnl.lock);
+    return img != NULL;
+}
+
+static int hook_write(uint32_t blk, size_t off, const uint8_t *data,
+                      size_t len, int whole)
+{
+    pthread_mutex_lock(&jnl.lock);
+    jent_t *e = find(blk);
+    bool  keep = t_keep == blk;
+    if (keep)
+        t_keep = UINT32_MAX;
+    if (!e && t_bypass && !keep) {      /* datos: directos a su bloque */
+        pthread_mutex_unlock(&jnl.lock);
+        return 0;
+    }
+
+    /* Fuera de un manejador la escritura es una operación por sí misma */
+    if (t_depth == 0 && jnl.committing) {
+        while (jnl.committing)
+            pthread_cond_wait(&jnl.idle, &jnl.lock);
+        e = find(blk);
+    }
+
+    if (!e) {
+        e = (jent_t *)calloc(1, sizeof *e);
+        if (!e) {
+            pthread_mutex_unlock(&jnl.lock);
+            return -1;
+        }
+        e->blk   = blk;
+        e->hnext = *slot(blk);
+        *slot(blk) = e;
+    }
+    if (!e->run && make_run(e, whole && off == 0) != BWFS_OK) {
+        if (!e->done)
+            drop(e);
+        pthread_mutex_unlock(&jnl.lock);
+        return -1;
+    }
+
+    run_apply(e, (uint32_t)off, data, (uint32_t)len);
+    if (whole)
+        run_apply(e, (uint32_t)(off + len), NULL,
+                  (uint32_t)(BWFS_BLOCK_SIZE_BYTES - off - len));
+    pthread_mutex_unlock(&jnl.lock);
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Checkpoint y confirmación (hilo del diario, con el cerrojo tomado)        */
+/* ------------------------------------------------------------------------- */
+
+/**
+ * \brief Lleva a su sitio todas las versiones confirmadas y avanza la cola
+ *        del diario hasta la cabeza.  Suelta el cerrojo durante la E/S.
+ */
+static int checkpoint(void)
+{
+    if (jnl.ndone == 0 && jnl.tail == jnl.head)
+        return BWFS_OK;
+
+    uint64_t to = jnl.head, to_seq = jnl.seq;
+    uint32_t n  = 0;
+    jent_t **list = NULL;
+    if (jnl.ndone > 0) {
+        list = (jent_t **)malloc(jnl.ndone * sizeof *list);
+        if (!list)
+            return BWFS_ERR_NOMEM;
+        for (uint32_t s = 0; s < JHASH_SLOTS; ++s)
+            for (jent_t *e = jnl.hash[s]; e; e = e->hnext)
+                if (e->done)
+                    list[n++] = e;
+    }
+
+    /* `done` y su rango solo los cambia este hilo: se leen sin cerrojo */
+    pthread_mutex_unlock(&jnl.lock);
+    int rc = BWFS_OK;
+    for (uint32_t i = 0; i < n && rc == BWFS_OK; ++i) {
+        jent_t *e = list[i];
+        if (e->ck_hi > e->ck_lo &&
+            util_write_block_direct(jnl.fs_dir, e->blk, e->ck_lo,
+                                    e->done + e->ck_lo, e->ck_hi - e->ck_lo) != 0)
+            rc = BWFS_ERR_IO;
+    }
+    if (rc == BWFS_OK && n > 0 && util_sync_fs(jnl.fs_dir) != 0)
+        rc = BWFS_ERR_IO;
+    if (rc == BWFS_OK)
+        rc = write_hdr(jnl.fs_dir, jnl.first, jnl.blocks, to, to_seq);
+    pthread_mutex_lock(&jnl.lock);
+
+    if (rc == BWFS_OK) {
+        jnl.tail = to;
+        for (uint32_t i = 0; i < n; ++i) {
+            jent_t *e = list[i];
+            free(e->done);
+            e->done  = NULL;
+            e->ck_lo = e->ck_hi = 0;
+            jnl.ndone--;
+            if (!e->run)
+                drop(e);
+        }
+    } else {
+        BWFS_LOG_ERROR("Diario: checkpoint fallido (%d)", rc);
+    }
+    free(list);
+    return rc;
+}
+
+/**
+ * \brief Escribe en su sitio, sin pasar por el registro, la transacción
+ *        en curso (no cabe en el diario o no se pudo registrar).  Pierde
+ *        la atomicidad, no los datos.
+ */
+static int write_through(void)
+{
+    int rc = checkpoint();
+    for (jent_t *e = jnl.running; e && rc == BWFS_OK; e = e->rnext)
+        if (e->run_hi > e->run_lo &&
+            util_write_block_direct(jnl.fs_dir, e->blk, e->run_lo,
+                                    e->run + e->run_lo,
+                                    e->run_hi - e->run_lo) != 0)
+            rc = BWFS_ERR_IO;
+    if (rc == BWFS_OK && util_sync_fs(jnl.fs_dir) != 0)
+        rc = BWFS_ERR_IO;
+    return rc;
+}
+
+/** \brief Vuelca la transacción en curso en `buf` (cabecera + registros). */
+static void build_txn(uint8_t *buf, size_t need, uint32_t nrec)
+{
+    bwfs_journal_txn_t t;
+    memset(&t, 0, sizeof t);
+    t.magic = BWFS_JOURNAL_TXN_MAGIC;
+    t.nrec  = nrec;
+    t.seq   = jnl.seq;
+    t.bytes = (uint32_t)(need - sizeof t);
+
+    uint8_t *p = buf + sizeof t;
+    for (jent_t *e = jnl.running; e; e = e->rnext) {
+        if (e->run_hi == e->run_lo)
+            continue;
+        bwfs_journal_rec_t r = { e->blk, e->run_lo, e->run_hi - e->run_lo };
+        memcpy(p, &r, sizeof r);
+        memcpy(p + sizeof r, e->run + e->run_lo, r.len);
+        p += sizeof r + r.len;
+    }
+    t.checksum = txn_sum(&t, buf + sizeof t);
+    memcpy(buf, &t, sizeof t);
+}
+
+/**
+ * \brief Confirma la transacción en curso: espera a que se cierren los
+ *        manejadores, la registra y sincroniza, y sus imágenes pasan a ser
+ *        las confirmadas.
+ */
+static int commit(void)
+{
+    if (!jnl.running)
+        return BWFS_OK;
+
+    jnl.committing = true;
+    while (jnl.handles > 0)
+        pthread_cond_wait(&jnl.idle, &jnl.lock);
+
+    uint32_t nrec = 0;
+    size_t   need = sizeof(bwfs_journal_txn_t);
+    for (jent_t *e = jnl.running; e; e = e->rnext)
+        if (e->run_hi > e->run_lo) {
+            nrec++;
+            need += sizeof(bwfs_journal_rec_t) + (e->run_hi - e->run_lo);
+        }
+
+    int rc = BWFS_OK;
+    if (nrec > 0 && need > jnl.cap) {
+        BWFS_LOG_ERROR("Diario: transacción de %zu bytes mayor que el diario; "
+                       "se escribe sin él", need);
+        rc = write_through();
+    } else if (nrec > 0) {
+        if (jnl.head + need - jnl.tail > jnl.cap)
+            rc = checkpoint();
+        uint8_t *buf = rc == BWFS_OK ? (uint8_t *)malloc(need) : NULL;
+        if (buf) {
+            build_txn(buf, need, nrec);
+            uint64_t at = jnl.head;
+            pthread_mutex_unlock(&jnl.lock);
+            rc = log_io(jnl.fs_dir, jnl.first, jnl.cap, at, NULL, buf, need);
+            if (rc == BWFS_OK)
+                rc = log_sync(at, need);
+            pthread_mutex_lock(&jnl.lock);
+            free(buf);
+            if (rc == BWFS_OK) {
+                jnl.head += need;
+                jnl.seq++;
+            }
+        }
+        if (rc != BWFS_OK || !buf)
+            rc = write_through();
+    }
+
+    /* Las imágenes en curso pasan a ser las confirmadas (también si no se
+     * pudo registrar: siguen en memoria y el checkpoint lo reintenta) */
+    jent_t *e = jnl.running;
+    while (e) {
+        jent_t *next = e->rnext;
+        e->rnext = NULL;
+        if (e->run_hi > e->run_lo) {
+            if (e->ck_hi == e->ck_lo) {
+                e->ck_lo = e->run_lo;
+                e->ck_hi = e->run_hi;
+            } else {
+                if (e->run_lo < e->ck_lo) e->ck_lo = e->run_lo;
+                if (e->run_hi > e->ck_hi) e->ck_hi = e->run_hi;
+            }
+            if (e->done) free(e->done);
+            else         jnl.ndone++;
+            e->done = e->run;
+        } else {
+            free(e->run);
+        }
+        e->run = NULL;
+        if (!e->done)
+            drop(e);
+        e = next;
+    }
+
+    jnl.running   = NULL;
+    jnl.nrun      = 0;
+    jnl.run_bytes = 0;
+    jnl.run_freed = 0;
+    jnl.last_rc   = rc;
+    jnl.gen++;
+    jnl.committing = false;
+    pthread_cond_broadcast(&jnl.idle);
+    return rc;
+}
+
+/**
+ * \brief Hilo del diario: confirma cuando se le pide o cada
+ *        #BWFS_JOURNAL_COMMIT_MS.  Por tiempo hace además checkpoint; si se
+ *        lo pidieron (fsync, transacción grande), solo cuando el registro
+ *        pasa de la mitad o hay muchas versiones en memoria.
+ */
+static void *journal_thread(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&jnl.lock);
+    while (!jnl.stop) {
+        bool asked = jnl.want_commit;
+        if (!asked) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec  += BWFS_JOURNAL_COMMIT_MS / 1000U;
+            ts.tv_nsec += (long)(BWFS_JOURNAL_COMMIT_MS % 1000U) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            int w = pthread_cond_timedwait(&jnl.wake, &jnl.lock, &ts);
+            if (jnl.stop)
+                break;
+            asked = jnl.want_commit;
+            if (!asked && w != ETIMEDOUT)
+                continue;
+        }
+        jnl.want_commit = false;
+
+        commit();
+        if (!asked || jnl.head - jnl.tail > jnl.cap / 2U || jnl.ndone >= JDONE_MAX)
+            checkpoint();
+    }
+    pthread_mutex_unlock(&jnl.lock);
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+int bwfs_journal_open(bwfs_superblock_t *sb, const char *fs_dir)
+{
+    if (sb->journal_blocks == 0)
+        return BWFS_OK;
+
+    bwfs_journal_hdr_t h;
+    int rc = read_hdr(sb, fs_dir, &h);
+    if (rc != BWFS_OK)
+        return rc;
+
+    memset(&jnl, 0, sizeof jnl);
+    jnl.sb     = sb;
+    jnl.fs_dir = fs_dir;
+    jnl.first  = sb->journal_blk;
+    jnl.blocks = sb->journal_blocks;
+    jnl.cap    = (uint64_t)(jnl.blocks - 1U) * BWFS_BLOCK_SIZE_BYTES;
+    jnl.head   = jnl.tail = h.tail;
+    jnl.seq    = h.tail_seq;
+
+    pthread_mutex_init(&jnl.lock, NULL);
+    pthread_cond_init(&jnl.wake, NULL);
+    pthread_cond_init(&jnl.idle, NULL);
+
+    /* Primero la marca en disco: una transacción confirmada sin ella no
+     * se reproduciría */
+    sb->feature_incompat |= BWFS_FEAT_INCOMPAT_RECOVER;
+    rc = bwfs_write_superblock(sb, fs_dir);
+    if (rc == BWFS_OK && util_sync_block(fs_dir, bwfs_sb_current_blk(sb)) != 0)
+        rc = BWFS_ERR_IO;
+    if (rc == BWFS_OK &&
+        pthread_create(&jnl.thread, NULL, journal_thread, NULL) != 0)
+        rc = BWFS_ERR_NOMEM;
+    if (rc != BWFS_OK) {
+        sb->feature_incompat &= ~(uint32_t)BWFS_FEAT_INCOMPAT_RECOVER;
+        pthread_cond_destroy(&jnl.idle);
+        pthread_cond_destroy(&jnl.wake);
+        pthread_mutex_destroy(&jnl.lock);
+        return rc;
+    }
+
+    util_set_cache_hooks(hook_read, hook_write);
+    jnl.ready = true;
+    return BWFS_OK;
+}
+
+void bwfs_journal_close(void)
+{
+    if (!jnl.ready)
+        return;
+
+    pthread_mutex_lock(&jnl.lock);
+    jnl.stop = true;
+    pthread_cond_signal(&jnl.wake);
+    pthread_mutex_unlock(&jnl.lock);
+    pthread_join(jnl.thread, NULL);
+
+    /* Lo último, ya sin el hilo: todo a su sitio y el diario vacío */
+    pthread_mutex_lock(&jnl.lock);
+    int rc = commit();
+    if (rc == BWFS_OK)
+        rc = checkpoint();
+    pthread_mutex_unlock(&jnl.lock);
+
+    util_set_cache_hooks(NULL, NULL);
+    jnl.ready = false;
+    for (uint32_t s = 0; s < JHASH_SLOTS; ++s) {
+        jent_t *e = jnl.hash[s];
+        while (e) {
+            jent_t *next = e->hnext;
+            free(e->run);
+            free(e->done);
+            free(e);
+            e = next;
+        }
+        jnl.hash[s] = NULL;
+    }
+    pthread_cond_destroy(&jnl.idle);
+    pthread_cond_destroy(&jnl.wake);
+    pthread_mutex_destroy(&jnl.lock);
+
+    /* Con algo sin aplicar, el próximo montaje reproduce el diario */
+    if (rc == BWFS_OK)
+        jnl.sb->feature_incompat &= ~(uint32_t)BWFS_FEAT_INCOMPAT_RECOVER;
+}
+
+void bwfs_journal_begin(void)
+{
+    if (!jnl.ready || t_depth++ > 0)
+        return;
+
+    pthread_mutex_lock(&jnl.lock);
+    while (jnl.committing || jnl.run_bytes >= jnl.cap / 2U ||
+           jnl.nrun >= JRUN_HARD) {
+        if (!jnl.committing) {          /* demasiado en curso: confirmar */
+            jnl.want_commit = true;
+            pthread_cond_signal(&jnl.wake);
+        }
+        pthread_cond_wait(&jnl.idle, &jnl.lock);
+    }
+    jnl.handles++;
+    pthread_mutex_unlock(&jnl.lock);
+}
+
+void bwfs_journal_end(void)
+{
+    if (!jnl.ready || t_depth == 0 || --t_depth > 0)
+        return;
+
+    pthread_mutex_lock(&jnl.lock);
+    if (--jnl.handles == 0 && jnl.committing)
+        pthread_cond_broadcast(&jnl.idle);
+    if (jnl.run_bytes >= jnl.cap / 4U || jnl.nrun >= JRUN_SOFT ||
+        jnl.run_freed >= jnl.sb->total_blocks / JFREE_SOFT_DIV) {
+        jnl.want_commit = true;
+        pthread_cond_signal(&jnl.wake);
+    }
+    pthread_mutex_unlock(&jnl.lock);
+}
+
+bool bwfs_journal_ready(void)
+{
+    return jnl.ready;
+}
+
+bool bwfs_journal_bypass(bool on)
+{
+    bool was = t_bypass;
+    t_bypass = on;
+    return was;
+}
+
+bool bwfs_journal_bypassing(void)
+{
+    return t_bypass;
+}
+
+void bwfs_journal_keep(uint32_t blk)
+{
+    t_keep = blk;
+}
+
+uint64_t bwfs_journal_free_tag(uint32_t blocks)
+{
+    if (!jnl.ready)
+        return 0;
+
+    /* Fuera de un manejador, una escritura durante la confirmación espera
+     * y entra en la siguiente */
+    pthread_mutex_lock(&jnl.lock);
+    uint64_t tag = jnl.gen + (t_depth == 0 && jnl.committing ? 2U : 1U);
+    jnl.run_freed += blocks;
+    pthread_mutex_unlock(&jnl.lock);
+    return tag;
+}
+
+bool bwfs_journal_settled(uint64_t tag)
+{
+    if (!jnl.ready)
+        return true;
+
+    pthread_mutex_lock(&jnl.lock);
+    bool done = jnl.gen >= tag;
+    pthread_mutex_unlock(&jnl.lock);
+    return done;
+}
+
+int bwfs_journal_commit(void)
+{
+    if (!jnl.ready)
+        return BWFS_OK;
+
+    pthread_mutex_lock(&jnl.lock);
+    int rc = BWFS_OK;
+    if (jnl.running || jnl.committing) {
+        uint64_t gen = jnl.gen;
+        jnl.want_commit = true;
+        pthread_cond_signal(&jnl.wake);
+        while (jnl.gen == gen)
+            pthread_cond_wait(&jnl.idle, &jnl.lock);
+        rc = jnl.last_rc;
+    }
+    pthread_mutex_unlock(&jnl.lock);
+    return rc;
+}
@@ -0,0 +1,89 @@
+// -----------------------------------------------------------------------------
+// File: src/core/orphan.c
+// -----------------------------------------------------------------------------
+/**
+ * \file orphan.c
+ * \brief Lista de huérfanos y recolector por pasos (ver orphan.h).
+ *
+ *  - Añadir escribe el inodo (con #BWFS_INODE_ORPHAN y el antiguo primero
+ *    en `next_orphan`) y después el superbloque: un corte entre medias deja
+ *    un inodo sin entrada ni lista, que fsck encuentra como huérfano.
+ *  - Un huérfano sale de la lista en el mismo paso en que se borra; si un
+ *    corte sin diario deja `orphan_head` apuntando a un inodo ya libre, la
+ *    lista se corta ahí y lo que seguía queda para fsck.
+ */
+
+#include "orphan.h"
+#include "inode.h"
+#include "dir.h"
+#include "txn.h"
+#include "util.h"
+
+/** \brief Saca de la lista el primero, que pasa a ser `next`. */
+static int pop(bwfs_superblock_t *sb, uint32_t next, const char *fs_dir)
+{
+    sb->orphan_head = next;
+    if (next == 0)
+        sb->feature_ro_compat &= ~(uint32_t)BWFS_FEAT_RO_COMPAT_ORPHAN;
+    return bwfs_write_superblock(sb, fs_dir);
+}
+
+int bwfs_orphan_add(bwfs_superblock_t *sb, bwfs_inode_t *inode,
+                    const char *fs_dir)
+{
+    /* Sin entrada: que nadie intente refrescar sus atributos en el padre */
+    bwfs_txn_lock_alloc();
+    if (bwfs_inode_set_link(inode->ino, 0, 0, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    inode->flags      |= BWFS_INODE_ORPHAN;
+    inode->next_orphan = sb->orphan_head;
+    if (bwfs_write_inode(inode, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+
+    sb->orphan_head        = inode->ino;
+    sb->feature_ro_compat |= BWFS_FEAT_RO_COMPAT_ORPHAN;
+    return bwfs_write_superblock(sb, fs_dir) == BWFS_OK ? BWFS_OK : BWFS_ERR_IO;
+}
+
+int bwfs_orphan_reap(bwfs_bitmap_t *bm, bwfs_superblock_t *sb,
+                     const char *fs_dir, uint32_t budget)
+{
+    uint32_t freed = 0;
+    bwfs_txn_lock_alloc();
+
+    while (sb->orphan_head != 0 && freed < budget) {
+        uint32_t     ino = sb->orphan_head;
+        bwfs_inode_t inode;
+        if (bwfs_read_inode(ino, &inode, fs_dir) != BWFS_OK)
+            return BWFS_ERR_IO;
+
+        if (!bwfs_inode_in_use(ino)) {
+            BWFS_LOG_INFO("Huérfano %u ya liberado: la lista acaba ahí", ino);
+            return pop(sb, 0, fs_dir) == BWFS_OK ? (int)freed : BWFS_ERR_IO;
+        }
+        if (!(inode.flags & BWFS_INODE_ORPHAN)) {
+            BWFS_LOG_ERROR("Lista de huérfanos rota en el inodo %u: se corta", ino);
+            return pop(sb, 0, fs_dir) == BWFS_OK ? (int)freed : BWFS_ERR_IO;
+        }
+
+        /* Grande: se recorta desde el final lo que permite el paso */
+        uint32_t left = budget - freed;
+        if (!(inode.flags & BWFS_INODE_DIR) && inode.block_count > left) {
+            int rc = bwfs_inode_trim(bm, &inode, inode.block_count - left, fs_dir);
+            if (rc != BWFS_OK)
+                return rc;
+            freed = budget;
+            break;
+        }
+
+        freed += inode.block_count + 1U;
+        if (pop(sb, inode.next_orphan, fs_dir) != BWFS_OK)
+            return BWFS_ERR_IO;
+        if (((inode.flags & BWFS_INODE_DIR) &&
+             bwfs_dir_release(bm, &inode, fs_dir) != BWFS_OK) ||
+            bwfs_delete_inode(bm, &inode, fs_dir) != BWFS_OK)
+            return BWFS_ERR_IO;
+    }
+    return (int)(freed > (uint32_t)INT32_MAX ? INT32_MAX : freed);
+}
@@ -0,0 +1,225 @@
+// -----------------------------------------------------------------------------
+// File: src/core/segment.c
+// -----------------------------------------------------------------------------
+/**
+ * \file segment.c
+ * \brief Limpieza de segmentos para la política de asignación log.
+ *
+ *  - Un segmento son #BWFS_SEG_BLOCKS bloques consecutivos alineados; el
+ *    último del disco puede ser más corto.
+ *  - Sus bloques vivos son los marcados en el bitmap: liberar un bloque
+ *    (sobrescritura fuera de sitio, truncado, borrado) ya descuenta.
+ *  - Mover un tramo: reservarlo en la cabeza del log, copiar los bloques
+ *    escritos (los preasignados no tienen nada que copiar) y remapear el
+ *    archivo, que libera los antiguos.
+ */
+
+#include "segment.h"
+#include "allocation.h"
+#include "extent.h"
+#include "dirty.h"
+#include "inode.h"
+#include "journal.h"
+#include "txn.h"
+#include "util.h"
+
+#include <stdlib.h>   /* malloc, free */
+
+/** Segmentos recientes en los que no había nada que mover. */
+#define SEG_PINNED_SLOTS    8U
+
+/**
+ * Segmentos con solo metadatos fijos (nº de segmento + 1; 0 = vacío).  Se
+ * saltan al elegir víctima para no recorrer la tabla de inodos en balde.
+ */
+static uint32_t g_pinned[SEG_PINNED_SLOTS];
+static uint32_t g_pinned_next;
+
+/* ------------------------------------------------------------------------- */
+/* Helpers                                                                   */
+/* ------------------------------------------------------------------------- */
+
+static inline uint32_t seg_total(const bwfs_bitmap_t *bm)
+{
+    return (bm->total_blocks + BWFS_SEG_BLOCKS - 1U) / BWFS_SEG_BLOCKS;
+}
+
+/** \brief Bloques del segmento `seg` (el último puede ser más corto). */
+static inline uint32_t seg_len(const bwfs_bitmap_t *bm, uint32_t seg)
+{
+    uint32_t start = seg * BWFS_SEG_BLOCKS;
+    return bm->total_blocks - start < BWFS_SEG_BLOCKS ? bm->total_blocks - start
+                                                      : BWFS_SEG_BLOCKS;
+}
+
+/** \brief Bloques en uso del segmento `seg`. */
+static uint32_t seg_live(const bwfs_bitmap_t *bm, uint32_t seg)
+{
+    uint32_t start = seg * BWFS_SEG_BLOCKS, live = 0;
+    for (uint32_t b = start; b < start + seg_len(bm, seg); ++b)
+        live += bwfs_bm_test(bm, b) != 0;
+    return live;
+}
+
+static bool seg_pinned(uint32_t seg)
+{
+    for (uint32_t i = 0; i < SEG_PINNED_SLOTS; ++i)
+        if (g_pinned[i] == seg + 1U)
+            return true;
+    return false;
+}
+
+static void seg_pin(uint32_t seg)
+{
+    g_pinned[g_pinned_next] = seg + 1U;
+    g_pinned_next = (g_pinned_next + 1U) % SEG_PINNED_SLOTS;
+}
+
+/**
+ * \brief Lleva los bloques lógicos `[lblk, lblk+len)` de `inode`, hoy en
+ *        `phys`, a la cabeza del log (fuera de `[vs, ve)`).
+ * @return BWFS_OK, BWFS_ERR_FULL (no hay sitio fuera de la víctima) u otro
+ *         código BWFS_ERR_*
+ */
+static int move_run(bwfs_bitmap_t *bm, bwfs_inode_t *inode, uint32_t lblk,
+                    uint32_t phys, uint32_t len, bool unwritten,
+                    uint32_t vs, uint32_t ve, uint8_t *buf, const char *fs_dir)
+{
+    uint32_t dst = bwfs_alloc_blocks(bm, len);
+    if (dst == UINT32_MAX)
+        return BWFS_ERR_FULL;
+    if (dst < ve && dst + len > vs) {           /* Next-Fit cayó en la víctima */
+        bwfs_free_blocks(bm, dst, len);
+        return BWFS_ERR_FULL;
+    }
+
+    /* Copias a bloques recién reservados: datos, fuera del diario */
+    int rc = BWFS_OK;
+    bool data = bwfs_journal_bypass(true);
+    for (uint32_t k = 0; !unwritten && k < len && rc == BWFS_OK; ++k) {
+        if (util_read_block(fs_dir, phys + k, buf, BWFS_BLOCK_SIZE_BYTES) != 0 ||
+            util_write_block(fs_dir, dst + k, buf, BWFS_BLOCK_SIZE_BYTES) != 0)
+            rc = BWFS_ERR_IO;
+        else
+            bwfs_dirty_add(inode->ino, dst + k);
+    }
+    bwfs_journal_bypass(data);
+    if (rc != BWFS_OK) {
+        bwfs_free_blocks(bm, dst, len);
+        return rc;
+    }
+    rc = bwfs_inode_remap(bm, inode, lblk, len, dst, unwritten, fs_dir);
+    if (rc != BWFS_OK)
+        bwfs_free_blocks(bm, dst, len);
+    else
+        bwfs_dirty_meta(inode->ino);
+    return rc;
+}
+
+/**
+ * \brief Mueve los bloques de datos de `inode` que caen en `[vs, ve)`.
+ * \param[in,out] moved   Bloques movidos (acotado por `budget`).
+ * \param[out]    found   true si había alguno.
+ */
+static int clean_inode(bwfs_bitmap_t *bm, bwfs_inode_t *inode,
+                       uint32_t vs, uint32_t ve, uint32_t budget,
+                       uint32_t *moved, bool *found,
+                       uint8_t *buf, const char *fs_dir)
+{
+    bwfs_extent_map_t map;
+    bwfs_extent_map_init(&map);
+    int rc = bwfs_extent_load(inode, fs_dir, &map);
+
+    for (uint32_t i = 0; rc == BWFS_OK && i < map.count; ++i) {
+        const bwfs_extent_t *e = &map.ext[i];
+        uint32_t len = e->len & BWFS_EXT_LEN_MASK;
+        if (e->physical >= ve || e->physical + len <= vs)
+            continue;
+
+        *found = true;
+        uint32_t a = e->physical > vs ? e->physical : vs;
+        uint32_t b = e->physical + len < ve ? e->physical + len : ve;
+        if (b - a > budget - *moved)
+            b = a + (budget - *moved);
+        if (b == a)
+            break;
+
+        /* El mapa cargado sigue valiendo: remapear un tramo no mueve otros */
+        rc = move_run(bm, inode, e->logical + (a - e->physical), a, b - a,
+                      (e->len & BWFS_EXT_UNWRITTEN) != 0, vs, ve, buf, fs_dir);
+        if (rc == BWFS_OK)
+            *moved += b - a;
+    }
+    bwfs_extent_map_free(&map);
+    return rc;
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+uint32_t bwfs_seg_clean_count(const bwfs_bitmap_t *bm)
+{
+    uint32_t clean = 0;
+    for (uint32_t s = 0; s < seg_total(bm); ++s)
+        clean += seg_live(bm, s) == 0;
+    return clean;
+}
+
+int bwfs_seg_clean(bwfs_bitmap_t *bm, const bwfs_superblock_t *sb,
+                   const char *fs_dir, uint32_t budget)
+{
+    if (bm->policy != BWFS_ALLOC_LOG || budget == 0)
+        return 0;
+    bwfs_txn_lock_alloc();
+
+    /* Víctima: la menos viva por debajo de tres cuartos, salvo la cabeza */
+    uint32_t nseg   = seg_total(bm);
+    uint32_t head   = bm->cursor / BWFS_SEG_BLOCKS;
+    uint32_t clean  = 0, victim = UINT32_MAX, vlive = 0;
+    for (uint32_t s = 0; s < nseg; ++s) {
+        uint32_t live = seg_live(bm, s);
+        if (live == 0) {
+            clean++;
+            continue;
+        }
+        if (s == head || live * 4U > seg_len(bm, s) * 3U || seg_pinned(s))
+            continue;
+        if (victim == UINT32_MAX || live < vlive) {
+            victim = s;
+            vlive  = live;
+        }
+    }
+    if (clean >= nseg / 8U + 1U || victim == UINT32_MAX)
+        return 0;
+
+    uint8_t *buf = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!buf)
+        return BWFS_ERR_NOMEM;
+
+    uint32_t vs = victim * BWFS_SEG_BLOCKS, ve = vs + seg_len(bm, victim);
+    uint32_t moved = 0;
+    bool     found = false;
+    int      rc    = BWFS_OK;
+
+    bwfs_inode_batch_t batch;
+    bwfs_inode_batch_init(&batch);
+    for (uint32_t ino = 1; rc == BWFS_OK && ino < sb->inode_count &&
+                           moved < budget; ++ino) {
+        if (!bwfs_inode_in_use(ino))
+            continue;
+        bwfs_inode_t inode;
+        rc = bwfs_inode_batch_read(&batch, ino, &inode, fs_dir);
+        if (rc != BWFS_OK)
+            break;
+        if (inode.flags & (BWFS_INODE_DIR | BWFS_INODE_INLINE))
+            continue;
+        rc = clean_inode(bm, &inode, vs, ve, budget, &moved, &found, buf, fs_dir);
+    }
+    bwfs_inode_batch_release(&batch);
+    free(buf);
+
+    if (!found)
+        seg_pin(victim);
+    return rc == BWFS_OK || rc == BWFS_ERR_FULL ? (int)moved : rc;
+}
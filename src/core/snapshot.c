@@ -0,0 +1,535 @@
+// -----------------------------------------------------------------------------
+// File: src/core/snapshot.c
+// -----------------------------------------------------------------------------
+/**
+ * \file snapshot.c
+ * \brief Instantáneas con copia en escritura a nivel de bloque.
+ *
+ *  - En RAM, por instantánea: su mapa completo (una entrada por bloque del
+ *    disco) y los bloques «pendientes», compartidos y aún sin versión
+ *    propia.  Pendiente = compartido al crearla y con la entrada del mapa a
+ *    0, así que no se guarda en disco.
+ *  - `any` reúne los pendientes de todas: la comprobación de cada
+ *    escritura es un bit.  `owned` marca los bloques de las instantáneas,
+ *    que las nuevas no comparten.
+ *  - Guardar una versión la apunta en el mapa de todas las instantáneas que
+ *    tenían el bloque pendiente y persiste solo la entrada tocada.
+ */
+
+#include "snapshot.h"
+#include "allocation.h"
+#include "inode.h"
+#include "journal.h"
+#include "txn.h"
+#include "util.h"
+
+#include <string.h>   /* memcpy, memset, strlen, strcmp */
+#include <stdlib.h>   /* malloc, calloc, free */
+
+/** Entradas de mapa por bloque de mapa. */
+#define MAP_PER_CHUNK   (BWFS_BLOCK_SIZE_BYTES / 4U)
+
+/* ------------------------------------------------------------------------- */
+/* Estado del disco abierto                                                  */
+/* ------------------------------------------------------------------------- */
+
+static struct {
+    bwfs_superblock_t *sb;
+    bwfs_bitmap_t     *bm;
+    const char        *fs_dir;
+    bwfs_snap_table_t *table;                  /**< Bloque completo        */
+    uint32_t          *map[BWFS_SNAP_MAX];     /**< Versión de cada bloque */
+    uint8_t           *pending[BWFS_SNAP_MAX]; /**< Compartidos sin versión*/
+    uint8_t           *any;                    /**< OR de los `pending`    */
+    uint8_t           *owned;                  /**< Bloques de instantáneas*/
+} stab;
+
+/** Instantánea que lee el hilo (-1 = disco vivo). */
+static __thread int t_view = -1;
+
+static inline bool bit_test(const uint8_t *map, uint32_t b)
+{
+    return (map[b / 8] >> (b % 8)) & 1U;
+}
+
+static inline void bit_set(uint8_t *map, uint32_t b, bool v)
+{
+    if (v) map[b / 8] |=  (uint8_t)(1U << (b % 8));
+    else   map[b / 8] &= (uint8_t)~(1U << (b % 8));
+}
+
+static inline uint32_t total_blocks(void)
+{
+    return stab.bm->total_blocks;
+}
+
+static inline size_t bitmap_bytes(void)
+{
+    return (total_blocks() + 7U) / 8U;
+}
+
+static int write_table(void)
+{
+    return util_write_block(stab.fs_dir, stab.sb->snap_table,
+                            (const uint8_t *)stab.table,
+                            sizeof *stab.table) ? BWFS_ERR_IO : BWFS_OK;
+}
+
+/** \brief Reserva un bloque para las instantáneas. */
+static uint32_t alloc_owned(void)
+{
+    uint32_t blk = bwfs_alloc_blocks(stab.bm, 1);
+    if (blk != UINT32_MAX)
+        bit_set(stab.owned, blk, true);
+    return blk;
+}
+
+static void free_owned(uint32_t blk)
+{
+    bit_set(stab.owned, blk, false);
+    bwfs_free_blocks(stab.bm, blk, 1);
+}
+
+static void rebuild_any(void)
+{
+    memset(stab.any, 0, bitmap_bytes());
+    for (uint32_t i = 0; i < stab.table->count; ++i)
+        for (size_t k = 0; k < bitmap_bytes(); ++k)
+            stab.any[k] |= stab.pending[i][k];
+}
+
+/* ------------------------------------------------------------------------- */
+/* Mapas                                                                     */
+/* ------------------------------------------------------------------------- */
+
+/** \brief Persiste la entrada `b` del mapa de la instantánea `i`. */
+static int store_entry(uint32_t i, uint32_t b)
+{
+    bwfs_snap_rec_t *rec = &stab.table->rec[i];
+    uint32_t k = b / MAP_PER_CHUNK;
+
+    if (rec->map[k] != 0)
+        return util_write_block_range(stab.fs_dir, rec->map[k],
+                                      (size_t)(b % MAP_PER_CHUNK) * 4U,
+                                      (const uint8_t *)&stab.map[i][b], 4)
+               ? BWFS_ERR_IO : BWFS_OK;
+
+    /* Primer cambio en este tramo: bloque de mapa nuevo, escrito entero */
+    uint32_t chunk = alloc_owned();
+    if (chunk == UINT32_MAX)
+        return BWFS_ERR_FULL;
+    uint32_t first = k * MAP_PER_CHUNK;
+    uint32_t n     = total_blocks() - first < MAP_PER_CHUNK
+                     ? total_blocks() - first : MAP_PER_CHUNK;
+    if (util_write_block(stab.fs_dir, chunk,
+                         (const uint8_t *)&stab.map[i][first], (size_t)n * 4U)) {
+        free_owned(chunk);
+        return BWFS_ERR_IO;
+    }
+    rec->map[k] = chunk;
+    return write_table();
+}
+
+/**
+ * \brief Apunta `version` como contenido de `b` en todas las instantáneas
+ *        que lo tenían pendiente, y persiste mapas y bitmap.
+ */
+static int record_version(uint32_t b, uint32_t version)
+{
+    bool data = bwfs_journal_bypass(false);   /* los mapas, al diario */
+    int rc = BWFS_OK;
+    for (uint32_t i = 0; i < stab.table->count; ++i) {
+        if (!bit_test(stab.pending[i], b))
+            continue;
+        stab.map[i][b] = version;
+        bit_set(stab.pending[i], b, false);
+        int r = store_entry(i, b);
+        if (rc == BWFS_OK)
+            rc = r;
+    }
+    bit_set(stab.any, b, false);
+    bit_set(stab.owned, version, true);
+
+    if (bwfs_write_bitmap(stab.bm, stab.fs_dir) != BWFS_OK && rc == BWFS_OK)
+        rc = BWFS_ERR_IO;
+    bwfs_journal_bypass(data);
+    return rc;
+}
+
+/**
+ * \brief ¿Usa otra instantánea que `skip` la versión `v` del bloque `b`?
+ *        Las versiones de `b` solo se apuntan en la entrada `b`.
+ */
+static bool version_shared(uint32_t skip, uint32_t b, uint32_t v)
+{
+    for (uint32_t i = 0; i < stab.table->count; ++i)
+        if (i != skip && stab.map[i][b] == v)
+            return true;
+    return false;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Ganchos                                                                   */
+/* ------------------------------------------------------------------------- */
+
+static uint32_t snap_remap(uint32_t blk)
+{
+    if (t_view < 0 || (uint32_t)t_view >= stab.table->count ||
+        blk >= total_blocks())
+        return blk;
+    uint32_t v = stab.map[t_view][blk];
+    return v ? v : blk;
+}
+
+/** \brief Copia aparte un bloque compartido antes de sobrescribirlo. */
+static int snap_before_write(const char *fs_dir, uint32_t blk)
+{
+    if (blk >= total_blocks() || !bit_test(stab.any, blk))
+        return 0;
+    bwfs_txn_lock_alloc();              /* otro hilo pudo copiarlo ya */
+    if (!bit_test(stab.any, blk))
+        return 0;
+
+    uint8_t *buf = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!buf)
+        return -1;
+
+    /* El destino es un bloque libre: no está compartido, no hay recursión.
+     * Nada lo apunta hasta confirmar el mapa, así que va directo */
+    uint32_t copy = alloc_owned();
+    int rc = copy == UINT32_MAX ? BWFS_ERR_FULL : BWFS_OK;
+    bool data = bwfs_journal_bypass(true);
+    if (rc == BWFS_OK &&
+        (util_read_block(fs_dir, blk, buf, BWFS_BLOCK_SIZE_BYTES) != 0 ||
+         util_write_block(fs_dir, copy, buf, BWFS_BLOCK_SIZE_BYTES) != 0)) {
+        free_owned(copy);
+        rc = BWFS_ERR_IO;
+    }
+    bwfs_journal_bypass(data);
+    free(buf);
+    if (rc == BWFS_OK)
+        rc = record_version(blk, copy);
+    if (rc != BWFS_OK)
+        BWFS_LOG_ERROR("No se pudo guardar el bloque %u para las instantáneas", blk);
+    else
+        bwfs_journal_keep(blk);     /* no pisarlo antes de confirmar el mapa */
+    return rc == BWFS_OK ? 0 : -1;
+}
+
+/** \brief Un bloque compartido liberado se queda como versión. */
+static bool snap_retain(uint32_t blk)
+{
+    if (blk >= total_blocks() || !bit_test(stab.any, blk))
+        return false;
+    if (record_version(blk, blk) != BWFS_OK)
+        BWFS_LOG_ERROR("No se pudo anotar el bloque %u en las instantáneas", blk);
+    return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Carga                                                                     */
+/* ------------------------------------------------------------------------- */
+
+/** \brief Carga mapa y pendientes de la instantánea `i`. */
+static int load_rec(uint32_t i, uint8_t *buf)
+{
+    const bwfs_snap_rec_t *rec = &stab.table->rec[i];
+    uint32_t total = total_blocks();
+
+    stab.map[i]     = (uint32_t *)calloc(total, sizeof(uint32_t));
+    stab.pending[i] = (uint8_t *)calloc(1, bitmap_bytes());
+    if (!stab.map[i] || !stab.pending[i])
+        return BWFS_ERR_NOMEM;
+
+    if (rec->shared_blk == 0 || rec->shared_blk >= total ||
+        util_read_block(stab.fs_dir, rec->shared_blk, buf, BWFS_BLOCK_SIZE_BYTES))
+        return BWFS_ERR_IO;
+    memcpy(stab.pending[i], buf, bitmap_bytes());
+    bit_set(stab.owned, rec->shared_blk, true);
+
+    for (uint32_t k = 0; k < BWFS_SNAP_MAP_CHUNKS; ++k) {
+        uint32_t first = k * MAP_PER_CHUNK;
+        if (rec->map[k] == 0 || first >= total)
+            continue;
+        uint32_t n = total - first < MAP_PER_CHUNK ? total - first : MAP_PER_CHUNK;
+        if (rec->map[k] >= total ||
+            util_read_block_range(stab.fs_dir, rec->map[k], 0,
+                                  (uint8_t *)&stab.map[i][first], (size_t)n * 4U))
+            return BWFS_ERR_IO;
+        bit_set(stab.owned, rec->map[k], true);
+    }
+
+    for (uint32_t b = 0; b < total; ++b) {
+        uint32_t v = stab.map[i][b];
+        if (v == 0)
+            continue;
+        if (v >= total)
+            return BWFS_ERR_IO;
+        bit_set(stab.pending[i], b, false);
+        bit_set(stab.owned, v, true);
+    }
+    return BWFS_OK;
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+int bwfs_snap_open(bwfs_superblock_t *sb, bwfs_bitmap_t *bm, const char *fs_dir)
+{
+    memset(&stab, 0, sizeof stab);
+    stab.sb     = sb;
+    stab.bm     = bm;
+    stab.fs_dir = fs_dir;
+    stab.table  = (bwfs_snap_table_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+    stab.any    = (uint8_t *)calloc(1, bitmap_bytes());
+    stab.owned  = (uint8_t *)calloc(1, bitmap_bytes());
+    uint8_t *buf = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!stab.table || !stab.any || !stab.owned || !buf) {
+        free(buf);
+        bwfs_snap_close();
+        return BWFS_ERR_NOMEM;
+    }
+
+    int rc = BWFS_OK;
+    if (sb->snap_table != 0) {
+        if (sb->snap_table >= total_blocks() ||
+            util_read_block(fs_dir, sb->snap_table, (uint8_t *)stab.table,
+                            BWFS_BLOCK_SIZE_BYTES) ||
+            stab.table->magic != BWFS_SNAP_MAGIC ||
+            stab.table->count > BWFS_SNAP_MAX) {
+            rc = BWFS_ERR_IO;
+        } else {
+            bit_set(stab.owned, sb->snap_table, true);
+            for (uint32_t i = 0; rc == BWFS_OK && i < stab.table->count; ++i)
+                rc = load_rec(i, buf);
+        }
+    }
+    free(buf);
+    if (rc != BWFS_OK) {
+        BWFS_LOG_ERROR("Tabla de instantáneas dañada (bloque %u)", sb->snap_table);
+        bwfs_snap_close();
+        return rc;
+    }
+
+    rebuild_any();
+    bm->retain = snap_retain;
+    util_set_block_hooks(snap_remap, snap_before_write);
+    return BWFS_OK;
+}
+
+void bwfs_snap_close(void)
+{
+    util_set_block_hooks(NULL, NULL);
+    if (stab.bm)
+        stab.bm->retain = NULL;
+    for (uint32_t i = 0; i < BWFS_SNAP_MAX; ++i) {
+        free(stab.map[i]);
+        free(stab.pending[i]);
+    }
+    free(stab.table);
+    free(stab.any);
+    free(stab.owned);
+    memset(&stab, 0, sizeof stab);
+}
+
+uint32_t bwfs_snap_count(void)
+{
+    return stab.table ? stab.table->count : 0;
+}
+
+const bwfs_snap_rec_t *bwfs_snap_get(uint32_t idx)
+{
+    return idx < bwfs_snap_count() ? &stab.table->rec[idx] : NULL;
+}
+
+int bwfs_snap_find(const char *name)
+{
+    for (uint32_t i = 0; i < bwfs_snap_count(); ++i)
+        if (strcmp(stab.table->rec[i].name, name) == 0)
+            return (int)i;
+    return -1;
+}
+
+int bwfs_snap_create(const char *name, const char *fs_dir)
+{
+    size_t len = strlen(name);
+    bwfs_txn_lock_alloc();
+    if (!stab.table || len == 0 || len > BWFS_SNAP_NAME_MAX ||
+        bwfs_snap_find(name) >= 0)
+        return BWFS_ERR_IO;
+    if (stab.table->count >= BWFS_SNAP_MAX)
+        return BWFS_ERR_FULL;
+    stab.fs_dir = fs_dir;
+
+    /* Primera instantánea: tabla nueva y disco marcado ro_compat */
+    if (stab.sb->snap_table == 0) {
+        uint32_t tb = alloc_owned();
+        if (tb == UINT32_MAX)
+            return BWFS_ERR_FULL;
+        memset(stab.table, 0, sizeof *stab.table);
+        stab.table->magic   = BWFS_SNAP_MAGIC;
+        stab.table->next_id = 1;
+        stab.sb->snap_table = tb;
+        stab.sb->feature_ro_compat |= BWFS_FEAT_RO_COMPAT_SNAP;
+        if (write_table() != BWFS_OK ||
+            bwfs_write_superblock(stab.sb, fs_dir) != BWFS_OK)
+            return BWFS_ERR_IO;
+    }
+
+    uint32_t  i       = stab.table->count;
+    uint32_t *map     = (uint32_t *)calloc(total_blocks(), sizeof(uint32_t));
+    uint8_t  *shared  = (uint8_t *)calloc(1, BWFS_BLOCK_SIZE_BYTES);
+    uint32_t  sblk    = alloc_owned();
+    if (!map || !shared || sblk == UINT32_MAX) {
+        free(map);
+        free(shared);
+        if (sblk != UINT32_MAX)
+            free_owned(sblk);
+        return sblk == UINT32_MAX ? BWFS_ERR_FULL : BWFS_ERR_NOMEM;
+    }
+
+    /* Compartido: lo que está en uso, salvo lo que la vista no lee, lo que
+     * ya es de otras instantáneas y lo liberado pendiente de confirmar */
+    for (size_t k = 0; k < bitmap_bytes(); ++k)
+        shared[k] = (uint8_t)(stab.bm->map[k] & ~stab.owned[k] &
+                              ~(stab.bm->npend ? stab.bm->pending[k] : 0U));
+    bit_set(shared, BWFS_SUPERBLOCK_BLK, false);
+    bit_set(shared, stab.bm->bitmap_blk ? stab.bm->bitmap_blk : BWFS_BITMAP_BLK, false);
+    if (stab.bm->alt_blk) {
+        bit_set(shared, BWFS_SUPERBLOCK_ALT_BLK, false);
+        bit_set(shared, stab.bm->alt_blk, false);
+    }
+    bit_set(shared, stab.sb->inode_bitmap_blk, false);
+    /* El relleno del último byte no corresponde a ningún bloque */
+    for (uint32_t b = total_blocks(); b < bitmap_bytes() * 8U; ++b)
+        bit_set(shared, b, false);
+
+    if (util_write_block(fs_dir, sblk, shared, BWFS_BLOCK_SIZE_BYTES) != 0) {
+        free(map);
+        free(shared);
+        free_owned(sblk);
+        return BWFS_ERR_IO;
+    }
+
+    bwfs_snap_rec_t *rec = &stab.table->rec[i];
+    memset(rec, 0, sizeof *rec);
+    memcpy(rec->name, name, len);
+    rec->ctime_ns   = bwfs_now_ns();
+    rec->id         = stab.table->next_id++;
+    rec->shared_blk = sblk;
+
+    stab.map[i]     = map;
+    stab.pending[i] = shared;
+    for (size_t k = 0; k < bitmap_bytes(); ++k)
+        stab.any[k] |= stab.pending[i][k];
+    stab.table->count++;
+
+    if (write_table() != BWFS_OK ||
+        bwfs_write_bitmap(stab.bm, fs_dir) != BWFS_OK)
+        return BWFS_ERR_IO;
+    BWFS_LOG_INFO("Instantánea '%s' creada (id %u)", rec->name, rec->id);
+    return BWFS_OK;
+}
+
+int bwfs_snap_delete(uint32_t idx, const char *fs_dir)
+{
+    if (idx >= bwfs_snap_count())
+        return BWFS_ERR_IO;
+    bwfs_txn_lock_alloc();
+    stab.fs_dir = fs_dir;
+
+    /* Versiones que ninguna otra instantánea usa */
+    bwfs_snap_rec_t *rec = &stab.table->rec[idx];
+    for (uint32_t b = 0; b < total_blocks(); ++b) {
+        uint32_t v = stab.map[idx][b];
+        if (v != 0 && !version_shared(idx, b, v))
+            free_owned(v);
+    }
+    for (uint32_t k = 0; k < BWFS_SNAP_MAP_CHUNKS; ++k)
+        if (rec->map[k] != 0)
+            free_owned(rec->map[k]);
+    free_owned(rec->shared_blk);
+    BWFS_LOG_INFO("Instantánea '%s' borrada", rec->name);
+
+    /* Compactar registros y estado en RAM */
+    free(stab.map[idx]);
+    free(stab.pending[idx]);
+    uint32_t last = stab.table->count - 1U;
+    for (uint32_t i = idx; i < last; ++i) {
+        stab.table->rec[i] = stab.table->rec[i + 1U];
+        stab.map[i]        = stab.map[i + 1U];
+        stab.pending[i]    = stab.pending[i + 1U];
+    }
+    memset(&stab.table->rec[last], 0, sizeof stab.table->rec[last]);
+    stab.map[last]     = NULL;
+    stab.pending[last] = NULL;
+    stab.table->count  = last;
+    rebuild_any();
+
+    int rc;
+    if (stab.table->count == 0) {
+        /* Sin instantáneas el disco vuelve a ser escribible por todos */
+        free_owned(stab.sb->snap_table);
+        stab.sb->snap_table = 0;
+        stab.sb->feature_ro_compat &= ~(uint32_t)BWFS_FEAT_RO_COMPAT_SNAP;
+        rc = bwfs_write_superblock(stab.sb, fs_dir);
+    } else {
+        rc = write_table();
+    }
+    if (bwfs_write_bitmap(stab.bm, fs_dir) != BWFS_OK)
+        rc = BWFS_ERR_IO;
+    return rc;
+}
+
+void bwfs_snap_view(int idx)
+{
+    t_view = idx;
+}
+
+bool bwfs_snap_viewing(void)
+{
+    return t_view >= 0;
+}
+
+int bwfs_snap_walk(const bwfs_superblock_t *sb, const char *fs_dir,
+                   int (*fn)(uint32_t blk, void *arg), void *arg)
+{
+    if (sb->snap_table == 0)
+        return BWFS_OK;
+
+    bwfs_snap_table_t *table = (bwfs_snap_table_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    uint32_t          *chunk = (uint32_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    int rc = table && chunk ? BWFS_OK : BWFS_ERR_NOMEM;
+    if (rc == BWFS_OK &&
+        (sb->snap_table >= sb->total_blocks ||
+         util_read_block(fs_dir, sb->snap_table, (uint8_t *)table,
+                         BWFS_BLOCK_SIZE_BYTES) ||
+         table->magic != BWFS_SNAP_MAGIC || table->count > BWFS_SNAP_MAX))
+        rc = BWFS_ERR_IO;
+    if (rc == BWFS_OK)
+        rc = fn(sb->snap_table, arg);
+
+    for (uint32_t i = 0; rc == BWFS_OK && i < table->count; ++i) {
+        const bwfs_snap_rec_t *rec = &table->rec[i];
+        rc = fn(rec->shared_blk, arg);
+        for (uint32_t k = 0; rc == BWFS_OK && k < BWFS_SNAP_MAP_CHUNKS; ++k) {
+            uint32_t first = k * MAP_PER_CHUNK;
+            if (rec->map[k] == 0 || first >= sb->total_blocks)
+                continue;
+            uint32_t n = sb->total_blocks - first < MAP_PER_CHUNK
+                         ? sb->total_blocks - first : MAP_PER_CHUNK;
+            rc = fn(rec->map[k], arg);
+            if (rc == BWFS_OK &&
+                util_read_block_range(fs_dir, rec->map[k], 0,
+                                      (uint8_t *)chunk, (size_t)n * 4U))
+                rc = BWFS_ERR_IO;
+            for (uint32_t j = 0; rc == BWFS_OK && j < n; ++j)
+                if (chunk[j] != 0)
+                    rc = fn(chunk[j], arg);
+        }
+    }
+    free(table);
+    free(chunk);
+    return rc;
+}
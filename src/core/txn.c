@@ -0,0 +1,313 @@
+// -----------------------------------------------------------------------------
+// File: src/core/txn.c
+// -----------------------------------------------------------------------------
+/**
+ * \file txn.c
+ * \brief Transacción de metadatos por operación (ver txn.h).
+ *
+ *  - Cada bloque retenido guarda una imagen completa en memoria, pero solo
+ *    son válidos los rangos escritos (unidos si se tocan).  No se lee
+ *    nada para rellenar huecos: otro hilo puede estar escribiendo otras
+ *    ranuras del mismo bloque de la tabla de inodos.
+ *  - Una lectura que los rangos no cubren lee debajo y superpone encima
+ *    lo retenido.
+ *  - Al confirmar, las escrituras que provoca la propia confirmación (la
+ *    copia de una instantánea actualiza sus mapas y el bitmap) se suman a
+ *    su bloque si aún no se escribió, o pasan directas si ya.
+ */
+
+#include "txn.h"
+#include "journal.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdlib.h>   /* malloc, realloc, free, qsort */
+#include <string.h>   /* memcpy, memset */
+
+/** Rangos sueltos por bloque antes de escribirlo por adelantado. */
+#define TXN_RANGES  8U
+
+typedef struct {
+    uint32_t lo, hi;
+} trange_t;
+
+typedef struct {
+    uint32_t  blk;
+    uint8_t  *img;
+    bool      whole;     /**< util_write_block: vale el bloque entero */
+    bool      done;      /**< ya escrito en esta confirmación         */
+    uint32_t  nr;
+    trange_t  r[TXN_RANGES];
+} tblk_t;
+
+static struct {
+    const bwfs_superblock_t *sb;
+    const char              *fs_dir;
+    bool                     ready;
+} tx;
+
+/* Transacción del hilo */
+static __thread int       t_depth;
+static __thread bool      t_flushing;
+static __thread bool      t_pass;    /**< leyendo debajo de lo retenido */
+static __thread tblk_t   *t_set;
+static __thread uint32_t  t_n, t_cap;
+
+/* Cerrojo del asignador: del primer uso a la escritura de lo retenido */
+static pthread_mutex_t    alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread bool      t_alloc;
+
+/* ------------------------------------------------------------------------- */
+/* Auxiliares                                                                */
+/* ------------------------------------------------------------------------- */
+
+/** \brief Orden de escritura: bitmaps, contenido, inodos, superbloque. */
+static int rank(uint32_t blk)
+{
+    const bwfs_superblock_t *sb = tx.sb;
+    if (blk == bwfs_sb_bitmap_blk(sb) || blk == sb->inode_bitmap_blk ||
+        (sb->bitmap_alt_blk && blk == sb->bitmap_alt_blk))
+        return 0;
+    if (blk == BWFS_SUPERBLOCK_BLK ||
+        (blk == BWFS_SUPERBLOCK_ALT_BLK && (sb->feature_incompat & BWFS_FEAT_INCOMPAT_DUAL)))
+        return 3;
+    if (blk >= sb->inode_table_blk && blk - sb->inode_table_blk < sb->inode_table_blocks)
+        return 2;
+    return 1;
+}
+
+static int cmp_tblk(const void *a, const void *b)
+{
+    const tblk_t *x = (const tblk_t *)a, *y = (const tblk_t *)b;
+    int rx = rank(x->blk), ry = rank(y->blk);
+    if (rx != ry)
+        return rx - ry;
+    return x->blk < y->blk ? -1 : x->blk > y->blk;
+}
+
+static tblk_t *find(uint32_t blk)
+{
+    for (uint32_t i = 0; i < t_n; ++i)
+        if (t_set[i].blk == blk)
+            return &t_set[i];
+    return NULL;
+}
+
+/** \brief Añade `[lo, hi)` uniéndolo a los que toca; false si no cabe. */
+static bool add_range(tblk_t *e, uint32_t lo, uint32_t hi)
+{
+    uint32_t apart = 0;
+    for (uint32_t i = 0; i < e->nr; ++i)
+        if (e->r[i].hi < lo || e->r[i].lo > hi)
+            apart++;
+    if (apart == TXN_RANGES)
+        return false;
+
+    uint32_t k = 0;
+    for (uint32_t i = 0; i < e->nr; ++i) {
+        if (e->r[i].hi < lo || e->r[i].lo > hi) {
+            e->r[k++] = e->r[i];
+        } else {
+            if (e->r[i].lo < lo) lo = e->r[i].lo;
+            if (e->r[i].hi > hi) hi = e->r[i].hi;
+        }
+    }
+    e->r[k].lo = lo;
+    e->r[k].hi = hi;
+    e->nr = k + 1U;
+    return true;
+}
+
+static bool covered(const tblk_t *e, size_t off, size_t len)
+{
+    if (e->whole)
+        return true;
+    for (uint32_t i = 0; i < e->nr; ++i)
+        if (e->r[i].lo <= off && off + len <= e->r[i].hi)
+            return true;
+    return false;
+}
+
+/** \brief Escribe los rangos de `e` (las escrituras siguen los ganchos). */
+static int write_entry(tblk_t *e)
+{
+    e->done = true;
+    if (e->whole)
+        return util_write_block(tx.fs_dir, e->blk, e->img, BWFS_BLOCK_SIZE_BYTES)
+               ? BWFS_ERR_IO : BWFS_OK;
+    for (uint32_t i = 0; i < e->nr; ++i)
+        if (util_write_block_range(tx.fs_dir, e->blk, e->r[i].lo,
+                                   e->img + e->r[i].lo, e->r[i].hi - e->r[i].lo))
+            return BWFS_ERR_IO;
+    return BWFS_OK;
+}
+
+/** \brief Escribe todo lo retenido, en orden, y lo suelta. */
+static int flush(void)
+{
+    int rc = BWFS_OK;
+    t_flushing = true;
+    qsort(t_set, t_n, sizeof *t_set, cmp_tblk);
+    for (uint32_t i = 0; i < t_n && rc == BWFS_OK; ++i)
+        rc = write_entry(&t_set[i]);
+    for (uint32_t i = 0; i < t_n; ++i)
+        free(t_set[i].img);
+    t_n = 0;
+    t_flushing = false;
+    if (rc != BWFS_OK)
+        BWFS_LOG_ERROR("Transacción: escritura de metadatos fallida (%d)", rc);
+    return rc;
+}
+
+static tblk_t *add_entry(uint32_t blk)
+{
+    if (t_n == t_cap) {
+        uint32_t cap = t_cap ? t_cap * 2U : 16U;
+        tblk_t *v = (tblk_t *)realloc(t_set, cap * sizeof *v);
+        if (!v)
+            return NULL;
+        t_set = v;
+        t_cap = cap;
+    }
+    uint8_t *img = (uint8_t *)malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!img)
+        return NULL;
+    tblk_t *e = &t_set[t_n++];
+    memset(e, 0, sizeof *e);
+    e->blk = blk;
+    e->img = img;
+    return e;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Ganchos                                                                   */
+/* ------------------------------------------------------------------------- */
+
+static int hook_read(uint32_t blk, size_t off, uint8_t *out, size_t len)
+{
+    if (t_depth == 0 || t_flushing || t_pass)
+        return 0;
+    tblk_t *e = find(blk);
+    if (!e)
+        return 0;
+
+    if (!covered(e, off, len)) {
+        t_pass = true;
+        int rc = util_read_block_range(tx.fs_dir, blk, off, out, len);
+        t_pass = false;
+        if (rc != 0)
+            return -1;
+    }
+    if (e->whole) {
+        memcpy(out, e->img + off, len);
+        return 1;
+    }
+    for (uint32_t i = 0; i < e->nr; ++i) {
+        size_t lo = e->r[i].lo > off ? e->r[i].lo : off;
+        size_t hi = e->r[i].hi < off + len ? e->r[i].hi : off + len;
+        if (lo < hi)
+            memcpy(out + (lo - off), e->img + lo, hi - lo);
+    }
+    return 1;
+}
+
+static bool hook_held(uint32_t blk)
+{
+    if (t_depth == 0)
+        return false;
+    const tblk_t *e = find(blk);
+    return e && !e->done;
+}
+
+static int hook_write(uint32_t blk, size_t off, const uint8_t *data,
+                      size_t len, int whole)
+{
+    if (t_depth == 0)
+        return 0;
+
+    tblk_t *e = find(blk);
+    if (t_flushing) {
+        if (!e || e->done)              /* nada pendiente: directa */
+            return 0;
+    } else if (!e) {
+        if (bwfs_journal_bypassing())   /* datos de archivo */
+            return 0;
+        if (t_n >= BWFS_TXN_MAX_BLOCKS && flush() != BWFS_OK)
+            return -1;
+        e = add_entry(blk);
+        if (!e)
+            return 0;                   /* sin memoria: directa */
+    }
+
+    memcpy(e->img + off, data, len);
+    if (whole) {
+        memset(e->img + off + len, 0, BWFS_BLOCK_SIZE_BYTES - off - len);
+        e->whole = true;
+        e->nr    = 0;
+    } else if (!e->whole && !add_range(e, (uint32_t)off, (uint32_t)(off + len))) {
+        /* Demasiados trozos: lo anterior se escribe ya.  El rango nuevo
+         * no toca ninguno, así que la imagen de esos sigue intacta */
+        bool flushing = t_flushing;
+        t_flushing = true;
+        int rc = write_entry(e);
+        t_flushing = flushing;
+        e->done = false;
+        e->nr   = 0;
+        if (rc != BWFS_OK)
+            return -1;
+        add_range(e, (uint32_t)off, (uint32_t)(off + len));
+    }
+    return 1;
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+void bwfs_txn_open(const bwfs_superblock_t *sb, const char *fs_dir)
+{
+    tx.sb     = sb;
+    tx.fs_dir = fs_dir;
+    tx.ready  = true;
+    util_set_txn_hooks(hook_read, hook_write, hook_held);
+}
+
+void bwfs_txn_close(void)
+{
+    util_set_txn_hooks(NULL, NULL, NULL);
+    tx.ready = false;
+}
+
+void bwfs_txn_begin(void)
+{
+    if (tx.ready)
+        t_depth++;
+}
+
+int bwfs_txn_end(void)
+{
+    if (t_depth == 0 || --t_depth > 0)
+        return BWFS_OK;
+
+    /* Abierta mientras se escribe: las escrituras de la propia confirmación
+     * tienen que ver lo retenido */
+    t_depth = 1;
+    int rc = flush();
+    t_depth = 0;
+    free(t_set);
+    t_set = NULL;
+    t_cap = 0;
+    if (t_alloc) {
+        t_alloc = false;
+        pthread_mutex_unlock(&alloc_lock);
+    }
+    return rc;
+}
+
+void bwfs_txn_lock_alloc(void)
+{
+    if (t_depth == 0 || t_alloc)
+        return;
+    pthread_mutex_lock(&alloc_lock);
+    t_alloc = true;
+}
@@ -7,12 +7,42 @@
  *
  * Funciones implementadas:
  *   - getattr, access, opendir, readdir, mkdir, rmdir
- *   - create, open, read, write, flush, fsync, lseek, unlink, rename
+ *   - create, open, read, write, flush, release, fsync, unlink, rename
+ *   - lseek (SEEK_SET, SEEK_END, SEEK_DATA y SEEK_HOLE)
+ *   - fallocate (modo 0 y FALLOC_FL_KEEP_SIZE, solo metadatos)
+ *   - utimens (atime/mtime explícitos; ctime siempre al instante actual)
  *   - statfs  (información de espacio libre)
+ *   - instantáneas bajo `/.snapshots`: `mkdir /.snapshots/<nombre>` crea
+ *     una, `rmdir` la borra; su contenido es de solo lectura
+ *
+ * Con diario (\ref journal.h), cada operación que cambia metadatos es un
+ * manejador: un corte no la deja a medias (un error sí: no hay vuelta
+ * atrás, lo escrito hasta el fallo se confirma).  Además abre una transacción
+ * (\ref txn.h) que escribe cada bloque de metadatos una vez al terminar.
+ * Los datos de archivo van directos a su bloque; fdatasync sincroniza los
+ * del archivo y fsync, además, su inodo (\ref dirty.h).
+ *
+ * unlink y rmdir solo quitan la entrada y dejan el inodo en la lista de
+ * huérfanos (\ref orphan.h); sus bloques los libera por tandas un hilo de
+ * mantenimiento, que también compacta fragmentos y limpia segmentos y
+ * excluye a las operaciones mientras da cada paso.  Al montar se terminan
+ * los huérfanos que quedaron pendientes.
+ *
+ * Concurrencia: cada operación toma, al resolver la ruta, los cerrojos de
+ * los inodos que recorre (\ref ilock.h), de lectura salvo el que va a
+ * cambiar.  Las lecturas de archivos distintos solo comparten cerrojos de
+ * lectura y van en paralelo; lo común a todos (bitmaps, fragmentos,
+ * instantáneas, superbloque) queda tras el cerrojo del asignador
+ * (\ref bwfs_txn_lock_alloc).
  *
  * Limitaciones deliberadas (MVP):
- *   • Máx. 10 bloques directos por archivo (≈ 1.25 MiB).
- *   • Cada directorio cabe en 1 bloque; no hay sub-bloques adicionales.
+ *   • Archivos mapeados por extents, con huecos: crecer o escribir lejos
+ *     de EOF solo asigna los bloques escritos; el resto se lee como ceros.
+ *   • Con la política log (`-a log` / `-o alloc=log`) las sobrescrituras
+ *     van fuera de sitio a la cabeza del log; el limpiador de segmentos
+ *     corre tras cerrar archivos (\ref segment.h).
+ *   • La cola de cada archivo se empaqueta en un bloque de fragmentos al
+ *     cerrarlo (release) y vuelve a un bloque propio al escribir en ella.
  *   • rename() solo dentro del mismo directorio.
  */
 
@@ -22,6 +52,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define FUSE_USE_VERSION 32
 #include <fuse3/fuse.h>
@@ -29,11 +60,22 @@
 #include "bwfs_common.h"
 #include "bitmap.h"
 #include "inode.h"
+#include "extent.h"
+#include "frag.h"
 #include "dir.h"
+#include "dirty.h"
+#include "ilock.h"
+#include "allocation.h"
+#include "segment.h"
+#include "journal.h"
+#include "orphan.h"
+#include "snapshot.h"
+#include "txn.h"
 #include "util.h"
 
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>      /* FALLOC_FL_KEEP_SIZE */
 #include <limits.h>     /* PATH_MAX */
 #include <sys/stat.h>   /* S_IFREG, S_IFDIR */
 
@@ -47,6 +89,7 @@
 #endif
 
 extern const char *fs_dir;
+extern int         alloc_policy_override;   /* -o alloc=…, o -1 */
 
 /* ------------------------------------------------------------------------- */
 /* Estado global                                                             */
@@ -54,13 +97,102 @@ extern const char *fs_dir;
 static bwfs_superblock_t g_sb;
 static bwfs_bitmap_t     g_bm;
 
+/* Las operaciones lo toman para leer; el hilo de mantenimiento y las
+ * instantáneas, para escribir: lo que hacen no se mezcla con nada */
+static pthread_rwlock_t  g_maint_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static void maint_kick(void);
+
 /* ------------------------------------------------------------------------- */
 /* Resolución de rutas                                                       */
 /* ------------------------------------------------------------------------- */
-static int bwfs_resolve(const char *path, bwfs_inode_t *out)
+
+/** Directorio virtual con las instantáneas (oculta una entrada real así). */
+#define SNAP_DIR     "/.snapshots"
+#define SNAP_DIR_LEN (sizeof SNAP_DIR - 1)
+
+/** Destino de una ruta según \ref snap_route. */
+typedef enum {
+    ROUTE_LIVE,         /**< disco vivo                          */
+    ROUTE_SNAPDIR,      /**< el propio /.snapshots               */
+    ROUTE_SNAP,         /**< dentro de una instantánea existente */
+    ROUTE_NOSNAP        /**< /.snapshots/<nombre inexistente>…   */
+} route_t;
+
+/**
+ * \brief Clasifica `path` y fija la vista de lectura del hilo.
+ *
+ * Con ROUTE_SNAP, `*rest` apunta a la ruta dentro de la instantánea ("/"
+ * para su raíz) y la vista queda en ella; en cualquier otro caso, en el
+ * disco vivo.
+ */
+static route_t snap_route(const char *path, const char **rest)
+{
+    bwfs_snap_view(-1);
+    *rest = path;
+    if (strncmp(path, SNAP_DIR, SNAP_DIR_LEN) != 0) return ROUTE_LIVE;
+
+    const char *p = path + SNAP_DIR_LEN;
+    if (*p == '\0') return ROUTE_SNAPDIR;
+    if (*p != '/')   return ROUTE_LIVE;       /* p. ej. "/.snapshotsX" */
+
+    char name[BWFS_SNAP_NAME_MAX + 1];
+    const char *end = strchr(p + 1, '/');
+    size_t len = end ? (size_t)(end - (p + 1)) : strlen(p + 1);
+    if (len == 0) return ROUTE_SNAPDIR;
+    if (len > BWFS_SNAP_NAME_MAX) return ROUTE_NOSNAP;
+    memcpy(name, p + 1, len);
+    name[len] = '\0';
+
+    int idx = bwfs_snap_find(name);
+    if (idx < 0) return ROUTE_NOSNAP;
+    *rest = end ? end : "/";
+    bwfs_snap_view(idx);
+    return ROUTE_SNAP;
+}
+
+/** \brief true si `path` cae bajo /.snapshots (solo lectura). */
+static bool snap_readonly(const char *path)
 {
-    if (strcmp(path, "/") == 0)
-        return bwfs_read_inode(g_sb.root_inode, out, fs_dir);
+    const char *rest;
+    return snap_route(path, &rest) != ROUTE_LIVE;
+}
+
+/** \brief errno de un fallo de \ref bwfs_ilock. */
+static int ilock_errno(int rc)
+{
+    return rc == BWFS_ERR_NOMEM ? -ENOMEM : -EDEADLK;
+}
+
+/** \brief errno de un fallo de \ref bwfs_dir_add con el nombre libre: un
+ *         directorio que no puede crecer es falta de espacio. */
+static int dir_add_errno(int rc)
+{
+    if (rc == BWFS_ERR_FULL)  return -ENOSPC;
+    if (rc == BWFS_ERR_NOMEM) return -ENOMEM;
+    return -EIO;
+}
+
+/**
+ * \brief Inodo de `path`, tomando por el camino los cerrojos de inodo
+ *        (\ref ilock.h): de lectura los directorios que atraviesa y, el
+ *        último, de escritura si `write`.  Se sueltan al final de la
+ *        operación, en su envoltorio.
+ * @return 0 o -errno (-ENOENT, -ENOMEM, -EIO...), para devolverlo tal cual
+ */
+static int bwfs_resolve(const char *path, bwfs_inode_t *out, bool write)
+{
+    route_t route = snap_route(path, &path);
+    if (route == ROUTE_SNAPDIR || route == ROUTE_NOSNAP)
+        return -ENOENT;
+
+    bool root_only = strcmp(path, "/") == 0;
+    int  rc = bwfs_ilock(g_sb.root_inode, write && root_only);
+    if (rc != BWFS_OK)
+        return ilock_errno(rc);
+    if (root_only)
+        return bwfs_read_inode(g_sb.root_inode, out, fs_dir) == BWFS_OK
+               ? 0 : -EIO;
 
     char buf[PATH_MAX];
     strncpy(buf, path, sizeof buf - 1);
@@ -80,13 +212,16 @@ static int bwfs_resolve(const char *path, bwfs_inode_t *out)
         if (ino == UINT32_MAX)
             return -ENOENT;
 
+        /* El inodo se lee ya con su cerrojo */
+        tok = strtok_r(NULL, "/", &save);
+        rc = bwfs_ilock(ino, write && !tok);
+        if (rc != BWFS_OK)
+            return ilock_errno(rc);
         if (bwfs_read_inode(ino, &cur, fs_dir) != BWFS_OK)
             return -ENOENT;
-
-        tok = strtok_r(NULL, "/", &save);
     }
     *out = cur;
-    return BWFS_OK;
+    return 0;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -116,8 +251,60 @@ static int split_path(const char *path,
 static int op_access(const char *path, int mask)
 {
     (void)mask;                 /* permisos no implementados */
+    const char *rest;
+    if (snap_route(path, &rest) == ROUTE_SNAPDIR) return 0;
     bwfs_inode_t tmp;
-    return (bwfs_resolve(path, &tmp) == BWFS_OK) ? 0 : -ENOENT;
+    return bwfs_resolve(path, &tmp, false);
+}
+
+/** \brief Nanosegundos desde la época → `struct timespec`. */
+static struct timespec ns_to_ts(uint64_t ns)
+{
+    struct timespec ts;
+    ts.tv_sec  = (time_t)(ns / 1000000000ULL);
+    ts.tv_nsec = (long)(ns % 1000000000ULL);
+    return ts;
+}
+
+static void fill_stat(const bwfs_inode_t *ino, struct stat *st)
+{
+    memset(st, 0, sizeof *st);
+    st->st_ino   = ino->ino;
+    st->st_mode  = (ino->flags & BWFS_INODE_DIR) ? (S_IFDIR | 0755)
+                                                : (S_IFREG | 0644);
+    st->st_nlink = 1;
+    st->st_size  = (off_t)bwfs_inode_size(ino);
+    st->st_blocks = ino->block_count;
+    st->st_atim  = ns_to_ts(ino->atime_ns);
+    st->st_mtim  = ns_to_ts(ino->mtime_ns);
+    st->st_ctim  = ns_to_ts(ino->ctime_ns);
+}
+
+/** \brief Como \ref fill_stat, con la copia de atributos de la entrada. */
+static void fill_stat_dirent(const bwfs_dirent_t *e, struct stat *st)
+{
+    memset(st, 0, sizeof *st);
+    st->st_ino    = e->ino;
+    st->st_mode   = e->type == BWFS_FT_DIR ? (S_IFDIR | 0755) : (S_IFREG | 0644);
+    st->st_nlink  = 1;
+    st->st_size   = (off_t)e->size;
+    st->st_blocks = e->blocks;
+    st->st_atim   = ns_to_ts(e->atime_ns);
+    st->st_mtim   = ns_to_ts(e->mtime_ns);
+    st->st_ctim   = ns_to_ts(e->ctime_ns);
+}
+
+/**
+ * \brief stat de /.snapshots o de la raíz de una instantánea sin leerla:
+ *        `rec` da las marcas de tiempo (NULL para el directorio virtual).
+ */
+static void fill_stat_snap(const bwfs_snap_rec_t *rec, struct stat *st)
+{
+    memset(st, 0, sizeof *st);
+    st->st_mode  = S_IFDIR | 0555;
+    st->st_nlink = 2;
+    if (rec)
+        st->st_atim = st->st_mtim = st->st_ctim = ns_to_ts(rec->ctime_ns);
 }
 
 static int op_getattr(const char *path, struct stat *st,
@@ -126,37 +313,102 @@ static int op_getattr(const char *path, struct stat *st,
     (void)fi;
     memset(st, 0, sizeof *st);
 
+    const char *rest;
+    if (snap_route(path, &rest) == ROUTE_SNAPDIR) {
+        fill_stat_snap(NULL, st);
+        return 0;
+    }
+
     bwfs_inode_t ino;
-    if (bwfs_resolve(path, &ino) != BWFS_OK)
-        return -ENOENT;
+    int res = bwfs_resolve(path, &ino, false);
+    if (res != 0)
+        return res;
 
-    st->st_mode  = (ino.flags & BWFS_INODE_DIR) ? (S_IFDIR | 0755)
-                                               : (S_IFREG | 0644);
-    st->st_nlink = 1;
-    st->st_size  = ino.size;
-    st->st_blocks = ino.block_count;
+    fill_stat(&ino, st);
     return 0;
 }
 
 static int op_opendir(const char *path, struct fuse_file_info *fi)
 {
+    (void)fi;
+    const char *rest;
+    if (snap_route(path, &rest) == ROUTE_SNAPDIR) return 0;
+
     bwfs_inode_t dir;
-    if (bwfs_resolve(path, &dir) != BWFS_OK)
-        return -ENOENT;
+    int res = bwfs_resolve(path, &dir, false);
+    if (res != 0)
+        return res;
     if (!(dir.flags & BWFS_INODE_DIR))
         return -ENOTDIR;
     return 0;
 }
 
+/** Estado compartido con el callback de \ref bwfs_dir_iterate en readdir. */
+typedef struct {
+    void                   *buf;
+    fuse_fill_dir_t         filler;
+    enum fuse_readdir_flags flags;
+    bwfs_inode_batch_t      batch;
+} readdir_ctx_t;
+
+static int readdir_entry(const bwfs_dirent_t *e, void *arg)
+{
+    readdir_ctx_t *rc = (readdir_ctx_t *)arg;
+
+    /* La entrada guarda tipo, tamaño y bloques: stat completo sin leer
+     * el inodo */
+    bwfs_inode_t child;
+    struct stat  st;
+    if (bwfs_dirent_has_attr(e)) {
+        fill_stat_dirent(e, &st);
+        rc->filler(rc->buf, e->name, &st, 0,
+                   (rc->flags & FUSE_READDIR_PLUS) ? FUSE_FILL_DIR_PLUS : 0);
+        return 0;
+    }
+
+    /* Registro de formato antiguo.  Con READDIRPLUS se leen los inodos:
+     * los de un mismo directorio suelen compartir bloque de tabla, así
+     * que el lote lee ese bloque una sola vez. */
+    if ((rc->flags & FUSE_READDIR_PLUS) &&
+        bwfs_inode_batch_read(&rc->batch, e->ino, &child, fs_dir) == BWFS_OK) {
+        fill_stat(&child, &st);
+        rc->filler(rc->buf, e->name, &st, 0, FUSE_FILL_DIR_PLUS);
+    } else if (e->type != BWFS_FT_UNKNOWN) {
+        /* El tipo del registro basta para d_type, sin leer el inodo */
+        memset(&st, 0, sizeof st);
+        st.st_ino  = e->ino;
+        st.st_mode = e->type == BWFS_FT_DIR ? S_IFDIR : S_IFREG;
+        rc->filler(rc->buf, e->name, &st, 0, 0);
+    } else {
+        rc->filler(rc->buf, e->name, NULL, 0, 0);
+    }
+    return 0;
+}
+
 static int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                       off_t off, struct fuse_file_info *fi,
                       enum fuse_readdir_flags flags)
 {
-    (void)off; (void)fi; (void)flags;
+    (void)off; (void)fi;
+
+    /* /.snapshots: una entrada por instantánea, de la tabla en memoria */
+    const char *rest;
+    if (snap_route(path, &rest) == ROUTE_SNAPDIR) {
+        filler(buf, ".",  NULL, 0, 0);
+        filler(buf, "..", NULL, 0, 0);
+        for (uint32_t i = 0; i < bwfs_snap_count(); i++) {
+            struct stat st;
+            fill_stat_snap(bwfs_snap_get(i), &st);
+            filler(buf, bwfs_snap_get(i)->name, &st, 0,
+                   (flags & FUSE_READDIR_PLUS) ? FUSE_FILL_DIR_PLUS : 0);
+        }
+        return 0;
+    }
 
     bwfs_inode_t dir;
-    if (bwfs_resolve(path, &dir) != BWFS_OK)
-        return -ENOENT;
+    int res = bwfs_resolve(path, &dir, false);
+    if (res != 0)
+        return res;
 
     if (!(dir.flags & BWFS_INODE_DIR))
         return -ENOTDIR;
@@ -164,116 +416,255 @@ static int op_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
     filler(buf, ".",  NULL, 0, 0);
     filler(buf, "..", NULL, 0, 0);
 
-    if (dir.block_count == 0) return 0;
-
-    size_t max = BWFS_BLOCK_SIZE_BYTES / sizeof(bwfs_dir_entry_t);
-    bwfs_dir_entry_t *entries = malloc(max * sizeof *entries);
-    if (!entries) return -ENOMEM;
-
-    if (util_read_block(fs_dir, dir.blocks[0],
-                        (uint8_t *)entries, BWFS_BLOCK_SIZE_BYTES) != 0) {
-        free(entries); return -EIO;
-    }
+    readdir_ctx_t rc = { .buf = buf, .filler = filler, .flags = flags };
+    bwfs_inode_batch_init(&rc.batch);
 
-    for (size_t i = 0; i < max; ++i)
-        if (entries[i].ino)
-            filler(buf, entries[i].name, NULL, 0, 0);
+    int err = bwfs_dir_iterate(&dir, fs_dir, readdir_entry, &rc);
+    bwfs_inode_batch_release(&rc.batch);
 
-    free(entries);
-    return 0;
+    if (err == BWFS_ERR_NOMEM) return -ENOMEM;
+    return err == BWFS_OK ? 0 : -EIO;
 }
 
+/**
+ * `mkdir /.snapshots/<nombre>` crea una instantánea; cualquier otro mkdir
+ * bajo /.snapshots es de solo lectura.
+ */
 static int op_mkdir(const char *path, mode_t mode)
 {
     (void)mode;
     char parent[PATH_MAX], name[BWFS_NAME_MAX + 1];
     if (split_path(path, parent, name) != 0) return -EINVAL;
 
+    if (strcmp(parent, SNAP_DIR) == 0) {
+        if (strlen(path) - SNAP_DIR_LEN - 1 > BWFS_SNAP_NAME_MAX)
+            return -ENAMETOOLONG;
+        if (bwfs_snap_find(name) >= 0) return -EEXIST;
+        bwfs_snap_view(-1);
+        int rc = bwfs_snap_create(name, fs_dir);
+        if (rc == BWFS_ERR_FULL)  return -ENOSPC;
+        if (rc == BWFS_ERR_NOMEM) return -ENOMEM;
+        return rc == BWFS_OK ? 0 : -EIO;
+    }
+    if (snap_readonly(path)) return -EROFS;
+
     bwfs_inode_t pdir;
-    if (bwfs_resolve(parent, &pdir) != BWFS_OK) return -ENOENT;
+    int res = bwfs_resolve(parent, &pdir, true);
+    if (res != 0) return res;
     if (!(pdir.flags & BWFS_INODE_DIR))        return -ENOTDIR;
 
-    uint32_t ino = bwfs_create_inode(&g_bm, true, fs_dir);
+    if (bwfs_dir_lookup(&pdir, fs_dir, name) != UINT32_MAX) return -EEXIST;
+
+    uint32_t ino = bwfs_create_inode(true, pdir.ino, fs_dir);
     if (ino == UINT32_MAX) return -ENOSPC;
 
-    if (bwfs_dir_add(&g_bm, &pdir, fs_dir, name, ino) != BWFS_OK)
-        return -EIO;
+    int rc = bwfs_dir_add(&g_bm, &pdir, fs_dir, name, ino, BWFS_FT_DIR);
+    if (rc != BWFS_OK) {
+        bwfs_inode_set_used(ino, false, fs_dir);
+        return dir_add_errno(rc);
+    }
     return 0;
 }
 
+/** `rmdir /.snapshots/<nombre>` borra la instantánea aunque no esté vacía. */
 static int op_rmdir(const char *path)
 {
     char parent[PATH_MAX], name[BWFS_NAME_MAX + 1];
     if (split_path(path, parent, name) != 0) return -EINVAL;
 
+    if (strcmp(parent, SNAP_DIR) == 0) {
+        int idx = bwfs_snap_find(name);
+        if (idx < 0) return -ENOENT;
+        bwfs_snap_view(-1);
+        return bwfs_snap_delete((uint32_t)idx, fs_dir) == BWFS_OK ? 0 : -EIO;
+    }
+    if (snap_readonly(path)) return -EROFS;
+
     bwfs_inode_t pdir;
-    if (bwfs_resolve(parent, &pdir) != BWFS_OK) return -ENOENT;
+    int res = bwfs_resolve(parent, &pdir, true);
+    if (res != 0) return res;
 
     uint32_t ino = bwfs_dir_lookup(&pdir, fs_dir, name);
     if (ino == UINT32_MAX) return -ENOENT;
+    res = bwfs_ilock(ino, true);
+    if (res != BWFS_OK) return ilock_errno(res);
 
     bwfs_inode_t dir;
     if (bwfs_read_inode(ino, &dir, fs_dir) != BWFS_OK) return -EIO;
     if (!(dir.flags & BWFS_INODE_DIR)) return -ENOTDIR;
     if (dir.size > 0)                  return -ENOTEMPTY;
 
-    bwfs_free_blocks(&g_bm, dir.blocks[0], dir.block_count);
-    bwfs_free_blocks(&g_bm, ino, 1);
-    bwfs_write_bitmap(&g_bm, fs_dir);
-
-    if (bwfs_dir_remove(&pdir, fs_dir, name) != BWFS_OK)
+    if (bwfs_dir_remove(&g_bm, &pdir, fs_dir, name) != BWFS_OK)
+        return -EIO;
+    if (bwfs_orphan_add(&g_sb, &dir, fs_dir) != BWFS_OK)
         return -EIO;
+    maint_kick();
     return 0;
 }
 
 static int op_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
     (void)mode; (void)fi;
+    if (snap_readonly(path)) return -EROFS;
     char parent[PATH_MAX], name[BWFS_NAME_MAX + 1];
     if (split_path(path, parent, name) != 0) return -EINVAL;
 
     bwfs_inode_t pdir;
-    if (bwfs_resolve(parent, &pdir) != BWFS_OK) return -ENOENT;
+    int res = bwfs_resolve(parent, &pdir, true);
+    if (res != 0) return res;
 
-    uint32_t ino = bwfs_create_inode(&g_bm, false, fs_dir);
+    if (bwfs_dir_lookup(&pdir, fs_dir, name) != UINT32_MAX) return -EEXIST;
+
+    uint32_t ino = bwfs_create_inode(false, pdir.ino, fs_dir);
     if (ino == UINT32_MAX) return -ENOSPC;
 
-    if (bwfs_dir_add(&g_bm, &pdir, fs_dir, name, ino) != BWFS_OK)
-        return -EIO;
+    int rc = bwfs_dir_add(&g_bm, &pdir, fs_dir, name, ino, BWFS_FT_REG);
+    if (rc != BWFS_OK) {
+        bwfs_inode_set_used(ino, false, fs_dir);
+        return dir_add_errno(rc);
+    }
     return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/* Validación de la caché de páginas del kernel                              */
+/* ------------------------------------------------------------------------- */
+
+/** Ranuras de la tabla de generaciones (direccionamiento directo por ino). */
+#define OPEN_GEN_SLOTS 1024U
+
+/**
+ * Generación de cada inodo la última vez que las páginas del kernel
+ * estaban al día: al abrirlo, o tras una escritura hecha por este montaje
+ * (que ya pasó por esa caché).  Una colisión solo cuesta una relectura.
+ */
+static struct { uint32_t ino; uint64_t gen; } g_open_gen[OPEN_GEN_SLOTS];
+static pthread_mutex_t g_open_gen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \brief ¿Siguen valiendo las páginas cacheadas de `ino`?  Anota además su
+ *        generación actual para la próxima apertura.
+ */
+static bool open_gen_check(const bwfs_inode_t *ino)
+{
+    size_t i = ino->ino % OPEN_GEN_SLOTS;
+    pthread_mutex_lock(&g_open_gen_lock);
+    bool same = ino->generation != 0 &&
+                g_open_gen[i].ino == ino->ino &&
+                g_open_gen[i].gen == ino->generation;
+    g_open_gen[i].ino = ino->ino;
+    g_open_gen[i].gen = ino->generation;
+    pthread_mutex_unlock(&g_open_gen_lock);
+    return same;
+}
+
+/**
+ * \brief Un cambio hecho por este montaje lleva `ino` de la generación
+ *        `old_gen` a la actual; si la caché estaba al día, lo sigue estando.
+ */
+static void open_gen_follow(const bwfs_inode_t *ino, uint64_t old_gen)
+{
+    size_t i = ino->ino % OPEN_GEN_SLOTS;
+    pthread_mutex_lock(&g_open_gen_lock);
+    if (g_open_gen[i].ino == ino->ino && g_open_gen[i].gen == old_gen)
+        g_open_gen[i].gen = ino->generation;
+    pthread_mutex_unlock(&g_open_gen_lock);
+}
+
+/**
+ * Si el contenido no cambió desde la última vez que el kernel lo tuvo en
+ * caché (misma generación), se le pide que conserve sus páginas.
+ */
 static int op_open(const char *path, struct fuse_file_info *fi)
 {
-    bwfs_inode_t tmp;
-    return (bwfs_resolve(path, &tmp) == BWFS_OK) ? 0 : -ENOENT;
+    bwfs_inode_t ino;
+    int res = bwfs_resolve(path, &ino, false);
+    if (res != 0) return res;
+    if (bwfs_snap_viewing() && (fi->flags & O_ACCMODE) != O_RDONLY)
+        return -EROFS;
+    fi->keep_cache = !bwfs_snap_viewing() && open_gen_check(&ino);
+    return 0;
 }
 
+/**
+ * El atime no se escribe aquí: `*atime` pide a \ref rop_read que lo haga
+ * después, ya sin cerrojos, en un manejador propio.
+ */
 static int op_read(const char *path, char *buf, size_t size, off_t off,
-                   struct fuse_file_info *fi)
+                   struct fuse_file_info *fi, bool *atime)
 {
     (void)fi;
     bwfs_inode_t ino;
-    if (bwfs_resolve(path, &ino) != BWFS_OK) return -ENOENT;
-    if (off >= (off_t)ino.size) return 0;
+    int res = bwfs_resolve(path, &ino, false);
+    if (res != 0) return res;
+    if (off < 0) return -EINVAL;
+
+    uint64_t fsize = bwfs_inode_size(&ino);
+    if ((uint64_t)off >= fsize) return 0;
 
-    size_t want = (off + size > ino.size) ? ino.size - off : size;
+    size_t want = ((uint64_t)off + size > fsize) ? (size_t)(fsize - off) : size;
     size_t done = 0, block_sz = BWFS_BLOCK_SIZE_BYTES;
 
+    // relatime: el atime solo se escribe si quedó atrás.  Las instantáneas
+    // no se tocan
+    *atime = !bwfs_snap_viewing() && bwfs_inode_atime_due(&ino, bwfs_now_ns());
+
+    // Archivo en línea: los datos ya vinieron con el inodo
+    if (ino.flags & BWFS_INODE_INLINE) {
+        memcpy(buf, bwfs_inode_inline_data(&ino) + off, want);
+        return (int)want;
+    }
+
     uint8_t *block_buf = malloc(BWFS_BLOCK_SIZE_BYTES);
+    if (!block_buf) return -ENOMEM;
+
+    bwfs_extent_t ext = { 0, 0, 0 };   // tramo actual (ya recortado)
     while (done < want) {
-        uint32_t blk_idx = (off + done) / block_sz;
-        uint32_t blk_off = (off + done) % block_sz;
-        uint32_t blk     = ino.blocks[blk_idx];
+        uint32_t blk_idx = (uint32_t)(((uint64_t)off + done) / block_sz);
+        uint32_t blk_off = (uint32_t)(((uint64_t)off + done) % block_sz);
         size_t chunk = MIN(block_sz - blk_off, want - done);
 
-        // Lee bloque completo a buffer temporal
-        if (util_read_block(fs_dir, blk, block_buf, block_sz) != 0) {
+        // Cola empaquetada: se lee de su bloque de fragmentos
+        if ((ino.flags & BWFS_INODE_FRAG) && blk_idx == ino.block_count) {
+            if (util_read_block_range(fs_dir, ino.frag_block,
+                                      bwfs_frag_offset(ino.frag_unit) + blk_off,
+                                      (uint8_t *)buf + done, chunk) != 0) {
+                free(block_buf); return -EIO;
+            }
+            done += chunk;
+            continue;
+        }
+
+        // Una consulta por extent, no por bloque
+        uint32_t elen = ext.len & BWFS_EXT_LEN_MASK;
+        if (blk_idx < ext.logical || blk_idx - ext.logical >= elen) {
+            if (bwfs_extent_lookup(&ino, fs_dir, blk_idx, &ext) != BWFS_OK) {
+                free(block_buf); return -EIO;
+            }
+        }
+
+        // Bloque sin asignar o preasignado sin escribir: ceros sin E/S
+        if (ext.physical == 0 || (ext.len & BWFS_EXT_UNWRITTEN)) {
+            memset(buf + done, 0, chunk);
+            done += chunk;
+            continue;
+        }
+        uint32_t blk = ext.physical + (blk_idx - ext.logical);
+
+        // Bloque completo: directo al buffer del llamador
+        if (chunk == block_sz) {
+            if (util_read_block(fs_dir, blk, (uint8_t *)buf + done, block_sz) != 0) {
+                free(block_buf); return -EIO;
+            }
+            done += chunk;
+            continue;
+        }
+
+        // Lee solo la porción necesaria
+        if (util_read_block_range(fs_dir, blk, blk_off, block_buf, chunk) != 0) {
             free(block_buf); return -EIO;
         }
-        
-        // Copia solo la porción necesaria
-        memcpy(buf + done, block_buf + blk_off, chunk);
+        memcpy(buf + done, block_buf, chunk);
         done += chunk;
     }
     free(block_buf);
@@ -285,68 +676,237 @@ static int op_write(const char *path, const char *buf, size_t size, off_t off,
                     struct fuse_file_info *fi)
 {
     (void)fi;
+    if (snap_readonly(path)) return -EROFS;
     bwfs_inode_t ino;
-    if (bwfs_resolve(path, &ino) != BWFS_OK) return -ENOENT;
+    int res = bwfs_resolve(path, &ino, true);
+    if (res != 0) return res;
     if (ino.flags & BWFS_INODE_DIR) return -EISDIR;  // No escribir en directorios
+    if (off < 0) return -EINVAL;
+    if (size == 0) return 0;
+
+    uint64_t end = (uint64_t)off + size;
+    if (end > BWFS_MAX_FILE_BYTES) return -EFBIG;    // Archivo demasiado grande
+
+    // Toda escritura cambia mtime/ctime y la generación; la caché del
+    // kernel ya tiene estos datos, así que sigue siendo válida
+    uint64_t old_gen = ino.generation;
+    bwfs_inode_touch(&ino, BWFS_TOUCH_MTIME | BWFS_TOUCH_CTIME);
+    open_gen_follow(&ino, old_gen);
+
+    // Cabe en línea: se escribe solo la ranura del inodo, sin bloques
+    if ((ino.flags & BWFS_INODE_INLINE) && end <= BWFS_INLINE_MAX) {
+        memcpy(bwfs_inode_inline_data(&ino) + off, buf, size);
+        if (end > ino.size) ino.size = (uint32_t)end;
+        bwfs_dirty_meta(ino.ino);       // los datos viven en el inodo
+        return bwfs_write_inode(&ino, fs_dir) == BWFS_OK ? (int)size : -EIO;
+    }
 
-    uint32_t end = off + size;
-    if (end > ino.size && bwfs_inode_resize(&g_bm, &ino, end, fs_dir) != BWFS_OK)
+    // Sobrescritura dentro de la cola empaquetada: en su sitio; cualquier
+    // otra escritura la devuelve antes a un bloque propio
+    if (ino.flags & BWFS_INODE_FRAG) {
+        uint64_t base = (uint64_t)ino.block_count * BWFS_BLOCK_SIZE_BYTES;
+        bwfs_dirty_meta(ino.ino);       // la cola va por el diario
+        if ((uint64_t)off >= base && end <= bwfs_inode_size(&ino))
+            return util_write_block_range(fs_dir, ino.frag_block,
+                                          bwfs_frag_offset(ino.frag_unit) +
+                                          (size_t)((uint64_t)off - base),
+                                          (const uint8_t *)buf, size) ||
+                   bwfs_write_inode(&ino, fs_dir) != BWFS_OK
+                   ? -EIO : (int)size;
+        int rc = bwfs_inode_unpack_tail(&g_bm, &ino, fs_dir);
+        if (rc != BWFS_OK) return rc == BWFS_ERR_IO ? -EIO : -ENOSPC;
+    }
+
+    uint32_t old_blocks = ino.block_count;
+    bool grown = end > bwfs_inode_size(&ino);   // resize persiste el inodo
+    if (grown && bwfs_inode_resize(&g_bm, &ino, end, fs_dir) != BWFS_OK)
         return -ENOSPC;
 
     size_t done = 0;
     const size_t block_sz = BWFS_BLOCK_SIZE_BYTES;
+
+    // Crecer deja un hueco: solo se asignan los bloques que toca esta
+    // escritura, «sin escribir» hasta que los datos estén en disco (el
+    // inodo se persiste una vez, al final)
+    uint32_t first = (uint32_t)((uint64_t)off / block_sz);
+    uint32_t last  = (uint32_t)((end - 1) / block_sz);
+    int rc = bwfs_inode_fill_holes(&g_bm, &ino, first, last - first + 1,
+                                   true, fs_dir);
+    if (rc != BWFS_OK) return rc == BWFS_ERR_IO ? -EIO : -ENOSPC;
+    bool fresh_written = false;
+
+    // Modo log: los bloques que ya existían se reescriben fuera de sitio,
+    // seguidos en la cabeza del log (los recién crecidos ya están allí).
+    // Sin sitio se escribe en el sitio de siempre
+    uint32_t log_first = first;
+    uint32_t log_count = 0, log_dst = UINT32_MAX;
+    if (g_bm.policy == BWFS_ALLOC_LOG && log_first < old_blocks) {
+        log_count = (last < old_blocks ? last + 1 : old_blocks) - log_first;
+        log_dst   = bwfs_alloc_blocks(&g_bm, log_count);
+        if (log_dst == UINT32_MAX) log_count = 0;
+    }
     
     // Buffer temporal reutilizable
+    int err = -EIO;
     uint8_t *block_buf = malloc(block_sz);
-    if (!block_buf) return -ENOMEM;
+    if (!block_buf) { err = -ENOMEM; goto fail; }
 
+    // Los datos, directos a su bloque; los metadatos, al diario
+    bwfs_journal_bypass(true);
+    bwfs_extent_t ext = { 0, 0, 0 };
     while (done < size) {
-        uint32_t blk_idx = (off + done) / block_sz;
-        uint32_t blk_off = (off + done) % block_sz;
-        
-        if (blk_idx >= BWFS_DIRECT_BLOCKS) {
-            free(block_buf);
-            return -EFBIG;  // Archivo demasiado grande
-        }
-        
-        uint32_t blk = ino.blocks[blk_idx];
+        uint32_t blk_idx = (uint32_t)(((uint64_t)off + done) / block_sz);
+        uint32_t blk_off = (uint32_t)(((uint64_t)off + done) % block_sz);
         size_t chunk = block_sz - blk_off;
         if (chunk > size - done) chunk = size - done;
 
-        // Solo leer si no escribimos el bloque completo
-        if (blk_off > 0 || chunk < block_sz) {
-            if (util_read_block(fs_dir, blk, block_buf, block_sz) != 0) {
-                free(block_buf);
-                return -EIO;
-            }
+        uint32_t elen = ext.len & BWFS_EXT_LEN_MASK;
+        if (blk_idx < ext.logical || blk_idx - ext.logical >= elen) {
+            if (bwfs_extent_lookup(&ino, fs_dir, blk_idx, &ext) != BWFS_OK ||
+                ext.physical == 0)
+                goto fail;
+        }
+        uint32_t blk = ext.physical + (blk_idx - ext.logical);
+        uint32_t dst = blk_idx - log_first < log_count
+                       ? log_dst + (blk_idx - log_first) : blk;
+
+        // Solo leer si no escribimos el bloque completo; de un bloque
+        // sin escribir se ponen a cero, en memoria, solo los bytes que
+        // esta escritura no cubre
+        bool fresh = (ext.len & BWFS_EXT_UNWRITTEN) != 0;
+        if (fresh && (blk_off > 0 || chunk < block_sz)) {
+            memset(block_buf, 0, blk_off);
+            memset(block_buf + blk_off + chunk, 0, block_sz - blk_off - chunk);
+        } else if (blk_off > 0 || chunk < block_sz) {
+            if (util_read_block(fs_dir, blk, block_buf, block_sz) != 0)
+                goto fail;
         }
 
         // Copiar datos al buffer
         memcpy(block_buf + blk_off, buf + done, chunk);
 
         // Escribir bloque modificado
-        if (util_write_block(fs_dir, blk, block_buf, block_sz) != 0) {
-            free(block_buf);
-            return -EIO;
-        }
+        if (util_write_block(fs_dir, dst, block_buf, block_sz) != 0)
+            goto fail;
+        bwfs_dirty_add(ino.ino, dst);
 
+        fresh_written |= fresh;
         done += chunk;
     }
 
+    bwfs_journal_bypass(false);
     free(block_buf);
+
+    // Apuntar el archivo a las copias nuevas; libera las antiguas y
+    // persiste bitmap e inodo
+    if (log_count) {
+        if (bwfs_inode_remap(&g_bm, &ino, log_first, log_count, log_dst,
+                             false, fs_dir) != BWFS_OK) {
+            bwfs_free_blocks(&g_bm, log_dst, log_count);
+            return -EIO;
+        }
+    }
+
+    // fdatasync también necesita lo que cambió el tamaño o el mapa (o la
+    // copia de un bloque compartido con una instantánea)
+    if (grown || fresh_written || log_count || bwfs_snap_count())
+        bwfs_dirty_meta(ino.ino);
+
+    // Los bloques preasignados recién escritos dejan de leerse como ceros;
+    // si no hay nada más que persistir, quedan las marcas de tiempo
+    if (fresh_written) {
+        if (bwfs_inode_mark_written(&g_bm, &ino, first, last - first + 1,
+                                    fs_dir) != BWFS_OK)
+            return -EIO;
+    } else if (!grown && !log_count &&
+               bwfs_write_inode(&ino, fs_dir) != BWFS_OK) {
+        return -EIO;
+    }
     return (int)size;
+
+fail:
+    // Los bloques reservados para huecos siguen «sin escribir» (se leen
+    // como ceros): se guarda el inodo para no perderlos
+    bwfs_journal_bypass(false);
+    free(block_buf);
+    if (log_count) bwfs_free_blocks(&g_bm, log_dst, log_count);
+    bwfs_write_inode(&ino, fs_dir);
+    return err;
+}
+
+static int op_fallocate(const char *path, int mode, off_t off, off_t len,
+                        struct fuse_file_info *fi)
+{
+    (void)fi;
+    if (mode & ~FALLOC_FL_KEEP_SIZE) return -EOPNOTSUPP;  /* sin punch/zero */
+    if (off < 0 || len <= 0)         return -EINVAL;
+    if ((uint64_t)off + (uint64_t)len > BWFS_MAX_FILE_BYTES)
+        return -EFBIG;
+    if (snap_readonly(path))         return -EROFS;
+
+    bwfs_inode_t ino;
+    int res = bwfs_resolve(path, &ino, true);
+    if (res != 0) return res;
+    if (ino.flags & BWFS_INODE_DIR)          return -EISDIR;
+
+    // Solo cambia el contenido visible (y la generación) si crece el tamaño
+    bool grows = !(mode & FALLOC_FL_KEEP_SIZE) &&
+                 (uint64_t)off + (uint64_t)len > bwfs_inode_size(&ino);
+    uint64_t old_gen = ino.generation;
+    bwfs_inode_touch(&ino, grows ? BWFS_TOUCH_MTIME | BWFS_TOUCH_CTIME
+                                 : BWFS_TOUCH_CTIME);
+    open_gen_follow(&ino, old_gen);
+
+    int rc = bwfs_inode_fallocate(&g_bm, &ino, (uint64_t)off, (uint64_t)len,
+                                  (mode & FALLOC_FL_KEEP_SIZE) != 0, fs_dir);
+    bwfs_dirty_meta(ino.ino);
+    if (rc == BWFS_ERR_FULL) return -ENOSPC;
+    return rc == BWFS_OK ? 0 : -EIO;
 }
 
 static int op_flush(const char *path, struct fuse_file_info *fi)
 { (void)path; (void)fi; return 0; }
 
+/**
+ * Al cerrar se empaqueta la cola del archivo y se avisa al hilo de
+ * mantenimiento, que compacta fragmentos y, en modo log, limpia segmentos;
+ * los fallos no se propagan (el archivo sigue siendo válido tal cual).
+ */
+static int op_release(const char *path, struct fuse_file_info *fi)
+{
+    (void)fi;
+    if (snap_readonly(path)) return 0;  /* nada que empaquetar ni limpiar */
+    bwfs_inode_t ino;
+    if (bwfs_resolve(path, &ino, true) == BWFS_OK && !(ino.flags & BWFS_INODE_DIR))
+        bwfs_inode_pack_tail(&g_bm, &ino, fs_dir);
+    maint_kick();
+    return 0;
+}
+
+/**
+ * fdatasync lleva a disco los bloques de datos escritos del archivo (y
+ * sus metadatos si cambió el tamaño o el mapa); fsync, también el inodo.
+ * Las llamadas simultáneas comparten tanda (\ref dirty.h).  Solo se
+ * resuelve con cerrojos: la espera a la confirmación del diario va sin
+ * ninguno, o no acabarían los manejadores que la confirmación espera.
+ */
 static int op_fsync(const char *path, int datasync,
                     struct fuse_file_info *fi)
-{ (void)path; (void)datasync; (void)fi; return 0; }
+{
+    (void)fi;
+    bwfs_inode_t ino;
+    pthread_rwlock_rdlock(&g_maint_lock);
+    int rc = bwfs_resolve(path, &ino, false);
+    bwfs_ilock_release();
+    pthread_rwlock_unlock(&g_maint_lock);
+    if (rc != 0) return rc;
+    return bwfs_dirty_sync(ino.ino, datasync != 0, fs_dir) == BWFS_OK ? 0 : -EIO;
+}
 
 static int op_rename(const char *from, const char *to, unsigned int flags)
 {
     if (flags) return -EINVAL;  /* no se soporta RENAME_EXCHANGE */
+    if (snap_readonly(from) || snap_readonly(to)) return -EROFS;
 
     char p_from[PATH_MAX], n_from[BWFS_NAME_MAX+1];
     char p_to  [PATH_MAX], n_to  [BWFS_NAME_MAX+1];
@@ -354,40 +914,93 @@ static int op_rename(const char *from, const char *to, unsigned int flags)
     if (split_path(from, p_from, n_from) != 0 ||
         split_path(to,   p_to,   n_to)   != 0) return -EINVAL;
 
-    /* solo renames dentro del mismo directorio */
+    /* solo renames dentro del mismo directorio: sus cerrojos son el del
+     * directorio y, debajo, el del archivo */
     if (strcmp(p_from, p_to) != 0) return -EXDEV;
 
     bwfs_inode_t dir;
-    if (bwfs_resolve(p_from, &dir) != BWFS_OK) return -ENOENT;
+    int res = bwfs_resolve(p_from, &dir, true);
+    if (res != 0) return res;
 
     uint32_t child = bwfs_dir_lookup(&dir, fs_dir, n_from);
     if (child == UINT32_MAX) return -ENOENT;
+    if (strcmp(n_from, n_to) == 0) return 0;
+    if (bwfs_dir_lookup(&dir, fs_dir, n_to) != UINT32_MAX) return -EEXIST;
+    res = bwfs_ilock(child, true);
+    if (res != BWFS_OK) return ilock_errno(res);
+
+    bwfs_inode_t cnode;
+    if (bwfs_read_inode(child, &cnode, fs_dir) != BWFS_OK) return -EIO;
+
+    /* añadir la nueva entrada y después quitar la vieja: si no hay sitio
+     * para la nueva, no ha cambiado nada */
+    res = bwfs_dir_add(&g_bm, &dir, fs_dir, n_to, child, bwfs_dir_ftype(&cnode));
+    if (res != BWFS_OK) return dir_add_errno(res);
+    if (bwfs_dir_remove(&g_bm, &dir, fs_dir, n_from) != BWFS_OK) return -EIO;
+
+    /* el renombrado cambia el ctime del propio archivo */
+    if (bwfs_read_inode(child, &cnode, fs_dir) != BWFS_OK) return -EIO;
+    bwfs_inode_touch(&cnode, BWFS_TOUCH_CTIME);
+    return bwfs_write_inode(&cnode, fs_dir) == BWFS_OK ? 0 : -EIO;
+}
 
-    /* quitar vieja entrada, añadir nueva */
-    if (bwfs_dir_remove(&dir, fs_dir, n_from) != BWFS_OK) return -EIO;
-    if (bwfs_dir_add(NULL, &dir, fs_dir, n_to, child) != BWFS_OK) return -EIO;
-    return 0;
+/** \brief Nuevo valor de una marca de tiempo según `utimensat(2)`. */
+static uint64_t utime_value(const struct timespec *ts, uint64_t cur,
+                            uint64_t now)
+{
+    if (ts->tv_nsec == UTIME_OMIT) return cur;
+    if (ts->tv_nsec == UTIME_NOW)  return now;
+    if (ts->tv_sec < 0)            return 0;   /* antes de la época */
+    return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
 }
 
+/**
+ * Fijar atime/mtime no cambia el contenido, así que la generación (y con
+ * ella la caché del kernel) se conserva; ctime pasa siempre a «ahora».
+ */
+static int op_utimens(const char *path, const struct timespec tv[2],
+                      struct fuse_file_info *fi)
+{
+    (void)fi;
+    if (snap_readonly(path)) return -EROFS;
+    bwfs_inode_t ino;
+    int res = bwfs_resolve(path, &ino, true);
+    if (res != 0) return res;
+
+    uint64_t now = bwfs_now_ns();
+    if (tv) {
+        ino.atime_ns = utime_value(&tv[0], ino.atime_ns, now);
+        ino.mtime_ns = utime_value(&tv[1], ino.mtime_ns, now);
+    } else {
+        ino.atime_ns = ino.mtime_ns = now;
+    }
+    ino.ctime_ns = now;
+    return bwfs_write_inode(&ino, fs_dir) == BWFS_OK ? 0 : -EIO;
+}
+
+/** Los bloques se liberan después, en el recolector (\ref orphan.h). */
 static int op_unlink(const char *path)
 {
+    if (snap_readonly(path)) return -EROFS;
     char parent[PATH_MAX], name[BWFS_NAME_MAX + 1];
     if (split_path(path, parent, name) != 0) return -EINVAL;
 
     bwfs_inode_t pdir;
-    if (bwfs_resolve(parent, &pdir) != BWFS_OK) return -ENOENT;
+    int res = bwfs_resolve(parent, &pdir, true);
+    if (res != 0) return res;
 
     uint32_t ino = bwfs_dir_lookup(&pdir, fs_dir, name);
     if (ino == UINT32_MAX) return -ENOENT;
+    res = bwfs_ilock(ino, true);
+    if (res != BWFS_OK) return ilock_errno(res);
 
     bwfs_inode_t file;
     if (bwfs_read_inode(ino, &file, fs_dir) != BWFS_OK) return -EIO;
 
-    bwfs_free_blocks(&g_bm, ino, 1);
-    bwfs_free_blocks(&g_bm, file.blocks[0], file.block_count);
-    bwfs_write_bitmap(&g_bm, fs_dir);
-
-    if (bwfs_dir_remove(&pdir, fs_dir, name) != BWFS_OK) return -EIO;
+    if (bwfs_dir_remove(&g_bm, &pdir, fs_dir, name) != BWFS_OK) return -EIO;
+    if (bwfs_orphan_add(&g_sb, &file, fs_dir) != BWFS_OK) return -EIO;
+    bwfs_dirty_forget(ino);
+    maint_kick();
     return 0;
 }
 
@@ -396,8 +1009,9 @@ static off_t op_lseek(const char *path, off_t off, int whence,
 {
     (void)fi;
     bwfs_inode_t ino;
-    if (bwfs_resolve(path, &ino) != BWFS_OK)
-        return -ENOENT;
+    int res = bwfs_resolve(path, &ino, false);
+    if (res != 0)
+        return res;
 
     off_t new_off = off;
 
@@ -406,8 +1020,22 @@ static off_t op_lseek(const char *path, off_t off, int whence,
             /* new_off ya es el valor absoluto proporcionado */
             break;
         case SEEK_END:
-            new_off = ino.size + off;
+            new_off = (off_t)bwfs_inode_size(&ino) + off;
             break;
+#ifdef SEEK_DATA
+        case SEEK_DATA:       /* saltar huecos: lo que usan cp --sparse, tar -S */
+        case SEEK_HOLE: {
+            uint64_t pos;
+            if (off < 0 || (uint64_t)off >= bwfs_inode_size(&ino))
+                return -ENXIO;
+            int rc = bwfs_inode_seek(&ino, (uint64_t)off, whence == SEEK_DATA,
+                                     fs_dir, &pos);
+            if (rc != BWFS_OK)     return rc == BWFS_ERR_NOMEM ? -ENOMEM : -EIO;
+            if (pos == UINT64_MAX) return -ENXIO;
+            new_off = (off_t)pos;
+            break;
+        }
+#endif
         case SEEK_CUR:        /* no llevamos offset interno → no soportado */
         default:
             return -EINVAL;
@@ -423,19 +1051,88 @@ static int op_statfs(const char *path, struct statvfs *st)
     (void)path;
     memset(st, 0, sizeof *st);
 
-    uint32_t total = g_sb.total_blocks;
-    uint32_t used  = 0;
-    for (uint32_t i = 0; i < total; ++i)
-        used += bwfs_bm_test(&g_bm, i);
-
     st->f_bsize   = BWFS_BLOCK_SIZE_BYTES;
-    st->f_blocks  = total;
-    st->f_bfree   = total - used;
-    st->f_bavail  = total - used;
+    st->f_blocks  = g_sb.total_blocks;
+    st->f_bfree   = g_bm.free_blocks;      /* contador, sin recorrer el bitmap */
+    st->f_bavail  = g_bm.free_blocks;
+    st->f_files   = g_sb.inode_count - 1;        /* el inodo 0 no existe */
+    st->f_ffree   = bwfs_itable_free_count();
+    st->f_favail  = st->f_ffree;
     st->f_namemax = BWFS_NAME_MAX;
     return 0;
 }
 
+/* ------------------------------------------------------------------------- */
+/* Hilo de mantenimiento                                                     */
+/* ------------------------------------------------------------------------- */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_t       thread;
+    bool            kick;       /**< Hay trabajo nuevo        */
+    bool            stop;       /**< op_destroy: terminar     */
+    bool            running;    /**< El hilo llegó a arrancar */
+} g_maint = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static void maint_kick(void)
+{
+    pthread_mutex_lock(&g_maint.lock);
+    g_maint.kick = true;
+    pthread_cond_signal(&g_maint.wake);
+    pthread_mutex_unlock(&g_maint.lock);
+}
+
+/**
+ * \brief Un paso de mantenimiento, como un manejador más pero excluyendo a
+ *        las operaciones: libera huérfanos, compacta fragmentos y, en modo
+ *        log, limpia segmentos.  Los dos últimos mueven bloques de otros
+ *        archivos, así que no pueden ir junto a sus lecturas.
+ * @return Bloques liberados (0 = lista vacía) o BWFS_ERR_*
+ */
+static int maint_step(void)
+{
+    bwfs_journal_begin();
+    pthread_rwlock_wrlock(&g_maint_lock);
+    bwfs_txn_begin();
+    int n = bwfs_orphan_reap(&g_bm, &g_sb, fs_dir, BWFS_ORPHAN_REAP_BUDGET);
+    bwfs_frag_compact(&g_bm, fs_dir, BWFS_FRAG_COMPACT_BUDGET);
+    bwfs_seg_clean(&g_bm, &g_sb, fs_dir, BWFS_SEG_CLEAN_BUDGET);
+    if (bwfs_txn_end() != BWFS_OK && n >= 0)
+        n = BWFS_ERR_IO;
+    pthread_rwlock_unlock(&g_maint_lock);
+    bwfs_journal_end();
+    return n;
+}
+
+/** Da pasos mientras quede algo y no se desmonte; lo que falte, al montar. */
+static void *maint_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_maint.lock);
+    while (!g_maint.stop) {
+        if (!g_maint.kick) {
+            pthread_cond_wait(&g_maint.wake, &g_maint.lock);
+            continue;
+        }
+        g_maint.kick = false;
+        pthread_mutex_unlock(&g_maint.lock);
+
+        int  rc   = 0;
+        bool stop = false;
+        while (!stop && (rc = maint_step()) > 0) {
+            pthread_mutex_lock(&g_maint.lock);
+            stop = g_maint.stop;
+            pthread_mutex_unlock(&g_maint.lock);
+        }
+        if (!stop && rc < 0)
+            BWFS_LOG_ERROR("Mantenimiento: error %d", rc);
+
+        pthread_mutex_lock(&g_maint.lock);
+    }
+    pthread_mutex_unlock(&g_maint.lock);
+    return NULL;
+}
+
 /* ------------------------------------------------------------------------- */
 /* init / destroy                                                            */
 /* ------------------------------------------------------------------------- */
@@ -443,11 +1140,236 @@ static void *op_init(struct fuse_conn_info *c, struct fuse_config *cfg)
 {
     (void)c; (void)cfg;
     if (bwfs_read_superblock(&g_sb, fs_dir) != BWFS_OK) return NULL;
+    if (bwfs_features_check(&g_sb, true) != BWFS_OK) return NULL;
+    if (bwfs_journal_replay(&g_sb, fs_dir) != BWFS_OK) return NULL;
     g_bm.total_blocks = g_sb.total_blocks;
+    g_bm.bitmap_blk   = bwfs_sb_bitmap_blk(&g_sb);
+    g_bm.alt_blk      = g_sb.bitmap_alt_blk;
     if (bwfs_read_bitmap(&g_bm, fs_dir) != BWFS_OK) { free(g_bm.map); return NULL; }
+    if (bwfs_itable_open(&g_sb, fs_dir) != BWFS_OK) { free(g_bm.map); return NULL; }
+    if (bwfs_frag_open(&g_sb, fs_dir) != BWFS_OK) {
+        bwfs_itable_close(); free(g_bm.map); return NULL;
+    }
+    if (bwfs_snap_open(&g_sb, &g_bm, fs_dir) != BWFS_OK) {
+        bwfs_frag_close(); bwfs_itable_close(); free(g_bm.map); return NULL;
+    }
+
+    /* Desmontaje limpio: el contador guardado vale; si no, recontar */
+    if ((g_sb.state & BWFS_STATE_CLEAN) &&
+        (g_sb.feature_compat & BWFS_FEAT_COMPAT_COUNTERS) &&
+        g_sb.free_blocks <= g_sb.total_blocks) {
+        g_bm.free_blocks = g_sb.free_blocks;
+    } else {
+        g_bm.free_blocks = bwfs_bitmap_count_free(&g_bm);
+        BWFS_LOG_INFO("Desmontaje no limpio: %u bloques libres recontados",
+                      g_bm.free_blocks);
+    }
+
+    /* Sucio hasta op_destroy: un corte deja el disco marcado */
+    bwfs_features_upgrade(&g_sb);
+    g_sb.state &= ~(uint32_t)BWFS_STATE_CLEAN;
+    g_sb.mount_count++;
+    if (bwfs_write_superblock(&g_sb, fs_dir) != BWFS_OK) {
+        bwfs_snap_close(); bwfs_frag_close(); bwfs_itable_close();
+        free(g_bm.map); return NULL;
+    }
+
+    g_bm.policy = alloc_policy_override >= 0 ? (uint32_t)alloc_policy_override
+                                             : g_sb.alloc_policy;
+    g_bm.cursor = 0;
+    BWFS_LOG_INFO("Política de asignación: %s",
+                  bwfs_alloc_policy_name(g_bm.policy));
+
+    /* Desde aquí los metadatos van al diario */
+    if (bwfs_journal_open(&g_sb, fs_dir) != BWFS_OK) {
+        bwfs_snap_close(); bwfs_frag_close(); bwfs_itable_close();
+        free(g_bm.map); return NULL;
+    }
+    bwfs_txn_open(&g_sb, fs_dir);
+    if (bwfs_journal_ready()) {         /* liberar no adelanta al diario */
+        g_bm.free_tag = bwfs_journal_free_tag;
+        g_bm.settled  = bwfs_journal_settled;
+    }
+
+    /* Borrados que un desmontaje dejó a medias */
+    if (bwfs_orphan_pending(&g_sb)) {
+        int rc;
+        while ((rc = maint_step()) > 0)
+            ;
+        if (rc < 0)
+            BWFS_LOG_ERROR("No se pudieron liberar los huérfanos: error %d", rc);
+    }
+    g_maint.stop    = false;
+    int prc = pthread_create(&g_maint.thread, NULL, maint_main, NULL);
+    g_maint.running = prc == 0;
+    if (prc != 0)
+        BWFS_LOG_ERROR("Sin hilo de mantenimiento (error %d): los huérfanos "
+                       "se liberarán al montar", prc);
     return &g_sb;
 }
-static void op_destroy(void *ud) { (void)ud; free(g_bm.map); }
+static void op_destroy(void *ud)
+{
+    (void)ud;
+    if (g_maint.running) {
+        pthread_mutex_lock(&g_maint.lock);
+        g_maint.stop = true;
+        pthread_cond_signal(&g_maint.wake);
+        pthread_mutex_unlock(&g_maint.lock);
+        pthread_join(g_maint.thread, NULL);
+        g_maint.running = false;
+    }
+    if (bwfs_frag_ready()) {            /* op_init llegó hasta el final */
+        bwfs_txn_close();
+        bwfs_journal_close();           /* todo a su sitio antes de limpio */
+        bwfs_dirty_close();
+        g_sb.free_blocks = g_bm.free_blocks;
+        g_sb.free_inodes = bwfs_itable_free_count();
+        g_sb.state      |= BWFS_STATE_CLEAN;
+        bwfs_write_superblock(&g_sb, fs_dir);
+    }
+
+    bwfs_snap_close();
+    bwfs_frag_close();
+    bwfs_itable_close();
+    free(g_bm.map);
+    free(g_bm.pending);
+    free(g_bm.pend);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Envoltorios: diario, transacción y cerrojos                               */
+/* ------------------------------------------------------------------------- */
+/* Las operaciones que cambian metadatos, cada una en un manejador y con
+ * su transacción; si no se pudo escribir lo retenido, la operación falla.
+ * Los cerrojos de inodo se sueltan después de escribirlo */
+#define JOP_(lock, call) \
+    do { bwfs_journal_begin(); lock(&g_maint_lock); \
+         bwfs_txn_begin(); int rc_ = (call); \
+         if (bwfs_txn_end() != BWFS_OK && rc_ >= 0) rc_ = -EIO; \
+         bwfs_ilock_release(); pthread_rwlock_unlock(&g_maint_lock); \
+         bwfs_journal_end(); return rc_; } while (0)
+#define JOP(call) JOP_(pthread_rwlock_rdlock, call)
+/* Las que cambian el conjunto de instantáneas, a solas: esperan a las
+ * operaciones en curso y detienen las nuevas hasta terminar */
+#define XOP(call) JOP_(pthread_rwlock_wrlock, call)
+
+/* Las de solo lectura: sin diario ni transacción */
+#define ROP(type, call) \
+    do { pthread_rwlock_rdlock(&g_maint_lock); type rc_ = (call); \
+         bwfs_ilock_release(); pthread_rwlock_unlock(&g_maint_lock); \
+         return rc_; } while (0)
+
+/** \brief ¿Va `path` a /.snapshots/<nombre>? */
+static bool snap_path(const char *path)
+{
+    return strncmp(path, SNAP_DIR "/", SNAP_DIR_LEN + 1) == 0;
+}
+
+static int jop_mkdir1(const char *path, mode_t mode)
+{ JOP(op_mkdir(path, mode)); }
+static int jop_rmdir(const char *path)
+{
+    if (snap_path(path)) XOP(op_rmdir(path));
+    JOP(op_rmdir(path));
+}
+static int jop_create1(const char *path, mode_t mode, struct fuse_file_info *fi)
+{ JOP(op_create(path, mode, fi)); }
+static int jop_write1(const char *path, const char *buf, size_t size,
+                      off_t off, struct fuse_file_info *fi)
+{ JOP(op_write(path, buf, size, off, fi)); }
+static int jop_fallocate1(const char *path, int mode, off_t off, off_t len,
+                          struct fuse_file_info *fi)
+{ JOP(op_fallocate(path, mode, off, len, fi)); }
+static int jop_rename1(const char *from, const char *to, unsigned int flags)
+{ JOP(op_rename(from, to, flags)); }
+
+/* Lo liberado no se reutiliza hasta confirmarlo: sin espacio, se confirma
+ * y se reintenta una vez (escribir y reservar se pueden repetir; crear y
+ * renombrar, sin espacio, no dejan nada hecho) */
+static bool enospc_retry(int rc)
+{
+    return rc == -ENOSPC && bwfs_journal_ready() &&
+           bwfs_journal_commit() == BWFS_OK;
+}
+static int jop_mkdir(const char *path, mode_t mode)
+{
+    if (snap_path(path)) XOP(op_mkdir(path, mode));
+    int rc = jop_mkdir1(path, mode);
+    return enospc_retry(rc) ? jop_mkdir1(path, mode) : rc;
+}
+static int jop_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int rc = jop_create1(path, mode, fi);
+    return enospc_retry(rc) ? jop_create1(path, mode, fi) : rc;
+}
+static int jop_rename(const char *from, const char *to, unsigned int flags)
+{
+    int rc = jop_rename1(from, to, flags);
+    return enospc_retry(rc) ? jop_rename1(from, to, flags) : rc;
+}
+static int jop_write(const char *path, const char *buf, size_t size, off_t off,
+                     struct fuse_file_info *fi)
+{
+    int rc = jop_write1(path, buf, size, off, fi);
+    return enospc_retry(rc) ? jop_write1(path, buf, size, off, fi) : rc;
+}
+static int jop_fallocate(const char *path, int mode, off_t off, off_t len,
+                         struct fuse_file_info *fi)
+{
+    int rc = jop_fallocate1(path, mode, off, len, fi);
+    return enospc_retry(rc) ? jop_fallocate1(path, mode, off, len, fi) : rc;
+}
+static int jop_release(const char *path, struct fuse_file_info *fi)
+{ JOP(op_release(path, fi)); }
+static int jop_utimens(const char *path, const struct timespec tv[2],
+                       struct fuse_file_info *fi)
+{ JOP(op_utimens(path, tv, fi)); }
+static int jop_unlink(const char *path)
+{ JOP(op_unlink(path)); }
+
+/** \brief Escribe el atime que pidió \ref op_read si sigue atrasado. */
+static int op_atime(const char *path)
+{
+    bwfs_inode_t ino;
+    int res = bwfs_resolve(path, &ino, true);
+    if (res != 0) return res;
+    if (!bwfs_inode_atime_due(&ino, bwfs_now_ns())) return 0;
+    bwfs_inode_touch(&ino, BWFS_TOUCH_ATIME);
+    return bwfs_write_inode(&ino, fs_dir) == BWFS_OK ? 0 : -EIO;
+}
+static int jop_atime(const char *path)
+{ JOP(op_atime(path)); }
+
+static int rop_access(const char *path, int mask)
+{ ROP(int, op_access(path, mask)); }
+static int rop_getattr(const char *path, struct stat *st,
+                       struct fuse_file_info *fi)
+{ ROP(int, op_getattr(path, st, fi)); }
+static int rop_opendir(const char *path, struct fuse_file_info *fi)
+{ ROP(int, op_opendir(path, fi)); }
+static int rop_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                       off_t off, struct fuse_file_info *fi,
+                       enum fuse_readdir_flags flags)
+{ ROP(int, op_readdir(path, buf, filler, off, fi, flags)); }
+static int rop_open(const char *path, struct fuse_file_info *fi)
+{ ROP(int, op_open(path, fi)); }
+static off_t rop_lseek(const char *path, off_t off, int whence,
+                       struct fuse_file_info *fi)
+{ ROP(off_t, op_lseek(path, off, whence, fi)); }
+
+/** Un fallo al escribir el atime no impide la lectura. */
+static int rop_read(const char *path, char *buf, size_t size, off_t off,
+                    struct fuse_file_info *fi)
+{
+    bool atime = false;
+    pthread_rwlock_rdlock(&g_maint_lock);
+    int rc = op_read(path, buf, size, off, fi, &atime);
+    bwfs_ilock_release();
+    pthread_rwlock_unlock(&g_maint_lock);
+    if (atime)
+        jop_atime(path);
+    return rc;
+}
 
 /* ------------------------------------------------------------------------- */
 /* Tabla de operaciones                                                      */
@@ -455,20 +1377,23 @@ static void op_destroy(void *ud) { (void)ud; free(g_bm.map); }
 struct fuse_operations bwfs_ops = {
     .init      = op_init,
     .destroy   = op_destroy,
-    .access    = op_access,
-    .getattr   = op_getattr,
-    .opendir   = op_opendir,
-    .readdir   = op_readdir,
-    .mkdir     = op_mkdir,
-    .rmdir     = op_rmdir,
-    .create    = op_create,
-    .open      = op_open,
-    .read      = op_read,
-    .write     = op_write,
+    .access    = rop_access,
+    .getattr   = rop_getattr,
+    .opendir   = rop_opendir,
+    .readdir   = rop_readdir,
+    .mkdir     = jop_mkdir,
+    .rmdir     = jop_rmdir,
+    .create    = jop_create,
+    .open      = rop_open,
+    .read      = rop_read,
+    .write     = jop_write,
+    .fallocate = jop_fallocate,
     .flush     = op_flush,
+    .release   = jop_release,
     .fsync     = op_fsync,
-    .lseek     = op_lseek,
-    .unlink    = op_unlink,
-    .rename    = op_rename,
+    .lseek     = rop_lseek,
+    .unlink    = jop_unlink,
+    .rename    = jop_rename,
+    .utimens   = jop_utimens,
     .statfs    = op_statfs,
 };
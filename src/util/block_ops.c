@@ -0,0 +1,61 @@
+// -----------------------------------------------------------------------------
+// File: src/util/block_ops.c
+// -----------------------------------------------------------------------------
+/**
+ * \file block_ops.c
+ * \brief Operaciones sobre bloques enteros, especializadas para las
+ *        geometrías habituales.
+ *
+ * Cada operación es un cuerpo static inline que recibe la longitud; las
+ * funciones públicas eligen según bwfs_geom.bytes y lo llaman con un
+ * literal para los tamaños comunes, así esas llamadas se compilan con la
+ * longitud constante.  Cualquier otro tamaño usa la variante genérica.
+ */
+
+#include "util.h"
+#include "bwfs_common.h"
+
+#include <string.h>
+
+/* Tamaños de bloque con copia propia de cada operación */
+#define BYTES_1000x1000  125000U
+#define BYTES_512x512     32768U
+#define BYTES_256x256      8192U
+#define BYTES_256x128      4096U
+
+/**
+ * Evalúa `kernel(args..., len)` con `len` constante para los tamaños
+ * comunes.
+ */
+#define DISPATCH(kernel, ...)                                          \
+    switch (bwfs_geom.bytes) {                                         \
+    case BYTES_1000x1000: kernel(__VA_ARGS__, BYTES_1000x1000); break; \
+    case BYTES_512x512:   kernel(__VA_ARGS__, BYTES_512x512);   break; \
+    case BYTES_256x256:   kernel(__VA_ARGS__, BYTES_256x256);   break; \
+    case BYTES_256x128:   kernel(__VA_ARGS__, BYTES_256x128);   break; \
+    default:              kernel(__VA_ARGS__, bwfs_geom.bytes); break; \
+    }
+
+static inline void zero_k(void *blk, size_t len)
+{
+    memset(blk, 0, len);
+}
+
+static inline void copy_k(void *dst, const void *src, size_t len)
+{
+    memcpy(dst, src, len);
+}
+
+/* ------------------------------------------------------------------------- */
+/* API pública                                                               */
+/* ------------------------------------------------------------------------- */
+
+void util_block_zero(void *blk)
+{
+    DISPATCH(zero_k, blk)
+}
+
+void util_block_copy(void *dst, const void *src)
+{
+    DISPATCH(copy_k, dst, src)
+}
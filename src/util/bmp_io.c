@@ -9,14 +9,27 @@
  *   - Mantiene el concepto de "imágenes" (archivos .bmp)
  *   - Pero usa almacenamiento binario directo sin conversión
  *   - Simple, confiable y eficiente
- *   - Cada bloque = archivo block<N>.bmp de exactamente 125,000 bytes
+ *   - Cada bloque = archivo block<N>.bmp de BWFS_BLOCK_SIZE_BYTES bytes
+ *     (ancho*alto/8 según la geometría elegida en mkfs; 125,000 por defecto)
  *
  * MAPEO:
- *   - Cada bloque BWFS = 125,000 bytes directos
+ *   - Cada bloque BWFS = ancho*alto bits = BWFS_BLOCK_SIZE_BYTES bytes directos
  *   - Sin conversión bits ↔ pixels
  *   - Archivos .bmp contienen datos binarios raw
+ *   - Los metadatos pequeños (inodos, bitmap de inodos) se actualizan con
+ *     E/S por rangos (pread/pwrite) sin reescribir el bloque entero
+ *   - Las instantáneas se enganchan aquí (util_set_block_hooks): las
+ *     lecturas pueden desviarse a otro bloque y las escrituras pasan antes
+ *     por la copia de lo que una instantánea aún necesita
+ *   - El diario también (util_set_cache_hooks): guarda en memoria las
+ *     escrituras de metadatos hasta confirmarlas y sirve sus lecturas; él
+ *     escribe los bloques con las variantes *_direct, sin ganchos
+ *   - Por encima de todo, la transacción de la operación en curso
+ *     (util_set_txn_hooks) retiene las escrituras del hilo hasta cerrarla
  */
 
+#define _GNU_SOURCE   /* pread, pwrite, syncfs */
+
 #include "util.h"
 #include "bwfs_common.h"
 
@@ -27,6 +40,8 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>   /* ← define off_t */
+#include <fcntl.h>       /* open */
+#include <unistd.h>      /* pread, pwrite, close */
 
 #ifndef PATH_MAX
 #define PATH_MAX 4096
@@ -36,6 +51,31 @@
 /* Helpers internos                                                          */
 /* ------------------------------------------------------------------------- */
 
+static util_read_remap_fn   read_remap;
+static util_before_write_fn before_write;
+static util_read_hook_fn    cache_read;
+static util_write_hook_fn   cache_write;
+static util_read_hook_fn    txn_read;
+static util_write_hook_fn   txn_write;
+static util_held_fn         txn_held;
+
+static inline uint32_t read_target(uint32_t blk)
+{
+    return read_remap ? read_remap(blk) : blk;
+}
+
+static inline int write_prepare(const char *fs_dir, uint32_t blk)
+{
+    return before_write ? before_write(fs_dir, blk) : 0;
+}
+
+/** \brief 1 si la transacción del hilo sirvió la lectura, 0 si no, -1. */
+static inline int txn_fetch(uint32_t blk, uint32_t target, size_t offset,
+                            uint8_t *out, size_t len)
+{
+    return txn_read && target == blk ? txn_read(blk, offset, out, len) : 0;
+}
+
 /**
  * \brief Construye la ruta del archivo BMP para un bloque dado.
  */
@@ -60,6 +100,31 @@ static int verify_file_size(const char *path, size_t expected_size)
 /* API pública                                                               */
 /* ------------------------------------------------------------------------- */
 
+void util_set_block_hooks(util_read_remap_fn remap, util_before_write_fn hook)
+{
+    read_remap   = remap;
+    before_write = hook;
+}
+
+void util_set_cache_hooks(util_read_hook_fn read, util_write_hook_fn write)
+{
+    cache_read  = read;
+    cache_write = write;
+}
+
+void util_set_txn_hooks(util_read_hook_fn read, util_write_hook_fn write,
+                        util_held_fn held)
+{
+    txn_read  = read;
+    txn_write = write;
+    txn_held  = held;
+}
+
+bool util_block_held(uint32_t block_id)
+{
+    return txn_held && txn_held(block_id);
+}
+
 int util_create_empty_block(const char *fs_dir, uint32_t block_id)
 {
     char path[PATH_MAX];
@@ -107,6 +172,19 @@ int util_write_block(const char *fs_dir, uint32_t block_id,
         return -1;
     }
 
+    if (txn_write) {
+        int kept = txn_write(block_id, 0, data, len, 1);
+        if (kept != 0)
+            return kept > 0 ? 0 : -1;
+    }
+    if (write_prepare(fs_dir, block_id) != 0)
+        return -1;
+    if (cache_write) {
+        int kept = cache_write(block_id, 0, data, len, 1);
+        if (kept != 0)
+            return kept > 0 ? 0 : -1;
+    }
+
     char path[PATH_MAX];
     make_bmp_path(path, sizeof path, fs_dir, block_id);
 
@@ -164,8 +242,18 @@ int util_read_block(const char *fs_dir, uint32_t block_id,
         return -1;
     }
 
+    uint32_t target = read_target(block_id);
+    int held = txn_fetch(block_id, target, 0, out, len);
+    if (held != 0)
+        return held > 0 ? 0 : -1;
+    if (cache_read) {
+        int hit = cache_read(target, 0, out, len);
+        if (hit != 0)
+            return hit > 0 ? 0 : -1;
+    }
+
     char path[PATH_MAX];
-    make_bmp_path(path, sizeof path, fs_dir, block_id);
+    make_bmp_path(path, sizeof path, fs_dir, target);
 
     // Verificar que el archivo existe y tiene el tamaño correcto
     if (verify_file_size(path, BWFS_BLOCK_SIZE_BYTES) != 0) {
@@ -189,4 +277,142 @@ int util_read_block(const char *fs_dir, uint32_t block_id,
     }
 
     return 0;
-}
\ No newline at end of file
+}
+
+/** \brief Comprueba que `[offset, offset+len)` cae dentro del bloque. */
+static int check_range(size_t offset, size_t len)
+{
+    if (offset > BWFS_BLOCK_SIZE_BYTES || len > BWFS_BLOCK_SIZE_BYTES - offset) {
+        BWFS_LOG_ERROR("Range out of block: %zu+%zu > %u bytes",
+                       offset, len, BWFS_BLOCK_SIZE_BYTES);
+        return -1;
+    }
+    return 0;
+}
+
+int util_read_block_range(const char *fs_dir, uint32_t block_id,
+                          size_t offset, uint8_t *out, size_t len)
+{
+    if (check_range(offset, len) != 0)
+        return -1;
+
+    uint32_t target = read_target(block_id);
+    int held = txn_fetch(block_id, target, offset, out, len);
+    if (held != 0)
+        return held > 0 ? 0 : -1;
+    if (cache_read) {
+        int hit = cache_read(target, offset, out, len);
+        if (hit != 0)
+            return hit > 0 ? 0 : -1;
+    }
+    return util_read_block_direct(fs_dir, target, offset, out, len);
+}
+
+int util_write_block_range(const char *fs_dir, uint32_t block_id,
+                           size_t offset, const uint8_t *data, size_t len)
+{
+    if (check_range(offset, len) != 0)
+        return -1;
+
+    if (txn_write) {
+        int kept = txn_write(block_id, offset, data, len, 0);
+        if (kept != 0)
+            return kept > 0 ? 0 : -1;
+    }
+    if (write_prepare(fs_dir, block_id) != 0)
+        return -1;
+    if (cache_write) {
+        int kept = cache_write(block_id, offset, data, len, 0);
+        if (kept != 0)
+            return kept > 0 ? 0 : -1;
+    }
+    return util_write_block_direct(fs_dir, block_id, offset, data, len);
+}
+
+int util_read_block_direct(const char *fs_dir, uint32_t block_id,
+                           size_t offset, uint8_t *out, size_t len)
+{
+    if (check_range(offset, len) != 0)
+        return -1;
+
+    char path[PATH_MAX];
+    make_bmp_path(path, sizeof path, fs_dir, block_id);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        BWFS_LOG_ERROR("Cannot open %s for reading", path);
+        return -1;
+    }
+
+    ssize_t got = pread(fd, out, len, (off_t)offset);
+    close(fd);
+
+    if (got != (ssize_t)len) {
+        BWFS_LOG_ERROR("Failed to read %zu bytes at %zu from %s", len, offset, path);
+        return -1;
+    }
+    return 0;
+}
+
+int util_write_block_direct(const char *fs_dir, uint32_t block_id,
+                            size_t offset, const uint8_t *data, size_t len)
+{
+    if (check_range(offset, len) != 0)
+        return -1;
+
+    char path[PATH_MAX];
+    make_bmp_path(path, sizeof path, fs_dir, block_id);
+
+    /* Sin O_CREAT: el bloque debe existir (mkfs los crea todos) */
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        BWFS_LOG_ERROR("Cannot open %s for writing", path);
+        return -1;
+    }
+
+    ssize_t put = pwrite(fd, data, len, (off_t)offset);
+    close(fd);
+
+    if (put != (ssize_t)len) {
+        BWFS_LOG_ERROR("Failed to write %zu bytes at %zu to %s", len, offset, path);
+        return -1;
+    }
+    return 0;
+}
+
+int util_sync_block(const char *fs_dir, uint32_t block_id)
+{
+    char path[PATH_MAX];
+    make_bmp_path(path, sizeof path, fs_dir, block_id);
+
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        BWFS_LOG_ERROR("Cannot open %s for syncing", path);
+        return -1;
+    }
+    int rc = fdatasync(fd);
+    close(fd);
+
+    if (rc != 0) {
+        BWFS_LOG_ERROR("fdatasync failed on %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+int util_sync_fs(const char *fs_dir)
+{
+    int fd = open(fs_dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        BWFS_LOG_ERROR("Cannot open %s for syncing", fs_dir);
+        return -1;
+    }
+    int rc = syncfs(fd);
+    close(fd);
+
+    if (rc != 0) {
+        BWFS_LOG_ERROR("syncfs failed on %s", fs_dir);
+        return -1;
+    }
+    return 0;
+}
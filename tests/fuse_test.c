@@ -0,0 +1,136 @@
+// -----------------------------------------------------------------------------
+// File: tests/fuse_test.c
+// -----------------------------------------------------------------------------
+/**
+ * \file fuse_test.c
+ * \brief Arnés de las pruebas sobre `bwfs_ops` (ver fuse_test.h).
+ */
+
+#define _GNU_SOURCE     /* fork, _exit */
+#include "fuse_test.h"
+#include "inode.h"
+#include "frag.h"
+#include "dir.h"
+#include "journal.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/wait.h>
+
+/* Lo que mount_bwfs.c da a bwfs.c */
+const char *fs_dir;
+int         alloc_policy_override = -1;
+
+/** Para leer y comparar archivos enteros. */
+static struct fuse_file_info ft_fi;
+
+int ft_run(const char *dir, int alloc, void (*fn)(void), bool crash)
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+        return 1;
+    if (pid == 0) {
+        struct fuse_conn_info conn = { 0 };
+        struct fuse_config    cfg  = { 0 };
+        fs_dir = dir;
+        alloc_policy_override = alloc;
+        CHECK(bwfs_ops.init(&conn, &cfg) != NULL);
+        fn();
+        if (crash) {            /* corte: sin destroy */
+            fflush(NULL);
+            _exit(0);
+        }
+        bwfs_ops.destroy(NULL);
+        exit(0);
+    }
+    int st;
+    if (waitpid(pid, &st, 0) != pid)
+        return 1;
+    return WIFEXITED(st) && WEXITSTATUS(st) == 0 ? 0 : 1;
+}
+
+void ft_pattern(void *buf, size_t n, unsigned seed)
+{
+    uint8_t *p = (uint8_t *)buf;
+    for (size_t i = 0; i < n; ++i)
+        p[i] = (uint8_t)(i * 13U + seed * 31U + (i >> 11));
+}
+
+void ft_put(const char *path, const void *buf, size_t n)
+{
+    CHECK(bwfs_ops.create(path, 0644, &ft_fi) == 0);
+    if (n > 0)
+        CHECK(bwfs_ops.write(path, (const char *)buf, n, 0, &ft_fi) == (int)n);
+    CHECK(bwfs_ops.release(path, &ft_fi) == 0);
+}
+
+void ft_expect(const char *path, const void *buf, size_t n)
+{
+    struct stat st;
+    CHECK(bwfs_ops.getattr(path, &st, NULL) == 0);
+    CHECK(st.st_size == (off_t)n);
+
+    char *got = (char *)malloc(n + 1);
+    CHECK(got != NULL);
+    CHECK(bwfs_ops.read(path, got, n + 1, 0, &ft_fi) == (int)n);
+    CHECK(memcmp(got, buf, n) == 0);
+    free(got);
+}
+
+unsigned long ft_free_blocks(void)
+{
+    struct statvfs sv;
+    CHECK(bwfs_ops.statfs("/", &sv) == 0);
+    return (unsigned long)sv.f_bfree;
+}
+
+void ft_inode(const char *path, bwfs_inode_t *out)
+{
+    struct stat st;
+    CHECK(bwfs_ops.getattr(path, &st, NULL) == 0);
+    CHECK(bwfs_read_inode((uint32_t)st.st_ino, out, fs_dir) == BWFS_OK);
+}
+
+int ft_offline(const char *dir, int (*fn)(bwfs_superblock_t *sb, bwfs_bitmap_t *bm))
+{
+    bwfs_superblock_t sb;
+    bwfs_bitmap_t     bm = { 0 };
+    fs_dir = dir;
+    if (bwfs_read_superblock(&sb, dir) != BWFS_OK ||
+        bwfs_features_check(&sb, true) != BWFS_OK ||
+        bwfs_journal_replay(&sb, dir) != BWFS_OK)
+        return 1;
+    bm.total_blocks = sb.total_blocks;
+    bm.bitmap_blk   = bwfs_sb_bitmap_blk(&sb);
+    bm.alt_blk      = sb.bitmap_alt_blk;
+    bm.policy       = sb.alloc_policy;
+    if (bwfs_read_bitmap(&bm, dir) != BWFS_OK) return 1;
+    bm.free_blocks  = bwfs_bitmap_count_free(&bm);
+    if (bwfs_itable_open(&sb, dir) != BWFS_OK) { free(bm.map); return 1; }
+    if (bwfs_frag_open(&sb, dir) != BWFS_OK) {
+        bwfs_itable_close(); free(bm.map); return 1;
+    }
+
+    int rc = fn(&sb, &bm) == 0 ? 0 : 1;
+
+    sb.free_blocks = bm.free_blocks;
+    sb.free_inodes = bwfs_itable_free_count();
+    if (bwfs_write_superblock(&sb, dir) != BWFS_OK) rc = 1;
+    bwfs_frag_close();
+    bwfs_itable_close();
+    free(bm.map);
+    return rc;
+}
+
+bool ft_offline_lookup(const bwfs_superblock_t *sb, const char *name,
+                       bwfs_inode_t *out)
+{
+    bwfs_inode_t root;
+    if (bwfs_read_inode(sb->root_inode, &root, fs_dir) != BWFS_OK)
+        return false;
+    uint32_t n = bwfs_dir_lookup(&root, fs_dir, name);
+    return n != UINT32_MAX && bwfs_read_inode(n, out, fs_dir) == BWFS_OK;
+}
@@ -0,0 +1,83 @@
+// -----------------------------------------------------------------------------
+// File: tests/fuse_test.h
+// -----------------------------------------------------------------------------
+#ifndef BWFS_FUSE_TEST_H
+#define BWFS_FUSE_TEST_H
+/**
+ * \file fuse_test.h
+ * \brief Arnés de las pruebas que llaman a `bwfs_ops` sin montar con FUSE.
+ *
+ * Cada montaje va en un proceso hijo (\ref ft_run): el estado de bwfs.c y
+ * de los módulos del núcleo es global, y así un corte es simplemente que
+ * el hijo termine sin `destroy`.  Los mensajes de la prueba van a stderr;
+ * stdout queda para el registro de BWFS.  Quien lo incluya define antes
+ * `_GNU_SOURCE`, como bwfs.c.
+ */
+
+#include <time.h>       /* struct timespec, antes de FUSE */
+
+#define FUSE_USE_VERSION 32
+#include <fuse3/fuse.h>
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+
+#include <stdio.h>
+#include <stdlib.h>   /* exit */
+
+/** Tabla de operaciones de src/fuse/bwfs.c. */
+extern struct fuse_operations bwfs_ops;
+
+/** Directorio del disco montado (dentro de \ref ft_run). */
+extern const char *fs_dir;
+
+/** Termina el proceso con un mensaje si `cond` es falsa. */
+#define CHECK(cond) \
+    do { if (!(cond)) { \
+             fprintf(stderr, "FALLO %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+             exit(1); \
+         } } while (0)
+
+/**
+ * \brief Monta `dir` en un proceso hijo, ejecuta `fn` y desmonta.
+ *
+ * Con `crash` el hijo sale sin desmontar, como tras un corte: lo que no
+ * llegó a confirmarse se pierde.  `alloc` fuerza una política de
+ * asignación (-1 = la del superbloque).
+ *
+ * @return 0 si `fn` terminó sin fallos, 1 si no
+ */
+int ft_run(const char *dir, int alloc, void (*fn)(void), bool crash);
+
+/** \brief Rellena `buf` con un patrón que depende de `seed`. */
+void ft_pattern(void *buf, size_t n, unsigned seed);
+
+/** \brief Crea `path` con `n` bytes de `buf` y lo cierra. */
+void ft_put(const char *path, const void *buf, size_t n);
+
+/** \brief Comprueba que `path` mide `n` bytes y son los de `buf`. */
+void ft_expect(const char *path, const void *buf, size_t n);
+
+/** \brief Bloques libres según statfs. */
+unsigned long ft_free_blocks(void);
+
+/** \brief Inodo de `path` leído del disco montado. */
+void ft_inode(const char *path, bwfs_inode_t *out);
+
+/**
+ * \brief Abre `dir` sin montar, como fsck y migrate, y llama a `fn`.
+ *
+ * Reproduce el diario, carga el bitmap y abre la tabla de inodos y los
+ * fragmentos; al volver de `fn` escribe los contadores del superbloque y
+ * cierra.  `fs_dir` apunta a `dir` mientras tanto.  Va en el proceso de la
+ * prueba, entre dos \ref ft_run.
+ *
+ * @return 0 si todo fue bien y `fn` devolvió 0, 1 si no
+ */
+int ft_offline(const char *dir, int (*fn)(bwfs_superblock_t *sb, bwfs_bitmap_t *bm));
+
+/** \brief Inodo de la entrada `name` de la raíz, dentro de \ref ft_offline. */
+bool ft_offline_lookup(const bwfs_superblock_t *sb, const char *name,
+                       bwfs_inode_t *out);
+
+#endif /* BWFS_FUSE_TEST_H */
@@ -0,0 +1,259 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_ab_copies.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_ab_copies.c
+ * \brief Copias A/B del superbloque y del bitmap: con una dañada se lee la
+ *        otra, según secuencia y checksum.
+ *
+ * Se ejecuta por pasos, con fsck entre ellos (ver el objetivo ab-test del
+ * Makefile):
+ *  - `escribir`: crea unos archivos y desmonta.
+ *  - `viejas`: daña la copia más antigua de cada uno (un byte cambiado en
+ *    el superbloque, el bitmap truncado).  Se sigue leyendo la más nueva
+ *    y el disco monta y se lee igual; escribir rehace la copia dañada.
+ *  - `nuevas`: daña la más nueva (superbloque truncado, un byte del
+ *    bitmap cambiado).  Se lee la anterior, con su secuencia más baja, y
+ *    el disco monta; fsck repara lo que esa copia no tenga.
+ *  - `comprobar`: monta, lee y escribe tras la reparación.
+ *
+ * Los bloques se dañan en sus archivos, como lo haría un corte o el disco.
+ *
+ * Uso: test_ab_copies <directorio_FS> escribir|viejas|nuevas|comprobar
+ */
+
+#define _GNU_SOURCE
+#include "fuse_test.h"
+#include "bitmap.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>     /* PATH_MAX */
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BS      ((size_t)BWFS_BLOCK_SIZE_BYTES)
+#define A_SIZE  (10 * BS + 321)
+#define B_SIZE  (3 * BS)
+#define C_SIZE  (4 * BS + 50)
+
+/** Lo que dicen los bloques de cada copia, sin validarlas. */
+typedef struct {
+    uint32_t blk[2];
+    uint32_t seq[2];
+    bool     ok[2];             /**< Se pudo leer y tiene su magic */
+} copies_t;
+
+static void expect_pattern(const char *path, unsigned seed, size_t n)
+{
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    ft_pattern(buf, n, seed);
+    ft_expect(path, buf, n);
+    free(buf);
+}
+
+static void put_pattern(const char *path, unsigned seed, size_t n)
+{
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    ft_pattern(buf, n, seed);
+    ft_put(path, buf, n);
+    free(buf);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fases montadas                                                            */
+/* ------------------------------------------------------------------------- */
+
+static void phase_write(void)
+{
+    put_pattern("/a", 1, A_SIZE);
+    CHECK(bwfs_ops.mkdir("/d", 0755) == 0);
+    put_pattern("/d/b", 2, B_SIZE);
+}
+
+static void phase_read(void)
+{
+    expect_pattern("/a", 1, A_SIZE);
+    expect_pattern("/d/b", 2, B_SIZE);
+}
+
+/** Lee y escribe: las dos copias vuelven a escribirse al desmontar. */
+static void phase_rewrite(void)
+{
+    phase_read();
+    struct stat st;
+    if (bwfs_ops.getattr("/c", &st, NULL) == 0)
+        CHECK(bwfs_ops.unlink("/c") == 0);
+    put_pattern("/c", 3, C_SIZE);
+    expect_pattern("/c", 3, C_SIZE);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Copias en disco                                                           */
+/* ------------------------------------------------------------------------- */
+
+static void block_path(const char *dir, uint32_t blk, char *out, size_t sz)
+{
+    snprintf(out, sz, "%s/block%u.bmp", dir, blk);
+}
+
+static void sb_copies(const char *dir, copies_t *c)
+{
+    c->blk[0] = BWFS_SUPERBLOCK_BLK;
+    c->blk[1] = BWFS_SUPERBLOCK_ALT_BLK;
+    for (int i = 0; i < 2; ++i) {
+        bwfs_superblock_t sb;
+        c->ok[i]  = util_read_block_range(dir, c->blk[i], 0, (uint8_t *)&sb,
+                                          sizeof sb) == 0 && sb.magic == BWFS_MAGIC;
+        c->seq[i] = c->ok[i] ? sb.seq : 0;
+    }
+}
+
+static void bm_copies(const char *dir, const bwfs_superblock_t *sb, copies_t *c)
+{
+    c->blk[0] = bwfs_sb_bitmap_blk(sb);
+    c->blk[1] = sb->bitmap_alt_blk;
+    for (int i = 0; i < 2; ++i) {
+        bwfs_bitmap_tail_t t;
+        c->ok[i]  = util_read_block_range(dir, c->blk[i], BS - sizeof t,
+                                          (uint8_t *)&t, sizeof t) == 0 &&
+                    t.magic == BWFS_BITMAP_TAIL_MAGIC;
+        c->seq[i] = c->ok[i] ? t.seq : 0;
+    }
+}
+
+/** Índice de la copia más nueva; las dos deben poder leerse. */
+static int newest(const copies_t *c, const char *what)
+{
+    if (!c->ok[0] || !c->ok[1] || c->seq[0] == c->seq[1]) {
+        fprintf(stderr, "%s: se esperaban dos copias (secuencias %u y %u)\n",
+                what, c->seq[0], c->seq[1]);
+        exit(1);
+    }
+    return (int32_t)(c->seq[1] - c->seq[0]) > 0 ? 1 : 0;
+}
+
+static void flip_byte(const char *dir, uint32_t blk, off_t off)
+{
+    char path[PATH_MAX];
+    block_path(dir, blk, path, sizeof path);
+    int fd = open(path, O_RDWR);
+    CHECK(fd >= 0);
+    uint8_t b;
+    CHECK(pread(fd, &b, 1, off) == 1);
+    b ^= 0x5A;
+    CHECK(pwrite(fd, &b, 1, off) == 1);
+    close(fd);
+}
+
+/** Deja el bloque a medio escribir: menos bytes que un superbloque. */
+static void truncate_block(const char *dir, uint32_t blk)
+{
+    char path[PATH_MAX];
+    block_path(dir, blk, path, sizeof path);
+    CHECK(truncate(path, 64) == 0);
+}
+
+/** El bitmap que se carga es el de la copia `blk`. */
+static void expect_bitmap_from(const char *dir, const bwfs_superblock_t *sb,
+                               uint32_t blk)
+{
+    bwfs_bitmap_t bm = { 0 };
+    bm.total_blocks = sb->total_blocks;
+    bm.bitmap_blk   = bwfs_sb_bitmap_blk(sb);
+    bm.alt_blk      = sb->bitmap_alt_blk;
+    CHECK(bwfs_read_bitmap(&bm, dir) == BWFS_OK);
+
+    size_t bytes = (sb->total_blocks + 7U) / 8U;
+    uint8_t *raw = (uint8_t *)malloc(bytes);
+    CHECK(raw != NULL);
+    CHECK(util_read_block(dir, blk, raw, bytes) == 0);
+    if (memcmp(bm.map, raw, bytes) != 0) {
+        fprintf(stderr, "el bitmap cargado no es el del bloque %u\n", blk);
+        exit(1);
+    }
+    free(raw);
+    free(bm.map);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Pasos                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static int step_old(const char *dir)
+{
+    bwfs_superblock_t sb;
+    CHECK(bwfs_read_superblock(&sb, dir) == BWFS_OK);
+    copies_t s, b;
+    sb_copies(dir, &s);
+    bm_copies(dir, &sb, &b);
+    int sn = newest(&s, "superbloque"), bn = newest(&b, "bitmap");
+    CHECK(sb.seq == s.seq[sn]);
+
+    flip_byte(dir, s.blk[!sn], (off_t)offsetof(bwfs_superblock_t, free_blocks));
+    truncate_block(dir, b.blk[!bn]);
+
+    CHECK(bwfs_read_superblock(&sb, dir) == BWFS_OK);
+    CHECK(sb.seq == s.seq[sn]);
+    expect_bitmap_from(dir, &sb, b.blk[bn]);
+
+    int rc = ft_run(dir, -1, phase_rewrite, false);
+
+    /* Desmontar reescribió las copias dañadas */
+    sb_copies(dir, &s);
+    CHECK(bwfs_read_superblock(&sb, dir) == BWFS_OK);
+    bm_copies(dir, &sb, &b);
+    newest(&s, "superbloque");
+    newest(&b, "bitmap");
+    return rc;
+}
+
+static int step_new(const char *dir)
+{
+    bwfs_superblock_t sb;
+    CHECK(bwfs_read_superblock(&sb, dir) == BWFS_OK);
+    copies_t s, b;
+    sb_copies(dir, &s);
+    bm_copies(dir, &sb, &b);
+    int sn = newest(&s, "superbloque"), bn = newest(&b, "bitmap");
+
+    truncate_block(dir, s.blk[sn]);
+    flip_byte(dir, b.blk[bn], 0);
+
+    CHECK(bwfs_read_superblock(&sb, dir) == BWFS_OK);
+    if (sb.seq != s.seq[!sn]) {
+        fprintf(stderr, "superbloque: secuencia %u, se esperaba la anterior %u\n",
+                sb.seq, s.seq[!sn]);
+        return 1;
+    }
+    expect_bitmap_from(dir, &sb, b.blk[!bn]);
+
+    return ft_run(dir, -1, phase_read, false);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Uso: %s <directorio_FS> escribir|viejas|nuevas|comprobar\n",
+                argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1], *step = argv[2];
+
+    int rc;
+    if      (strcmp(step, "escribir")  == 0) rc = ft_run(dir, -1, phase_write, false);
+    else if (strcmp(step, "viejas")    == 0) rc = step_old(dir);
+    else if (strcmp(step, "nuevas")    == 0) rc = step_new(dir);
+    else if (strcmp(step, "comprobar") == 0) rc = ft_run(dir, -1, phase_rewrite, false);
+    else {
+        fprintf(stderr, "Paso desconocido: %s\n", step);
+        return 2;
+    }
+
+    fprintf(stderr, "%s: %s\n", step, rc == 0 ? "OK" : "FALLO");
+    return rc;
+}
@@ -0,0 +1,231 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_dir_split.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_dir_split.c
+ * \brief Regresión: dos nombres con el mismo hash no se separan al dividir
+ *        una hoja del árbol de un directorio.
+ *
+ * Busca una colisión real de \ref bwfs_dir_name_hash (hash H) y llena un
+ * directorio nuevo con la pareja y, alternando, nombres de hash menor y
+ * mayor que H, de modo que al dividirse la hoja la pareja quede en la
+ * mediana.  Se prueba con las dos paridades (empezando por uno mayor o por
+ * uno menor) porque el punto exacto de la división depende de la geometría.  Después
+ * todos los nombres deben encontrarse y ninguno puede añadirse dos veces.
+ *
+ * Uso: test_dir_split <directorio_FS>  (recién formateado, sin montar)
+ */
+
+#include "bwfs_common.h"
+#include "bitmap.h"
+#include "inode.h"
+#include "dir.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>   /* malloc, free, qsort */
+#include <string.h>
+
+/** Nombres que se prueban para encontrar una colisión (~5 esperadas). */
+#define PROBE_NAMES  200000U
+/** Letras de cada nombre de prueba. */
+#define NAME_LEN     12U
+/** Nombres de cada lado de H como mucho; de sobra para dividir la hoja. */
+#define SIDE_NAMES   2048U
+
+typedef struct {
+    uint32_t hash;
+    uint32_t seed;      /**< Estado del PRNG que genera el nombre */
+} probe_t;
+
+/** PRNG xorshift32: los nombres son los mismos en cada ejecución. */
+static uint32_t rng_next(uint32_t *s)
+{
+    uint32_t x = *s;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return *s = x;
+}
+
+/**
+ * \brief Nombre de #NAME_LEN letras a partir de `*seed`, que avanza.
+ *
+ * Letras al azar, no un contador: con nombres de la forma "c%08x" el
+ * xxHash32 apenas produce colisiones.
+ */
+static void random_name(char *out, uint32_t *seed)
+{
+    for (uint32_t i = 0; i < NAME_LEN; ++i)
+        out[i] = (char)('a' + rng_next(seed) % 26U);
+    out[NAME_LEN] = '\0';
+}
+
+static int cmp_probe(const void *a, const void *b)
+{
+    const probe_t *x = (const probe_t *)a, *y = (const probe_t *)b;
+    if (x->hash != y->hash)
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    return (x->seed > y->seed) - (x->seed < y->seed);
+}
+
+/**
+ * \brief Busca dos nombres con el mismo hash, lejos de los extremos para
+ *        que haya nombres a ambos lados.
+ */
+static int find_collision(char *a, char *b, uint32_t *hash)
+{
+    probe_t *p = (probe_t *)malloc(PROBE_NAMES * sizeof *p);
+    if (!p) return -1;
+
+    char     name[NAME_LEN + 1];
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < PROBE_NAMES; ++i) {
+        p[i].seed = seed;
+        random_name(name, &seed);
+        p[i].hash = bwfs_dir_name_hash(name);
+    }
+    qsort(p, PROBE_NAMES, sizeof *p, cmp_probe);
+
+    int rc = -1;
+    for (uint32_t i = 1; i < PROBE_NAMES && rc != 0; ++i) {
+        if (p[i].hash != p[i - 1].hash ||
+            p[i].hash < (1U << 28) || p[i].hash > (15U << 28))
+            continue;
+        uint32_t sa = p[i - 1].seed, sb = p[i].seed;
+        random_name(a, &sa);
+        random_name(b, &sb);
+        *hash = p[i].hash;
+        rc = 0;
+    }
+    free(p);
+    return rc;
+}
+
+/** \brief Siguiente nombre "l%08x" (hash menor que H) o "u%08x" (mayor). */
+static void next_side(char *out, bool below, uint32_t h, uint32_t *ctr)
+{
+    for (;;) {
+        snprintf(out, 16, "%c%08x", below ? 'l' : 'u', (*ctr)++);
+        uint32_t x = bwfs_dir_name_hash(out);
+        if (below ? x < h : x > h)
+            return;
+    }
+}
+
+static int add_child(bwfs_bitmap_t *bm, bwfs_inode_t *dir,
+                     const char *fs_dir, const char *name)
+{
+    uint32_t ino = bwfs_create_inode(false, dir->ino, fs_dir);
+    if (ino == UINT32_MAX) return BWFS_ERR_FULL;
+    int rc = bwfs_dir_add(bm, dir, fs_dir, name, ino, BWFS_FT_REG);
+    if (rc != BWFS_OK) bwfs_inode_set_used(ino, false, fs_dir);
+    return rc;
+}
+
+/**
+ * \brief Una pasada: crea `dname` en la raíz y lo llena hasta que su raíz
+ *        deja de ser una hoja (primera división) y un poco más.
+ * @return 0 si todo se encuentra, 1 si falla la comprobación, -1 error
+ */
+static int run(bwfs_bitmap_t *bm, const bwfs_superblock_t *sb,
+               const char *fs_dir, const char *dname, bool lead_low,
+               const char *a, const char *b, uint32_t h)
+{
+    bwfs_inode_t root, dir;
+    if (bwfs_read_inode(sb->root_inode, &root, fs_dir) != BWFS_OK) return -1;
+    uint32_t dino = bwfs_create_inode(true, root.ino, fs_dir);
+    if (dino == UINT32_MAX ||
+        bwfs_dir_add(bm, &root, fs_dir, dname, dino, BWFS_FT_DIR) != BWFS_OK ||
+        bwfs_read_inode(dino, &dir, fs_dir) != BWFS_OK)
+        return -1;
+
+    static char names[2 * SIDE_NAMES + 3][16];
+    uint32_t n = 0, lo_ctr = 0, hi_ctr = 0;
+
+    if (lead_low) next_side(names[n++], true,  h, &lo_ctr);
+    else          next_side(names[n++], false, h, &hi_ctr);
+    strcpy(names[n++], a);
+    strcpy(names[n++], b);
+    for (uint32_t i = 0; i < SIDE_NAMES; ++i) {
+        next_side(names[n++], true,  h, &lo_ctr);
+        next_side(names[n++], false, h, &hi_ctr);
+    }
+
+    /* Unos pocos más tras la primera división */
+    uint32_t blocks0 = 0, added = 0, extra = 0;
+    for (uint32_t i = 0; i < n && extra < 4; ++i, ++added) {
+        if (add_child(bm, &dir, fs_dir, names[i]) != BWFS_OK) {
+            fprintf(stderr, "%s: no se pudo añadir %s\n", dname, names[i]);
+            return -1;
+        }
+        if (bwfs_read_inode(dino, &dir, fs_dir) != BWFS_OK) return -1;
+        if (blocks0 == 0) blocks0 = dir.block_count;
+        if (dir.block_count > blocks0) extra++;
+    }
+    if (extra == 0) {
+        fprintf(stderr, "%s: la hoja no llegó a dividirse\n", dname);
+        return -1;
+    }
+
+    int bad = 0;
+    for (uint32_t i = 0; i < added; ++i) {
+        if (bwfs_dir_lookup(&dir, fs_dir, names[i]) == UINT32_MAX) {
+            printf("%s: %s (hash %08x) no se encuentra\n",
+                   dname, names[i], bwfs_dir_name_hash(names[i]));
+            bad = 1;
+        }
+    }
+    const char *pair[2] = { a, b };
+    for (int i = 0; i < 2; ++i) {
+        if (bwfs_dir_add(bm, &dir, fs_dir, pair[i], root.ino,
+                         BWFS_FT_REG) == BWFS_OK) {
+            printf("%s: %s se añadió dos veces\n", dname, pair[i]);
+            bad = 1;
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Uso: %s <directorio_FS>\n", argv[0]);
+        return 2;
+    }
+    const char *fs_dir = argv[1];
+
+    char a[16], b[16];
+    uint32_t h;
+    if (find_collision(a, b, &h) != 0) {
+        fprintf(stderr, "No se encontró ninguna colisión de hash\n");
+        return 2;
+    }
+    printf("Colisión: %s y %s (hash %08x)\n", a, b, h);
+
+    bwfs_superblock_t sb;
+    bwfs_bitmap_t     bm = { 0 };
+    if (bwfs_read_superblock(&sb, fs_dir) != BWFS_OK ||
+        bwfs_features_check(&sb, true) != BWFS_OK)
+        return 2;
+    bm.total_blocks = sb.total_blocks;
+    bm.bitmap_blk   = bwfs_sb_bitmap_blk(&sb);
+    bm.alt_blk      = sb.bitmap_alt_blk;
+    bm.policy       = sb.alloc_policy;
+    if (bwfs_read_bitmap(&bm, fs_dir) != BWFS_OK) return 2;
+    bm.free_blocks  = bwfs_bitmap_count_free(&bm);
+    if (bwfs_itable_open(&sb, fs_dir) != BWFS_OK) { free(bm.map); return 2; }
+
+    int rc = 0;
+    int r0 = run(&bm, &sb, fs_dir, "mayor", false, a, b, h);
+    int r1 = run(&bm, &sb, fs_dir, "menor", true,  a, b, h);
+    if (r0 < 0 || r1 < 0) rc = 2;
+    else if (r0 || r1)    rc = 1;
+
+    sb.free_blocks = bm.free_blocks;
+    sb.free_inodes = bwfs_itable_free_count();
+    bwfs_write_superblock(&sb, fs_dir);
+    bwfs_itable_close();
+    free(bm.map);
+
+    printf("%s\n", rc == 0 ? "OK" : "FALLO");
+    return rc;
+}
@@ -0,0 +1,222 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_journal.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_journal.c
+ * \brief Diario: reproducción tras un corte, bloques liberados que esperan
+ *        a la confirmación y reintento sin espacio.
+ *
+ *  - Corte tras confirmar (fsync) y antes del checkpoint: en su sitio los
+ *    metadatos aún no están, pero el superbloque lleva RECOVER; al montar,
+ *    \ref bwfs_journal_replay los repone.  Lo hecho después de confirmar
+ *    desaparece o queda entero.
+ *  - Un archivo borrado sin confirmar libera sus bloques, pero con la
+ *    política first-fit el siguiente archivo no debe recibirlos: tras el
+ *    corte el borrado no existió y el archivo tiene que leerse igual.
+ *  - Con el disco lleno, lo recién liberado solo se puede usar
+ *    confirmando: la escritura que se queda sin espacio confirma y
+ *    reintenta, y debe salir bien.
+ *
+ * Uso: test_journal <directorio_FS>  (recién formateado, con diario)
+ */
+
+#define _GNU_SOURCE
+#include "fuse_test.h"
+#include "allocation.h"
+#include "inode.h"
+#include "dir.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>       /* nanosleep */
+#include <sys/stat.h>
+
+#define BS          ((size_t)BWFS_BLOCK_SIZE_BYTES)
+#define FILE_SIZE   (36 * BS + 1234)
+#define REUSE_SIZE  (20 * BS)
+#define VICTIM_SIZE (100 * BS)      /**< Por debajo de lo que pide confirmar */
+#define CHUNK       (16 * BS)
+
+static char *pattern(unsigned seed, size_t n)
+{
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    ft_pattern(buf, n, seed);
+    return buf;
+}
+
+static void put(const char *path, unsigned seed, size_t n)
+{
+    char *buf = pattern(seed, n);
+    ft_put(path, buf, n);
+    free(buf);
+}
+
+static void expect(const char *path, unsigned seed, size_t n)
+{
+    char *buf = pattern(seed, n);
+    ft_expect(path, buf, n);
+    free(buf);
+}
+
+/** `path` no existe, o existe entero con el patrón `seed`. */
+static void expect_all_or_nothing(const char *path, unsigned seed, size_t n)
+{
+    struct stat st;
+    int rc = bwfs_ops.getattr(path, &st, NULL);
+    CHECK(rc == 0 || rc == -ENOENT);
+    if (rc == 0)
+        expect(path, seed, n);
+}
+
+static void fsync_path(const char *path)
+{
+    struct fuse_file_info fi = { 0 };
+    CHECK(bwfs_ops.fsync(path, 0, &fi) == 0);
+}
+
+/** Espera a que el hilo de mantenimiento libere los huérfanos. */
+static void wait_free(unsigned long want)
+{
+    struct timespec ts = { 0, 10 * 1000 * 1000 };
+    for (int i = 0; i < 300 && ft_free_blocks() < want; ++i)
+        nanosleep(&ts, NULL);
+    CHECK(ft_free_blocks() >= want);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Reproducción                                                              */
+/* ------------------------------------------------------------------------- */
+
+static void phase_commit(void)
+{
+    char p[16];
+    CHECK(bwfs_ops.mkdir("/d", 0755) == 0);
+    for (unsigned f = 0; f < 4; ++f) {
+        snprintf(p, sizeof p, "/d/f%u", f);
+        put(p, f, FILE_SIZE);
+    }
+    CHECK(bwfs_ops.unlink("/d/f1") == 0);
+    fsync_path("/d/f0");
+
+    /* Sin confirmar: se pierde o queda entero */
+    for (unsigned f = 10; f < 13; ++f) {
+        snprintf(p, sizeof p, "/d/f%u", f);
+        put(p, f, FILE_SIZE);
+    }
+    CHECK(bwfs_ops.unlink("/d/f2") == 0);
+}
+
+/** Sin montar ni reproducir: lo confirmado aún no está en su sitio. */
+static int check_unreplayed(const char *dir)
+{
+    bwfs_superblock_t sb;
+    if (bwfs_read_superblock(&sb, dir) != BWFS_OK)
+        return 1;
+    if (!(sb.feature_incompat & BWFS_FEAT_INCOMPAT_RECOVER)) {
+        fprintf(stderr, "tras el corte el superbloque no pide reproducir\n");
+        return 1;
+    }
+    if (bwfs_itable_open(&sb, dir) != BWFS_OK)
+        return 1;
+    bwfs_inode_t root;
+    int rc = 0;
+    if (bwfs_read_inode(sb.root_inode, &root, dir) != BWFS_OK) {
+        rc = 1;
+    } else if (bwfs_dir_lookup(&root, dir, "d") != UINT32_MAX) {
+        fprintf(stderr, "/d ya estaba en su sitio: no prueba la reproducción\n");
+        rc = 1;
+    }
+    bwfs_itable_close();
+    return rc;
+}
+
+static void phase_replayed(void)
+{
+    struct stat st;
+    expect("/d/f0", 0, FILE_SIZE);
+    expect("/d/f3", 3, FILE_SIZE);
+    CHECK(bwfs_ops.getattr("/d/f1", &st, NULL) == -ENOENT);
+    expect_all_or_nothing("/d/f2", 2, FILE_SIZE);
+    expect_all_or_nothing("/d/f10", 10, FILE_SIZE);
+    expect_all_or_nothing("/d/f11", 11, FILE_SIZE);
+    expect_all_or_nothing("/d/f12", 12, FILE_SIZE);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Liberados sin confirmar                                                   */
+/* ------------------------------------------------------------------------- */
+
+static void phase_reuse(void)
+{
+    put("/old", 20, REUSE_SIZE);
+    fsync_path("/old");
+
+    unsigned long before = ft_free_blocks();
+    CHECK(bwfs_ops.unlink("/old") == 0);
+    wait_free(before + REUSE_SIZE / BS);
+
+    /* first-fit: si los bloques de /old estuvieran libres, serían estos */
+    put("/new", 21, REUSE_SIZE);
+}
+
+static void phase_reused(void)
+{
+    struct stat st;
+    expect("/old", 20, REUSE_SIZE);
+    CHECK(bwfs_ops.getattr("/new", &st, NULL) == -ENOENT);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Sin espacio                                                               */
+/* ------------------------------------------------------------------------- */
+
+static void phase_enospc(void)
+{
+    struct fuse_file_info fi = { 0 };
+    put("/victim", 30, VICTIM_SIZE);
+    fsync_path("/victim");
+
+    /* Llenar el disco */
+    char *buf = pattern(31, CHUNK);
+    CHECK(bwfs_ops.create("/fill", 0644, &fi) == 0);
+    off_t off = 0;
+    for (size_t n = CHUNK; n >= BS; n /= 2) {
+        int rc;
+        while ((rc = bwfs_ops.write("/fill", buf, n, off, &fi)) == (int)n)
+            off += (off_t)n;
+        CHECK(rc == -ENOSPC);
+    }
+    free(buf);
+    CHECK(bwfs_ops.release("/fill", &fi) == 0);
+    fsync_path("/fill");
+    CHECK(ft_free_blocks() < VICTIM_SIZE / BS / 4);
+
+    /* Lo de /victim queda libre pero sin confirmar */
+    unsigned long before = ft_free_blocks();
+    CHECK(bwfs_ops.unlink("/victim") == 0);
+    wait_free(before + VICTIM_SIZE / BS);
+
+    size_t n = VICTIM_SIZE - 8 * BS;
+    put("/again", 32, n);
+    expect("/again", 32, n);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Uso: %s <directorio_FS>\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+
+    int rc = ft_run(dir, -1, phase_commit, true);
+    if (rc == 0) rc = check_unreplayed(dir);
+    if (rc == 0) rc = ft_run(dir, -1, phase_replayed, false);
+    if (rc == 0) rc = ft_run(dir, BWFS_ALLOC_FIRST_FIT, phase_reuse, true);
+    if (rc == 0) rc = ft_run(dir, -1, phase_reused, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_enospc, false);
+
+    fprintf(stderr, "%s\n", rc == 0 ? "OK" : "FALLO");
+    return rc;
+}
@@ -0,0 +1,178 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_orphan.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_orphan.c
+ * \brief Huérfanos: lo que un corte deja por liberar se libera al montar.
+ *
+ *  - Un archivo abierto y escrito, sin release, se borra junto a otro con
+ *    la cola empaquetada; el borrado se confirma y llega el corte.  Al
+ *    volver a montar, el bucle de `maint_step` de `op_init` termina la
+ *    lista antes de arrancar el hilo de mantenimiento: nada más montar
+ *    quedan los mismos bloques libres que antes de crear los archivos.
+ *  - Sin montar, un archivo grande con cola empaquetada se encadena como
+ *    huérfano y el recolector da un solo paso, como si un desmontaje lo
+ *    parara entre tandas.  El recorte suelta la cola (`FRAG` fuera) y deja
+ *    el tamaño; el siguiente montaje lo libera entero.
+ *
+ * El objetivo orphan-test del Makefile pasa después fsck -f y exige que no
+ * avise de bloques sin referenciar.
+ *
+ * Uso: test_orphan <directorio_FS>  (recién formateado, sin montar)
+ */
+
+#define _GNU_SOURCE
+#include "fuse_test.h"
+#include "inode.h"
+#include "dir.h"
+#include "orphan.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BS          ((size_t)BWFS_BLOCK_SIZE_BYTES)
+#define F_SIZE      (30 * BS + 700)         /**< /f: abierto al borrarlo */
+#define P_SIZE      (3 * BS + 500)          /**< /p: cola empaquetada */
+#define T_BLOCKS    600U                    /**< /t: más que un paso */
+#define T_SIZE      (T_BLOCKS * BS + 900)
+#define T_STEP      100U                    /**< Paso del recolector sin montar */
+#define K_SIZE      700U                    /**< /keep: en un fragmento */
+
+/** Bloques libres antes de crear los archivos que se borran. */
+static unsigned long *g_base;
+
+static char *pattern(unsigned seed, size_t n)
+{
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    ft_pattern(buf, n, seed);
+    return buf;
+}
+
+static void expect_gone(const char *path)
+{
+    struct stat st;
+    CHECK(bwfs_ops.getattr(path, &st, NULL) == -ENOENT);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fases montadas                                                            */
+/* ------------------------------------------------------------------------- */
+
+/** /keep abre el bloque de fragmentos, que no se libera aunque se vacíe. */
+static void phase_base(void)
+{
+    char *buf = pattern(4, K_SIZE);
+    ft_put("/keep", buf, K_SIZE);
+    free(buf);
+    bwfs_inode_t ino;
+    ft_inode("/keep", &ino);
+    CHECK(ino.flags & BWFS_INODE_FRAG);
+    *g_base = ft_free_blocks();
+}
+
+/** Borra /f abierto y /p ya cerrado; confirma y se corta. */
+static void phase_open(void)
+{
+    struct fuse_file_info fi = { 0 };
+    char *buf = pattern(1, F_SIZE);
+    CHECK(bwfs_ops.create("/f", 0644, &fi) == 0);
+    CHECK(bwfs_ops.write("/f", buf, F_SIZE, 0, &fi) == (int)F_SIZE);
+    free(buf);
+
+    buf = pattern(2, P_SIZE);
+    ft_put("/p", buf, P_SIZE);
+    free(buf);
+    bwfs_inode_t ino;
+    ft_inode("/p", &ino);
+    CHECK(ino.flags & BWFS_INODE_FRAG);
+    CHECK(*g_base - ft_free_blocks() >= F_SIZE / BS + P_SIZE / BS);
+
+    CHECK(bwfs_ops.unlink("/p") == 0);
+    CHECK(bwfs_ops.unlink("/f") == 0);
+    expect_gone("/f");
+
+    struct fuse_file_info kfi = { 0 };
+    CHECK(bwfs_ops.fsync("/keep", 0, &kfi) == 0);
+}
+
+/** Nada más montar: el hilo aún no ha dado ningún paso. */
+static void phase_reaped(void)
+{
+    CHECK(ft_free_blocks() == *g_base);
+    expect_gone("/f");
+    expect_gone("/p");
+    expect_gone("/t");
+    char *buf = pattern(4, K_SIZE);
+    ft_expect("/keep", buf, K_SIZE);
+    free(buf);
+}
+
+static void phase_big(void)
+{
+    char *buf = pattern(3, T_SIZE);
+    ft_put("/t", buf, T_SIZE);
+    free(buf);
+    bwfs_inode_t ino;
+    ft_inode("/t", &ino);
+    CHECK(ino.flags & BWFS_INODE_FRAG);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Borrado a medias sin montar                                               */
+/* ------------------------------------------------------------------------- */
+
+static int reap_one_step(bwfs_superblock_t *sb, bwfs_bitmap_t *bm)
+{
+    bwfs_inode_t root, ino;
+    if (!ft_offline_lookup(sb, "t", &ino) ||
+        bwfs_read_inode(sb->root_inode, &root, fs_dir) != BWFS_OK ||
+        bwfs_dir_remove(bm, &root, fs_dir, "t") != BWFS_OK ||
+        bwfs_orphan_add(sb, &ino, fs_dir) != BWFS_OK)
+        return 1;
+
+    uint32_t before = bm->free_blocks;
+    int n = bwfs_orphan_reap(bm, sb, fs_dir, T_STEP);
+    if (n != (int)T_STEP || bm->free_blocks - before < T_STEP) {
+        fprintf(stderr, "el paso liberó %d bloques (%u en el bitmap)\n",
+                n, bm->free_blocks - before);
+        return 1;
+    }
+
+    /* Sigue en la lista, recortado, sin cola y con su tamaño */
+    if (bwfs_read_inode(ino.ino, &ino, fs_dir) != BWFS_OK)
+        return 1;
+    if (sb->orphan_head != ino.ino || !(ino.flags & BWFS_INODE_ORPHAN) ||
+        (ino.flags & BWFS_INODE_FRAG) || ino.size != T_SIZE ||
+        ino.block_count != T_BLOCKS - T_STEP) {
+        fprintf(stderr, "huérfano a medias: flags 0x%x, tamaño %llu, %u bloques\n",
+                (unsigned)ino.flags, (unsigned long long)ino.size, ino.block_count);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Uso: %s <directorio_FS>\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+
+    g_base = (unsigned long *)mmap(NULL, sizeof *g_base, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(g_base != MAP_FAILED);
+
+    int rc = ft_run(dir, -1, phase_base, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_open, true);
+    if (rc == 0) rc = ft_run(dir, -1, phase_reaped, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_big, false);
+    if (rc == 0) rc = ft_offline(dir, reap_one_step);
+    if (rc == 0) rc = ft_run(dir, -1, phase_reaped, false);
+
+    fprintf(stderr, "%s\n", rc == 0 ? "OK" : "FALLO");
+    return rc;
+}
@@ -0,0 +1,197 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_snapshot.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_snapshot.c
+ * \brief Instantáneas: ven los datos viejos, son de solo lectura y al
+ *        borrarlas solo se liberan sus bloques.
+ *
+ * Hace lo mismo en dos discos recién formateados; en el primero se toma
+ * una instantánea antes de cambiar los archivos y se borra al final.
+ *  - Tras remontar, la instantánea lee el contenido de antes (también de
+ *    lo sobrescrito y de lo borrado) y rechaza cualquier cambio con EROFS,
+ *    mientras el disco vivo lee el nuevo.
+ *  - Mientras existe, retiene bloques: quedan menos libres que en el disco
+ *    de referencia.
+ *  - Borrada, los dos discos tienen los mismos bloques libres y el mismo
+ *    contenido.  Si el borrado liberara un bloque que el disco vivo aún
+ *    usa sobrarían libres (y fsck lo vería); si olvidara alguna versión,
+ *    faltarían.
+ *
+ * Uso: test_snapshot <directorio_FS> <directorio_FS_referencia>
+ *      (los dos recién formateados igual, sin montar)
+ */
+
+#define _GNU_SOURCE
+#include "fuse_test.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAP     "/.snapshots/s1"
+#define A_OFF    1234U          /**< Sobrescritura de /a tras la instantánea */
+#define A_LEN    5000U
+
+/** Bloques libres vistos por los hijos: [0] disco con instantánea, [1] ref. */
+static unsigned long *g_free;
+static int            g_img;
+
+static size_t a_size(void) { return 40U * BWFS_BLOCK_SIZE_BYTES + 500U; }
+static size_t b_size(void) { return 20U * BWFS_BLOCK_SIZE_BYTES; }
+static size_t c_size(void) { return 12U * BWFS_BLOCK_SIZE_BYTES + 77U; }
+static size_t g_size(void) { return 3U  * BWFS_BLOCK_SIZE_BYTES; }
+
+/** Compara `path` con el patrón `seed` de `n` bytes. */
+static void expect_pattern(const char *path, unsigned seed, size_t n)
+{
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    ft_pattern(buf, n, seed);
+    ft_expect(path, buf, n);
+    free(buf);
+}
+
+static void put_pattern(const char *path, unsigned seed, size_t n)
+{
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    ft_pattern(buf, n, seed);
+    ft_put(path, buf, n);
+    free(buf);
+}
+
+/** /a después de sobrescribir [A_OFF, A_OFF + A_LEN). */
+static void expect_new_a(const char *path)
+{
+    char *buf = (char *)malloc(a_size());
+    CHECK(buf != NULL);
+    ft_pattern(buf, a_size(), 1);
+    ft_pattern(buf + A_OFF, A_LEN, 7);
+    ft_expect(path, buf, a_size());
+    free(buf);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fases                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static void phase_fill(void)
+{
+    put_pattern("/a", 1, a_size());
+    put_pattern("/c", 3, c_size());
+    CHECK(bwfs_ops.mkdir("/d", 0755) == 0);
+    put_pattern("/d/g", 4, g_size());
+}
+
+static void phase_snap(void)
+{
+    CHECK(bwfs_ops.mkdir(SNAP, 0755) == 0);
+    CHECK(bwfs_ops.mkdir(SNAP, 0755) == -EEXIST);
+}
+
+static void phase_change(void)
+{
+    struct fuse_file_info fi = { 0 };
+    char buf[A_LEN];
+    ft_pattern(buf, sizeof buf, 7);
+    CHECK(bwfs_ops.write("/a", buf, sizeof buf, A_OFF, &fi) == (int)sizeof buf);
+    CHECK(bwfs_ops.release("/a", &fi) == 0);
+
+    CHECK(bwfs_ops.unlink("/c") == 0);
+    CHECK(bwfs_ops.unlink("/d/g") == 0);
+    CHECK(bwfs_ops.rmdir("/d") == 0);
+    put_pattern("/b", 2, b_size());
+}
+
+/** Lo que ve el disco vivo al final, con o sin instantánea. */
+static void expect_live(void)
+{
+    struct stat st;
+    expect_new_a("/a");
+    expect_pattern("/b", 2, b_size());
+    CHECK(bwfs_ops.getattr("/c", &st, NULL) == -ENOENT);
+    CHECK(bwfs_ops.getattr("/d", &st, NULL) == -ENOENT);
+}
+
+static void phase_view(void)
+{
+    struct fuse_file_info fi = { 0 };
+    struct stat st;
+
+    expect_pattern(SNAP "/a", 1, a_size());
+    expect_pattern(SNAP "/c", 3, c_size());
+    expect_pattern(SNAP "/d/g", 4, g_size());
+    CHECK(bwfs_ops.getattr(SNAP "/b", &st, NULL) == -ENOENT);
+    expect_live();
+
+    CHECK(bwfs_ops.write(SNAP "/a", "x", 1, 0, &fi) == -EROFS);
+    CHECK(bwfs_ops.create(SNAP "/x", 0644, &fi) == -EROFS);
+    CHECK(bwfs_ops.unlink(SNAP "/c") == -EROFS);
+    CHECK(bwfs_ops.mkdir(SNAP "/e", 0755) == -EROFS);
+    CHECK(bwfs_ops.rmdir(SNAP "/d") == -EROFS);
+    CHECK(bwfs_ops.rename(SNAP "/a", "/z", 0) == -EROFS);
+    expect_pattern(SNAP "/a", 1, a_size());
+
+    g_free[0] = ft_free_blocks();
+}
+
+static void phase_drop(void)
+{
+    struct stat st;
+    CHECK(bwfs_ops.rmdir(SNAP) == 0);
+    CHECK(bwfs_ops.getattr(SNAP, &st, NULL) == -ENOENT);
+    expect_live();
+}
+
+/** Tras remontar, para que lo liberado ya esté confirmado. */
+static void phase_final(void)
+{
+    expect_live();
+    g_free[g_img] = ft_free_blocks();
+
+    bwfs_superblock_t sb;
+    CHECK(bwfs_read_superblock(&sb, fs_dir) == BWFS_OK);
+    CHECK(sb.snap_table == 0);
+    CHECK(!(sb.feature_ro_compat & BWFS_FEAT_RO_COMPAT_SNAP));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3) {
+        fprintf(stderr, "Uso: %s <directorio_FS> <directorio_FS_referencia>\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1], *ref = argv[2];
+
+    g_free = (unsigned long *)mmap(NULL, 2 * sizeof *g_free, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(g_free != MAP_FAILED);
+
+    /* Referencia: los mismos cambios, sin instantánea */
+    int rc = ft_run(ref, -1, phase_fill, false);
+    if (rc == 0) rc = ft_run(ref, -1, phase_change, false);
+    if (rc == 0) { g_img = 1; rc = ft_run(ref, -1, phase_final, false); }
+    unsigned long ref_free = g_free[1];
+
+    if (rc == 0) rc = ft_run(dir, -1, phase_fill, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_snap, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_change, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_view, false);
+    if (rc == 0 && g_free[0] >= ref_free) {
+        fprintf(stderr, "la instantánea no retiene bloques (%lu libres, ref. %lu)\n",
+                g_free[0], ref_free);
+        rc = 1;
+    }
+    if (rc == 0) rc = ft_run(dir, -1, phase_drop, false);
+    if (rc == 0) { g_img = 0; rc = ft_run(dir, -1, phase_final, false); }
+    if (rc == 0 && g_free[0] != ref_free) {
+        fprintf(stderr, "tras borrar la instantánea: %lu libres, ref. %lu\n",
+                g_free[0], ref_free);
+        rc = 1;
+    }
+
+    fprintf(stderr, "%s\n", rc == 0 ? "OK" : "FALLO");
+    return rc;
+}
@@ -0,0 +1,233 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_sparse.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_sparse.c
+ * \brief Archivos dispersos: los huecos no gastan bloques y se leen a cero.
+ *
+ * Antes de nada llena y borra un archivo con 0xAB, para que los bloques
+ * que se reutilicen tengan datos viejos.  Después:
+ *  - una escritura lejos del final solo asigna lo escrito, y lo que queda
+ *    detrás se lee a cero;
+ *  - fallocate reserva bloques «sin escribir» que se leen a cero (también
+ *    tras remontar) hasta que algo se escribe encima;
+ *  - SEEK_DATA y SEEK_HOLE saltan los huecos y lo preasignado sin
+ *    escribir, también en colas empaquetadas y archivos en el inodo;
+ *  - agrandar un archivo sin montar (\ref bwfs_inode_resize) no asigna
+ *    nada.
+ *
+ * Uso: test_sparse <directorio_FS>  (recién formateado, sin montar)
+ */
+
+#define _GNU_SOURCE
+#include "fuse_test.h"
+#include "inode.h"
+
+#include <errno.h>
+#include <fcntl.h>      /* FALLOC_FL_KEEP_SIZE */
+#include <string.h>
+#include <unistd.h>     /* SEEK_DATA, SEEK_HOLE */
+#include <sys/mman.h>
+
+#define BS          ((size_t)BWFS_BLOCK_SIZE_BYTES)
+#define JUNK_BLOCKS 40U
+#define S_SIZE      (10 * BS + 12)      /**< /s: "mid" en el bloque 3, "hello" en el 10 */
+#define F_SIZE      (5 * BS)            /**< /f: todo preasignado */
+#define GROWN_SIZE  (100 * BS)          /**< /s tras \ref grow_offline */
+
+/** Bloques libres al acabar la última fase, visto desde los hijos. */
+static unsigned long *g_free;
+
+/** Contenido esperado de /s hasta `n` bytes, con o sin "mid". */
+static char *s_contents(size_t n, bool mid)
+{
+    char *buf = (char *)calloc(1, n);
+    CHECK(buf != NULL);
+    if (mid)
+        memcpy(buf + 3 * BS + 100, "mid", 3);
+    memcpy(buf + 10 * BS + 7, "hello", 5);
+    return buf;
+}
+
+/** Contenido esperado de /f. */
+static char *f_contents(void)
+{
+    char *buf = (char *)calloc(1, F_SIZE);
+    CHECK(buf != NULL);
+    memcpy(buf + 2 * BS + 5, "0123456789", 10);
+    return buf;
+}
+
+static void expect_s(size_t n, bool mid)
+{
+    char *buf = s_contents(n, mid);
+    ft_expect("/s", buf, n);
+    free(buf);
+}
+
+static void expect_f(void)
+{
+    char *buf = f_contents();
+    ft_expect("/f", buf, F_SIZE);
+    free(buf);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fases montadas                                                            */
+/* ------------------------------------------------------------------------- */
+
+static void phase_junk(void)
+{
+    size_t n = JUNK_BLOCKS * BS;
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    memset(buf, 0xAB, n);
+    ft_put("/junk", buf, n);
+    free(buf);
+    CHECK(bwfs_ops.unlink("/junk") == 0);
+}
+
+static void phase_write(void)
+{
+    struct fuse_file_info fi = { 0 };
+    unsigned long f0 = ft_free_blocks();
+
+    /* Una escritura a 10 bloques del principio: un bloque, no once */
+    CHECK(bwfs_ops.create("/s", 0644, &fi) == 0);
+    CHECK(bwfs_ops.write("/s", "hello", 5, (off_t)(10 * BS + 7), &fi) == 5);
+    CHECK(f0 - ft_free_blocks() <= 1);
+    expect_s(S_SIZE, false);
+
+    /* Otra en medio del hueco solo asigna su bloque */
+    CHECK(bwfs_ops.write("/s", "mid", 3, (off_t)(3 * BS + 100), &fi) == 3);
+    CHECK(f0 - ft_free_blocks() <= 2);
+    expect_s(S_SIZE, true);
+
+    /* fallocate más allá del final sin cambiar el tamaño: dos bloques,
+     * que se leen a cero */
+    unsigned long f1 = ft_free_blocks();
+    CHECK(bwfs_ops.fallocate("/s", FALLOC_FL_KEEP_SIZE, (off_t)(12 * BS),
+                             (off_t)(2 * BS), &fi) == 0);
+    CHECK(f1 - ft_free_blocks() == 2);
+    expect_s(S_SIZE, true);
+    CHECK(bwfs_ops.release("/s", &fi) == 0);
+
+    /* fallocate que fija el tamaño: bloques reservados, contenido a cero
+     * aunque hereden los datos de /junk */
+    CHECK(bwfs_ops.create("/f", 0644, &fi) == 0);
+    f1 = ft_free_blocks();
+    CHECK(bwfs_ops.fallocate("/f", 0, 0, (off_t)F_SIZE, &fi) == 0);
+    CHECK(f1 - ft_free_blocks() == F_SIZE / BS);
+    char *zero = (char *)calloc(1, F_SIZE);
+    CHECK(zero != NULL);
+    ft_expect("/f", zero, F_SIZE);
+    free(zero);
+
+    /* Escribir dentro de lo preasignado no asigna y el resto sigue a cero */
+    f1 = ft_free_blocks();
+    CHECK(bwfs_ops.write("/f", "0123456789", 10, (off_t)(2 * BS + 5), &fi) == 10);
+    CHECK(ft_free_blocks() == f1);
+    expect_f();
+    CHECK(bwfs_ops.release("/f", &fi) == 0);
+
+    *g_free = ft_free_blocks();
+}
+
+static void phase_remount(void)
+{
+    expect_s(S_SIZE, true);
+    expect_f();
+    CHECK(ft_free_blocks() == *g_free);
+}
+
+static off_t seek(const char *path, off_t off, int whence)
+{
+    struct fuse_file_info fi = { 0 };
+    return bwfs_ops.lseek(path, off, whence, &fi);
+}
+
+static void phase_seek(void)
+{
+    /* /s: datos en los bloques 3 y 10, preasignado tras el final */
+    CHECK(seek("/s", 0, SEEK_DATA) == (off_t)(3 * BS));
+    CHECK(seek("/s", (off_t)(3 * BS + 5), SEEK_DATA) == (off_t)(3 * BS + 5));
+    CHECK(seek("/s", (off_t)(3 * BS + 5), SEEK_HOLE) == (off_t)(4 * BS));
+    CHECK(seek("/s", (off_t)(4 * BS), SEEK_DATA) == (off_t)(10 * BS));
+    CHECK(seek("/s", 0, SEEK_HOLE) == 0);
+    CHECK(seek("/s", (off_t)(10 * BS + 3), SEEK_HOLE) == (off_t)S_SIZE);
+    CHECK(seek("/s", (off_t)S_SIZE, SEEK_DATA) == -ENXIO);
+    CHECK(seek("/s", (off_t)S_SIZE, SEEK_HOLE) == -ENXIO);
+
+    /* /f: preasignado entero, escrito solo el bloque 2 */
+    CHECK(seek("/f", 0, SEEK_DATA) == (off_t)(2 * BS));
+    CHECK(seek("/f", (off_t)(2 * BS), SEEK_HOLE) == (off_t)(3 * BS));
+    CHECK(seek("/f", (off_t)(3 * BS), SEEK_DATA) == -ENXIO);
+
+    /* Cola en un fragmento y archivo en el inodo: todo datos */
+    size_t n = BS + 500;
+    char *buf = (char *)malloc(n);
+    CHECK(buf != NULL);
+    ft_pattern(buf, n, 5);
+    ft_put("/p", buf, n);
+    free(buf);
+    ft_put("/i", "abc", 3);
+    bwfs_inode_t ino;
+    ft_inode("/p", &ino);
+    CHECK(ino.flags & BWFS_INODE_FRAG);
+    ft_inode("/i", &ino);
+    CHECK(ino.flags & BWFS_INODE_INLINE);
+    CHECK(seek("/p", (off_t)(BS + 10), SEEK_DATA) == (off_t)(BS + 10));
+    CHECK(seek("/p", 0, SEEK_HOLE) == (off_t)n);
+    CHECK(seek("/i", 1, SEEK_DATA) == 1);
+    CHECK(seek("/i", 1, SEEK_HOLE) == 3);
+
+    *g_free = ft_free_blocks();
+}
+
+static void phase_grown(void)
+{
+    expect_s(GROWN_SIZE, true);
+    expect_f();
+    CHECK(ft_free_blocks() == *g_free);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Crecimiento sin montar                                                    */
+/* ------------------------------------------------------------------------- */
+
+static int grow_offline(bwfs_superblock_t *sb, bwfs_bitmap_t *bm)
+{
+    bwfs_inode_t ino;
+    uint32_t before = bm->free_blocks;
+    if (!ft_offline_lookup(sb, "s", &ino) ||
+        bwfs_inode_resize(bm, &ino, GROWN_SIZE, fs_dir) != BWFS_OK)
+        return 1;
+    if (bm->free_blocks != before) {
+        fprintf(stderr, "agrandar /s asignó %u bloques\n", before - bm->free_blocks);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Uso: %s <directorio_FS>\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+
+    g_free = (unsigned long *)mmap(NULL, sizeof *g_free, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    CHECK(g_free != MAP_FAILED);
+
+    int rc = ft_run(dir, -1, phase_junk, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_write, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_remount, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_seek, false);
+    if (rc == 0) rc = ft_offline(dir, grow_offline);
+    if (rc == 0) rc = ft_run(dir, -1, phase_grown, false);
+
+    fprintf(stderr, "%s\n", rc == 0 ? "OK" : "FALLO");
+    return rc;
+}
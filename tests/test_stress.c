@@ -0,0 +1,206 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_stress.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_stress.c
+ * \brief Estrés: muchos archivos y operaciones simultáneas desde varios
+ *        hilos, como las despacha FUSE en modo multihilo.
+ *
+ * #NTHREADS hilos crean, escriben, sobrescriben, leen, renombran y borran
+ * archivos, unos en su directorio y otros en uno común (/s) que otro hilo
+ * lista sin parar; entre medias todos leen trozos de un archivo grande
+ * compartido.  Cada lectura se compara con lo escrito.  Tras remontar se
+ * comprueba que los que no se borraron siguen enteros y los demás no
+ * existen.
+ *
+ * Uso: test_stress <directorio_FS>  (recién formateado, sin montar)
+ */
+
+#define _GNU_SOURCE
+#include "fuse_test.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define NTHREADS    8
+#define NFILES      60                  /**< Archivos creados por hilo */
+#define MAX_SIZE    40000U
+#define BIG_SIZE    200000U             /**< /big, leído por todos */
+#define BIG_READ    5000U
+
+static char *g_big;
+
+/** Parada del hilo que lista /s. */
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool            g_done;
+static unsigned long   g_listings;
+
+/** Ruta del archivo `k` del hilo `t`, antes o después de renombrarlo: en
+ *  /s los impares. */
+static void file_path(unsigned t, unsigned k, bool renamed, char *out, size_t sz)
+{
+    const char *sfx = renamed ? "_r" : "";
+    if (k & 1)
+        snprintf(out, sz, "/s/f%u_%u%s", t, k, sfx);
+    else
+        snprintf(out, sz, "/t%u/f%u%s", t, k, sfx);
+}
+
+static bool kept(unsigned k) { return k % 3 == 0; }
+
+/**
+ * Contenido del archivo `k` del hilo `t` tras la sobrescritura: el
+ * patrón, con su primera mitad copiada a partir del tercio.
+ * @return Tamaño final
+ */
+static size_t contents(unsigned t, unsigned k, char *buf)
+{
+    size_t n = (k * 997U + t * 131U) % MAX_SIZE + 1U;
+    ft_pattern(buf, n, t * 1000U + k);
+    memmove(buf + n / 3, buf, n / 2);
+    return n / 3 + n / 2 > n ? n / 3 + n / 2 : n;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Hilos                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static void *worker(void *arg)
+{
+    unsigned t = (unsigned)(uintptr_t)arg;
+    struct fuse_file_info fi = { 0 };
+    struct stat st;
+    char *buf = (char *)malloc(MAX_SIZE);
+    char *got = (char *)malloc(MAX_SIZE + 1);
+    CHECK(buf != NULL && got != NULL);
+
+    char p[64], q[64];
+    snprintf(p, sizeof p, "/t%u", t);
+    CHECK(bwfs_ops.mkdir(p, 0755) == 0);
+
+    for (unsigned k = 0; k < NFILES; ++k) {
+        size_t n = (k * 997U + t * 131U) % MAX_SIZE + 1U;
+        file_path(t, k, false, p, sizeof p);
+        file_path(t, k, true, q, sizeof q);
+
+        CHECK(bwfs_ops.create(p, 0644, &fi) == 0);
+        ft_pattern(buf, n, t * 1000U + k);
+        CHECK(bwfs_ops.write(p, buf, n, 0, &fi) == (int)n);
+        CHECK(bwfs_ops.write(p, buf, n / 2, (off_t)(n / 3), &fi) == (int)(n / 2));
+        CHECK(bwfs_ops.release(p, &fi) == 0);
+
+        n = contents(t, k, buf);
+        CHECK(bwfs_ops.read(p, got, MAX_SIZE + 1, 0, &fi) == (int)n);
+        CHECK(memcmp(got, buf, n) == 0);
+        CHECK(bwfs_ops.getattr(p, &st, NULL) == 0 && st.st_size == (off_t)n);
+
+        CHECK(bwfs_ops.rename(p, q, 0) == 0);
+        CHECK(bwfs_ops.getattr(p, &st, NULL) == -ENOENT);
+        CHECK(bwfs_ops.read(q, got, MAX_SIZE + 1, 0, &fi) == (int)n);
+        CHECK(memcmp(got, buf, n) == 0);
+        if (!kept(k))
+            CHECK(bwfs_ops.unlink(q) == 0);
+
+        size_t off = (k * 4099U + t * 7919U) % (BIG_SIZE - BIG_READ);
+        CHECK(bwfs_ops.read("/big", got, BIG_READ, (off_t)off, &fi) == (int)BIG_READ);
+        CHECK(memcmp(got, g_big + off, BIG_READ) == 0);
+    }
+    free(got);
+    free(buf);
+    return NULL;
+}
+
+static int count_entry(void *buf, const char *name, const struct stat *st,
+                       off_t off, enum fuse_fill_dir_flags flags)
+{
+    (void)name; (void)st; (void)off; (void)flags;
+    ++*(unsigned *)buf;
+    return 0;
+}
+
+/** Lista /s mientras trabajan los demás. */
+static void *lister(void *arg)
+{
+    (void)arg;
+    struct fuse_file_info fi = { 0 };
+    for (;;) {
+        pthread_mutex_lock(&g_lock);
+        bool done = g_done;
+        pthread_mutex_unlock(&g_lock);
+        if (done)
+            break;
+
+        unsigned n = 0;
+        CHECK(bwfs_ops.readdir("/s", &n, count_entry, 0, &fi, 0) == 0);
+        pthread_mutex_lock(&g_lock);
+        ++g_listings;
+        pthread_mutex_unlock(&g_lock);
+    }
+    return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fases                                                                     */
+/* ------------------------------------------------------------------------- */
+
+static void phase_stress(void)
+{
+    CHECK(bwfs_ops.mkdir("/s", 0755) == 0);
+    ft_put("/big", g_big, BIG_SIZE);
+
+    pthread_t th[NTHREADS], ls;
+    CHECK(pthread_create(&ls, NULL, lister, NULL) == 0);
+    for (unsigned t = 0; t < NTHREADS; ++t)
+        CHECK(pthread_create(&th[t], NULL, worker, (void *)(uintptr_t)t) == 0);
+    for (unsigned t = 0; t < NTHREADS; ++t)
+        CHECK(pthread_join(th[t], NULL) == 0);
+
+    pthread_mutex_lock(&g_lock);
+    g_done = true;
+    pthread_mutex_unlock(&g_lock);
+    CHECK(pthread_join(ls, NULL) == 0);
+    CHECK(g_listings > 0);
+}
+
+static void phase_verify(void)
+{
+    char *buf = (char *)malloc(MAX_SIZE);
+    CHECK(buf != NULL);
+    char q[64];
+    struct stat st;
+    for (unsigned t = 0; t < NTHREADS; ++t) {
+        for (unsigned k = 0; k < NFILES; ++k) {
+            file_path(t, k, true, q, sizeof q);
+            if (kept(k)) {
+                size_t n = contents(t, k, buf);
+                ft_expect(q, buf, n);
+            } else {
+                CHECK(bwfs_ops.getattr(q, &st, NULL) == -ENOENT);
+            }
+        }
+    }
+    free(buf);
+    ft_expect("/big", g_big, BIG_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Uso: %s <directorio_FS>\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+
+    g_big = (char *)malloc(BIG_SIZE);
+    CHECK(g_big != NULL);
+    ft_pattern(g_big, BIG_SIZE, 5);
+
+    int rc = ft_run(dir, -1, phase_stress, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_verify, false);
+
+    free(g_big);
+    fprintf(stderr, "%s\n", rc == 0 ? "OK" : "FALLO");
+    return rc;
+}
@@ -0,0 +1,167 @@
+// -----------------------------------------------------------------------------
+// File: tests/test_tail_pack.c
+// -----------------------------------------------------------------------------
+/**
+ * \file test_tail_pack.c
+ * \brief Colas empaquetadas: sobreviven a un remontaje y a un truncado.
+ *
+ * Escribe archivos cuya cola cabe en un fragmento (uno entero por debajo
+ * de #BWFS_FRAG_MAX, otros con bloques delante) y uno cuya cola no cabe.
+ * Al cerrarlos, los primeros deben quedar con #BWFS_INODE_FRAG; tras
+ * remontar siguen así y se leen igual.  Después se truncan sin montar
+ * (FUSE no tiene truncate: va por \ref bwfs_inode_resize, como fsck y
+ * migrate): un corte dentro de la cola, otro antes de ella y un
+ * crecimiento.  Al volver a montar se comprueba el contenido y se
+ * reescribe cada archivo para que la cola se empaquete de nuevo.
+ *
+ * Uso: test_tail_pack <directorio_FS>  (recién formateado, sin montar)
+ */
+
+#define _GNU_SOURCE
+#include "fuse_test.h"
+#include "inode.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+/** Archivos de la prueba, con su tamaño en bloques más bytes de cola. */
+static const struct {
+    const char *path;
+    unsigned    blocks;
+    unsigned    tail;       /**< 0 = BWFS_FRAG_MAX + 1 (no cabe) */
+    bool        packed;
+} files[] = {
+    { "/solo",  0, 700,  true  },
+    { "/dos",   2, 300,  true  },
+    { "/uno",   1, 1000, true  },
+    { "/larga", 3, 0,    false },
+};
+#define NFILES (sizeof files / sizeof files[0])
+
+static size_t file_size(unsigned i)
+{
+    size_t tail = files[i].tail ? files[i].tail : BWFS_FRAG_MAX + 1U;
+    return files[i].blocks * (size_t)BWFS_BLOCK_SIZE_BYTES + tail;
+}
+
+/** Contenido esperado de un archivo de `n` bytes tras cortar en `cut`. */
+static char *expected(unsigned i, size_t cut, size_t n)
+{
+    char *buf = (char *)calloc(1, n + 1);
+    CHECK(buf != NULL);
+    ft_pattern(buf, cut < n ? cut : n, i);
+    return buf;
+}
+
+static void check_packed(const char *path, bool packed)
+{
+    bwfs_inode_t ino;
+    ft_inode(path, &ino);
+    if (((ino.flags & BWFS_INODE_FRAG) != 0) != packed) {
+        fprintf(stderr, "%s: cola %sempaquetada\n", path, packed ? "no " : "");
+        exit(1);
+    }
+}
+
+/* ------------------------------------------------------------------------- */
+/* Fases montadas                                                            */
+/* ------------------------------------------------------------------------- */
+
+static void phase_write(void)
+{
+    for (unsigned i = 0; i < NFILES; ++i) {
+        size_t n = file_size(i);
+        char *buf = expected(i, n, n);
+        ft_put(files[i].path, buf, n);
+        free(buf);
+        check_packed(files[i].path, files[i].packed);
+    }
+
+    /* Un archivo entero en su fragmento no tiene bloques propios */
+    struct stat st;
+    CHECK(bwfs_ops.getattr("/solo", &st, NULL) == 0 && st.st_blocks == 0);
+}
+
+static void phase_remount(void)
+{
+    for (unsigned i = 0; i < NFILES; ++i) {
+        size_t n = file_size(i);
+        char *buf = expected(i, n, n);
+        ft_expect(files[i].path, buf, n);
+        free(buf);
+        check_packed(files[i].path, files[i].packed);
+    }
+}
+
+/** Tamaños tras \ref truncate_offline. */
+static size_t new_size(unsigned i)
+{
+    size_t bs = BWFS_BLOCK_SIZE_BYTES;
+    switch (i) {
+        case 0:  return 2000;                 /* crece: la cola vuelve a bloque */
+        case 1:  return 2 * bs + 100;         /* corta dentro de la cola */
+        case 2:  return bs - 10;              /* corta antes de la cola  */
+        default: return file_size(i);
+    }
+}
+
+static void phase_truncated(void)
+{
+    for (unsigned i = 0; i < NFILES; ++i) {
+        size_t n = new_size(i);
+        char *buf = expected(i, file_size(i), n);
+        ft_expect(files[i].path, buf, n);
+        free(buf);
+    }
+    check_packed("/dos", true);
+    check_packed("/uno", false);     /* sin cola: ya no tiene fragmento */
+
+    /* Reescribir el final vuelve a empaquetar lo que quepa */
+    struct fuse_file_info fi = { 0 };
+    for (unsigned i = 0; i < 3; ++i) {
+        size_t n = new_size(i);
+        char *buf = expected(i, file_size(i), n + 200);
+        ft_pattern(buf + n, 200, 99);
+        CHECK(bwfs_ops.write(files[i].path, buf + n, 200, (off_t)n, &fi) == 200);
+        CHECK(bwfs_ops.release(files[i].path, &fi) == 0);
+        ft_expect(files[i].path, buf, n + 200);
+        free(buf);
+    }
+    check_packed("/solo", false);    /* 2200 bytes: no cabe en uno */
+    check_packed("/dos",  true);
+    check_packed("/uno",  true);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Truncado sin montar                                                       */
+/* ------------------------------------------------------------------------- */
+
+static int truncate_offline(bwfs_superblock_t *sb, bwfs_bitmap_t *bm)
+{
+    for (unsigned i = 0; i < 3; ++i) {
+        bwfs_inode_t ino;
+        if (!ft_offline_lookup(sb, files[i].path + 1, &ino) ||
+            bwfs_inode_resize(bm, &ino, new_size(i), fs_dir) != BWFS_OK) {
+            fprintf(stderr, "%s: no se pudo truncar\n", files[i].path);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "Uso: %s <directorio_FS>\n", argv[0]);
+        return 2;
+    }
+    const char *dir = argv[1];
+
+    int rc = ft_run(dir, -1, phase_write, false);
+    if (rc == 0) rc = ft_run(dir, -1, phase_remount, false);
+    if (rc == 0) rc = ft_offline(dir, truncate_offline);
+    if (rc == 0) rc = ft_run(dir, -1, phase_truncated, false);
+
+    fprintf(stderr, "%s\n", rc == 0 ? "OK" : "FALLO");
+    return rc;
+}